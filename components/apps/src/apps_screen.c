@@ -68,6 +68,8 @@ static void app_click_event_cb(lv_event_t* e)
         break;
     default:
         ESP_LOGW(TAG, "Unknown app ID: %d", app);
+        // Drop the empty subtile and its arena, which is current for this task
+        ui_dynamic_subtile_close();
         return;
     }
     
@@ -10,6 +10,7 @@
 #include "freertos/task.h"
 #include <stdio.h>
 #include <sys/stat.h>
+#include "lwmalloc.h"
 
 static const char* TAG = "AUDIO_ALERT";
 
@@ -171,7 +172,8 @@ static bool play_wav_from_spiffs(const char *path)
     (void)esp_codec_dev_set_out_mute(s_spk, false);
 
     enum { BUF_SAMP = 1024*2 };
-    int16_t *buf = (int16_t*)malloc(BUF_SAMP * sizeof(int16_t));
+    // Streaming buffer: filled from SPIFFS, copied into the I2S DMA ring by the codec driver
+    int16_t *buf = (int16_t*)lw_malloc_tagged(BUF_SAMP * sizeof(int16_t), LW_TAG_COLD);
     if (!buf) { fclose(f); return false; }
     size_t remaining = data_size;
     while (remaining > 0) {
@@ -0,0 +1,246 @@
+#include "ble_file.h"
+#include "ble_proto.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PART_SUFFIX ".part"
+#define PATH_MAX_LEN 64
+#define VERIFY_BLOCK 512
+
+static char s_dir[PATH_MAX_LEN - BLE_FILE_NAME_MAX - 2] = "/spiffs";
+static FILE* s_fp;
+static char s_name[BLE_FILE_NAME_MAX + 1];
+static char s_part[PATH_MAX_LEN];
+static uint32_t s_size;
+static uint32_t s_crc;
+static uint32_t s_next; // bytes written, the offset of the next chunk
+static unsigned s_ack_every;
+static unsigned s_unacked;
+static bool s_nak_sent;
+static uint32_t s_gap_off; // last chunk dropped behind the gap
+static const char* s_err = "";
+
+static uint32_t get_le32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool name_ok(const char* name)
+{
+    size_t n = strlen(name);
+    size_t sfx = sizeof(PART_SUFFIX) - 1;
+    if (n == 0 || n > BLE_FILE_NAME_MAX || name[0] == '.' || strchr(name, '/') != NULL) {
+        return false;
+    }
+    return n < sfx || strcmp(name + n - sfx, PART_SUFFIX) != 0;
+}
+
+// One part file per name, size and CRC, so a changed file never resumes
+// from the bytes of the old one
+static void part_path(char* out, const char* name, uint32_t size, uint32_t crc)
+{
+    uint8_t meta[8] = { size, size >> 8, size >> 16, size >> 24, crc, crc >> 8, crc >> 16, crc >> 24 };
+    uint32_t key = ble_crc32(ble_crc32(0, name, strlen(name)), meta, sizeof(meta));
+    snprintf(out, PATH_MAX_LEN, "%s/%08" PRIx32 PART_SUFFIX, s_dir, key);
+}
+
+// Only the transfer in progress may resume; other part files only hold space
+static void remove_stale_parts(const char* keep)
+{
+    DIR* d = opendir(s_dir);
+    if (!d) {
+        return;
+    }
+    const char* keep_base = keep + strlen(s_dir) + 1;
+    size_t sfx = sizeof(PART_SUFFIX) - 1;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        size_t n = strlen(e->d_name);
+        if (n > sfx && strcmp(e->d_name + n - sfx, PART_SUFFIX) == 0 && strcmp(e->d_name, keep_base) != 0) {
+            char path[PATH_MAX_LEN + 256];
+            snprintf(path, sizeof(path), "%s/%s", s_dir, e->d_name);
+            remove(path);
+        }
+    }
+    closedir(d);
+}
+
+static void close_fp(void)
+{
+    if (s_fp) {
+        fclose(s_fp);
+        s_fp = NULL;
+    }
+}
+
+static ble_file_status_t fail(const char* why, uint32_t* offset)
+{
+    close_fp();
+    remove(s_part);
+    s_err = why;
+    *offset = s_next;
+    return BLE_FILE_FAIL;
+}
+
+// Read the part file back: what is on flash is what gets checked
+static bool part_crc_ok(void)
+{
+    static uint8_t buf[VERIFY_BLOCK];
+    FILE* f = fopen(s_part, "rb");
+    if (!f) {
+        return false;
+    }
+    uint32_t crc = 0;
+    uint32_t total = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        crc = ble_crc32(crc, buf, n);
+        total += n;
+    }
+    fclose(f);
+    return total == s_size && crc == s_crc;
+}
+
+static ble_file_status_t commit(uint32_t* offset)
+{
+    char path[PATH_MAX_LEN];
+
+    if (fclose(s_fp) != 0) {
+        s_fp = NULL;
+        return fail("io", offset);
+    }
+    s_fp = NULL;
+    if (!part_crc_ok()) {
+        return fail("crc", offset);
+    }
+    // SPIFFS cannot rename over an existing file, so the old one goes
+    // first; losing power in between leaves only the part file
+    snprintf(path, sizeof(path), "%s/%s", s_dir, s_name);
+    remove(path);
+    if (rename(s_part, path) != 0) {
+        return fail("io", offset);
+    }
+    *offset = s_size;
+    return BLE_FILE_DONE;
+}
+
+void ble_file_init(const char* dir)
+{
+    close_fp();
+    snprintf(s_dir, sizeof(s_dir), "%s", dir);
+}
+
+int ble_file_open(const char* name, uint32_t size, uint32_t crc, unsigned ack_every, uint32_t* offset)
+{
+    close_fp();
+    if (!name_ok(name) || size == 0) {
+        return -EINVAL;
+    }
+    snprintf(s_name, sizeof(s_name), "%s", name);
+    part_path(s_part, name, size, crc);
+    remove_stale_parts(s_part);
+
+    s_fp = fopen(s_part, "ab");
+    if (!s_fp) {
+        return -errno;
+    }
+    long len = fseek(s_fp, 0, SEEK_END) == 0 ? ftell(s_fp) : -1;
+    if (len < 0 || (uint32_t)len >= size) {
+        // Unreadable, or complete but never renamed: start over
+        fclose(s_fp);
+        s_fp = fopen(s_part, "wb");
+        if (!s_fp) {
+            return -errno;
+        }
+        len = 0;
+    }
+    s_size = size;
+    s_crc = crc;
+    s_next = (uint32_t)len;
+    s_ack_every = ack_every > 0 ? ack_every : 1;
+    s_unacked = 0;
+    s_nak_sent = false;
+    s_gap_off = 0;
+    s_err = "";
+    *offset = s_next;
+    return 0;
+}
+
+ble_file_status_t ble_file_chunk(const uint8_t* payload, size_t len, uint32_t* offset)
+{
+    if (!s_fp) {
+        *offset = 0;
+        return BLE_FILE_IDLE;
+    }
+    *offset = s_next;
+    if (len <= BLE_FILE_CHUNK_HDR) {
+        s_nak_sent = true;
+        return BLE_FILE_NAK;
+    }
+    uint32_t off = get_le32(payload);
+    uint32_t crc = get_le32(payload + 4);
+    const uint8_t* data = payload + BLE_FILE_CHUNK_HDR;
+    size_t n = len - BLE_FILE_CHUNK_HDR;
+
+    if (off < s_next) {
+        // A resend of data already written: the ack that covered it was
+        // lost, repeat it
+        return BLE_FILE_ACK;
+    }
+    if (off > s_next) {
+        // Go-back-N: ask once, then drop what is still in flight behind
+        // the gap. An offset that goes back is the resend, missing its
+        // first chunk too: ask again.
+        bool resend = off <= s_gap_off;
+        s_gap_off = off;
+        if (s_nak_sent && !resend) {
+            return BLE_FILE_PENDING;
+        }
+        s_nak_sent = true;
+        return BLE_FILE_NAK;
+    }
+    if (n > s_size - s_next) {
+        return fail("size", offset);
+    }
+    if (ble_crc32(0, data, n) != crc) {
+        s_nak_sent = true;
+        s_gap_off = off;
+        return BLE_FILE_NAK;
+    }
+    if (fwrite(data, 1, n, s_fp) != n) {
+        return fail("io", offset);
+    }
+    s_next += n;
+    s_nak_sent = false;
+    if (s_next == s_size) {
+        return commit(offset);
+    }
+    *offset = s_next;
+    if (++s_unacked >= s_ack_every) {
+        s_unacked = 0;
+        return BLE_FILE_ACK;
+    }
+    return BLE_FILE_PENDING;
+}
+
+void ble_file_abort(void)
+{
+    if (s_fp) {
+        close_fp();
+        remove(s_part);
+    }
+}
+
+const char* ble_file_error(void)
+{
+    return s_err;
+}
+
+bool ble_file_active(void)
+{
+    return s_fp != NULL;
+}
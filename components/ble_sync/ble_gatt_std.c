@@ -0,0 +1,421 @@
+#include "ble_gatt_std.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "nimble-nordic-uart.h"
+#include "rtc_lib.h"
+#include "sensors.h"
+
+static const char* TAG = "BLE_GATT_STD";
+
+// Assigned numbers
+#define UUID_SVC_BATTERY 0x180F
+#define UUID_SVC_CURRENT_TIME 0x1805
+#define UUID_SVC_RSC 0x1814
+#define UUID_CHR_BATTERY_LEVEL 0x2A19
+#define UUID_CHR_BATTERY_LEVEL_STATUS 0x2BED
+#define UUID_CHR_CURRENT_TIME 0x2A2B
+#define UUID_CHR_RSC_MEASUREMENT 0x2A53
+#define UUID_CHR_RSC_FEATURE 0x2A54
+#define UUID_CHR_SC_CONTROL_POINT 0x2A55
+
+// Current Time adjust reason
+#define CTS_ADJUST_EXTERNAL_REF (1u << 1)
+
+// RSC Measurement flags and features: total distance and walking/running
+#define RSC_FLAG_TOTAL_DISTANCE (1u << 1)
+#define RSC_FLAG_RUNNING (1u << 2)
+#define RSC_FEATURES 0x0006
+
+// SC Control Point: Set Cumulative Value is the only procedure supported
+#define SC_CP_SET_CUMULATIVE 0x01
+#define SC_CP_RESPONSE 0x10
+#define SC_CP_SUCCESS 0x01
+#define SC_CP_NOT_SUPPORTED 0x02
+#define SC_CP_INVALID_PARAM 0x03
+// ATT errors the RSC service defines for the control point
+#define SC_CP_ERR_IN_PROGRESS 0x80
+#define SC_CP_ERR_CCCD_IMPROPER 0x81
+
+// The step detector counts steps, not meters: distance and speed use a
+// typical step length
+#define STEP_WALK_DM 7 // 0.7 m
+#define STEP_RUN_DM 10 // 1.0 m
+
+#define RSC_SAMPLE_MS 1000
+// After a time set, reads return the new time until the RTC cache has it
+#define TIME_ADJUST_HOLD_MS 1500
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_battery_level = 0;
+static uint8_t s_battery_status[4]; // flags, power state (LE16), level
+static uint8_t s_rsc[8];            // flags, speed (LE16), cadence, total distance (LE32)
+static uint32_t s_steps_dm = 0;     // distance walked since boot; wraps like the characteristic
+static uint32_t s_last_steps = 0;   // daily step count at the last sample
+static uint32_t s_distance_offset_dm = 0;
+static uint8_t s_time_adjusted[10];
+static TickType_t s_time_adjusted_at;
+static bool s_time_adjusted_valid = false;
+static TimerHandle_t s_rsc_timer = NULL;
+
+static uint16_t s_battery_level_hdl;
+static uint16_t s_battery_status_hdl;
+static uint16_t s_current_time_hdl;
+static uint16_t s_rsc_hdl;
+static uint16_t s_sc_cp_hdl;
+
+// SC Control Point state, on the host task only. The response indication is
+// sent from an event after the write response, and no new procedure starts
+// until the phone confirmed it.
+static struct ble_npl_event s_sc_cp_ev;
+static bool s_sc_cp_ev_ready = false;
+static bool s_sc_cp_indicate = false; // the phone enabled indications
+static bool s_sc_cp_busy = false;
+static uint16_t s_sc_cp_conn;
+static uint8_t s_sc_cp_rsp[3];
+
+static void put_le16(uint8_t* p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, v >> 16);
+}
+
+// Store a new cached value; true when it differs from the old one
+static bool cache_update(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    bool changed;
+    portENTER_CRITICAL(&s_lock);
+    changed = memcmp(dst, src, len) != 0;
+    if (changed) {
+        memcpy(dst, src, len);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return changed;
+}
+
+static int read_cached(struct ble_gatt_access_ctxt* ctxt, const uint8_t* src, size_t len)
+{
+    uint8_t buf[16];
+    portENTER_CRITICAL(&s_lock);
+    memcpy(buf, src, len);
+    portEXIT_CRITICAL(&s_lock);
+    return os_mbuf_append(ctxt->om, buf, len) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+// 1 = Monday .. 7 = Sunday
+static uint8_t day_of_week(int y, int m, int d)
+{
+    static const uint8_t t[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+    if (m < 3) {
+        y -= 1;
+    }
+    int w = (y + y / 4 - y / 100 + y / 400 + t[(m - 1) % 12] + d) % 7; // 0 = Sunday
+    return w == 0 ? 7 : w;
+}
+
+static void encode_time(uint8_t out[10], int y, int mo, int d, int h, int mi, int s, uint8_t reason)
+{
+    put_le16(out, (uint16_t)y);
+    out[2] = mo;
+    out[3] = d;
+    out[4] = h;
+    out[5] = mi;
+    out[6] = s;
+    out[7] = (mo >= 1 && mo <= 12 && d >= 1) ? day_of_week(y, mo, d) : 0; // 0: unknown
+    out[8] = 0;                                                           // fractions256
+    out[9] = reason;
+}
+
+// Total distance, shifted by the phone's Set Cumulative Value. Lock held.
+static uint32_t distance_dm(void)
+{
+    return s_steps_dm - s_distance_offset_dm;
+}
+
+// Add the steps since the last sample. The daily count starts over at
+// midnight; the total keeps going. Lock held.
+static void distance_add(uint32_t steps, uint32_t step_dm)
+{
+    uint32_t delta = steps >= s_last_steps ? steps - s_last_steps : steps;
+    s_last_steps = steps;
+    s_steps_dm += delta * step_dm;
+}
+
+static void rsc_sample(void)
+{
+    uint16_t cadence = sensors_get_cadence();
+    bool running = sensors_get_activity() == SENSORS_ACTIVITY_RUN;
+    uint32_t step_dm = running ? STEP_RUN_DM : STEP_WALK_DM;
+    uint8_t m[8];
+
+    m[0] = RSC_FLAG_TOTAL_DISTANCE | (running ? RSC_FLAG_RUNNING : 0);
+    // steps/min * dm/step -> 1/256 m/s
+    put_le16(m + 1, (uint16_t)(cadence * step_dm * 256 / 600));
+    m[3] = cadence > 255 ? 255 : cadence;
+    uint32_t steps = sensors_get_step_count();
+    portENTER_CRITICAL(&s_lock);
+    distance_add(steps, step_dm);
+    uint32_t dist = distance_dm();
+    portEXIT_CRITICAL(&s_lock);
+    put_le32(m + 4, dist);
+    if (cache_update(s_rsc, m, sizeof(m))) {
+        ble_gatts_chr_updated(s_rsc_hdl);
+    }
+}
+
+static void rsc_timer_cb(TimerHandle_t t)
+{
+    (void)t;
+    rsc_sample();
+}
+
+static int battery_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt* ctxt, void* arg)
+{
+    if (attr_handle == s_battery_level_hdl) {
+        return read_cached(ctxt, &s_battery_level, 1);
+    }
+    return read_cached(ctxt, s_battery_status, sizeof(s_battery_status));
+}
+
+static int current_time_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt* ctxt, void* arg)
+{
+    // rtc_lib keeps the time read from the RTC once a second
+    uint8_t ct[10];
+    bool adjusted;
+    portENTER_CRITICAL(&s_lock);
+    adjusted = s_time_adjusted_valid && xTaskGetTickCount() - s_time_adjusted_at < pdMS_TO_TICKS(TIME_ADJUST_HOLD_MS);
+    if (adjusted) {
+        memcpy(ct, s_time_adjusted, sizeof(ct));
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (!adjusted) {
+        encode_time(ct, rtc_get_year(), rtc_get_month(), rtc_get_day(), rtc_get_hour(), rtc_get_minute(), rtc_get_second(), 0);
+    }
+    return os_mbuf_append(ctxt->om, ct, sizeof(ct)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+static void sc_control_point_indicate(struct ble_npl_event* ev)
+{
+    (void)ev;
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(s_sc_cp_rsp, sizeof(s_sc_cp_rsp));
+    int rc = om ? ble_gatts_indicate_custom(s_sc_cp_conn, s_sc_cp_hdl, om) : BLE_HS_ENOMEM;
+    if (rc != 0) {
+        ESP_LOGW(TAG, "SC Control Point indication failed: %d", rc);
+        s_sc_cp_busy = false;
+    }
+}
+
+static int sc_control_point(uint16_t conn_handle, struct ble_gatt_access_ctxt* ctxt)
+{
+    uint8_t req[5];
+    uint16_t len = 0;
+    if (!s_sc_cp_indicate) {
+        return SC_CP_ERR_CCCD_IMPROPER;
+    }
+    if (s_sc_cp_busy) {
+        return SC_CP_ERR_IN_PROGRESS;
+    }
+    if (ble_hs_mbuf_to_flat(ctxt->om, req, sizeof(req), &len) != 0 || len < 1) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    uint8_t rsp[3] = { SC_CP_RESPONSE, req[0], SC_CP_SUCCESS };
+    if (req[0] != SC_CP_SET_CUMULATIVE) {
+        rsp[2] = SC_CP_NOT_SUPPORTED;
+    } else if (len != 5) {
+        rsp[2] = SC_CP_INVALID_PARAM;
+    } else {
+        uint32_t value = req[1] | (req[2] << 8) | (req[3] << 16) | ((uint32_t)req[4] << 24);
+        portENTER_CRITICAL(&s_lock);
+        s_distance_offset_dm += distance_dm() - value;
+        portEXIT_CRITICAL(&s_lock);
+        ESP_LOGI(TAG, "RSC total distance set to %u dm", (unsigned)value);
+    }
+
+    // The result goes back as an indication. This runs inside the write, so
+    // the event sends it once the write response is out.
+    memcpy(s_sc_cp_rsp, rsp, sizeof(rsp));
+    s_sc_cp_conn = conn_handle;
+    s_sc_cp_busy = true;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &s_sc_cp_ev);
+    if (rsp[2] == SC_CP_SUCCESS) {
+        rsc_sample();
+    }
+    return 0;
+}
+
+static int rsc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt* ctxt, void* arg)
+{
+    if (attr_handle == s_sc_cp_hdl) {
+        return sc_control_point(conn_handle, ctxt);
+    }
+    if (attr_handle == s_rsc_hdl) {
+        return read_cached(ctxt, s_rsc, sizeof(s_rsc));
+    }
+    uint8_t feat[2];
+    put_le16(feat, RSC_FEATURES);
+    return os_mbuf_append(ctxt->om, feat, sizeof(feat)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+static const struct ble_gatt_svc_def s_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(UUID_SVC_BATTERY),
+        .characteristics = (struct ble_gatt_chr_def[]){
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_BATTERY_LEVEL),
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &s_battery_level_hdl,
+                .access_cb = battery_access,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_BATTERY_LEVEL_STATUS),
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &s_battery_status_hdl,
+                .access_cb = battery_access,
+            },
+            { 0 },
+        },
+    },
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(UUID_SVC_CURRENT_TIME),
+        .characteristics = (struct ble_gatt_chr_def[]){
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_CURRENT_TIME),
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &s_current_time_hdl,
+                .access_cb = current_time_access,
+            },
+            { 0 },
+        },
+    },
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(UUID_SVC_RSC),
+        .characteristics = (struct ble_gatt_chr_def[]){
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_RSC_MEASUREMENT),
+                .flags = BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &s_rsc_hdl,
+                .access_cb = rsc_access,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_RSC_FEATURE),
+                .flags = BLE_GATT_CHR_F_READ,
+                .access_cb = rsc_access,
+            },
+            {
+                .uuid = BLE_UUID16_DECLARE(UUID_CHR_SC_CONTROL_POINT),
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_INDICATE,
+                .val_handle = &s_sc_cp_hdl,
+                .access_cb = rsc_access,
+            },
+            { 0 },
+        },
+    },
+    { 0 },
+};
+
+// Every GAP event of the connection, on the host task
+static int gap_event(struct ble_gap_event* event, void* arg)
+{
+    (void)arg;
+    switch (event->type) {
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle == s_sc_cp_hdl) {
+            s_sc_cp_indicate = event->subscribe.cur_indicate;
+        }
+        break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        // 0 only says the indication went out; BLE_HS_EDONE when confirmed,
+        // anything else when it failed or timed out
+        if (event->notify_tx.indication && event->notify_tx.attr_handle == s_sc_cp_hdl && event->notify_tx.status != 0) {
+            s_sc_cp_busy = false;
+        }
+        break;
+    case BLE_GAP_EVENT_DISCONNECT:
+        s_sc_cp_indicate = false;
+        s_sc_cp_busy = false;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+esp_err_t ble_gatt_std_init(void)
+{
+    if (!s_rsc_timer) {
+        s_rsc_timer = xTimerCreate("ble_rsc", pdMS_TO_TICKS(RSC_SAMPLE_MS), pdTRUE, NULL, rsc_timer_cb);
+        if (!s_rsc_timer) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (!s_sc_cp_ev_ready) {
+        ble_npl_event_init(&s_sc_cp_ev, sc_control_point_indicate, NULL);
+        s_sc_cp_ev_ready = true;
+    }
+    return nordic_uart_add_services(s_svcs, gap_event);
+}
+
+void ble_gatt_std_set_battery(int percent, bool charging, bool external_power)
+{
+    uint8_t level = percent < 0 ? 0 : percent > 100 ? 100 : (uint8_t)percent;
+
+    // Power state: battery present, wired power, charge state, charge level
+    uint16_t state = 1u << 0;
+    state |= (external_power ? 1u : 0u) << 1;
+    state |= (charging ? 1u : external_power ? 3u : 2u) << 5; // charging / inactive / active discharge
+    state |= (level >= 20 ? 1u : level >= 10 ? 2u : 3u) << 7; // good / low / critical
+    uint8_t status[4] = { 1u << 1, 0, 0, level };              // flags: level present
+    put_le16(status + 1, state);
+
+    if (cache_update(&s_battery_level, &level, 1)) {
+        ble_gatts_chr_updated(s_battery_level_hdl);
+    }
+    if (cache_update(s_battery_status, status, sizeof(status))) {
+        ble_gatts_chr_updated(s_battery_status_hdl);
+    }
+}
+
+void ble_gatt_std_time_adjusted(const ble_datetime_t* dt)
+{
+    // The RTC cache catches up within a second; until then the
+    // notification and reads carry the time just set
+    uint8_t ct[10];
+    encode_time(ct, dt->year, dt->month, dt->day, dt->hour, dt->minute, dt->second, CTS_ADJUST_EXTERNAL_REF);
+    portENTER_CRITICAL(&s_lock);
+    memcpy(s_time_adjusted, ct, sizeof(ct));
+    s_time_adjusted_at = xTaskGetTickCount();
+    s_time_adjusted_valid = true;
+    portEXIT_CRITICAL(&s_lock);
+    ble_gatts_chr_updated(s_current_time_hdl);
+}
+
+void ble_gatt_std_connected(void)
+{
+    rsc_sample();
+    if (s_rsc_timer) {
+        xTimerStart(s_rsc_timer, 0);
+    }
+}
+
+void ble_gatt_std_disconnected(void)
+{
+    if (s_rsc_timer) {
+        xTimerStop(s_rsc_timer, 0);
+    }
+}
@@ -0,0 +1,68 @@
+#include "ble_hist.h"
+
+static ble_hist_rec_t* s_buf;
+static size_t s_cap;
+static uint32_t s_next;  // cursor of the next record
+static uint32_t s_count; // records held, up to s_cap
+
+void ble_hist_init(ble_hist_rec_t* buf, size_t cap, uint32_t first)
+{
+    s_buf = buf;
+    s_cap = cap;
+    s_next = first;
+    s_count = 0;
+}
+
+uint32_t ble_hist_append(const ble_hist_rec_t* rec)
+{
+    if (s_cap == 0) {
+        return s_next++;
+    }
+    s_buf[s_next % s_cap] = *rec;
+    if (s_count < s_cap) {
+        s_count++;
+    }
+    return s_next++;
+}
+
+uint32_t ble_hist_next(void)
+{
+    return s_next;
+}
+
+size_t ble_hist_read(uint32_t since, ble_hist_rec_t* out, size_t max, uint32_t* first)
+{
+    uint32_t oldest = s_next - s_count;
+    if (since < oldest || since > s_next) {
+        since = oldest;
+    }
+    size_t n = s_next - since;
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = s_buf[(since + i) % s_cap];
+    }
+    *first = since;
+    return n;
+}
+
+// Days from 1970-01-01 to a date of the proleptic Gregorian calendar
+static int32_t days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    int32_t yoe = y - era * 400;
+    int32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+uint32_t ble_hist_minutes(int year, int month, int day, int hour, int minute)
+{
+    int32_t days = days_from_civil(year, month, day);
+    if (days < 0) {
+        return 0;
+    }
+    return (uint32_t)days * 1440 + hour * 60 + minute;
+}
@@ -0,0 +1,207 @@
+#include "ble_lz.h"
+
+#include <string.h>
+
+// LZ4 block format: sequences of
+//   token (literal length << 4 | match length - 4) | more literal length |
+//   literals | offset (LE16) | more match length
+// where a length field of 15 continues in bytes of 255 up to one below.
+// The last sequence has literals only. As the format requires, the last 5
+// bytes are always literals and no match starts in the last 12.
+#define MINMATCH 4
+#define LASTLITERALS 5
+#define MFLIMIT 12
+#define MAX_OFFSET (BLE_LZ_WINDOW - 1)
+// Literal runs speed up the search: one more byte skipped per 32 tried
+#define SKIP_SHIFT 5
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - BLE_LZ_HASH_BITS);
+}
+
+static uint8_t* put_len(uint8_t* op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* put_literals(uint8_t* op, uint8_t* token, const uint8_t* lit, size_t n)
+{
+    *token = (uint8_t)((n >= 15 ? 15 : n) << 4);
+    if (n >= 15) {
+        op = put_len(op, n - 15);
+    }
+    memcpy(op, lit, n);
+    return op + n;
+}
+
+// Compress base[start, end). Matches may reach back into base[0, start),
+// and table holds positions in base.
+static size_t compress_range(const uint8_t* base, size_t start, size_t end, uint16_t* table, uint8_t* out, size_t cap)
+{
+    uint8_t* op = out;
+    uint8_t* const oend = out + cap;
+    size_t anchor = start;
+    size_t ip = start;
+
+    while (ip + MFLIMIT <= end) {
+        uint32_t seq = read32(base + ip);
+        uint32_t h = hash4(seq);
+        size_t ref = table[h];
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || ip - ref > MAX_OFFSET || read32(base + ref) != seq) {
+            ip += 1 + ((ip - anchor) >> SKIP_SHIFT);
+            continue;
+        }
+
+        while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        size_t len = MINMATCH;
+        while (ip + len < end - LASTLITERALS && base[ip + len] == base[ref + len]) {
+            len++;
+        }
+
+        size_t lit = ip - anchor;
+        size_t ml = len - MINMATCH;
+        if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1) {
+            return 0;
+        }
+        uint8_t* token = op++;
+        op = put_literals(op, token, base + anchor, lit);
+        *op++ = (uint8_t)(ip - ref);
+        *op++ = (uint8_t)((ip - ref) >> 8);
+        *token |= ml >= 15 ? 15 : ml;
+        if (ml >= 15) {
+            op = put_len(op, ml - 15);
+        }
+
+        ip += len;
+        anchor = ip;
+        // Index the end of the match too, so the next repeat is found
+        if (ip + MFLIMIT <= end) {
+            table[hash4(read32(base + ip - 2))] = (uint16_t)(ip - 2);
+        }
+    }
+
+    size_t lit = end - anchor;
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) {
+        return 0;
+    }
+    uint8_t* token = op++;
+    op = put_literals(op, token, base + anchor, lit);
+    return op - out;
+}
+
+size_t ble_lz_compress(const void* in, size_t n, void* out, size_t cap, uint16_t* table)
+{
+    if (n > UINT16_MAX) {
+        return 0;
+    }
+    memset(table, 0, BLE_LZ_HASH_SIZE * sizeof(table[0]));
+    return compress_range((const uint8_t*)in, 0, n, table, (uint8_t*)out, cap);
+}
+
+void ble_lz_stream_init(ble_lz_stream_t* s)
+{
+    memset(s->table, 0, sizeof(s->table));
+    s->len = 0;
+}
+
+size_t ble_lz_stream_compress(ble_lz_stream_t* s, const void* in, size_t n, void* out, size_t cap)
+{
+    if (n > BLE_LZ_BLOCK_MAX) {
+        return 0;
+    }
+    if (s->len + n > sizeof(s->buf)) {
+        // Keep the window, and move the positions in the table with it;
+        // ones that fall off point at the start and fail the compare
+        size_t drop = s->len - BLE_LZ_WINDOW;
+        memmove(s->buf, s->buf + drop, BLE_LZ_WINDOW);
+        s->len = BLE_LZ_WINDOW;
+        for (size_t i = 0; i < BLE_LZ_HASH_SIZE; i++) {
+            s->table[i] = s->table[i] >= drop ? s->table[i] - drop : 0;
+        }
+    }
+    memcpy(s->buf + s->len, in, n);
+    size_t r = compress_range(s->buf, s->len, s->len + n, s->table, (uint8_t*)out, cap);
+    s->len += n;
+    return r;
+}
+
+int ble_lz_decompress(const void* in, size_t n, uint8_t* out, size_t cap, size_t dict)
+{
+    const uint8_t* ip = (const uint8_t*)in;
+    const uint8_t* const iend = ip + n;
+    size_t op = 0;
+
+    for (;;) {
+        if (ip >= iend) {
+            return -1;
+        }
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > cap - op) {
+            return -1;
+        }
+        memcpy(out + op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) {
+            return (int)op;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > op + dict) {
+            return -1;
+        }
+        size_t ml = token & 15;
+        if (ml == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += MINMATCH;
+        if (ml > cap - op) {
+            return -1;
+        }
+        // Byte by byte: a match may overlap what it produces
+        const uint8_t* m = out + op - off;
+        for (size_t i = 0; i < ml; i++) {
+            out[op + i] = m[i];
+        }
+        op += ml;
+    }
+}
@@ -0,0 +1,153 @@
+#include "ble_notif.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    char app[BLE_NOTIF_APP_MAX];
+    ble_notif_prio_t prio;
+} app_prio_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t at;
+} seen_t;
+
+static uint32_t s_window_ms;
+static uint32_t s_dedup_ms;
+static app_prio_t s_apps[BLE_NOTIF_APPS_MAX];
+static unsigned s_app_count;
+static seen_t s_seen[BLE_NOTIF_SEEN_MAX];
+static unsigned s_seen_next;
+static ble_notif_batch_t s_batch;
+static uint32_t s_opened; // when the first of the batch came
+static bool s_urgent;     // a high priority one is in the batch
+
+// FNV-1a over the strings with their terminators, so "ab"+"c" and "a"+"bc"
+// differ
+static uint32_t fnv1a(uint32_t h, const char* s)
+{
+    do {
+        h = (h ^ (uint8_t)*s) * 16777619u;
+    } while (*s++);
+    return h;
+}
+
+static void copy(char* dst, size_t cap, const char* src)
+{
+    snprintf(dst, cap, "%s", src ? src : "");
+}
+
+// Seen within the dedup time of the first time? A message the phone keeps
+// reposting comes through again once that has passed.
+static bool seen(uint32_t hash, uint32_t now_ms)
+{
+    for (unsigned i = 0; i < BLE_NOTIF_SEEN_MAX; i++) {
+        if (s_seen[i].at != 0 && s_seen[i].hash == hash && now_ms - s_seen[i].at < s_dedup_ms) {
+            return true;
+        }
+    }
+    // 0 marks a free slot
+    s_seen[s_seen_next] = (seen_t){ hash, now_ms | 1 };
+    s_seen_next = (s_seen_next + 1) % BLE_NOTIF_SEEN_MAX;
+    return false;
+}
+
+void ble_notif_init(uint32_t window_ms, uint32_t dedup_ms)
+{
+    s_window_ms = window_ms;
+    s_dedup_ms = dedup_ms;
+    s_app_count = 0;
+    memset(s_seen, 0, sizeof(s_seen));
+    s_seen_next = 0;
+    memset(&s_batch, 0, sizeof(s_batch));
+    s_urgent = false;
+}
+
+bool ble_notif_set_prio(const char* app, ble_notif_prio_t prio)
+{
+    for (unsigned i = 0; i < s_app_count; i++) {
+        if (strcmp(s_apps[i].app, app) == 0) {
+            if (prio == BLE_NOTIF_NORMAL) {
+                s_apps[i] = s_apps[--s_app_count];
+            } else {
+                s_apps[i].prio = prio;
+            }
+            return true;
+        }
+    }
+    if (prio == BLE_NOTIF_NORMAL) {
+        return true;
+    }
+    if (s_app_count == BLE_NOTIF_APPS_MAX || strlen(app) >= BLE_NOTIF_APP_MAX) {
+        return false;
+    }
+    copy(s_apps[s_app_count].app, BLE_NOTIF_APP_MAX, app);
+    s_apps[s_app_count].prio = prio;
+    s_app_count++;
+    return true;
+}
+
+ble_notif_prio_t ble_notif_get_prio(const char* app)
+{
+    for (unsigned i = 0; i < s_app_count; i++) {
+        if (strcmp(s_apps[i].app, app ? app : "") == 0) {
+            return s_apps[i].prio;
+        }
+    }
+    return BLE_NOTIF_NORMAL;
+}
+
+bool ble_notif_push(const char* app, const char* title, const char* message, const char* ts, uint32_t now_ms)
+{
+    uint32_t h = fnv1a(fnv1a(fnv1a(2166136261u, app ? app : ""), title ? title : ""), message ? message : "");
+    if (seen(h, now_ms)) {
+        return false;
+    }
+
+    if (s_batch.count == 0) {
+        s_opened = now_ms;
+    }
+    if (s_batch.count == BLE_NOTIF_BATCH_MAX) {
+        memmove(&s_batch.item[0], &s_batch.item[1], (BLE_NOTIF_BATCH_MAX - 1) * sizeof(s_batch.item[0]));
+        s_batch.count--;
+        s_batch.dropped++;
+    }
+    ble_notif_item_t* it = &s_batch.item[s_batch.count++];
+    copy(it->app, sizeof(it->app), app);
+    copy(it->title, sizeof(it->title), title);
+    copy(it->message, sizeof(it->message), message);
+    copy(it->ts, sizeof(it->ts), ts);
+
+    ble_notif_prio_t prio = ble_notif_get_prio(app);
+    if (prio != BLE_NOTIF_LOW) {
+        s_batch.alert = true;
+    }
+    if (prio == BLE_NOTIF_HIGH) {
+        s_urgent = true;
+    }
+    return true;
+}
+
+uint32_t ble_notif_due_in(uint32_t now_ms)
+{
+    if (s_batch.count == 0) {
+        return UINT32_MAX;
+    }
+    uint32_t age = now_ms - s_opened;
+    if (s_urgent || age >= s_window_ms) {
+        return 0;
+    }
+    return s_window_ms - age;
+}
+
+bool ble_notif_take(ble_notif_batch_t* out)
+{
+    if (s_batch.count == 0) {
+        return false;
+    }
+    *out = s_batch;
+    memset(&s_batch, 0, sizeof(s_batch));
+    s_urgent = false;
+    return true;
+}
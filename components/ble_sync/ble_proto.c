@@ -0,0 +1,955 @@
+#include "ble_proto.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+#endif
+
+// ---------------------------------------------------------------------------
+// Decoder
+
+typedef struct {
+    char* p;
+    char* end;
+} cursor_t;
+
+static void skip_ws(cursor_t* c)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n')) {
+        c->p++;
+    }
+}
+
+static int hex4(const char* s, uint32_t* out)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        char ch = s[i];
+        v <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            v |= ch - '0';
+        } else if (ch >= 'a' && ch <= 'f') {
+            v |= ch - 'a' + 10;
+        } else if (ch >= 'A' && ch <= 'F') {
+            v |= ch - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+    *out = v;
+    return 0;
+}
+
+static char* put_utf8(char* w, uint32_t cp)
+{
+    if (cp < 0x80) {
+        *w++ = (char)cp;
+    } else if (cp < 0x800) {
+        *w++ = (char)(0xC0 | (cp >> 6));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *w++ = (char)(0xE0 | (cp >> 12));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *w++ = (char)(0xF0 | (cp >> 18));
+        *w++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return w;
+}
+
+// Parse the string at c->p (on the opening quote), unescaping it over itself.
+// Every escape is at least as long as what it decodes to, so the write
+// position never passes the read position and the terminating NUL lands on
+// or before the closing quote.
+static int parse_string(cursor_t* c, const char** out)
+{
+    if (c->p >= c->end || *c->p != '"') {
+        return -1;
+    }
+    char* r = ++c->p;
+    char* w = r;
+    *out = w;
+
+    // Fast path: plain runs need no copying until the first escape
+    while (r < c->end && *r != '"' && *r != '\\') {
+        if ((unsigned char)*r < 0x20) {
+            return -1;
+        }
+        r++;
+    }
+    w = r;
+    while (r < c->end) {
+        char ch = *r++;
+        if (ch == '"') {
+            *w = '\0';
+            c->p = r;
+            return 0;
+        }
+        if ((unsigned char)ch < 0x20) {
+            return -1;
+        }
+        if (ch != '\\') {
+            *w++ = ch;
+            continue;
+        }
+        if (r >= c->end) {
+            return -1;
+        }
+        switch (*r++) {
+        case '"': *w++ = '"'; break;
+        case '\\': *w++ = '\\'; break;
+        case '/': *w++ = '/'; break;
+        case 'b': *w++ = '\b'; break;
+        case 'f': *w++ = '\f'; break;
+        case 'n': *w++ = '\n'; break;
+        case 'r': *w++ = '\r'; break;
+        case 't': *w++ = '\t'; break;
+        case 'u': {
+            uint32_t cp;
+            if (c->end - r < 4 || hex4(r, &cp) != 0) {
+                return -1;
+            }
+            r += 4;
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                uint32_t lo;
+                if (c->end - r >= 6 && r[0] == '\\' && r[1] == 'u' && hex4(r + 2, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    r += 6;
+                } else {
+                    cp = 0xFFFD;
+                }
+            } else if (cp >= 0xDC00 && cp < 0xE000) {
+                cp = 0xFFFD;
+            }
+            w = put_utf8(w, cp);
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Parse a JSON number, keeping the integer part. Out of range values
+// saturate at INT64_MIN / INT64_MAX.
+static int parse_int(cursor_t* c, int64_t* out)
+{
+    char* p = c->p;
+    bool neg = false;
+    uint64_t v = 0;
+
+    if (p < c->end && *p == '-') {
+        neg = true;
+        p++;
+    }
+    if (p >= c->end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    const uint64_t lim = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    while (p < c->end && *p >= '0' && *p <= '9') {
+        unsigned d = *p - '0';
+        v = v > (lim - d) / 10 ? lim : v * 10 + d;
+        p++;
+    }
+    if (p < c->end && *p == '.') {
+        p++;
+        while (p < c->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    if (p < c->end && (*p == 'e' || *p == 'E')) {
+        // Exponents are not used by the protocol; accept and ignore them
+        p++;
+        if (p < c->end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        while (p < c->end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    c->p = p;
+    *out = neg && v ? -(int64_t)(v - 1) - 1 : (int64_t)v;
+    return 0;
+}
+
+static int skip_literal(cursor_t* c, const char* lit, size_t n)
+{
+    if ((size_t)(c->end - c->p) < n || memcmp(c->p, lit, n) != 0) {
+        return -1;
+    }
+    c->p += n;
+    return 0;
+}
+
+// Skip any value, nested containers included, without recursion.
+static int skip_value(cursor_t* c)
+{
+    int depth = 0;
+    do {
+        skip_ws(c);
+        if (c->p >= c->end) {
+            return -1;
+        }
+        const char* s;
+        int64_t n;
+        switch (*c->p) {
+        case '{':
+        case '[':
+            depth++;
+            c->p++;
+            continue;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return -1;
+            }
+            depth--;
+            c->p++;
+            break;
+        case '"':
+            if (parse_string(c, &s) != 0) {
+                return -1;
+            }
+            break;
+        case 't':
+            if (skip_literal(c, "true", 4) != 0) {
+                return -1;
+            }
+            break;
+        case 'f':
+            if (skip_literal(c, "false", 5) != 0) {
+                return -1;
+            }
+            break;
+        case 'n':
+            if (skip_literal(c, "null", 4) != 0) {
+                return -1;
+            }
+            break;
+        default:
+            if (parse_int(c, &n) != 0) {
+                return -1;
+            }
+            break;
+        }
+        // Inside a container: separators are not validated strictly, they
+        // only need to be consumed
+        skip_ws(c);
+        while (depth > 0 && c->p < c->end && (*c->p == ',' || *c->p == ':')) {
+            c->p++;
+            skip_ws(c);
+        }
+    } while (depth > 0);
+    return 0;
+}
+
+// Same fields as sscanf("%d-%d-%dT%d:%d:%d"): numbers need no zero padding
+// and anything after the seconds is ignored
+static bool parse_datetime(const char* s, ble_datetime_t* dt)
+{
+    static const char seps[] = "--T::";
+    int* f[6] = { &dt->year, &dt->month, &dt->day, &dt->hour, &dt->minute, &dt->second };
+
+    for (int i = 0; i < 6; i++) {
+        if (i > 0 && *s++ != seps[i - 1]) {
+            return false;
+        }
+        while (*s == ' ') {
+            s++;
+        }
+        bool neg = *s == '-';
+        if (neg || *s == '+') {
+            s++;
+        }
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        int v = 0;
+        while (*s >= '0' && *s <= '9') {
+            if (v < 100000) {
+                v = v * 10 + (*s - '0');
+            }
+            s++;
+        }
+        *f[i] = neg ? -v : v;
+    }
+    return true;
+}
+
+static ble_cmd_t cmd_from_name(const char* name)
+{
+    if (strcmp(name, "heap") == 0) {
+        return BLE_CMD_HEAP;
+    }
+    if (strcmp(name, "trace") == 0) {
+        return BLE_CMD_TRACE;
+    }
+    if (strcmp(name, "bench_tx") == 0) {
+        return BLE_CMD_BENCH_TX;
+    }
+    if (strcmp(name, "framing") == 0) {
+        return BLE_CMD_FRAMING;
+    }
+    if (strcmp(name, "radio") == 0) {
+        return BLE_CMD_RADIO;
+    }
+    if (strcmp(name, "file_open") == 0) {
+        return BLE_CMD_FILE_OPEN;
+    }
+    if (strcmp(name, "file_abort") == 0) {
+        return BLE_CMD_FILE_ABORT;
+    }
+    if (strcmp(name, "status_ack") == 0) {
+        return BLE_CMD_STATUS_ACK;
+    }
+    if (strcmp(name, "notif_prio") == 0) {
+        return BLE_CMD_NOTIF_PRIO;
+    }
+    if (strcmp(name, "sync") == 0) {
+        return BLE_CMD_SYNC;
+    }
+    return BLE_CMD_UNKNOWN;
+}
+
+// Where a known key's value goes. Keys the schema does not know, or values
+// of the wrong type, are skipped like cJSON_Is* checks would ignore them.
+typedef struct {
+    enum { FIELD_NONE, FIELD_STR, FIELD_NUM, FIELD_DATETIME } kind;
+    const char** str;
+    int64_t* num;
+    uint32_t flag;
+} field_t;
+
+static field_t lookup_field(ble_msg_t* out, const char* key)
+{
+    field_t f = { FIELD_NONE, NULL, NULL, 0 };
+    switch (key[0]) {
+    case 'a':
+        if (strcmp(key, "app") == 0) f = (field_t){ FIELD_STR, &out->app, NULL, 0 };
+        break;
+    case 'b':
+        if (strcmp(key, "bytes") == 0) f = (field_t){ FIELD_NUM, NULL, &out->bytes, BLE_MSG_BYTES };
+        break;
+    case 'c':
+        if (strcmp(key, "cmd") == 0) f = (field_t){ FIELD_STR, &out->cmd_name, NULL, BLE_MSG_CMD };
+        else if (strcmp(key, "crc") == 0) f = (field_t){ FIELD_NUM, NULL, &out->crc, BLE_MSG_CRC };
+        else if (strcmp(key, "comp") == 0) f = (field_t){ FIELD_STR, &out->comp, NULL, BLE_MSG_COMP };
+        break;
+    case 'd':
+        if (strcmp(key, "datetime") == 0) f = (field_t){ FIELD_DATETIME, NULL, NULL, BLE_MSG_DATETIME };
+        break;
+    case 'm':
+        if (strcmp(key, "message") == 0) f = (field_t){ FIELD_STR, &out->message, NULL, 0 };
+        else if (strcmp(key, "mode") == 0) f = (field_t){ FIELD_STR, &out->mode, NULL, BLE_MSG_MODE };
+        break;
+    case 'n':
+        if (strcmp(key, "notification") == 0) f = (field_t){ FIELD_STR, &out->notification, NULL, BLE_MSG_NOTIFICATION };
+        else if (strcmp(key, "name") == 0) f = (field_t){ FIELD_STR, &out->name, NULL, BLE_MSG_NAME };
+        break;
+    case 'p':
+        if (strcmp(key, "prio") == 0) f = (field_t){ FIELD_STR, &out->prio, NULL, BLE_MSG_PRIO };
+        break;
+    case 's':
+        if (strcmp(key, "status") == 0) f = (field_t){ FIELD_STR, &out->status, NULL, BLE_MSG_STATUS };
+        else if (strcmp(key, "sample") == 0) f = (field_t){ FIELD_NUM, NULL, &out->sample, BLE_MSG_SAMPLE };
+        else if (strcmp(key, "size") == 0) f = (field_t){ FIELD_NUM, NULL, &out->size, BLE_MSG_SIZE };
+        else if (strcmp(key, "seq") == 0) f = (field_t){ FIELD_NUM, NULL, &out->seq, BLE_MSG_SEQ };
+        else if (strcmp(key, "since") == 0) f = (field_t){ FIELD_NUM, NULL, &out->since, BLE_MSG_SINCE };
+        break;
+    case 't':
+        if (strcmp(key, "title") == 0) f = (field_t){ FIELD_STR, &out->title, NULL, 0 };
+        else if (strcmp(key, "to") == 0) f = (field_t){ FIELD_STR, &out->to, NULL, BLE_MSG_TO };
+        break;
+    }
+    return f;
+}
+
+// Store a string value for a FIELD_STR or FIELD_DATETIME field
+static void set_str(ble_msg_t* out, const field_t* f, const char* val)
+{
+    if (f->kind == FIELD_DATETIME) {
+        if (parse_datetime(val, &out->datetime)) {
+            out->fields |= f->flag;
+        }
+    } else {
+        *f->str = val;
+        out->fields |= f->flag;
+    }
+}
+
+static void msg_init(ble_msg_t* out)
+{
+    static const char empty[] = "";
+    memset(out, 0, sizeof(*out));
+    out->notification = out->app = out->title = out->message = empty;
+    out->status = out->cmd_name = out->to = out->mode = out->name = out->comp = out->prio = empty;
+}
+
+static void msg_finish(ble_msg_t* out)
+{
+    if (out->fields & BLE_MSG_CMD) {
+        out->cmd = cmd_from_name(out->cmd_name);
+    }
+}
+
+int ble_proto_decode(char* line, size_t len, ble_msg_t* out)
+{
+    cursor_t c = { line, line + len };
+
+    msg_init(out);
+    skip_ws(&c);
+    if (c.p >= c.end || *c.p != '{') {
+        return -1;
+    }
+    c.p++;
+    skip_ws(&c);
+    if (c.p < c.end && *c.p == '}') {
+        return 0;
+    }
+
+    for (;;) {
+        const char* key;
+        skip_ws(&c);
+        if (parse_string(&c, &key) != 0) {
+            return -1;
+        }
+        skip_ws(&c);
+        if (c.p >= c.end || *c.p != ':') {
+            return -1;
+        }
+        c.p++;
+        skip_ws(&c);
+        if (c.p >= c.end) {
+            return -1;
+        }
+
+        field_t f = lookup_field(out, key);
+        if ((f.kind == FIELD_STR || f.kind == FIELD_DATETIME) && *c.p == '"') {
+            const char* val;
+            if (parse_string(&c, &val) != 0) {
+                return -1;
+            }
+            set_str(out, &f, val);
+        } else if (f.kind == FIELD_NUM && (*c.p == '-' || (*c.p >= '0' && *c.p <= '9'))) {
+            if (parse_int(&c, f.num) != 0) {
+                return -1;
+            }
+            out->fields |= f.flag;
+        } else if (skip_value(&c) != 0) {
+            return -1;
+        }
+
+        skip_ws(&c);
+        if (c.p >= c.end) {
+            return -1;
+        }
+        if (*c.p == ',') {
+            c.p++;
+            continue;
+        }
+        if (*c.p == '}') {
+            break;
+        }
+        return -1;
+    }
+
+    msg_finish(out);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// CBOR decoder (RFC 8949 subset: maps with text keys, nesting skipped)
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* end;
+} cbor_t;
+
+#define CBOR_INDEF 31
+#define CBOR_BREAK 0xFF
+#define CBOR_MAX_DEPTH 8
+
+// Read an item head: major type and argument. *indef is set for
+// indefinite-length strings, arrays and maps.
+static int cbor_head(cbor_t* c, int* major, uint64_t* arg, bool* indef)
+{
+    if (c->p >= c->end) {
+        return -1;
+    }
+    uint8_t ib = *c->p++;
+    int info = ib & 31;
+    *major = ib >> 5;
+    *indef = false;
+    if (info < 24) {
+        *arg = info;
+        return 0;
+    }
+    if (info == CBOR_INDEF) {
+        if (*major < 2 || *major == 6 || *major == 7) {
+            return -1;
+        }
+        *indef = true;
+        *arg = 0;
+        return 0;
+    }
+    if (info > 27) {
+        return -1;
+    }
+    int n = 1 << (info - 24);
+    if (c->end - c->p < n) {
+        return -1;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++) {
+        v = (v << 8) | *c->p++;
+    }
+    *arg = v;
+    return 0;
+}
+
+static int cbor_skip(cbor_t* c, int depth)
+{
+    int major;
+    uint64_t arg;
+    bool indef;
+
+    if (depth > CBOR_MAX_DEPTH || cbor_head(c, &major, &arg, &indef) != 0) {
+        return -1;
+    }
+    switch (major) {
+    case 0:
+    case 1:
+    case 7: // simple values and floats carry their payload in the argument
+        return 0;
+    case 2:
+    case 3:
+        if (indef) {
+            while (c->p < c->end && *c->p != CBOR_BREAK) {
+                if (cbor_skip(c, depth + 1) != 0) {
+                    return -1;
+                }
+            }
+            break;
+        }
+        if ((uint64_t)(c->end - c->p) < arg) {
+            return -1;
+        }
+        c->p += arg;
+        return 0;
+    case 4:
+    case 5: {
+        uint64_t items = major == 5 ? arg * 2 : arg;
+        if (indef) {
+            while (c->p < c->end && *c->p != CBOR_BREAK) {
+                if (cbor_skip(c, depth + 1) != 0) {
+                    return -1;
+                }
+            }
+            break;
+        }
+        for (uint64_t i = 0; i < items; i++) {
+            if (cbor_skip(c, depth + 1) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    case 6: // tag: skip the tagged item
+        return cbor_skip(c, depth + 1);
+    }
+    // indefinite item: consume the break
+    if (c->p >= c->end) {
+        return -1;
+    }
+    c->p++;
+    return 0;
+}
+
+// Read a definite-length text string and NUL-terminate it in place: the
+// bytes move down over their own head (at least one byte long), so the NUL
+// only overwrites the string's own last byte.
+static int cbor_text(cbor_t* c, const char** out)
+{
+    uint8_t* head = c->p;
+    int major;
+    uint64_t arg;
+    bool indef;
+
+    if (cbor_head(c, &major, &arg, &indef) != 0 || major != 3 || indef || (uint64_t)(c->end - c->p) < arg) {
+        return -1;
+    }
+    memmove(head, c->p, arg);
+    head[arg] = '\0';
+    c->p += arg;
+    *out = (const char*)head;
+    return 0;
+}
+
+int ble_proto_decode_cbor(uint8_t* buf, size_t len, ble_msg_t* out)
+{
+    cbor_t c = { buf, buf + len };
+    int major;
+    uint64_t pairs;
+    bool indef;
+
+    msg_init(out);
+    if (cbor_head(&c, &major, &pairs, &indef) != 0 || major != 5) {
+        return -1;
+    }
+    for (uint64_t i = 0; indef || i < pairs; i++) {
+        if (indef) {
+            if (c.p >= c.end) {
+                return -1;
+            }
+            if (*c.p == CBOR_BREAK) {
+                break;
+            }
+        }
+        const char* key;
+        if (cbor_text(&c, &key) != 0) {
+            return -1;
+        }
+        if (c.p >= c.end) {
+            return -1;
+        }
+        field_t f = lookup_field(out, key);
+        int vmajor = *c.p >> 5;
+        if ((f.kind == FIELD_STR || f.kind == FIELD_DATETIME) && vmajor == 3 && (*c.p & 31) != CBOR_INDEF) {
+            const char* val;
+            if (cbor_text(&c, &val) != 0) {
+                return -1;
+            }
+            set_str(out, &f, val);
+        } else if (f.kind == FIELD_NUM && vmajor <= 1) {
+            uint64_t arg;
+            bool unused;
+            if (cbor_head(&c, &vmajor, &arg, &unused) != 0) {
+                return -1;
+            }
+            if (arg > INT64_MAX) {
+                arg = INT64_MAX;
+            }
+            *f.num = vmajor == 0 ? (int64_t)arg : -1 - (int64_t)arg;
+            out->fields |= f.flag;
+        } else if (cbor_skip(&c, 1) != 0) {
+            return -1;
+        }
+    }
+
+    msg_finish(out);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Frames
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), a nibble at a time
+static uint16_t crc16(uint16_t crc, const uint8_t* p, size_t n)
+{
+    static const uint16_t tbl[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+    while (n--) {
+        crc = (crc << 4) ^ tbl[(crc >> 12) ^ (*p >> 4)];
+        crc = (crc << 4) ^ tbl[(crc >> 12) ^ (*p++ & 15)];
+    }
+    return crc;
+}
+
+size_t ble_frame_seal(uint8_t* frame, uint8_t type, uint8_t seq, size_t payload_len)
+{
+    frame[0] = BLE_FRAME_SYNC;
+    frame[1] = type;
+    frame[2] = seq;
+    frame[3] = payload_len & 0xFF;
+    frame[4] = payload_len >> 8;
+    uint16_t crc = crc16(0xFFFF, frame + 1, BLE_FRAME_HDR - 1 + payload_len);
+    frame[BLE_FRAME_HDR + payload_len] = crc & 0xFF;
+    frame[BLE_FRAME_HDR + payload_len + 1] = crc >> 8;
+    return BLE_FRAME_HDR + payload_len + BLE_FRAME_CRC;
+}
+
+int ble_frame_open(uint8_t* frame, size_t len, ble_frame_t* out)
+{
+    if (len < BLE_FRAME_OVERHEAD || frame[0] != BLE_FRAME_SYNC) {
+        return -1;
+    }
+    size_t plen = frame[3] | (frame[4] << 8);
+    if (len != plen + BLE_FRAME_OVERHEAD) {
+        return -1;
+    }
+    uint16_t crc = frame[len - 2] | (frame[len - 1] << 8);
+    if (crc16(0xFFFF, frame + 1, len - 1 - BLE_FRAME_CRC) != crc) {
+        return -1;
+    }
+    out->type = frame[1];
+    out->seq = frame[2];
+    out->payload = frame + BLE_FRAME_HDR;
+    out->len = plen;
+    return 0;
+}
+
+// CRC-32, reflected: the ROM has a table-driven one on the target
+uint32_t ble_crc32(uint32_t crc, const void* data, size_t len)
+{
+#ifdef ESP_PLATFORM
+    return esp_rom_crc32_le(crc, (const uint8_t*)data, len);
+#else
+    static const uint32_t tbl[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while (len--) {
+        crc = (crc >> 4) ^ tbl[(crc ^ *p) & 15];
+        crc = (crc >> 4) ^ tbl[(crc ^ (*p++ >> 4)) & 15];
+    }
+    return ~crc;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Writer
+
+static void put(ble_jw_t* w, const char* s, size_t n)
+{
+    if (w->overflow) {
+        return;
+    }
+    // Keep one byte for the NUL added by ble_jw_finish()
+    if (w->len + n >= w->cap) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void putc_(ble_jw_t* w, int ch)
+{
+    char b = (char)ch;
+    put(w, &b, 1);
+}
+
+static void put_escaped(ble_jw_t* w, const char* s)
+{
+    static const char hex[] = "0123456789abcdef";
+    putc_(w, '"');
+    const char* run = s;
+    for (;; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        put(w, run, s - run);
+        if (ch == '\0') {
+            break;
+        }
+        char esc[6] = { '\\', 0 };
+        size_t n = 2;
+        switch (ch) {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[ch >> 4];
+            esc[5] = hex[ch & 15];
+            n = 6;
+            break;
+        }
+        put(w, esc, n);
+        run = s + 1;
+    }
+    putc_(w, '"');
+}
+
+static void cbor_put_head(ble_jw_t* w, uint8_t major, uint64_t v)
+{
+    uint8_t h[9];
+    size_t n;
+    major <<= 5;
+    if (v < 24) {
+        h[0] = major | (uint8_t)v;
+        n = 1;
+    } else if (v <= 0xFF) {
+        h[0] = major | 24;
+        h[1] = (uint8_t)v;
+        n = 2;
+    } else if (v <= 0xFFFF) {
+        h[0] = major | 25;
+        h[1] = (uint8_t)(v >> 8);
+        h[2] = (uint8_t)v;
+        n = 3;
+    } else if (v <= 0xFFFFFFFFu) {
+        h[0] = major | 26;
+        for (int i = 0; i < 4; i++) {
+            h[1 + i] = (uint8_t)(v >> (24 - 8 * i));
+        }
+        n = 5;
+    } else {
+        h[0] = major | 27;
+        for (int i = 0; i < 8; i++) {
+            h[1 + i] = (uint8_t)(v >> (56 - 8 * i));
+        }
+        n = 9;
+    }
+    put(w, (const char*)h, n);
+}
+
+static void cbor_put_text(ble_jw_t* w, const char* s)
+{
+    size_t n = strlen(s);
+    cbor_put_head(w, 3, n);
+    put(w, s, n);
+}
+
+// Comma and key for the next member of the current container
+static void member(ble_jw_t* w, const char* key)
+{
+    if (w->cbor) {
+        if (key) {
+            cbor_put_text(w, key);
+        }
+        return;
+    }
+    if (w->first & (1u << w->depth)) {
+        w->first &= ~(1u << w->depth);
+    } else {
+        putc_(w, ',');
+    }
+    if (key) {
+        put_escaped(w, key);
+        putc_(w, ':');
+    }
+}
+
+static void open_(ble_jw_t* w, const char* key, char ch)
+{
+    member(w, key);
+    if (w->depth >= BLE_JW_MAX_DEPTH) {
+        w->overflow = true;
+        return;
+    }
+    // CBOR containers are indefinite-length, so nothing needs patching later
+    putc_(w, w->cbor ? (ch == '{' ? 0xBF : 0x9F) : ch);
+    w->depth++;
+    w->first |= 1u << w->depth;
+}
+
+static void close_(ble_jw_t* w, char ch)
+{
+    if (w->depth == 0) {
+        w->overflow = true;
+        return;
+    }
+    w->depth--;
+    putc_(w, w->cbor ? 0xFF : ch);
+}
+
+void ble_jw_init(ble_jw_t* w, char* buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->depth = 0;
+    w->first = 1;
+    w->overflow = cap == 0;
+    w->cbor = false;
+}
+
+void ble_jw_init_cbor(ble_jw_t* w, uint8_t* buf, size_t cap)
+{
+    ble_jw_init(w, (char*)buf, cap);
+    w->cbor = true;
+}
+
+void ble_jw_begin_object(ble_jw_t* w, const char* key)
+{
+    open_(w, key, '{');
+}
+
+void ble_jw_end_object(ble_jw_t* w)
+{
+    close_(w, '}');
+}
+
+void ble_jw_begin_array(ble_jw_t* w, const char* key)
+{
+    open_(w, key, '[');
+}
+
+void ble_jw_end_array(ble_jw_t* w)
+{
+    close_(w, ']');
+}
+
+void ble_jw_str(ble_jw_t* w, const char* key, const char* val)
+{
+    member(w, key);
+    if (w->cbor) {
+        cbor_put_text(w, val ? val : "");
+        return;
+    }
+    put_escaped(w, val ? val : "");
+}
+
+void ble_jw_int(ble_jw_t* w, const char* key, int64_t val)
+{
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    uint64_t u = val < 0 ? (uint64_t)0 - (uint64_t)val : (uint64_t)val;
+
+    member(w, key);
+    if (w->cbor) {
+        cbor_put_head(w, val < 0 ? 1 : 0, val < 0 ? u - 1 : u);
+        return;
+    }
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (val < 0) {
+        putc_(w, '-');
+    }
+    put(w, p, tmp + sizeof(tmp) - p);
+}
+
+void ble_jw_bool(ble_jw_t* w, const char* key, bool val)
+{
+    member(w, key);
+    if (w->cbor) {
+        putc_(w, val ? 0xF5 : 0xF4);
+        return;
+    }
+    if (val) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+size_t ble_jw_finish(ble_jw_t* w)
+{
+    if (w->overflow || w->depth != 0) {
+        if (w->cap) {
+            w->buf[0] = '\0';
+        }
+        return 0;
+    }
+    if (!w->cbor) {
+        w->buf[w->len] = '\0';
+    }
+    return w->len;
+}
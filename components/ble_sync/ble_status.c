@@ -0,0 +1,78 @@
+#include "ble_status.h"
+
+#include <string.h>
+
+static unsigned diff(const ble_status_t* a, const ble_status_t* b)
+{
+    unsigned mask = 0;
+    if (a->battery != b->battery) {
+        mask |= BLE_STATUS_BATTERY;
+    }
+    if (a->charging != b->charging) {
+        mask |= BLE_STATUS_CHARGING;
+    }
+    if (a->vbus != b->vbus) {
+        mask |= BLE_STATUS_VBUS;
+    }
+    if (a->steps != b->steps) {
+        mask |= BLE_STATUS_STEPS;
+    }
+    return mask;
+}
+
+void ble_status_reset(ble_status_model_t* m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+unsigned ble_status_next(ble_status_model_t* m, const ble_status_t* cur, bool key, uint16_t* seq, uint16_t* base)
+{
+    if (!key && m->have_last && diff(&m->last, cur) == 0) {
+        return 0;
+    }
+    unsigned mask = BLE_STATUS_ALL;
+    if (!key && m->have_acked) {
+        mask = diff(&m->acked, cur);
+        if (mask == 0) {
+            // Back to the acknowledged state; a delta would be empty
+            mask = BLE_STATUS_ALL;
+        }
+    }
+
+    m->seq++;
+    m->last = *cur;
+    m->have_last = true;
+    // seq counts up by one from 1, so its slot replaces the oldest update
+    unsigned i = (uint16_t)(m->seq - 1) % BLE_STATUS_INFLIGHT;
+    if (m->sent_count < BLE_STATUS_INFLIGHT) {
+        m->sent_count++;
+    }
+    m->sent[i] = *cur;
+    m->sent_seq[i] = m->seq;
+
+    *seq = m->seq;
+    *base = mask == BLE_STATUS_ALL ? 0 : m->acked_seq;
+    return mask;
+}
+
+void ble_status_unsent(ble_status_model_t* m)
+{
+    m->have_last = false;
+}
+
+bool ble_status_ack(ble_status_model_t* m, uint16_t seq)
+{
+    // Acks may arrive out of order: never go back to an older state
+    if (m->have_acked && (int16_t)(seq - m->acked_seq) <= 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < m->sent_count; i++) {
+        if (m->sent_seq[i] == seq) {
+            m->acked = m->sent[i];
+            m->acked_seq = seq;
+            m->have_acked = true;
+            return true;
+        }
+    }
+    return false;
+}
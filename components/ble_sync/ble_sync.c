@@ -1,4 +1,12 @@
 #include "ble_sync.h"
+#include "ble_proto.h"
+#include "ble_gatt_std.h"
+#include "ble_file.h"
+#include "ble_lz.h"
+#include "ble_status.h"
+#include "ble_notif.h"
+#include "ble_hist.h"
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,8 +16,9 @@
 #include "cJSON.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "nimble-nordic-uart.h"
@@ -22,41 +31,372 @@
 #include "display_manager.h"
 #include "ui.h"
 #include "audio_alert.h"
+#include "lwmalloc.h"
+#include "mbedtls/base64.h"
+#include "esp_spiffs.h"
+#include "nvs.h"
 
-typedef struct {
-    char* ts; char* app; char* title; char* msg;
-} notif_async_t;
+// Show a batch of notifications, oldest first so the newest is on top.
+// Only one that alerts switches to the messages tile.
+static void notif_show_batch(const ble_notif_batch_t* b)
+{
+    if (b->alert) {
+        ui_show_messages_tile();
+    }
+    for (unsigned i = 0; i < b->count; i++) {
+        const ble_notif_item_t* it = &b->item[i];
+        notifications_show(it->app, it->title, it->message, it->ts);
+    }
+}
 
 static void notif_async_cb(void* p)
 {
-    notif_async_t* c = (notif_async_t*)p;
-    ui_show_messages_tile();
-    notifications_show(c->app, c->title, c->msg, c->ts);
-    free(c->ts);
-    free(c->app);
-    free(c->title);
-    free(c->msg);
-    free(c);
+    notif_show_batch((const ble_notif_batch_t*)p);
+    free(p);
 }
 
 static const char* TAG = "BLE_SYNC";
 
+#define BENCH_TX_DEFAULT (64 * 1024)
+#define BENCH_TX_MAX (4 * 1024 * 1024)
+// Bulk streams run on uartTask and may wait this long for TX queue space
+#define BULK_TX_WAIT pdMS_TO_TICKS(2000)
+
+// File transfers land next to the assets flashed at build time
+#define FILE_DIR "/spiffs"
+#define FILE_PARTITION "storage"
+// A chunk frame fits the fixed RX line buffer, so it goes through the RX
+// ring inline; the window is as many chunk frames as the ring holds (with
+// their headers and padding), less one for the space a wrap can skip
+#define FILE_CHUNK ((CONFIG_NORDIC_UART_MAX_LINE_LENGTH - BLE_FILE_CHUNK_HDR) & ~15)
+#define FILE_CHUNK_FRAME (BLE_FRAME_OVERHEAD + BLE_FILE_CHUNK_HDR + FILE_CHUNK)
+#define FILE_WINDOW (CONFIG_NORDIC_UART_RX_BUFFER_SIZE / (FILE_CHUNK_FRAME + 16) - 1)
+// The window is small, so the phone should not wait for acks: one per chunk
+// keeps the link ~90% busy where one per half window gets 70%
+// (host/ble_file_bench.c at 15 ms latency)
+#define FILE_ACK_EVERY 1
+_Static_assert(FILE_CHUNK >= 64 && FILE_WINDOW >= 2, "RX line or ring buffer too small for file transfers");
+
+// Received lines are logged up to this many characters
+#define LOG_LINE_PREFIX 80
+
+// Frames shorter than this go uncompressed: LZ4 has little to find in them
+#define LZ_MIN_BYTES 96
+
+// Status: what asks for an update within this window (a burst of power
+// events, the periodic timer) goes out as one
+#define STATUS_COALESCE_MS 250
+// Every so many periodic updates is a keyframe: 30 minutes
+#define STATUS_KEY_EVERY 6
+
+// History: a day of one-minute records (8 bytes each, in PSRAM when there
+// is some), sent in lines of HIST_BATCH records of at most 26 characters
+#define HIST_RECORDS (24 * 60)
+#define HIST_BATCH 128
+#define HIST_LINE (64 + HIST_BATCH * 26)
+// Cursors are reserved in NVS this many at a time, so a reboot starts past
+// every cursor handed out without a flash write per record
+#define HIST_LEASE 64
+#define HIST_NVS_NS "ble_sync"
+#define HIST_NVS_KEY "hist_cursor"
+_Static_assert(HIST_LINE <= BLE_LZ_BLOCK_MAX, "history lines must fit a compressed stream block");
+
 // Define event base for BLE connection status
 ESP_EVENT_DEFINE_BASE(BLE_SYNC_EVENT_BASE);
 
 // Track BLE connection state to gate periodic status updates
 static volatile bool s_ble_connected = false;
 static TimerHandle_t s_status_timer = NULL;
+static TimerHandle_t s_status_flush_timer = NULL;
 static TimerHandle_t s_time_sync_timer = NULL;
 static bool s_time_sync_requested = false;
 static bool s_ble_enabled = false;
 static bool s_ble_stack_started = false;
 
+// Notifications go through ble_notif to this task, which wakes the screen,
+// hands the batch to the UI and plays the sound, off uartTask. It also saves
+// the history lease, so no flash write blocks the timer task.
+static TaskHandle_t s_notif_task = NULL;
+static SemaphoreHandle_t s_notif_mutex = NULL;
+
+// Minute history (see ble_hist.h), appended from the timer task and read by
+// {"cmd":"sync"} on uartTask
+static portMUX_TYPE s_hist_lock = portMUX_INITIALIZER_UNLOCKED;
+static TimerHandle_t s_hist_timer = NULL;
+static uint32_t s_hist_steps; // step count at the last record
+static uint32_t s_hist_lease; // end of the cursors reserved in NVS
+static uint32_t s_hist_lease_save; // lease end for notif_task to save; 0: none
+
+// Codec of the current connection: JSON lines until the phone negotiates
+// binary frames with {"cmd":"framing","mode":"cbor"}; back to lines on
+// disconnect.
+static volatile bool s_framed = false;
+static volatile bool s_lz = false; // and the phone decodes LZ4 frames
+static uint8_t s_tx_seq;
+static uint8_t s_rx_seq; // next expected from the phone
+// Held from reading the codec to queueing the message by senders outside
+// uartTask, so none of them encodes in a codec set_framing() has replaced.
+// A mutex: queueing allocates.
+static SemaphoreHandle_t s_codec_mutex = NULL;
+
+// Status updates of the current connection (see ble_status.h). Power events,
+// the timers, connects and the phone's acks all get here from different tasks.
+static portMUX_TYPE s_status_lock = portMUX_INITIALIZER_UNLOCKED;
+static ble_status_model_t s_status;
+static int s_status_battery;
+static bool s_status_charging;
+static bool s_status_key; // the next update is a keyframe
+static unsigned s_status_ticks;
+
+_Static_assert(BLE_FRAME_SYNC == NORDIC_UART_FRAME_SYNC && BLE_FRAME_HDR == NORDIC_UART_FRAME_HDR && BLE_FRAME_CRC == NORDIC_UART_FRAME_TRAILER,
+               "ble_proto frames must match the Nordic UART frame reassembly");
+
+// Seal the payload at frame + BLE_FRAME_HDR and queue the frame
+static esp_err_t send_sealed_via(uint8_t* frame, uint8_t type, size_t len, nordic_uart_prio_t prio,
+                                 nordic_uart_transport_t via, TickType_t wait)
+{
+    uint8_t seq = __atomic_fetch_add(&s_tx_seq, 1, __ATOMIC_RELAXED);
+    size_t n = ble_frame_seal(frame, type, seq, len);
+    return nordic_uart_enqueue_via(frame, n, prio, via, wait);
+}
+
+static esp_err_t send_sealed(uint8_t* frame, uint8_t type, size_t len, nordic_uart_prio_t prio, TickType_t wait)
+{
+    return send_sealed_via(frame, type, len, prio, NORDIC_UART_TRANSPORT_AUTO, wait);
+}
+
+// Send the payload compressed, if that makes it shorter. ESP_ERR_NOT_FINISHED:
+// it does not, send it as is.
+static esp_err_t send_frame_lz(uint8_t type, const void* payload, size_t len, nordic_uart_prio_t prio, TickType_t wait)
+{
+    const size_t table = BLE_LZ_HASH_SIZE * sizeof(uint16_t);
+    const size_t cap = len - BLE_FRAME_LZ_HDR - 1;
+    uint8_t* mem = (uint8_t*)malloc(table + BLE_FRAME_OVERHEAD + BLE_FRAME_LZ_HDR + cap);
+    if (!mem) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+    uint8_t* frame = mem + table;
+    uint8_t* p = frame + BLE_FRAME_HDR;
+    esp_err_t err = ESP_ERR_NOT_FINISHED;
+    size_t n = ble_lz_compress(payload, len, p + BLE_FRAME_LZ_HDR, cap, (uint16_t*)mem);
+    if (n > 0) {
+        p[0] = len & 0xFF;
+        p[1] = len >> 8;
+        err = send_sealed(frame, type | BLE_FRAME_F_LZ, BLE_FRAME_LZ_HDR + n, prio, wait);
+    }
+    free(mem);
+    return err;
+}
+
+static esp_err_t send_frame(uint8_t type, const void* payload, size_t len, nordic_uart_prio_t prio, TickType_t wait)
+{
+    uint8_t small[BLE_FRAME_OVERHEAD + 160];
+    uint8_t* frame = small;
+
+    if (len > UINT16_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (s_lz && len >= LZ_MIN_BYTES) {
+        esp_err_t err = send_frame_lz(type, payload, len, prio, wait);
+        if (err != ESP_ERR_NOT_FINISHED) {
+            return err;
+        }
+    }
+    if (len + BLE_FRAME_OVERHEAD > sizeof(small)) {
+        frame = (uint8_t*)malloc(len + BLE_FRAME_OVERHEAD);
+        if (!frame) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    memcpy(frame + BLE_FRAME_HDR, payload, len);
+    esp_err_t err = send_sealed(frame, type, len, prio, wait);
+    if (frame != small) {
+        free(frame);
+    }
+    return err;
+}
+
+// Send one JSON message as a line, or wrapped in a frame
+static esp_err_t send_json_as(bool framed, const char* json, nordic_uart_prio_t prio, TickType_t wait)
+{
+    if (!framed) {
+        return nordic_uart_enqueueln(json, prio, wait);
+    }
+    return send_frame(BLE_FRAME_JSON, json, strlen(json), prio, wait);
+}
+
+// Send one JSON message in the connection's codec
+static esp_err_t send_json(const char* json, nordic_uart_prio_t prio, TickType_t wait)
+{
+    return send_json_as(s_framed, json, prio, wait);
+}
+
+// A bulk stream: a sequence of messages that, with compression on, is
+// compressed as one so that short records find matches in the ones before.
+// It stays on the transport it starts on so the phone gets its frames in
+// order.
+typedef struct {
+    ble_lz_stream_t* lz; // NULL: messages go out like send_json()
+    uint8_t* frame;
+    nordic_uart_transport_t via;
+    bool first;
+} bulk_stream_t;
+
+static void stream_begin(bulk_stream_t* s)
+{
+    memset(s, 0, sizeof(*s));
+    if (!s_framed || !s_lz) {
+        return;
+    }
+    s->lz = (ble_lz_stream_t*)malloc(sizeof(*s->lz));
+    s->frame = (uint8_t*)malloc(BLE_FRAME_OVERHEAD + BLE_LZ_BLOCK_MAX);
+    if (!s->lz || !s->frame) {
+        free(s->lz);
+        free(s->frame);
+        s->lz = NULL;
+        s->frame = NULL;
+        return;
+    }
+    ble_lz_stream_init(s->lz);
+    s->via = nordic_uart_coc_connected() ? NORDIC_UART_TRANSPORT_COC : NORDIC_UART_TRANSPORT_GATT;
+    s->first = true;
+}
+
+static esp_err_t stream_send_json(bulk_stream_t* s, const char* json)
+{
+    size_t len = strlen(json);
+    if (!s->lz || len > BLE_LZ_BLOCK_MAX) {
+        // Outside the stream's history
+        return send_json(json, NORDIC_UART_PRIO_BULK, BULK_TX_WAIT);
+    }
+
+    uint8_t type = BLE_FRAME_JSON | BLE_FRAME_F_STREAM | (s->first ? BLE_FRAME_F_START : 0);
+    // Compressed only if that saves bytes; either way it is history now
+    uint8_t* p = s->frame + BLE_FRAME_HDR;
+    size_t cap = len > BLE_FRAME_LZ_HDR + 1 ? len - BLE_FRAME_LZ_HDR - 1 : 0;
+    size_t n = ble_lz_stream_compress(s->lz, json, len, p + BLE_FRAME_LZ_HDR, cap);
+    s->first = false;
+    if (n > 0) {
+        p[0] = len & 0xFF;
+        p[1] = len >> 8;
+        return send_sealed_via(s->frame, type | BLE_FRAME_F_LZ, BLE_FRAME_LZ_HDR + n, NORDIC_UART_PRIO_BULK, s->via, BULK_TX_WAIT);
+    }
+    memcpy(p, json, len);
+    return send_sealed_via(s->frame, type, len, NORDIC_UART_PRIO_BULK, s->via, BULK_TX_WAIT);
+}
+
+static void stream_end(bulk_stream_t* s)
+{
+    free(s->lz);
+    free(s->frame);
+    s->lz = NULL;
+    s->frame = NULL;
+}
+
+// Start a reply in the connection's codec: a CBOR map for a frame, or a
+// JSON line
+static void reply_init(ble_jw_t* w, uint8_t* buf, size_t cap)
+{
+    if (s_framed) {
+        ble_jw_init_cbor(w, buf + BLE_FRAME_HDR, cap - BLE_FRAME_OVERHEAD);
+    } else {
+        ble_jw_init(w, (char*)buf, cap);
+    }
+}
+
+static esp_err_t reply_send(ble_jw_t* w, uint8_t* buf, nordic_uart_prio_t prio)
+{
+    size_t n = ble_jw_finish(w);
+    if (n == 0) {
+        return ESP_FAIL;
+    }
+    if (w->cbor) {
+        return send_sealed(buf, BLE_FRAME_CBOR, n, prio, 0);
+    }
+    return nordic_uart_enqueueln((const char*)buf, prio, 0);
+}
+
+// Send the pending status update, if there is anything new for the phone
+static esp_err_t status_flush(void)
+{
+    ble_status_t cur;
+    cur.vbus = bsp_power_get_vbus_voltage_mv() > 0;
+    cur.steps = sensors_get_step_count();
+
+    uint16_t seq = 0, base = 0;
+    unsigned mask = 0;
+    bool connected = s_ble_connected;
+    taskENTER_CRITICAL(&s_status_lock);
+    cur.battery = s_status_battery;
+    cur.charging = s_status_charging;
+    if (connected) {
+        mask = ble_status_next(&s_status, &cur, s_status_key, &seq, &base);
+        s_status_key = false;
+    }
+    taskEXIT_CRITICAL(&s_status_lock);
+    // Battery Service readers see the same snapshot
+    ble_gatt_std_set_battery(cur.battery, cur.charging, cur.vbus);
+    if (mask == 0) {
+        return ESP_OK;
+    }
+
+    // Runs from the timer service task: encode on the stack, as a CBOR map
+    // in a frame or as a JSON line
+    uint8_t buf[BLE_FRAME_OVERHEAD + 96];
+    ble_jw_t w;
+    xSemaphoreTake(s_codec_mutex, portMAX_DELAY);
+    reply_init(&w, buf, sizeof(buf));
+    ble_jw_begin_object(&w, NULL);
+    if (mask & BLE_STATUS_BATTERY) {
+        ble_jw_int(&w, "battery", cur.battery);
+    }
+    if (mask & BLE_STATUS_CHARGING) {
+        ble_jw_bool(&w, "charging", cur.charging);
+    }
+    if (mask & BLE_STATUS_VBUS) {
+        ble_jw_bool(&w, "vbus", cur.vbus);
+    }
+    if (mask & BLE_STATUS_STEPS) {
+        ble_jw_int(&w, "steps", cur.steps);
+    }
+    ble_jw_int(&w, "seq", seq);
+    if (mask != BLE_STATUS_ALL) {
+        ble_jw_int(&w, "base", base);
+    }
+    ble_jw_end_object(&w);
+    esp_err_t err = reply_send(&w, buf, NORDIC_UART_PRIO_STATUS);
+    xSemaphoreGive(s_codec_mutex);
+    if (err != ESP_OK) {
+        // Not queued: the next update must go out even if nothing changes
+        taskENTER_CRITICAL(&s_status_lock);
+        ble_status_unsent(&s_status);
+        taskEXIT_CRITICAL(&s_status_lock);
+    }
+    return err;
+}
+
+static void status_flush_cb(TimerHandle_t xTimer)
+{
+    (void)xTimer;
+    (void)status_flush();
+}
+
+// Ask for a status update; key makes it a keyframe
+static void status_request(bool key)
+{
+    if (key) {
+        taskENTER_CRITICAL(&s_status_lock);
+        s_status_key = true;
+        taskEXIT_CRITICAL(&s_status_lock);
+    }
+    ble_sync_send_status(bsp_power_get_battery_percent(), bsp_power_is_charging());
+}
+
 static void status_timer_cb(TimerHandle_t xTimer)
 {
     (void)xTimer;
     if (s_ble_connected) {
-        ble_sync_send_status(bsp_power_get_battery_percent(), bsp_power_is_charging());
+        status_request(++s_status_ticks % STATUS_KEY_EVERY == 0);
     }
 }
 
@@ -65,20 +405,25 @@ static void time_sync_timer_cb(TimerHandle_t xTimer)
     (void)xTimer;
     // Send the time sync request now that the link is fully up
     const char* sync_cmd = "{\"cmd\":\"time_sync\"}\n";
-    (void)nordic_uart_sendln(sync_cmd);
+    xSemaphoreTake(s_codec_mutex, portMAX_DELAY);
+    (void)send_json(sync_cmd, NORDIC_UART_PRIO_ACK, 0);
+    xSemaphoreGive(s_codec_mutex);
     ESP_LOGI(TAG, "Requested time sync on connect (delayed)");
 }
 
-static void handle_notification_fields(const char* timestamp,
-    const char* app,
-    const char* title,
-    const char* message)
+static uint32_t notif_now_ms(void)
 {
-    ESP_LOGI(TAG, "Notification: app='%s' title='%s' message='%s' ts='%s'",
-        app ? app : "", title ? title : "", message ? message : "", timestamp ? timestamp : "");
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
 
-    // Wake display for visibility and ensure LVGL is running
-    display_manager_turn_on();
+static void notif_deliver(const ble_notif_batch_t* b)
+{
+    ESP_LOGI(TAG, "Notifications: %u shown, %u dropped%s", b->count, b->dropped, b->alert ? "" : ", silent");
+
+    if (b->alert) {
+        // Wake display for visibility and ensure LVGL is running
+        display_manager_turn_on();
+    }
     // Try to acquire LVGL lock with a reasonable timeout; avoid calling
     // LVGL APIs without the lock to prevent races when the display is turning off.
     bool locked = false;
@@ -87,96 +432,392 @@ static void handle_notification_fields(const char* timestamp,
         if (!locked) vTaskDelay(pdMS_TO_TICKS(10));
     }
     if (locked) {
-        ui_show_messages_tile();
-        notifications_show(app, title, message, timestamp);
+        notif_show_batch(b);
         bsp_display_unlock();
     } else {
-        // Fallback: defer safely to LVGL thread by copying strings
-        notif_async_t* ctx = (notif_async_t*)calloc(1, sizeof(notif_async_t));
-        if (ctx) {
-            ctx->ts = timestamp ? strdup(timestamp) : NULL;
-            ctx->app = app ? strdup(app) : NULL;
-            ctx->title = title ? strdup(title) : NULL;
-            ctx->msg = message ? strdup(message) : NULL;
-            lv_async_call(notif_async_cb, ctx);
+        // Fallback: defer safely to LVGL thread with a copy of the batch,
+        // which only lives until the LVGL thread picks it up
+        lw_tag_t prev_tag = lw_set_task_tag(LW_TAG_COLD);
+        ble_notif_batch_t* copy = (ble_notif_batch_t*)malloc(sizeof(*copy));
+        lw_set_task_tag(prev_tag);
+        if (copy) {
+            *copy = *b;
+            lv_async_call(notif_async_cb, copy);
         }
     }
 
-    // Play notification sound if enabled
-    audio_alert_notify();
+    // Play notification sound if enabled, once for the whole batch
+    if (b->alert) {
+        audio_alert_notify();
+    }
 }
 
-static void process_one_json_object(const char* json, size_t len)
+// Reserve cursors up to end. Returns the end of the previous reservation,
+// 0 if there was none.
+static uint32_t hist_lease(uint32_t end)
 {
-    // cJSON requires a C-string; ensure local null-terminated copy for parsing
-    char* tmp = (char*)malloc(len + 1);
-    if (!tmp) return;
-    memcpy(tmp, json, len);
-    tmp[len] = '\0';
+    nvs_handle_t h;
+    uint32_t prev = 0;
+    if (nvs_open(HIST_NVS_NS, NVS_READWRITE, &h) != ESP_OK) {
+        ESP_LOGW(TAG, "History cursor not saved");
+        return 0;
+    }
+    (void)nvs_get_u32(h, HIST_NVS_KEY, &prev);
+    if (end > 0 && (nvs_set_u32(h, HIST_NVS_KEY, end) != ESP_OK || nvs_commit(h) != ESP_OK)) {
+        ESP_LOGW(TAG, "History cursor not saved");
+    }
+    nvs_close(h);
+    return prev;
+}
 
-    cJSON* root = cJSON_Parse(tmp);
-    if (!root) {
-        free(tmp);
+static void notif_task(void* arg)
+{
+    (void)arg;
+    // Too big for the stack; only this task uses it
+    static ble_notif_batch_t batch;
+    for (;;) {
+        uint32_t lease = __atomic_exchange_n(&s_hist_lease_save, 0, __ATOMIC_RELAXED);
+        if (lease != 0) {
+            hist_lease(lease);
+        }
+        xSemaphoreTake(s_notif_mutex, portMAX_DELAY);
+        uint32_t due = ble_notif_due_in(notif_now_ms());
+        bool ready = due == 0 && ble_notif_take(&batch);
+        xSemaphoreGive(s_notif_mutex);
+        if (ready) {
+            notif_deliver(&batch);
+            continue;
+        }
+        // Woken early by every new notification
+        ulTaskNotifyTake(pdTRUE, due == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(due) + 1);
+    }
+}
+
+static void handle_notification_fields(const char* timestamp,
+    const char* app,
+    const char* title,
+    const char* message)
+{
+    ESP_LOGI(TAG, "Notification: app='%s' title='%s' message='%s' ts='%s'",
+        app ? app : "", title ? title : "", message ? message : "", timestamp ? timestamp : "");
+
+    xSemaphoreTake(s_notif_mutex, portMAX_DELAY);
+    bool fresh = ble_notif_push(app, title, message, timestamp, notif_now_ms());
+    xSemaphoreGive(s_notif_mutex);
+    if (!fresh) {
+        ESP_LOGI(TAG, "Duplicate notification dropped");
         return;
     }
+    xTaskNotifyGive(s_notif_task);
+}
+
+static void set_framing(const ble_msg_t* msg)
+{
+    bool framed = (msg->fields & BLE_MSG_MODE) && strcmp(msg->mode, "cbor") == 0;
+    bool lz = framed && (msg->fields & BLE_MSG_COMP) && strcmp(msg->comp, "lz4") == 0;
+    bool was_framed = s_framed;
+    // Switch and queue the ack under the codec mutex: a status flush on the
+    // timer task either goes out before the ack in the old codec or after it
+    // in the new one
+    xSemaphoreTake(s_codec_mutex, portMAX_DELAY);
+    if (lz != s_lz) {
+        ESP_LOGI(TAG, "Compression: %s", lz ? "lz4" : "off");
+        s_lz = lz;
+    }
+    if (framed != s_framed) {
+        ESP_LOGI(TAG, "Framing: %s", framed ? "cbor" : "json");
+        s_tx_seq = 0;
+        s_rx_seq = 0;
+        s_framed = framed;
+        nordic_uart_set_rx_frames(framed);
+    }
+    // Acknowledge in the codec the phone used to ask; a receiver tells JSON
+    // lines and frames apart by the first byte ('{' or 0xA5). The phone
+    // starts sending frames once it has seen the ack.
+    send_json_as(was_framed,
+                 !framed ? "{\"framing\":\"json\"}"
+                 : lz    ? "{\"framing\":\"cbor\",\"ver\":1,\"comp\":\"lz4\"}"
+                         : "{\"framing\":\"cbor\",\"ver\":1}",
+                 NORDIC_UART_PRIO_ACK, 0);
+    xSemaphoreGive(s_codec_mutex);
+}
+
+static bool file_fits(uint32_t bytes)
+{
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info(FILE_PARTITION, &total, &used) != ESP_OK) {
+        return true; // let the writes fail
+    }
+    return used <= total && bytes <= total - used;
+}
+
+// {"cmd":"file_open"}: chunks come as BLE_FRAME_FILE frames, so the
+// connection has to be framed first
+static void file_open(const ble_msg_t* msg)
+{
+    const uint32_t need = BLE_MSG_NAME | BLE_MSG_SIZE | BLE_MSG_CRC;
+    uint8_t buf[BLE_FRAME_OVERHEAD + 128];
+    const char* err = NULL;
+    uint32_t offset = 0;
+    ble_jw_t w;
 
-    // Existing handlers (datetime, notification, status)
-    cJSON* datetime = cJSON_GetObjectItem(root, "datetime");
-    if (cJSON_IsString(datetime)) {
-        int year, month, day, hour, minute, second;
-        if (sscanf(datetime->valuestring, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) == 6) {
-            struct tm t = {
-                .tm_year = year,
-                .tm_mon = month,
-                .tm_mday = day,
-                .tm_hour = hour,
-                .tm_min = minute,
-                .tm_sec = second };
-            rtc_set_time(&t);
-            ESP_LOGI(TAG, "RTC updated");
+    if (!s_framed) {
+        err = "framing";
+    } else if ((msg->fields & need) != need || msg->size <= 0 || msg->size > UINT32_MAX || msg->crc < 0 || msg->crc > UINT32_MAX) {
+        err = "args";
+    } else {
+        int rc = ble_file_open(msg->name, (uint32_t)msg->size, (uint32_t)msg->crc, FILE_ACK_EVERY, &offset);
+        if (rc == -EINVAL) {
+            err = "name";
+        } else if (rc != 0) {
+            err = "io";
+        } else if (!file_fits((uint32_t)msg->size - offset)) {
+            ble_file_abort();
+            err = "space";
         }
     }
+    if (err) {
+        ESP_LOGW(TAG, "File '%s' refused: %s", msg->name, err);
+    } else {
+        ESP_LOGI(TAG, "File '%s': %u bytes from %u", msg->name, (unsigned)msg->size, (unsigned)offset);
+    }
+
+    reply_init(&w, buf, sizeof(buf));
+    ble_jw_begin_object(&w, NULL);
+    ble_jw_begin_object(&w, "file");
+    ble_jw_str(&w, "name", strlen(msg->name) <= BLE_FILE_NAME_MAX ? msg->name : "");
+    if (err) {
+        ble_jw_str(&w, "err", err);
+    } else {
+        ble_jw_int(&w, "offset", offset);
+        ble_jw_int(&w, "chunk", FILE_CHUNK);
+        ble_jw_int(&w, "window", FILE_WINDOW);
+    }
+    ble_jw_end_object(&w);
+    ble_jw_end_object(&w);
+    reply_send(&w, buf, NORDIC_UART_PRIO_ACK);
+}
+
+static void file_chunk(const uint8_t* payload, size_t len)
+{
+    uint8_t buf[BLE_FRAME_OVERHEAD + 32];
+    uint32_t offset;
+    ble_jw_t w;
+
+    ble_file_status_t st = ble_file_chunk(payload, len, &offset);
+    if (st == BLE_FILE_PENDING || st == BLE_FILE_IDLE) {
+        return;
+    }
+    reply_init(&w, buf, sizeof(buf));
+    ble_jw_begin_object(&w, NULL);
+    switch (st) {
+    case BLE_FILE_ACK:
+        ble_jw_int(&w, "file_ack", offset);
+        break;
+    case BLE_FILE_NAK:
+        ESP_LOGW(TAG, "File chunk missing or damaged, back to %u", (unsigned)offset);
+        ble_jw_int(&w, "file_nak", offset);
+        break;
+    case BLE_FILE_DONE:
+        ESP_LOGI(TAG, "File complete: %u bytes", (unsigned)offset);
+        ble_jw_int(&w, "file_done", offset);
+        break;
+    default:
+        ESP_LOGW(TAG, "File transfer failed at %u: %s", (unsigned)offset, ble_file_error());
+        ble_jw_str(&w, "file_err", ble_file_error());
+        break;
+    }
+    ble_jw_end_object(&w);
+    reply_send(&w, buf, NORDIC_UART_PRIO_ACK);
+}
+
+// Strings in msg point into the received item
+static void handle_msg(const ble_msg_t* m)
+{
+    const ble_msg_t msg = *m;
+
+    if (msg.fields & BLE_MSG_DATETIME) {
+        struct tm t = {
+            .tm_year = msg.datetime.year,
+            .tm_mon = msg.datetime.month,
+            .tm_mday = msg.datetime.day,
+            .tm_hour = msg.datetime.hour,
+            .tm_min = msg.datetime.minute,
+            .tm_sec = msg.datetime.second };
+        rtc_set_time(&t);
+        ESP_LOGI(TAG, "RTC updated");
+        ble_gatt_std_time_adjusted(&msg.datetime);
+    }
 
-    cJSON* notification = cJSON_GetObjectItem(root, "notification");
-    if (cJSON_IsString(notification)) {
+    if (msg.fields & BLE_MSG_NOTIFICATION) {
         ESP_LOGI(TAG, "Notification");
-        cJSON* app = cJSON_GetObjectItem(root, "app");
-        cJSON* title = cJSON_GetObjectItem(root, "title");
-        cJSON* message = cJSON_GetObjectItem(root, "message");
-        const char* app_s = cJSON_IsString(app) ? app->valuestring : "";
-        const char* title_s = cJSON_IsString(title) ? title->valuestring : "";
-        const char* msg_s = cJSON_IsString(message) ? message->valuestring : "";
-        handle_notification_fields(notification->valuestring, app_s, title_s, msg_s);
+        handle_notification_fields(msg.notification, msg.app, msg.title, msg.message);
     }
 
-    cJSON* status = cJSON_GetObjectItem(root, "status");
-    if (cJSON_IsString(status)) {
+    if (msg.fields & BLE_MSG_STATUS) {
         ESP_LOGI(TAG, "Status");
-        ble_sync_send_status(bsp_power_get_battery_percent(), bsp_power_is_charging());
+        // The phone has lost track: answer with a keyframe
+        status_request(true);
     }
 
-    cJSON_Delete(root);
-    free(tmp);
+    switch (msg.cmd) {
+    case BLE_CMD_HEAP:
+        ESP_LOGI(TAG, "Heap stats");
+        // Optional "sample": N records every Nth allocation size (0 stops sampling)
+        if ((msg.fields & BLE_MSG_SAMPLE) && msg.sample >= 0) {
+            lw_set_sample_rate((uint32_t)msg.sample);
+        }
+        ble_sync_send_heap_stats();
+        break;
+    case BLE_CMD_TRACE: {
+        bool to_spiffs = (msg.fields & BLE_MSG_TO) && strcmp(msg.to, "spiffs") == 0;
+        ESP_LOGI(TAG, "Heap trace (%s)", to_spiffs ? "spiffs" : "ble");
+        ble_sync_send_heap_trace(to_spiffs);
+        break;
+    }
+    case BLE_CMD_SYNC:
+        // Without "since" the phone has nothing yet: all that is held
+        ble_sync_send_history((msg.fields & BLE_MSG_SINCE) && msg.since > 0 ? (uint32_t)msg.since : 0);
+        break;
+    case BLE_CMD_BENCH_TX: {
+        size_t n = BENCH_TX_DEFAULT;
+        if ((msg.fields & BLE_MSG_BYTES) && msg.bytes > 0) {
+            n = msg.bytes < BENCH_TX_MAX ? (size_t)msg.bytes : BENCH_TX_MAX;
+        }
+        const char* via = (msg.fields & BLE_MSG_TO) ? msg.to : NULL;
+        ESP_LOGI(TAG, "TX benchmark: %u bytes via %s", (unsigned)n, via ? via : "auto");
+        ble_sync_bench_tx(n, via);
+        break;
+    }
+    case BLE_CMD_FRAMING:
+        set_framing(&msg);
+        break;
+    case BLE_CMD_RADIO:
+        ESP_LOGI(TAG, "Radio stats");
+        ble_sync_send_radio_stats();
+        break;
+    case BLE_CMD_FILE_OPEN:
+        file_open(&msg);
+        break;
+    case BLE_CMD_FILE_ABORT:
+        ESP_LOGI(TAG, "File transfer aborted");
+        ble_file_abort();
+        break;
+    case BLE_CMD_NOTIF_PRIO: {
+        // {"cmd":"notif_prio","app":"...","prio":"high"|"normal"|"low"}
+        ble_notif_prio_t prio = strcmp(msg.prio, "high") == 0  ? BLE_NOTIF_HIGH
+                                : strcmp(msg.prio, "low") == 0 ? BLE_NOTIF_LOW
+                                                               : BLE_NOTIF_NORMAL;
+        if (msg.app[0] == '\0' || !(msg.fields & BLE_MSG_PRIO)) {
+            ESP_LOGW(TAG, "notif_prio needs app and prio");
+            break;
+        }
+        xSemaphoreTake(s_notif_mutex, portMAX_DELAY);
+        bool ok = ble_notif_set_prio(msg.app, prio);
+        xSemaphoreGive(s_notif_mutex);
+        ESP_LOGI(TAG, "Notification priority of '%s': %s%s", msg.app, msg.prio, ok ? "" : " (table full)");
+        break;
+    }
+    case BLE_CMD_STATUS_ACK:
+        if (msg.fields & BLE_MSG_SEQ) {
+            taskENTER_CRITICAL(&s_status_lock);
+            bool ok = ble_status_ack(&s_status, (uint16_t)msg.seq);
+            taskEXIT_CRITICAL(&s_status_lock);
+            ESP_LOGD(TAG, "Status ack %d%s", (int)msg.seq, ok ? "" : " (stale)");
+        }
+        break;
+    case BLE_CMD_UNKNOWN:
+        ESP_LOGW(TAG, "Unknown cmd '%s'", msg.cmd_name);
+        break;
+    case BLE_CMD_NONE:
+        break;
+    }
 }
 
-void uartTask(void* parameter) {
-    static char mbuf[CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1];
+static void process_one_json_object(char* json, size_t len)
+{
+    // Decoded in place: the strings in msg point into json
+    ble_msg_t msg;
+    if (ble_proto_decode(json, len, &msg) != 0) {
+        ESP_LOGW(TAG, "Malformed line dropped");
+        return;
+    }
+    handle_msg(&msg);
+}
 
-    for (;;) {
-        size_t item_size;
-        if (nordic_uart_rx_buf_handle) {
-            const char* item = (char*)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, portMAX_DELAY);
+static void process_frame(uint8_t* data, size_t len)
+{
+    ble_frame_t f;
+    ble_msg_t msg;
 
-            if (item) {
-                memcpy(mbuf, item, item_size);
-                mbuf[item_size] = '\0';
-                vRingbufferReturnItem(nordic_uart_rx_buf_handle, (void*)item);
+    if (ble_frame_open(data, len, &f) != 0) {
+        ESP_LOGW(TAG, "Bad frame dropped (%u bytes)", (unsigned)len);
+        return;
+    }
+    if (f.seq != s_rx_seq) {
+        ESP_LOGW(TAG, "Frame seq %u, expected %u: %u lost", f.seq, s_rx_seq, (uint8_t)(f.seq - s_rx_seq));
+    }
+    s_rx_seq = f.seq + 1;
+
+    // Compressed frames from the phone are decoded on their own
+    uint8_t* plain = NULL;
+    if (f.type & BLE_FRAME_F_LZ) {
+        size_t n = f.len >= BLE_FRAME_LZ_HDR ? (f.payload[0] | (f.payload[1] << 8)) : 0;
+        if (!(f.type & BLE_FRAME_F_STREAM) && n > 0 && n <= CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH) {
+            plain = (uint8_t*)malloc(n);
+        }
+        if (!plain || ble_lz_decompress(f.payload + BLE_FRAME_LZ_HDR, f.len - BLE_FRAME_LZ_HDR, plain, n, 0) != (int)n) {
+            ESP_LOGW(TAG, "Compressed frame dropped (%u bytes)", (unsigned)f.len);
+            free(plain);
+            return;
+        }
+        f.payload = plain;
+        f.len = n;
+    }
 
-                ESP_LOGI(TAG, "Received chunk: %u bytes", (unsigned)item_size);
-                ESP_LOGI(TAG, "Received buffer: %s", mbuf);
+    int rc = 0;
+    switch (f.type & BLE_FRAME_TYPE_MASK) {
+    case BLE_FRAME_JSON:
+        rc = ble_proto_decode((char*)f.payload, f.len, &msg);
+        break;
+    case BLE_FRAME_CBOR:
+        rc = ble_proto_decode_cbor(f.payload, f.len, &msg);
+        break;
+    case BLE_FRAME_FILE:
+        file_chunk(f.payload, f.len);
+        break;
+    default:
+        ESP_LOGW(TAG, "Frame type %u ignored", f.type);
+        break;
+    }
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Malformed frame payload dropped");
+    } else if ((f.type & BLE_FRAME_TYPE_MASK) == BLE_FRAME_JSON || (f.type & BLE_FRAME_TYPE_MASK) == BLE_FRAME_CBOR) {
+        handle_msg(&msg);
+    }
+    free(plain);
+}
 
-                process_one_json_object(mbuf, item_size);
+void uartTask(void* parameter) {
+    for (;;) {
+        size_t item_size;
+        if (_nordic_uart_linebuf_initialized()) {
+            char* item = (char*)nordic_uart_rx_receive(&item_size, portMAX_DELAY);
 
+            if (item) {
+                // Items are whole NUL-terminated lines or frames, long ones
+                // included; decode the view in place (it is ours until
+                // returned) and hand it back afterwards.
+                if (item_size > 0 && (uint8_t)item[0] == BLE_FRAME_SYNC) {
+                    ESP_LOGD(TAG, "Received frame: %u bytes", (unsigned)item_size);
+                    process_frame((uint8_t*)item, item_size);
+                } else if (item_size > 0 && item[0] != '\003') {
+                    size_t len = item_size - 1;
+                    // A line can be up to MAX_MESSAGE_LENGTH: log only its start
+                    ESP_LOGD(TAG, "Received line: %u bytes: %.*s", (unsigned)len, LOG_LINE_PREFIX, item);
+                    process_one_json_object(item, len);
+                }
+                nordic_uart_rx_return((uint8_t*)item);
             }
         }
         else {
@@ -193,8 +834,13 @@ static void nordic_uart_callback(enum nordic_uart_callback_type callback_type) {
         ESP_LOGI(TAG, "Nordic UART connected");
         s_ble_connected = true;
         (void)esp_event_post(BLE_SYNC_EVENT_BASE, BLE_SYNC_EVT_CONNECTED, NULL, 0, 0);
-        // Optionally send immediate status upon connect
-        ble_sync_send_status(bsp_power_get_battery_percent(), bsp_power_is_charging());
+        ble_gatt_std_connected();
+        // A new connection starts from a keyframe
+        taskENTER_CRITICAL(&s_status_lock);
+        ble_status_reset(&s_status);
+        taskEXIT_CRITICAL(&s_status_lock);
+        s_status_ticks = 0;
+        status_request(true);
 
         // Minimize time/date requests: if RTC is earlier than 2025-02-02, request sync once on connect
         {
@@ -231,6 +877,9 @@ static void nordic_uart_callback(enum nordic_uart_callback_type callback_type) {
         ESP_LOGI(TAG, "Nordic UART disconnected");
         s_ble_connected = false;
         s_time_sync_requested = false;
+        s_framed = false;
+        s_lz = false;
+        ble_gatt_std_disconnected();
         if (s_time_sync_timer) {
             xTimerStop(s_time_sync_timer, 0);
         }
@@ -251,16 +900,88 @@ static void power_ble_evt(void* handler_arg, esp_event_base_t base, int32_t id,
     }
 }
 
+static void hist_timer_cb(TimerHandle_t xTimer)
+{
+    (void)xTimer;
+    uint32_t steps = sensors_get_step_count();
+    // The count may start over (reboot, midnight): then all of it is new
+    uint32_t delta = steps >= s_hist_steps ? steps - s_hist_steps : steps;
+    int battery = bsp_power_get_battery_percent();
+    ble_hist_rec_t rec = {
+        .minute = rtc_get_year() > 0 ? ble_hist_minutes(rtc_get_year(), rtc_get_month(), rtc_get_day(), rtc_get_hour(), rtc_get_minute()) : 0,
+        .steps = delta > UINT16_MAX ? UINT16_MAX : (uint16_t)delta,
+        .activity = (uint8_t)sensors_get_activity(),
+        .battery = battery >= 0 && battery <= 100 ? (uint8_t)battery : BLE_HIST_BATTERY_UNKNOWN,
+    };
+    s_hist_steps = steps;
+
+    taskENTER_CRITICAL(&s_hist_lock);
+    uint32_t cursor = ble_hist_append(&rec);
+    taskEXIT_CRITICAL(&s_hist_lock);
+    // NVS commits can wait for a flash erase: leave them to notif_task, and
+    // renew half a lease early so the write lands before the old one runs out
+    if (cursor + 1 + HIST_LEASE / 2 >= s_hist_lease) {
+        s_hist_lease = cursor + 1 + HIST_LEASE;
+        __atomic_store_n(&s_hist_lease_save, s_hist_lease, __ATOMIC_RELAXED);
+        xTaskNotifyGive(s_notif_task);
+    }
+}
+
+static void hist_init(void)
+{
+    // Cold data: written once a minute, read on a sync
+    lw_tag_t prev_tag = lw_set_task_tag(LW_TAG_COLD);
+    ble_hist_rec_t* buf = (ble_hist_rec_t*)malloc(HIST_RECORDS * sizeof(*buf));
+    lw_set_task_tag(prev_tag);
+    if (!buf) {
+        ESP_LOGW(TAG, "No memory for the history; cursors still count");
+    }
+
+    // Start past everything the last boot reserved
+    uint32_t first = hist_lease(0);
+    s_hist_lease = first + HIST_LEASE;
+    hist_lease(s_hist_lease);
+    ble_hist_init(buf, buf ? HIST_RECORDS : 0, first);
+    s_hist_steps = sensors_get_step_count();
+    ESP_LOGI(TAG, "History from cursor %u", (unsigned)first);
+
+    s_hist_timer = xTimerCreate("ble_hist_1m", pdMS_TO_TICKS(60 * 1000), pdTRUE, NULL, hist_timer_cb);
+    if (s_hist_timer) {
+        xTimerStart(s_hist_timer, 0);
+    }
+}
+
 esp_err_t ble_sync_init(void)
 {
+    if (!s_codec_mutex) {
+        s_codec_mutex = xSemaphoreCreateMutex();
+        if (!s_codec_mutex) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
     esp_err_t err = ble_sync_set_enabled(true);
     if (err != ESP_OK) {
         return err;
     }
 
+    ble_file_init(FILE_DIR);
+    if (!s_notif_task) {
+        ble_notif_init(CONFIG_BLE_SYNC_NOTIF_WINDOW_MS, CONFIG_BLE_SYNC_NOTIF_DEDUP_MS);
+        s_notif_mutex = xSemaphoreCreateMutex();
+        if (!s_notif_mutex || xTaskCreate(notif_task, "ble_notif", 4000, NULL, 3, &s_notif_task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start the notification task");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (!s_hist_timer) {
+        hist_init();
+    }
     xTaskCreate(uartTask, "uartTask", 4000, NULL, 3, NULL);
 
     // Periodic status every 5 minutes when connected
+    if (!s_status_flush_timer) {
+        s_status_flush_timer = xTimerCreate("ble_status_tx", pdMS_TO_TICKS(STATUS_COALESCE_MS), pdFALSE, NULL, status_flush_cb);
+    }
     if (!s_status_timer) {
         s_status_timer = xTimerCreate("ble_status_5m", pdMS_TO_TICKS(5 * 60 * 1000), pdTRUE, NULL, status_timer_cb);
         if (s_status_timer && s_ble_enabled) {
@@ -280,17 +1001,66 @@ esp_err_t ble_sync_send_status(int battery_percent, bool charging)
         return ESP_ERR_INVALID_STATE;
     }
 
+    taskENTER_CRITICAL(&s_status_lock);
+    s_status_battery = battery_percent;
+    s_status_charging = charging;
+    taskEXIT_CRITICAL(&s_status_lock);
+    // The first request opens the window; the ones in it only update the values
+    if (!s_status_flush_timer) {
+        return status_flush();
+    }
+    if (xTimerIsTimerActive(s_status_flush_timer) == pdFALSE && xTimerStart(s_status_flush_timer, 0) != pdPASS) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ble_sync_send_heap_stats(void)
+{
+    if (!s_ble_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Snapshot first so building the reply does not show up in the numbers
+    lw_heap_stats_t st;
+    lw_coalesce_stats_t cs;
+    lw_heap_stats(&st);
+    lw_get_coalesce_stats(&cs);
+
     cJSON* root = cJSON_CreateObject();
     if (!root) {
         return ESP_FAIL;
     }
+    cJSON* heap = cJSON_AddObjectToObject(root, "heap");
+    cJSON_AddNumberToObject(heap, "size", st.heap_bytes);
+    cJSON_AddNumberToObject(heap, "used", st.used_bytes);
+    cJSON_AddNumberToObject(heap, "free", st.free_bytes);
+    cJSON_AddNumberToObject(heap, "largest", st.largest_free);
+    cJSON_AddNumberToObject(heap, "peak", st.peak_used_bytes);
+    cJSON_AddNumberToObject(heap, "frag", st.frag_permille);
+    cJSON_AddNumberToObject(heap, "arenas", st.arenas);
+    cJSON_AddNumberToObject(heap, "arena_bytes", st.arena_bytes);
+    cJSON_AddNumberToObject(heap, "psram_used", st.tiers[1].used_bytes);
+    cJSON_AddNumberToObject(heap, "psram_free", st.tiers[1].free_bytes);
+    cJSON_AddNumberToObject(heap, "regions", st.tiers[0].regions + st.tiers[1].regions);
+    cJSON_AddNumberToObject(heap, "trimmed", st.trimmed_bytes);
+    cJSON_AddNumberToObject(heap, "pause_max_us", cs.max_pause_ns / 1000);
+    cJSON_AddNumberToObject(heap, "pause_avg_us", cs.calls ? (double)cs.total_pause_ns / cs.calls / 1000 : 0);
 
-    cJSON_AddNumberToObject(root, "battery", battery_percent);
-    cJSON_AddBoolToObject(root, "charging", charging);
-    // Include VBUS presence for richer client status
-    bool vbus = (bsp_power_get_vbus_voltage_mv() > 0);
-    cJSON_AddBoolToObject(root, "vbus", vbus);
-    cJSON_AddNumberToObject(root, "steps", sensors_get_step_count());
+    // [block size, used, cached, chunks] per small class that has been touched
+    cJSON* classes = cJSON_AddArrayToObject(heap, "classes");
+    for (int i = 0; i < LW_HEAP_STATS_CLASSES; i++) {
+        const lw_class_stats_t* c = &st.classes[i];
+        if (c->chunks == 0) {
+            continue;
+        }
+        const int row[4] = { c->block_size, (int)c->used, (int)c->cached, c->chunks };
+        cJSON_AddItemToArray(classes, cJSON_CreateIntArray(row, 4));
+    }
+    if (st.sample_rate) {
+        cJSON_AddNumberToObject(heap, "sample", st.sample_rate);
+        cJSON_AddItemToObject(heap, "hist", cJSON_CreateIntArray((const int*)st.size_hist, LW_HEAP_HIST_BUCKETS));
+    }
 
     char* json_str = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
@@ -298,11 +1068,243 @@ esp_err_t ble_sync_send_status(int battery_percent, bool charging)
         return ESP_FAIL;
     }
 
-    esp_err_t err = nordic_uart_sendln(json_str);
+    esp_err_t err = send_json(json_str, NORDIC_UART_PRIO_ACK, 0);
     free(json_str);
     return err;
 }
 
+#define HEAP_TRACE_PATH "/spiffs/lwtrace.bin"
+#define HEAP_TRACE_CHUNK 288 // raw bytes per line; 384 base64 characters
+
+esp_err_t ble_sync_send_heap_trace(bool to_spiffs)
+{
+    char line[64];
+
+    if (!s_ble_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (to_spiffs) {
+        int n = lw_trace_dump(HEAP_TRACE_PATH);
+        snprintf(line, sizeof(line), "{\"trace\":{\"file\":\"%s\",\"count\":%d}}", HEAP_TRACE_PATH, n);
+        return send_json(line, NORDIC_UART_PRIO_ACK, 0);
+    }
+
+    // Lines: {"trace_begin":bytes}, {"tr":"<base64>"}..., {"trace_end":bytes}.
+    // Decoding and concatenating the "tr" payloads gives the same file as the SPIFFS dump.
+    // With compression on, the lines are one LZ4 stream.
+    static uint8_t raw[HEAP_TRACE_CHUNK];
+    static char out[sizeof("{\"tr\":\"\"}") + (HEAP_TRACE_CHUNK / 3) * 4 + 1];
+    size_t offset = 0;
+    size_t n;
+    esp_err_t err = ESP_OK;
+    bulk_stream_t stream;
+
+    lw_trace_enable(false);
+    stream_begin(&stream);
+    lw_trace_file_hdr_t hdr;
+    size_t total = lw_trace_export(0, &hdr, sizeof(hdr)) == sizeof(hdr) ? sizeof(hdr) + hdr.count * hdr.rec_size : 0;
+    snprintf(line, sizeof(line), "{\"trace_begin\":%u}", (unsigned)total);
+    err = stream_send_json(&stream, line);
+
+    while (err == ESP_OK && (n = lw_trace_export(offset, raw, sizeof(raw))) > 0) {
+        size_t olen = 0;
+        memcpy(out, "{\"tr\":\"", 7);
+        if (mbedtls_base64_encode((unsigned char*)out + 7, sizeof(out) - 10, &olen, raw, n) != 0) {
+            err = ESP_FAIL;
+            break;
+        }
+        memcpy(out + 7 + olen, "\"}", 3);
+        err = stream_send_json(&stream, out);
+        offset += n;
+    }
+    lw_trace_enable(true);
+
+    if (err == ESP_OK) {
+        snprintf(line, sizeof(line), "{\"trace_end\":%u}", (unsigned)offset);
+        err = stream_send_json(&stream, line);
+    }
+    stream_end(&stream);
+    return err;
+}
+
+esp_err_t ble_sync_send_history(uint32_t since)
+{
+    if (!s_ble_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Lines: {"hist":{"c":cursor,"r":[[minute,steps,activity,battery],...]}}
+    // with the cursor of the first record, then
+    // {"sync":{"since","from","cursor","count"}}: "from" past "since" means
+    // records were lost in between, "cursor" is the one to send next time.
+    static ble_hist_rec_t recs[HIST_BATCH];
+    static char line[HIST_LINE];
+    uint32_t asked = since;
+    uint32_t from = 0;
+    uint32_t cursor;
+    size_t count = 0;
+    esp_err_t err = ESP_OK;
+    bulk_stream_t stream;
+
+    stream_begin(&stream);
+    for (;;) {
+        uint32_t first;
+        taskENTER_CRITICAL(&s_hist_lock);
+        size_t n = ble_hist_read(since, recs, HIST_BATCH, &first);
+        cursor = ble_hist_next();
+        taskEXIT_CRITICAL(&s_hist_lock);
+        if (count == 0) {
+            from = first;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        ble_jw_t w;
+        ble_jw_init(&w, line, sizeof(line));
+        ble_jw_begin_object(&w, NULL);
+        ble_jw_begin_object(&w, "hist");
+        ble_jw_int(&w, "c", first);
+        ble_jw_begin_array(&w, "r");
+        for (size_t i = 0; i < n; i++) {
+            ble_jw_begin_array(&w, NULL);
+            ble_jw_int(&w, NULL, recs[i].minute);
+            ble_jw_int(&w, NULL, recs[i].steps);
+            ble_jw_int(&w, NULL, recs[i].activity);
+            ble_jw_int(&w, NULL, recs[i].battery == BLE_HIST_BATTERY_UNKNOWN ? -1 : recs[i].battery);
+            ble_jw_end_array(&w);
+        }
+        ble_jw_end_array(&w);
+        ble_jw_end_object(&w);
+        ble_jw_end_object(&w);
+        if (ble_jw_finish(&w) == 0) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        err = stream_send_json(&stream, line);
+        if (err != ESP_OK) {
+            break;
+        }
+        count += n;
+        since = first + n;
+    }
+
+    if (err == ESP_OK) {
+        snprintf(line, sizeof(line), "{\"sync\":{\"since\":%u,\"from\":%u,\"cursor\":%u,\"count\":%u}}",
+                 (unsigned)asked, (unsigned)from, (unsigned)cursor, (unsigned)count);
+        err = stream_send_json(&stream, line);
+    }
+    stream_end(&stream);
+    ESP_LOGI(TAG, "History sync from %u: %u records, cursor %u (%s)", (unsigned)from, (unsigned)count,
+             (unsigned)cursor, esp_err_to_name(err));
+    return err;
+}
+
+static esp_err_t bench_tx_via(size_t bytes, nordic_uart_transport_t via)
+{
+    // Filler lines of 511 letters and '\n': whole queue entries, so a status
+    // update queued meanwhile lands between lines instead of inside one.
+    static uint8_t fill[512];
+    for (size_t i = 0; i < sizeof(fill) - 1; i++) {
+        fill[i] = 'A' + i % 26;
+    }
+    fill[sizeof(fill) - 1] = '\n';
+    static uint8_t frame[sizeof(fill)];
+    memcpy(frame + BLE_FRAME_HDR, fill, sizeof(fill) - BLE_FRAME_OVERHEAD);
+
+    char line[160];
+    snprintf(line, sizeof(line), "{\"bench_begin\":%u}", (unsigned)bytes);
+    esp_err_t err = send_json(line, NORDIC_UART_PRIO_BULK, BULK_TX_WAIT);
+    if (err == ESP_OK) {
+        err = nordic_uart_tx_wait_idle(BULK_TX_WAIT);
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    size_t sent = 0;
+    while (err == ESP_OK && sent < bytes) {
+        size_t n = bytes - sent < sizeof(fill) ? bytes - sent : sizeof(fill);
+        if (s_framed) {
+            // Raw frames of the same size on the wire; only the last one is
+            // shorter, so the CRC never lands on payload still to be sent
+            size_t plen = n > BLE_FRAME_OVERHEAD ? n - BLE_FRAME_OVERHEAD : 1;
+            err = send_sealed_via(frame, BLE_FRAME_RAW, plen, NORDIC_UART_PRIO_BULK, via, BULK_TX_WAIT);
+            n = plen + BLE_FRAME_OVERHEAD;
+        } else {
+            err = nordic_uart_enqueue_via(fill + sizeof(fill) - n, n, NORDIC_UART_PRIO_BULK, via, BULK_TX_WAIT);
+        }
+        if (err == ESP_OK) {
+            sent += n;
+        }
+    }
+    // Stop the clock once the last notification went to the controller
+    if (err == ESP_OK) {
+        err = nordic_uart_tx_wait_idle(BULK_TX_WAIT);
+    }
+    int64_t dt = esp_timer_get_time() - t0;
+
+    // The phone's receive rate is the reference; this one also shows local stalls
+    nordic_uart_link_t link;
+    nordic_uart_get_link(&link);
+    snprintf(line, sizeof(line),
+             "{\"bench_tx\":{\"via\":\"%s\",\"bytes\":%u,\"us\":%lld,\"bps\":%u,\"mtu\":%u,\"dle\":%u,\"phy\":%u,"
+             "\"chunk\":%u,\"coc_mtu\":%u}}",
+             via == NORDIC_UART_TRANSPORT_COC ? "coc" : "gatt", (unsigned)sent, (long long)dt,
+             dt > 0 ? (unsigned)(sent * 1000000ULL / dt) : 0, link.mtu, link.tx_octets, link.phy, link.chunk, link.coc_mtu);
+    esp_err_t end_err = send_json(line, NORDIC_UART_PRIO_ACK, BULK_TX_WAIT);
+    return err != ESP_OK ? err : end_err;
+}
+
+esp_err_t ble_sync_bench_tx(size_t bytes, const char* via)
+{
+    if (!s_ble_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (bytes > BENCH_TX_MAX) {
+        bytes = BENCH_TX_MAX;
+    }
+
+    bool coc = nordic_uart_coc_connected();
+    if (via && strcmp(via, "both") == 0) {
+        // Same payload over each transport, one result line per run
+        esp_err_t err = bench_tx_via(bytes, NORDIC_UART_TRANSPORT_GATT);
+        if (err == ESP_OK && coc) {
+            err = bench_tx_via(bytes, NORDIC_UART_TRANSPORT_COC);
+        }
+        return err;
+    }
+    if (via && strcmp(via, "gatt") == 0) {
+        return bench_tx_via(bytes, NORDIC_UART_TRANSPORT_GATT);
+    }
+    if (via && strcmp(via, "coc") == 0 && !coc) {
+        send_json("{\"bench_tx\":{\"error\":\"no l2cap channel\"}}", NORDIC_UART_PRIO_ACK, 0);
+        return ESP_ERR_INVALID_STATE;
+    }
+    return bench_tx_via(bytes, coc ? NORDIC_UART_TRANSPORT_COC : NORDIC_UART_TRANSPORT_GATT);
+}
+
+esp_err_t ble_sync_send_radio_stats(void)
+{
+    if (!s_ble_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    nordic_uart_radio_stats_t st;
+    nordic_uart_get_radio_stats(&st);
+    unsigned duty = st.uptime_ms ? (unsigned)(st.radio_on_us / st.uptime_ms) : 0; // us per ms = per mille
+
+    char line[320];
+    snprintf(line, sizeof(line),
+             "{\"radio\":{\"up_ms\":%u,\"adv_ms\":%u,\"conn_ms\":%u,\"on_ms\":%u,\"duty\":%u,"
+             "\"adv_ev\":%u,\"conn_ev\":%u,\"tx\":[%u,%u],\"rx\":[%u,%u],"
+             "\"adv_itvl_ms\":%u,\"itvl_us\":%u,\"latency\":%u,\"level\":%d}}",
+             (unsigned)st.uptime_ms, (unsigned)st.adv_ms, (unsigned)st.conn_ms, (unsigned)(st.radio_on_us / 1000), duty,
+             (unsigned)st.adv_events, (unsigned)st.conn_events, (unsigned)st.tx_pkts, (unsigned)st.tx_bytes,
+             (unsigned)st.rx_pkts, (unsigned)st.rx_bytes, st.adv_itvl_ms, (unsigned)st.conn_itvl_us, st.conn_latency,
+             st.level == NORDIC_UART_RADIO_LEVEL_COUNT ? -1 : (int)st.level);
+    return send_json(line, NORDIC_UART_PRIO_ACK, 0);
+}
+
 esp_err_t ble_sync_set_enabled(bool enabled)
 {
     if (enabled == s_ble_enabled) {
@@ -312,7 +1314,11 @@ esp_err_t ble_sync_set_enabled(bool enabled)
     if (enabled) {
         s_ble_connected = false;
         if (!s_ble_stack_started) {
-            esp_err_t err = nordic_uart_start("ESP32 S3 Watch", nordic_uart_callback);
+            esp_err_t err = ble_gatt_std_init();
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "Standard GATT services unavailable: %s", esp_err_to_name(err));
+            }
+            err = nordic_uart_start("ESP32 S3 Watch", nordic_uart_callback);
             if (err == ESP_FAIL && _nordic_uart_linebuf_initialized()) {
                 ESP_LOGW(TAG, "Start failed: buffers still allocated, resetting");
                 _nordic_uart_buf_deinit();
@@ -0,0 +1,328 @@
+/*
+ * Host benchmark: file transfer throughput against a loopback stand-in for
+ * the BLE link.
+ *
+ * Build and run on Linux:
+ *   gcc -O2 -Icomponents/ble_sync/include components/ble_sync/ble_proto.c \
+ *       components/ble_sync/ble_file.c components/ble_sync/host/ble_file_bench.c \
+ *       -o ble_file_bench
+ *   ./ble_file_bench [size_kb] [link_bytes_per_s] [latency_ms] [flash_bytes_per_s]
+ *
+ * The sender is the phone side of the protocol in ble_file.h (go-back-N
+ * with a window of chunks and a resend timeout); the receiver is ble_file.c
+ * itself, writing into a temporary directory. The link between them runs
+ * on a simulated clock: frames are serialized at the link rate and arrive
+ * after the latency, answers come back after the same latency, and frames
+ * are lost at random at the given rate. The watch side takes the time
+ * ble_file_chunk() really took, or what the flash write rate allows if that
+ * is longer, and holds at most RX_RING_FRAMES unprocessed frames (the RX
+ * ring): more are dropped as the ring would drop them. Defaults: 256 KB,
+ * 80 KB/s (2M PHY, data length extension, 15 ms interval), 15 ms, 100 KB/s.
+ *
+ * After the table, one transfer is cut halfway and resumed from the part
+ * file, and the result is compared with the source.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ble_file.h"
+#include "ble_proto.h"
+
+// As ble_sync sizes them for a 512 byte line and a 4 KB RX ring
+#define CHUNK 496
+#define RX_RING_FRAMES 6
+#define FRAME_LEN (BLE_FRAME_OVERHEAD + BLE_FILE_CHUNK_HDR + CHUNK)
+#define REPLY_LEN 16
+#define RTO_US 1000000.0
+#define MAX_EVENTS 4096
+
+enum { EV_ARRIVE, EV_REPLY, EV_WAKE, EV_TIMEOUT };
+
+typedef struct {
+    double t;
+    int type;
+    uint32_t off; // chunk offset, or the answer's offset
+    int status;   // answer
+    unsigned gen; // timeout generation
+} event_t;
+
+static event_t heap[MAX_EVENTS];
+static int nheap;
+
+static void push(event_t e)
+{
+    if (nheap == MAX_EVENTS) {
+        fprintf(stderr, "event queue full\n");
+        exit(1);
+    }
+    int i = nheap++;
+    while (i > 0 && heap[(i - 1) / 2].t > e.t) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static event_t pop(void)
+{
+    event_t top = heap[0];
+    event_t last = heap[--nheap];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= nheap) {
+            break;
+        }
+        if (c + 1 < nheap && heap[c + 1].t < heap[c].t) {
+            c++;
+        }
+        if (heap[c].t >= last.t) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+typedef struct {
+    double rate;    // link bytes/s
+    double lat_us;  // one way
+    double flash;   // bytes/s
+    double loss;    // per frame
+    unsigned window;
+    unsigned ack_every;
+    uint32_t cut_at; // stop once this much is acknowledged (0: never)
+} params_t;
+
+typedef struct {
+    double t_end;
+    uint32_t acked;
+    uint64_t sent_bytes;
+    unsigned naks, timeouts, ring_drops;
+    int result; // BLE_FILE_DONE, _FAIL, or -1 when cut
+} result_t;
+
+static const uint8_t* src;
+static uint32_t src_size;
+static uint32_t src_crc;
+
+static result_t run(const params_t* p, uint32_t start)
+{
+    result_t r = { 0 };
+    double link_free = 0, rx_free = 0;
+    double ring[RX_RING_FRAMES] = { 0 }; // when each slot is returned
+    uint32_t base = start, next = start;
+    unsigned gen = 0;
+    static uint8_t frame[FRAME_LEN];
+
+    nheap = 0;
+    r.result = -1;
+    push((event_t){ .t = 0, .type = EV_WAKE });
+    push((event_t){ .t = RTO_US, .type = EV_TIMEOUT, .gen = gen });
+
+    while (nheap > 0) {
+        event_t e = pop();
+        double t = e.t;
+
+        switch (e.type) {
+        case EV_ARRIVE: {
+            // The frame needs a free slot in the RX ring
+            int slot = -1;
+            for (int i = 0; i < RX_RING_FRAMES; i++) {
+                if (ring[i] <= t) {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                r.ring_drops++;
+                break;
+            }
+            uint32_t n = src_size - e.off < CHUNK ? src_size - e.off : CHUNK;
+            uint8_t* pl = frame + BLE_FRAME_HDR;
+            uint32_t crc = ble_crc32(0, src + e.off, n);
+            for (int i = 0; i < 4; i++) {
+                pl[i] = e.off >> (8 * i);
+                pl[4 + i] = crc >> (8 * i);
+            }
+            memcpy(pl + BLE_FILE_CHUNK_HDR, src + e.off, n);
+
+            uint32_t off;
+            double t0 = now_us();
+            ble_file_status_t st = ble_file_chunk(pl, BLE_FILE_CHUNK_HDR + n, &off);
+            double cost = now_us() - t0;
+            double flash = n * 1e6 / p->flash;
+            double done = (t > rx_free ? t : rx_free) + (cost > flash ? cost : flash);
+            rx_free = done;
+            ring[slot] = done;
+            if (st != BLE_FILE_PENDING && st != BLE_FILE_IDLE) {
+                push((event_t){ .t = done + REPLY_LEN * 1e6 / p->rate + p->lat_us, .type = EV_REPLY, .off = off, .status = st });
+            }
+            break;
+        }
+        case EV_REPLY:
+            if (e.status == BLE_FILE_DONE || e.status == BLE_FILE_FAIL) {
+                r.result = e.status;
+                r.acked = e.off;
+                r.t_end = t;
+                return r;
+            }
+            if (e.status == BLE_FILE_NAK) {
+                r.naks++;
+                next = e.off;
+            }
+            if (e.off > base) {
+                base = e.off;
+                // progress: restart the resend timer
+                push((event_t){ .t = t + RTO_US, .type = EV_TIMEOUT, .gen = ++gen });
+            }
+            if (next < base) {
+                next = base;
+            }
+            if (p->cut_at && base >= p->cut_at) {
+                r.acked = base;
+                r.t_end = t;
+                return r;
+            }
+            push((event_t){ .t = t, .type = EV_WAKE });
+            break;
+        case EV_TIMEOUT:
+            if (e.gen != gen) {
+                break;
+            }
+            r.timeouts++;
+            next = base;
+            push((event_t){ .t = t + RTO_US, .type = EV_TIMEOUT, .gen = ++gen });
+            push((event_t){ .t = t, .type = EV_WAKE });
+            break;
+        case EV_WAKE:
+            if (link_free > t) {
+                break; // a wake-up is already set for then
+            }
+            if (next < src_size && next < base + p->window * CHUNK) {
+                uint32_t n = src_size - next < CHUNK ? src_size - next : CHUNK;
+                size_t len = BLE_FRAME_OVERHEAD + BLE_FILE_CHUNK_HDR + n;
+                link_free = t + len * 1e6 / p->rate;
+                r.sent_bytes += n;
+                if ((double)rand() / RAND_MAX >= p->loss) {
+                    push((event_t){ .t = link_free + p->lat_us, .type = EV_ARRIVE, .off = next });
+                }
+                next += n;
+                push((event_t){ .t = link_free, .type = EV_WAKE });
+            }
+            break;
+        }
+    }
+    return r;
+}
+
+static int check_result(const char* dir)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/bench.bin", dir);
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    uint8_t* buf = malloc(src_size + 1);
+    size_t n = fread(buf, 1, src_size + 1, f);
+    fclose(f);
+    int rc = n == src_size && memcmp(buf, src, n) == 0 ? 0 : -1;
+    free(buf);
+    return rc;
+}
+
+static void row(params_t* p, const char* dir)
+{
+    uint32_t off;
+    srand(1);
+    if (ble_file_open("bench.bin", src_size, src_crc, p->ack_every, &off) != 0) {
+        fprintf(stderr, "ble_file_open failed\n");
+        exit(1);
+    }
+    result_t r = run(p, off);
+    double kbps = src_size / (r.t_end / 1e6) / 1024;
+    double payload_max = p->rate * CHUNK / FRAME_LEN / 1024;
+    printf("%6u  %4u  %3.0f%%  %5.1f  %6.0f%%  %5.1f%%  %4u  %8u  %10u  %s\n", p->window, p->ack_every, p->loss * 100,
+           kbps, kbps * 100 / payload_max, (r.sent_bytes - src_size) * 100.0 / src_size, r.naks, r.timeouts,
+           r.ring_drops, r.result == BLE_FILE_DONE && check_result(dir) == 0 ? "ok" : "BAD");
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t kb = argc > 1 ? atoi(argv[1]) : 256;
+    params_t p = {
+        .rate = argc > 2 ? atof(argv[2]) : 80000,
+        .lat_us = (argc > 3 ? atof(argv[3]) : 15) * 1000,
+        .flash = argc > 4 ? atof(argv[4]) : 100000,
+    };
+    static const unsigned windows[] = { 1, 2, 4, 6, 8, 12 };
+    static const double losses[] = { 0, 0.01, 0.05 };
+    char dir[] = "/tmp/ble_file_bench.XXXXXX";
+    uint32_t off;
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    src_size = kb * 1024;
+    uint8_t* data = malloc(src_size);
+    for (uint32_t i = 0; i < src_size; i++) {
+        data[i] = (uint8_t)(rand() >> 7);
+    }
+    src = data;
+    src_crc = ble_crc32(0, src, src_size);
+    ble_file_init(dir);
+
+    printf("%u KB, link %.0f B/s, latency %.0f ms, flash %.0f B/s, chunk %u, ring %u frames\n",
+           (unsigned)kb, p.rate, p.lat_us / 1000, p.flash, CHUNK, RX_RING_FRAMES);
+    printf("window  acks  loss   KB/s  of link  resent  naks  timeouts  ring drops  file\n");
+    // An ack per chunk (what ble_sync asks for), window against loss
+    for (size_t li = 0; li < sizeof(losses) / sizeof(losses[0]); li++) {
+        for (size_t wi = 0; wi < sizeof(windows) / sizeof(windows[0]); wi++) {
+            p.window = windows[wi];
+            p.ack_every = 1;
+            p.loss = losses[li];
+            row(&p, dir);
+        }
+    }
+    // Fewer acks at the window the RX ring allows
+    for (unsigned a = 2; a <= RX_RING_FRAMES / 2; a++) {
+        p.window = RX_RING_FRAMES;
+        p.ack_every = a;
+        p.loss = 0;
+        row(&p, dir);
+    }
+
+    // Disconnect halfway, then open the same file again
+    p.window = RX_RING_FRAMES;
+    p.ack_every = 1;
+    p.loss = 0.01;
+    p.cut_at = src_size / 2;
+    srand(2);
+    ble_file_open("bench.bin", src_size, src_crc, p.ack_every, &off);
+    result_t r1 = run(&p, off);
+    p.cut_at = 0;
+    ble_file_open("bench.bin", src_size, src_crc, p.ack_every, &off);
+    uint32_t resumed = off;
+    result_t r2 = run(&p, off);
+    printf("resume: cut at %u, reopened at %u, %u more bytes sent, %s\n", (unsigned)r1.acked, (unsigned)resumed,
+           (unsigned)r2.sent_bytes, r2.result == BLE_FILE_DONE && check_result(dir) == 0 ? "ok" : "BAD");
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    return system(cmd) == 0 ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Send a file into the watch's SPIFFS over BLE.
+
+Usage:
+    pip install bleak
+    python3 components/ble_sync/host/ble_file_send.py spiffs/notification.wav
+    python3 components/ble_sync/host/ble_file_send.py face.bin --name face.bin \
+        --device "ESP32 S3 Watch"
+
+Speaks the protocol in components/ble_sync/include/ble_file.h over the
+Nordic UART service: switches the connection to binary frames, opens the
+transfer, then keeps up to the watch's window of chunks unacknowledged and
+goes back on a file_nak or when no answer comes within --timeout. Run it
+again after an interruption and the watch resumes where its part file ends.
+"""
+import argparse
+import asyncio
+import binascii
+import json
+import os
+import struct
+import sys
+import time
+import zlib
+
+from bleak import BleakClient, BleakScanner
+
+NUS_RX = "6e400002-b5a3-f393-e0a9-e50e24dcca9e"  # phone -> watch
+NUS_TX = "6e400003-b5a3-f393-e0a9-e50e24dcca9e"  # watch -> phone
+
+FRAME_SYNC = 0xA5
+FRAME_JSON = 1
+FRAME_CBOR = 2
+FRAME_FILE = 4
+
+
+def crc16(data):
+    # CRC-16/CCITT-FALSE
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def seal(ftype, seq, payload):
+    body = struct.pack("<BBH", ftype, seq & 0xFF, len(payload)) + payload
+    return bytes([FRAME_SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+def cbor_decode(buf, i=0):
+    """Decode the CBOR the watch writes (ble_jw): maps, arrays, text,
+    integers and booleans, definite or indefinite length."""
+    ib = buf[i]
+    major, info = ib >> 5, ib & 31
+    i += 1
+    if major == 7:
+        return {20: False, 21: True, 22: None}.get(info), i
+    if info < 24:
+        arg = info
+    elif info in (24, 25, 26, 27):
+        n = 1 << (info - 24)
+        arg = int.from_bytes(buf[i:i + n], "big")
+        i += n
+    elif info == 31:
+        arg = None
+    else:
+        raise ValueError("bad CBOR")
+    if major == 0:
+        return arg, i
+    if major == 1:
+        return -1 - arg, i
+    if major == 3:
+        return buf[i:i + arg].decode(), i + arg
+    if major in (4, 5):
+        out = [] if major == 4 else {}
+        k = 0
+        while (arg is None and buf[i] != 0xFF) or (arg is not None and k < arg):
+            v, i = cbor_decode(buf, i)
+            if major == 5:
+                out[v], i = cbor_decode(buf, i)
+            else:
+                out.append(v)
+            k += 1
+        return out, i + (1 if arg is None else 0)
+    raise ValueError("bad CBOR")
+
+
+class Link:
+    """Nordic UART with the watch's lines and frames split into messages."""
+
+    def __init__(self, client):
+        self.client = client
+        self.rx = bytearray()
+        self.messages = asyncio.Queue()
+        self.seq = 0
+        self.piece = 20
+
+    async def start(self):
+        char = self.client.services.get_characteristic(NUS_RX)
+        self.piece = max(20, char.max_write_without_response_size)
+        await self.client.start_notify(NUS_TX, self._on_notify)
+
+    def _on_notify(self, _char, data):
+        self.rx += data
+        while self.rx:
+            if self.rx[0] == FRAME_SYNC:
+                if len(self.rx) < 5:
+                    return
+                end = 5 + (self.rx[3] | self.rx[4] << 8) + 2
+                if len(self.rx) < end:
+                    return
+                frame, self.rx = bytes(self.rx[:end]), self.rx[end:]
+                if crc16(frame[1:-2]) != struct.unpack("<H", frame[-2:])[0]:
+                    continue
+                payload = frame[5:-2]
+                try:
+                    if frame[1] == FRAME_CBOR:
+                        self.messages.put_nowait(cbor_decode(payload)[0])
+                    elif frame[1] == FRAME_JSON:
+                        self.messages.put_nowait(json.loads(payload))
+                except ValueError:
+                    pass
+            else:
+                nl = self.rx.find(b"\n")
+                if nl < 0:
+                    return
+                line, self.rx = bytes(self.rx[:nl]), self.rx[nl + 1:]
+                try:
+                    self.messages.put_nowait(json.loads(line))
+                except ValueError:
+                    pass
+
+    async def write(self, data):
+        # The watch reassembles lines and frames across writes
+        for i in range(0, len(data), self.piece):
+            await self.client.write_gatt_char(NUS_RX, data[i:i + self.piece], response=False)
+
+    async def send_frame(self, ftype, payload):
+        await self.write(seal(ftype, self.seq, payload))
+        self.seq += 1
+
+    async def wait_for(self, key, timeout):
+        """Next message with key, skipping status and other traffic."""
+        deadline = time.monotonic() + timeout
+        while True:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                raise asyncio.TimeoutError
+            msg = await asyncio.wait_for(self.messages.get(), left)
+            if isinstance(msg, dict) and (key is None or key in msg):
+                return msg
+
+
+async def find_device(args):
+    if args.address:
+        return args.address
+    dev = await BleakScanner.find_device_by_name(args.device, timeout=10)
+    if dev is None:
+        sys.exit(f"'{args.device}' not found")
+    return dev
+
+
+async def send(args):
+    if args.abort:
+        data = b""
+    elif args.file:
+        data = open(args.file, "rb").read()
+    else:
+        sys.exit("no file given")
+    name = args.name or os.path.basename(args.file or "")
+    crc = zlib.crc32(data)
+
+    async with BleakClient(await find_device(args)) as client:
+        link = Link(client)
+        await link.start()
+
+        await link.write(b'{"cmd":"framing","mode":"cbor"}\n')
+        r = await link.wait_for("framing", 5)
+        if r["framing"] != "cbor":
+            sys.exit("the watch did not switch to frames")
+
+        if args.abort:
+            await link.send_frame(FRAME_JSON, b'{"cmd":"file_abort"}')
+            return
+
+        req = json.dumps({"cmd": "file_open", "name": name, "size": len(data), "crc": crc})
+        await link.send_frame(FRAME_JSON, req.encode())
+        r = (await link.wait_for("file", 5))["file"]
+        if "err" in r:
+            sys.exit(f"open refused: {r['err']}")
+        base = nxt = r["offset"]
+        chunk, window = r["chunk"], r["window"]
+        print(f"{name}: {len(data)} bytes, from {base}, chunk {chunk}, window {window}")
+
+        t0 = time.monotonic()
+        start = base
+        resent = 0
+        while True:
+            while nxt < len(data) and nxt < base + window * chunk:
+                part = data[nxt:nxt + chunk]
+                hdr = struct.pack("<II", nxt, zlib.crc32(part))
+                await link.send_frame(FRAME_FILE, hdr + part)
+                nxt += len(part)
+            try:
+                r = await link.wait_for(None, args.timeout)
+            except asyncio.TimeoutError:
+                resent += nxt - base
+                nxt = base
+                continue
+            if "file_done" in r:
+                break
+            if "file_err" in r:
+                sys.exit(f"transfer failed: {r['file_err']}")
+            if "file_ack" in r:
+                base = max(base, r["file_ack"])
+            elif "file_nak" in r:
+                base = max(base, r["file_nak"])
+                resent += nxt - base
+                nxt = base
+            else:
+                continue
+            nxt = max(nxt, base)
+            done = base * 100 // len(data)
+            print(f"\r{base}/{len(data)} ({done}%)", end="", file=sys.stderr)
+
+        dt = time.monotonic() - t0
+        sent = len(data) - start
+        print(f"\rdone: {sent} bytes in {dt:.1f} s, {sent / dt / 1024:.1f} KB/s, {resent} resent")
+
+        await link.send_frame(FRAME_JSON, b'{"cmd":"framing","mode":"json"}')
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("file", nargs="?")
+    ap.add_argument("--name", help="name on the watch (default: the file's)")
+    ap.add_argument("--device", default="ESP32 S3 Watch", help="advertised name")
+    ap.add_argument("--address", help="connect to this address instead of scanning")
+    ap.add_argument("--timeout", type=float, default=1.0, help="resend after this long without an answer (s)")
+    ap.add_argument("--abort", action="store_true", help="drop the transfer in progress")
+    asyncio.run(send(ap.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,199 @@
+/*
+ * Host benchmark: LZ4 frame compression (ble_lz) on recorded BLE traffic.
+ *
+ * Build and run on Linux:
+ *   gcc -O2 -Icomponents/ble_sync/include components/ble_sync/ble_lz.c \
+ *       components/ble_sync/host/ble_lz_bench.c -o ble_lz_bench
+ *   ./ble_lz_bench [link_bytes_per_s] [traffic.jsonl...]
+ *
+ * Each traffic file holds one message per row; host/phone_traffic.jsonl and
+ * host/watch_traffic.jsonl are the defaults. Every message is sent as one
+ * frame, the way ble_sync sends them, in two modes:
+ *   frame:  each frame compressed on its own, frames under LZ_MIN_BYTES and
+ *           ones that do not shrink sent as they are
+ *   stream: all frames of the file as one LZ4 stream (BLE_FRAME_F_STREAM),
+ *           as the heap trace goes out
+ * and the wire bytes, including the frame header and CRC, are compared with
+ * uncompressed frames. Every block is decoded again and checked. Encode and
+ * decode speeds are measured on the host; the effective link rate is what
+ * the link carries in message bytes once it only has to send the wire bytes
+ * (80 KB/s by default: 2M PHY, data length extension, 15 ms interval).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ble_lz.h"
+#include "ble_proto.h"
+
+// As in ble_sync.c
+#define LZ_MIN_BYTES 96
+#define MAX_LINES 4096
+#define MAX_LINE BLE_LZ_BLOCK_MAX
+#define ROUNDS 50
+
+typedef struct {
+    char* line[MAX_LINES];
+    size_t len[MAX_LINES];
+    size_t n;
+    size_t bytes;
+} traffic_t;
+
+static int load(const char* path, traffic_t* t)
+{
+    static char buf[MAX_LINE + 2];
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(t, 0, sizeof(*t));
+    while (t->n < MAX_LINES && fgets(buf, sizeof(buf), f)) {
+        size_t n = strcspn(buf, "\r\n");
+        if (n == 0) {
+            continue;
+        }
+        t->line[t->n] = malloc(n);
+        memcpy(t->line[t->n], buf, n);
+        t->len[t->n] = n;
+        t->bytes += n;
+        t->n++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Wire bytes of every message as its own frame. Returns -1 if a block does
+// not decode to its message.
+static long run_frames(const traffic_t* t, double* enc_us, double* dec_us, size_t* packed)
+{
+    static uint16_t table[BLE_LZ_HASH_SIZE];
+    static uint8_t out[BLE_LZ_BOUND(MAX_LINE)];
+    static uint8_t back[MAX_LINE];
+    long wire = 0;
+
+    *packed = 0;
+    for (size_t i = 0; i < t->n; i++) {
+        size_t len = t->len[i];
+        size_t n = 0;
+        if (len >= LZ_MIN_BYTES) {
+            double t0 = now_us();
+            n = ble_lz_compress(t->line[i], len, out, len - BLE_FRAME_LZ_HDR - 1, table);
+            *enc_us += now_us() - t0;
+        }
+        if (n == 0) {
+            wire += BLE_FRAME_OVERHEAD + len;
+            continue;
+        }
+        double t0 = now_us();
+        int r = ble_lz_decompress(out, n, back, sizeof(back), 0);
+        *dec_us += now_us() - t0;
+        if (r != (int)len || memcmp(back, t->line[i], len) != 0) {
+            return -1;
+        }
+        wire += BLE_FRAME_OVERHEAD + BLE_FRAME_LZ_HDR + n;
+        (*packed)++;
+    }
+    return wire;
+}
+
+// Wire bytes of all messages as one stream
+static long run_stream(const traffic_t* t, double* enc_us, double* dec_us, size_t* packed)
+{
+    static ble_lz_stream_t s;
+    static uint8_t out[BLE_LZ_BOUND(MAX_LINE)];
+    uint8_t* hist = malloc(t->bytes);
+    size_t pos = 0;
+    long wire = 0;
+
+    *packed = 0;
+    ble_lz_stream_init(&s);
+    for (size_t i = 0; i < t->n; i++) {
+        size_t len = t->len[i];
+        size_t cap = len > BLE_FRAME_LZ_HDR + 1 ? len - BLE_FRAME_LZ_HDR - 1 : 0;
+        double t0 = now_us();
+        size_t n = ble_lz_stream_compress(&s, t->line[i], len, out, cap);
+        *enc_us += now_us() - t0;
+        if (n == 0) {
+            // Sent as is, history all the same
+            memcpy(hist + pos, t->line[i], len);
+            wire += BLE_FRAME_OVERHEAD + len;
+        } else {
+            size_t dict = pos < BLE_LZ_WINDOW ? pos : BLE_LZ_WINDOW;
+            t0 = now_us();
+            int r = ble_lz_decompress(out, n, hist + pos, len, dict);
+            *dec_us += now_us() - t0;
+            if (r != (int)len || memcmp(hist + pos, t->line[i], len) != 0) {
+                free(hist);
+                return -1;
+            }
+            wire += BLE_FRAME_OVERHEAD + BLE_FRAME_LZ_HDR + n;
+            (*packed)++;
+        }
+        pos += len;
+    }
+    free(hist);
+    return wire;
+}
+
+static void report(const char* mode, const traffic_t* t, long wire, long plain, size_t packed, double enc_us,
+                   double dec_us, double rate)
+{
+    if (wire < 0) {
+        printf("  %-7s BAD: a block did not decode to its message\n", mode);
+        exit(1);
+    }
+    double mb = t->bytes * (double)ROUNDS / 1e6;
+    printf("  %-7s %7ld  %5.1f%%  %6zu  %8.0f  %8.0f  %7.1f\n", mode, wire, wire * 100.0 / plain, packed,
+           mb / (enc_us / 1e6), dec_us > 0 ? mb / (dec_us / 1e6) : 0.0, rate * t->bytes / wire / 1024);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* defaults[] = { "components/ble_sync/host/phone_traffic.jsonl",
+                                      "components/ble_sync/host/watch_traffic.jsonl" };
+    double rate = argc > 1 ? atof(argv[1]) : 80000;
+    const char** files = argc > 2 ? (const char**)argv + 2 : defaults;
+    int nfiles = argc > 2 ? argc - 2 : 2;
+    static traffic_t t;
+
+    printf("link %.0f B/s, frames under %d bytes uncompressed, %d rounds\n", rate, LZ_MIN_BYTES, ROUNDS);
+    for (int fi = 0; fi < nfiles; fi++) {
+        if (load(files[fi], &t) != 0) {
+            return 1;
+        }
+        long plain = (long)(t.n * BLE_FRAME_OVERHEAD + t.bytes);
+        printf("%s: %zu messages, %zu bytes, %ld on the wire uncompressed (%.1f KB/s of messages)\n", files[fi], t.n,
+               t.bytes, plain, rate * t.bytes / plain / 1024);
+        printf("  mode       wire   ratio  packed  enc MB/s  dec MB/s     KB/s\n");
+
+        double enc = 0, dec = 0;
+        size_t packed = 0;
+        long wire = 0;
+        for (int r = 0; r < ROUNDS && wire >= 0; r++) {
+            wire = run_frames(&t, &enc, &dec, &packed);
+        }
+        report("frame", &t, wire, plain, packed, enc, dec, rate);
+
+        enc = dec = 0;
+        wire = 0;
+        for (int r = 0; r < ROUNDS && wire >= 0; r++) {
+            wire = run_stream(&t, &enc, &dec, &packed);
+        }
+        report("stream", &t, wire, plain, packed, enc, dec, rate);
+
+        for (size_t i = 0; i < t.n; i++) {
+            free(t.line[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Host benchmark: ble_proto codec against cJSON on phone traffic.
+ *
+ * Build and run on Linux:
+ *   gcc -O2 -Icomponents/ble_sync/include -I$IDF_PATH/components/json/cJSON \
+ *       components/ble_sync/ble_proto.c $IDF_PATH/components/json/cJSON/cJSON.c \
+ *       components/ble_sync/host/ble_proto_bench.c -o ble_proto_bench
+ *   ./ble_proto_bench [traffic.jsonl] [iterations]
+ *
+ * The traffic file holds one received line per row, as the phone sends
+ * them; host/phone_traffic.jsonl is the default. Each line is decoded the
+ * way ble_sync handles it (the cJSON side parses, looks up the same keys and
+ * frees the tree), and the status reply is encoded once per line. malloc is
+ * interposed to count the allocations each codec makes.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ble_proto.h"
+#include "cJSON.h"
+
+#define MAX_LINES 4096
+#define MAX_LINE 1024
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+static unsigned long n_allocs;
+
+void* malloc(size_t n)
+{
+    n_allocs++;
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t a, size_t b)
+{
+    n_allocs++;
+    return __libc_calloc(a, b);
+}
+
+void* realloc(void* p, size_t n)
+{
+    n_allocs++;
+    return __libc_realloc(p, n);
+}
+
+void free(void* p)
+{
+    __libc_free(p);
+}
+
+static char* lines[MAX_LINES];
+static size_t lens[MAX_LINES];
+static int nlines;
+static volatile uint32_t sink;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void use(const char* s)
+{
+    sink += (uint8_t)s[0];
+}
+
+static void decode_proto(char* scratch, int i)
+{
+    ble_msg_t m;
+    memcpy(scratch, lines[i], lens[i] + 1);
+    if (ble_proto_decode(scratch, lens[i], &m) != 0) {
+        return;
+    }
+    sink += m.fields + m.cmd + m.datetime.second;
+    if (m.fields & BLE_MSG_NOTIFICATION) {
+        use(m.app);
+        use(m.title);
+        use(m.message);
+    }
+}
+
+static const char* str_or_empty(cJSON* it)
+{
+    return cJSON_IsString(it) ? it->valuestring : "";
+}
+
+static void decode_cjson(char* scratch, int i)
+{
+    memcpy(scratch, lines[i], lens[i] + 1);
+    cJSON* root = cJSON_ParseWithLength(scratch, lens[i]);
+    if (!root) {
+        return;
+    }
+    int y, mo, d, h, mi, s;
+    cJSON* it = cJSON_GetObjectItem(root, "datetime");
+    if (cJSON_IsString(it) && sscanf(it->valuestring, "%d-%d-%dT%d:%d:%d", &y, &mo, &d, &h, &mi, &s) == 6) {
+        sink += s;
+    }
+    it = cJSON_GetObjectItem(root, "notification");
+    if (cJSON_IsString(it)) {
+        use(str_or_empty(cJSON_GetObjectItem(root, "app")));
+        use(str_or_empty(cJSON_GetObjectItem(root, "title")));
+        use(str_or_empty(cJSON_GetObjectItem(root, "message")));
+    }
+    sink += cJSON_IsString(cJSON_GetObjectItem(root, "status"));
+    it = cJSON_GetObjectItem(root, "cmd");
+    if (cJSON_IsString(it)) {
+        use(it->valuestring);
+        sink += cJSON_IsNumber(cJSON_GetObjectItem(root, "sample"));
+        sink += cJSON_IsNumber(cJSON_GetObjectItem(root, "bytes"));
+        sink += cJSON_IsString(cJSON_GetObjectItem(root, "to"));
+    }
+    cJSON_Delete(root);
+}
+
+static void encode_proto(int i)
+{
+    char buf[96];
+    ble_jw_t w;
+    ble_jw_init(&w, buf, sizeof(buf));
+    ble_jw_begin_object(&w, NULL);
+    ble_jw_int(&w, "battery", 40 + i % 60);
+    ble_jw_bool(&w, "charging", i & 1);
+    ble_jw_bool(&w, "vbus", i & 1);
+    ble_jw_int(&w, "steps", 1234 + i);
+    ble_jw_end_object(&w);
+    sink += ble_jw_finish(&w);
+}
+
+static void encode_cjson(int i)
+{
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "battery", 40 + i % 60);
+    cJSON_AddBoolToObject(root, "charging", i & 1);
+    cJSON_AddBoolToObject(root, "vbus", i & 1);
+    cJSON_AddNumberToObject(root, "steps", 1234 + i);
+    char* s = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    sink += strlen(s);
+    free(s);
+}
+
+typedef void (*line_fn)(char* scratch, int i);
+
+static void run(const char* name, line_fn dec, void (*enc)(int), long iters)
+{
+    static char scratch[MAX_LINE];
+    unsigned long a0 = n_allocs;
+    double t0 = now_s();
+    for (long k = 0; k < iters; k++) {
+        for (int i = 0; i < nlines; i++) {
+            dec(scratch, i);
+        }
+    }
+    double t1 = now_s();
+    unsigned long a1 = n_allocs;
+    for (long k = 0; k < iters; k++) {
+        for (int i = 0; i < nlines; i++) {
+            enc(i);
+        }
+    }
+    double t2 = now_s();
+    unsigned long a2 = n_allocs;
+
+    double n = (double)iters * nlines;
+    printf("%-8s decode %7.1f ns/line %6.2f allocs/line | encode status %7.1f ns %6.2f allocs\n",
+           name, (t1 - t0) * 1e9 / n, (a1 - a0) / n, (t2 - t1) * 1e9 / n, (a2 - a1) / n);
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "components/ble_sync/host/phone_traffic.jsonl";
+    long iters = argc > 2 ? atol(argv[2]) : 20000;
+    static char buf[MAX_LINE];
+    size_t bytes = 0;
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    while (nlines < MAX_LINES && fgets(buf, sizeof(buf), f)) {
+        size_t n = strcspn(buf, "\r\n");
+        if (n == 0) {
+            continue;
+        }
+        buf[n] = '\0';
+        lines[nlines] = strdup(buf);
+        lens[nlines++] = n;
+        bytes += n;
+    }
+    fclose(f);
+    printf("%d lines, %zu bytes avg, %ld iterations\n", nlines, nlines ? bytes / nlines : 0, iters);
+
+    run("ble_proto", decode_proto, encode_proto, iters);
+    run("cJSON", decode_cjson, encode_cjson, iters);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Receiving side of the file transfer: one file at a time, streamed into
+// <dir>/<name> through a part file, with no whole-file buffer. Plain stdio
+// and no ESP-IDF dependencies, so it also builds on the host.
+//
+// The phone opens a transfer with
+//   {"cmd":"file_open","name":"face.bin","size":N,"crc":C}
+// (C is the CRC-32 of the whole file, see ble_crc32()) and the watch
+// answers {"file":{"name","offset","chunk","window"}}, or with "err". It
+// then sends BLE_FRAME_FILE frames starting at "offset", each payload
+//   offset (LE32) | CRC-32 of the data (LE32) | data, at most "chunk" bytes
+// and keeps up to "window" of them unacknowledged. The watch answers
+//   {"file_ack":off}  everything before off is written (every chunk or few)
+//   {"file_nak":off}  a chunk was missing or damaged: go back to off
+//   {"file_done":N}   all N bytes verified and the file is in place
+//   {"file_err":why}  the transfer failed and was dropped
+// Chunks after a gap are dropped until the missing one arrives (go-back-N);
+// if no answer comes, the phone resends from the last ack.
+//
+// The part file outlives disconnects and reboots: opening the same name,
+// size and CRC again resumes at its length, opening another file drops it.
+// The file replaces <dir>/<name> only after the CRC-32 of what was written
+// has been checked.
+
+#define BLE_FILE_CHUNK_HDR 8
+// "/" + name + NUL within SPIFFS's 32 byte object names
+#define BLE_FILE_NAME_MAX 30
+
+typedef enum {
+    BLE_FILE_PENDING, // nothing to answer yet
+    BLE_FILE_ACK,     // answer file_ack
+    BLE_FILE_NAK,     // answer file_nak
+    BLE_FILE_DONE,    // answer file_done; the transfer is closed
+    BLE_FILE_FAIL,    // answer file_err; the transfer is closed
+    BLE_FILE_IDLE,    // no transfer open: chunk ignored
+} ble_file_status_t;
+
+// Directory files go to ("/spiffs" on the watch). Closes an open transfer.
+void ble_file_init(const char* dir);
+
+// Open (or resume) a transfer. An earlier one still open is closed, and
+// every part file but the one for this name, size and CRC is deleted, so
+// only the latest transfer can be resumed. ack_every is the number of
+// in-order chunks per file_ack, at most the window. Returns 0 and the
+// offset to continue from, or a negative errno.
+int ble_file_open(const char* name, uint32_t size, uint32_t crc,
+                  unsigned ack_every, uint32_t* offset);
+
+// Handle one BLE_FRAME_FILE payload. *offset is the value for the answer.
+ble_file_status_t ble_file_chunk(const uint8_t* payload, size_t len,
+                                 uint32_t* offset);
+
+// Drop the transfer and its part file.
+void ble_file_abort(void);
+
+// Reason for the last BLE_FILE_FAIL: "crc", "io" or "size".
+const char* ble_file_error(void);
+
+bool ble_file_active(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ble_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Standard GATT services next to the Nordic UART one, so generic tools read
+// the watch without the companion app:
+//   - Battery Service: Battery Level and Battery Level Status (charging,
+//     external power);
+//   - Current Time Service: Current Time from the RTC;
+//   - Running Speed and Cadence: cadence from the step detector, speed and
+//     total distance estimated from it.
+// Reads are answered from cached values; notifications go out only when a
+// value changes.
+
+// Register the services with the Nordic UART driver. Call before
+// nordic_uart_start().
+esp_err_t ble_gatt_std_init(void);
+
+// Cache a new battery state; notifies subscribers when it changed.
+void ble_gatt_std_set_battery(int percent, bool charging, bool external_power);
+
+// The clock was set from the phone: notify Current Time with the new value.
+void ble_gatt_std_time_adjusted(const ble_datetime_t* dt);
+
+// Sample steps and cadence once a second while connected.
+void ble_gatt_std_connected(void);
+void ble_gatt_std_disconnected(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-minute history for the phone to catch up on after a reconnect.
+//
+// Every record gets a cursor, one more than the record before. The phone
+// keeps the cursor the last sync ended at and asks for what came since;
+// once the ring has wrapped, the oldest records are gone and a sync starts
+// at the oldest one left. Cursors only move forward as long as the caller
+// starts each boot past the last one handed out.
+//
+// There is one history: its state is module-wide and the ring is the
+// caller's buffer. Appending and reading copy records and never block;
+// ble_sync wraps each call in the critical section its minute timer and
+// sync task share.
+
+#define BLE_HIST_BATTERY_UNKNOWN 0xFF
+
+typedef struct {
+    uint32_t minute;  // watch clock, minutes since 1970-01-01
+    uint16_t steps;   // in this minute
+    uint8_t activity; // sensors_activity_t at the end of the minute
+    uint8_t battery;  // percent, or BLE_HIST_BATTERY_UNKNOWN
+} ble_hist_rec_t;
+
+// Use buf (cap records) as the ring; the first record gets cursor first
+void ble_hist_init(ble_hist_rec_t* buf, size_t cap, uint32_t first);
+
+// Returns the record's cursor
+uint32_t ble_hist_append(const ble_hist_rec_t* rec);
+
+// The cursor the next record gets
+uint32_t ble_hist_next(void);
+
+// Copy up to max records from cursor since on into out, *first being the
+// cursor of out[0]. Records no longer held are skipped, and so is a since
+// past ble_hist_next() (a cursor from before the history was lost): both
+// start at the oldest record. Returns the number copied.
+size_t ble_hist_read(uint32_t since, ble_hist_rec_t* out, size_t max, uint32_t* first);
+
+// Minutes since 1970-01-01 of a calendar time (month and day from 1)
+uint32_t ble_hist_minutes(int year, int month, int day, int hour, int minute);
+
+#ifdef __cplusplus
+}
+#endif
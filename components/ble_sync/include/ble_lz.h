@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// LZ4 block compression with a 4 KB window, for frames on the BLE link.
+// Output is a plain LZ4 block (any LZ4 decoder reads it); matches never
+// reach back further than BLE_LZ_WINDOW bytes, so a decoder needs no more
+// history than that. No allocations and no ESP-IDF dependencies, so it
+// also builds on the host.
+//
+// A stream compresses a sequence of blocks as one: each block may refer to
+// the last BLE_LZ_WINDOW bytes of the blocks before it (LZ4 linked blocks),
+// which is what makes short records of a bulk transfer compress.
+
+#define BLE_LZ_WINDOW 4096
+#define BLE_LZ_HASH_BITS 10
+#define BLE_LZ_HASH_SIZE (1u << BLE_LZ_HASH_BITS)
+// Largest block a stream takes per call
+#define BLE_LZ_BLOCK_MAX 4096
+// Output size that always suffices for n input bytes
+#define BLE_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+typedef struct {
+    uint16_t table[BLE_LZ_HASH_SIZE]; // positions in buf by hash of 4 bytes
+    uint8_t buf[BLE_LZ_WINDOW + BLE_LZ_BLOCK_MAX];
+    size_t len; // history in buf
+} ble_lz_stream_t;
+
+// Compress n bytes (at most 65535) on their own. table is scratch space of
+// BLE_LZ_HASH_SIZE entries. Returns the block length, or 0 if it would not
+// fit in cap.
+size_t ble_lz_compress(const void* in, size_t n, void* out, size_t cap, uint16_t* table);
+
+void ble_lz_stream_init(ble_lz_stream_t* s);
+// Compress the next block of the stream (n <= BLE_LZ_BLOCK_MAX). The block
+// becomes history whatever the result, as it does for the decoder even when
+// the block is sent uncompressed. Returns the block length, or 0 if it would
+// not fit in cap.
+size_t ble_lz_stream_compress(ble_lz_stream_t* s, const void* in, size_t n, void* out, size_t cap);
+
+// Decode a block into out. The dict bytes right before out are the
+// history matches may refer to (0 for a block on its own). Returns the
+// decoded length, or -1 if the block is malformed or does not fit in cap.
+int ble_lz_decompress(const void* in, size_t n, uint8_t* out, size_t cap, size_t dict);
+
+#ifdef __cplusplus
+}
+#endif
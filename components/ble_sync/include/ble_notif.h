@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ingest stage for phone notifications, between the decoder and the UI.
+//
+// A notification whose app, title and message match one seen within the
+// dedup time is dropped. The rest collect in a batch: the first opens a
+// window, and when it closes the batch goes to the UI at once, with one
+// wake and one sound for all of it. Each app has a priority: high closes
+// the window right away, low is shown without waking the screen or making
+// a sound.
+//
+// Times are milliseconds on any clock that counts up and may wrap. The
+// state is module-wide; ble_sync calls in under its notification mutex
+// from the decoder and the delivery task.
+
+// Copies are cut to what the notifications screen keeps
+#define BLE_NOTIF_APP_MAX 32
+#define BLE_NOTIF_TITLE_MAX 64
+#define BLE_NOTIF_MESSAGE_MAX 256
+#define BLE_NOTIF_TS_MAX 40
+// Notifications per batch; in a longer burst the oldest give way (the
+// screen keeps fewer anyway)
+#define BLE_NOTIF_BATCH_MAX 8
+// Apps with a priority other than normal
+#define BLE_NOTIF_APPS_MAX 16
+// Recent notifications remembered for dedup
+#define BLE_NOTIF_SEEN_MAX 16
+
+typedef enum {
+    BLE_NOTIF_LOW,    // shown, no wake, no sound
+    BLE_NOTIF_NORMAL, // waits for the window
+    BLE_NOTIF_HIGH,   // delivered now
+} ble_notif_prio_t;
+
+typedef struct {
+    char app[BLE_NOTIF_APP_MAX];
+    char title[BLE_NOTIF_TITLE_MAX];
+    char message[BLE_NOTIF_MESSAGE_MAX];
+    char ts[BLE_NOTIF_TS_MAX];
+} ble_notif_item_t;
+
+typedef struct {
+    ble_notif_item_t item[BLE_NOTIF_BATCH_MAX]; // oldest first
+    unsigned count;
+    unsigned dropped; // older ones that gave way
+    bool alert;       // wake the screen and play the sound
+} ble_notif_batch_t;
+
+void ble_notif_init(uint32_t window_ms, uint32_t dedup_ms);
+
+// Set an app's priority; normal removes it from the table. Returns false if
+// the table is full.
+bool ble_notif_set_prio(const char* app, ble_notif_prio_t prio);
+ble_notif_prio_t ble_notif_get_prio(const char* app);
+
+// Add a notification (NULL strings are empty). Returns false if it was
+// dropped as a duplicate.
+bool ble_notif_push(const char* app, const char* title, const char* message, const char* ts, uint32_t now_ms);
+
+// Milliseconds until the batch is due: 0 when it is, UINT32_MAX when there
+// is none
+uint32_t ble_notif_due_in(uint32_t now_ms);
+
+// Move the batch out and start a new one. Returns false if it is empty.
+bool ble_notif_take(ble_notif_batch_t* out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Streaming codec for the JSON lines exchanged with the phone app. Decoding
+// works in place on the received line and fills a typed message; encoding
+// writes into a caller-provided buffer. Neither allocates, and the code has
+// no ESP-IDF dependencies so it also builds on the host.
+
+typedef enum {
+    BLE_CMD_NONE = 0, // no "cmd" key
+    BLE_CMD_UNKNOWN,  // "cmd" with a name this firmware does not handle
+    BLE_CMD_HEAP,
+    BLE_CMD_TRACE,
+    BLE_CMD_BENCH_TX,
+    BLE_CMD_FRAMING,
+    BLE_CMD_RADIO,
+    BLE_CMD_FILE_OPEN,
+    BLE_CMD_FILE_ABORT,
+    BLE_CMD_STATUS_ACK,
+    BLE_CMD_NOTIF_PRIO,
+    BLE_CMD_SYNC,
+} ble_cmd_t;
+
+// Bits of ble_msg_t.fields: which keys were present with the expected type
+#define BLE_MSG_DATETIME (1u << 0)     // "datetime": "YYYY-MM-DDTHH:MM:SS"
+#define BLE_MSG_NOTIFICATION (1u << 1) // "notification" (timestamp) with app/title/message
+#define BLE_MSG_STATUS (1u << 2)       // "status": status request
+#define BLE_MSG_CMD (1u << 3)          // "cmd"
+#define BLE_MSG_SAMPLE (1u << 4)       // "sample": number
+#define BLE_MSG_TO (1u << 5)           // "to": string
+#define BLE_MSG_BYTES (1u << 6)        // "bytes": number
+#define BLE_MSG_MODE (1u << 7)         // "mode": string
+#define BLE_MSG_NAME (1u << 8)         // "name": string
+#define BLE_MSG_SIZE (1u << 9)         // "size": number
+#define BLE_MSG_CRC (1u << 10)         // "crc": number
+#define BLE_MSG_COMP (1u << 11)        // "comp": string
+#define BLE_MSG_SEQ (1u << 12)         // "seq": number
+#define BLE_MSG_PRIO (1u << 13)        // "prio": string
+#define BLE_MSG_SINCE (1u << 14)       // "since": number
+
+typedef struct {
+    int year, month, day, hour, minute, second;
+} ble_datetime_t;
+
+// String members point into the decoded line, unescaped and NUL-terminated,
+// and stay valid as long as the line does. Absent strings are "".
+typedef struct {
+    uint32_t fields;
+    ble_datetime_t datetime;
+    const char* notification;
+    const char* app;
+    const char* title;
+    const char* message;
+    const char* status;
+    ble_cmd_t cmd;
+    const char* cmd_name;
+    int64_t sample; // fractions are truncated
+    const char* to;
+    int64_t bytes;
+    const char* mode;
+    const char* name;
+    int64_t size;
+    int64_t crc;
+    const char* comp;
+    int64_t seq;
+    const char* prio;
+    int64_t since;
+} ble_msg_t;
+
+// Decode one line (a single JSON object). The line is modified: strings are
+// unescaped where they stand. Unknown keys and nested values are skipped.
+// Returns 0, or -1 if the line is not a well-formed object.
+int ble_proto_decode(char* line, size_t len, ble_msg_t* out);
+
+// Same for a CBOR map (RFC 8949) with the same keys. Text strings are
+// NUL-terminated in place by moving them over their own length header.
+int ble_proto_decode_cbor(uint8_t* buf, size_t len, ble_msg_t* out);
+
+// Binary framing, negotiated per connection with {"cmd":"framing","mode":"cbor"}.
+// A frame is
+//   sync 0xA5 | type | seq | payload length (LE16) | payload | CRC-16 (LE16)
+// with CRC-16/CCITT-FALSE over type..payload. seq counts frames per
+// direction and wraps at 256. Payload lengths are limited by the receiver's
+// line length; frames never need escaping, newlines included.
+#define BLE_FRAME_SYNC 0xA5
+#define BLE_FRAME_HDR 5
+#define BLE_FRAME_CRC 2
+#define BLE_FRAME_OVERHEAD (BLE_FRAME_HDR + BLE_FRAME_CRC)
+
+typedef enum {
+    BLE_FRAME_JSON = 1, // a JSON message, as it would be sent on a line
+    BLE_FRAME_CBOR = 2, // the same message as a CBOR map
+    BLE_FRAME_RAW = 3,  // opaque bytes (benchmark filler)
+    BLE_FRAME_FILE = 4, // a file transfer chunk (see ble_file.h)
+} ble_frame_type_t;
+
+// Flags in the type byte. A compressed payload is its decoded length (LE16)
+// and an LZ4 block (see ble_lz.h). The payloads of BLE_FRAME_F_STREAM frames
+// form one history their blocks may refer to, which BLE_FRAME_F_START
+// begins anew; other frames are decoded on their own. The watch compresses
+// after {"cmd":"framing","mode":"cbor","comp":"lz4"}, and only frames for
+// which it pays off: a frame without BLE_FRAME_F_LZ is as sent.
+#define BLE_FRAME_F_LZ 0x80
+#define BLE_FRAME_F_STREAM 0x40
+#define BLE_FRAME_F_START 0x20
+#define BLE_FRAME_TYPE_MASK 0x1F
+#define BLE_FRAME_LZ_HDR 2
+
+typedef struct {
+    uint8_t type; // with flags
+    uint8_t seq;
+    uint8_t* payload;
+    size_t len;
+} ble_frame_t;
+
+// The payload is already at frame + BLE_FRAME_HDR; write the header and the
+// CRC behind it. Returns the frame length.
+size_t ble_frame_seal(uint8_t* frame, uint8_t type, uint8_t seq, size_t payload_len);
+// Check a received frame; returns 0 and points out at the payload, or -1.
+int ble_frame_open(uint8_t* frame, size_t len, ble_frame_t* out);
+
+// CRC-32 as zlib computes it (reflected 0x04C11DB7). Start with crc = 0 and
+// pass the result back in to continue over more data.
+uint32_t ble_crc32(uint32_t crc, const void* data, size_t len);
+
+// JSON writer over a fixed buffer. Values at the top level or inside arrays
+// take key == NULL. After an overflow every call is a no-op and
+// ble_jw_finish() returns 0.
+#define BLE_JW_MAX_DEPTH 8
+
+typedef struct {
+    char* buf;
+    size_t cap;
+    size_t len;
+    uint8_t depth;
+    uint16_t first; // bit d: nothing written yet at depth d
+    bool overflow;
+    bool cbor;
+} ble_jw_t;
+
+void ble_jw_init(ble_jw_t* w, char* buf, size_t cap);
+// Write the same calls as CBOR (indefinite-length maps and arrays). The
+// output is not NUL-terminated.
+void ble_jw_init_cbor(ble_jw_t* w, uint8_t* buf, size_t cap);
+void ble_jw_begin_object(ble_jw_t* w, const char* key);
+void ble_jw_end_object(ble_jw_t* w);
+void ble_jw_begin_array(ble_jw_t* w, const char* key);
+void ble_jw_end_array(ble_jw_t* w);
+void ble_jw_str(ble_jw_t* w, const char* key, const char* val);
+void ble_jw_int(ble_jw_t* w, const char* key, int64_t val);
+void ble_jw_bool(ble_jw_t* w, const char* key, bool val);
+// NUL-terminate; returns the length, or 0 if the buffer was too small or
+// objects are still open.
+size_t ble_jw_finish(ble_jw_t* w);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Status updates as deltas against what the phone has acknowledged.
+//
+// Every update carries "seq". A keyframe has all fields; a delta only the
+// ones that differ from the state the phone acknowledged last, and "base",
+// the seq of that state. The phone applies a delta to its copy of state
+// "base" (keeping the few it acknowledged since) and answers every update
+// with {"cmd":"status_ack","seq":n}; a {"status":...} request gets a
+// keyframe. Until the phone acknowledges one, every update is a keyframe,
+// so a phone that never does sees the full status as before. A delta is
+// relative to an acknowledged state, so one that is lost costs nothing: the
+// next one has its fields too.
+//
+// The model is plain data owned by the caller, one per connection. Each call
+// is a few comparisons and copies over at most BLE_STATUS_INFLIGHT entries,
+// so ble_sync makes them inside its status spinlock.
+
+#define BLE_STATUS_BATTERY (1u << 0)
+#define BLE_STATUS_CHARGING (1u << 1)
+#define BLE_STATUS_VBUS (1u << 2)
+#define BLE_STATUS_STEPS (1u << 3)
+#define BLE_STATUS_ALL 0x0Fu
+// Updates sent and not yet acknowledged that an ack can still refer to
+#define BLE_STATUS_INFLIGHT 4
+
+typedef struct {
+    int battery;
+    bool charging;
+    bool vbus;
+    uint32_t steps;
+} ble_status_t;
+
+typedef struct {
+    ble_status_t acked; // the phone's state, valid once have_acked
+    uint16_t acked_seq;
+    bool have_acked;
+    ble_status_t last;  // last sent
+    bool have_last;
+    uint16_t seq;       // of the last update sent
+    ble_status_t sent[BLE_STATUS_INFLIGHT];
+    uint16_t sent_seq[BLE_STATUS_INFLIGHT];
+    unsigned sent_count;
+} ble_status_model_t;
+
+// Start over for a new connection: the next update is a keyframe
+void ble_status_reset(ble_status_model_t* m);
+
+// The update to send for cur. Returns the fields to send (BLE_STATUS_ALL for
+// a keyframe), with its seq and, for a delta, the seq of the state it
+// applies to in *base; 0 when there is nothing new since the last update
+// and no keyframe is asked for. A nonzero result counts as sent.
+unsigned ble_status_next(ble_status_model_t* m, const ble_status_t* cur, bool key, uint16_t* seq, uint16_t* base);
+
+// The last update did not go out: the next call sends one even if nothing
+// changed since
+void ble_status_unsent(ble_status_model_t* m);
+
+// The phone has update seq. Returns false for a seq no longer (or never) in
+// flight, which changes nothing.
+bool ble_status_ack(ble_status_model_t* m, uint16_t seq);
+
+#ifdef __cplusplus
+}
+#endif
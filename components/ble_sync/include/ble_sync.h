@@ -13,7 +13,44 @@ extern "C" {
 #endif
 
 esp_err_t ble_sync_init(void);
+// Queue a status update ({"battery","charging","vbus","steps","seq"}).
+// Requests within 250 ms go out as one; only fields that changed since the
+// state the phone acknowledged with {"cmd":"status_ack","seq"} are sent,
+// with "base" (see ble_status.h). {"status":...} gets a full keyframe, as do
+// a new connection and every sixth periodic update.
 esp_err_t ble_sync_send_status(int battery_percent, bool charging);
+// Reply to {"cmd":"heap"} with an lwmalloc telemetry snapshot
+esp_err_t ble_sync_send_heap_stats(void);
+// Reply to {"cmd":"trace"}: stream the lwmalloc allocation trace file
+// base64-encoded, or write it to SPIFFS with "to":"spiffs"
+esp_err_t ble_sync_send_heap_trace(bool to_spiffs);
+// Reply to {"cmd":"sync","since":cursor}: the one-minute history records
+// (steps, activity class, battery) from that cursor on, in batches of 128
+// per line, then {"sync":{...,"cursor"}} with the cursor for next time (see
+// ble_hist.h). Compressed as one stream when the phone asked for it.
+esp_err_t ble_sync_send_history(uint32_t since);
+// Reply to {"cmd":"bench_tx","bytes":N}: send N bytes of filler lines as fast
+// as the link allows, then {"bench_tx":{...}} with the measured bytes/s and the
+// negotiated MTU, LL payload (dle), PHY, notification size and L2CAP SDU size.
+// "to" picks the transport: "gatt", "coc" (the L2CAP channel), or "both" to
+// run the two back to back; by default bulk goes over the channel if open.
+esp_err_t ble_sync_bench_tx(size_t bytes, const char* via);
+// {"cmd":"framing","mode":"cbor"} switches the connection to binary frames
+// (see ble_proto.h) in both directions after the {"framing":"cbor"} ack;
+// "mode":"json" or a disconnect switches back to JSON lines. With
+// "comp":"lz4" as well, frames of 96 bytes or more go LZ4-compressed when
+// that makes them smaller, and bulk replies such as the heap trace are sent
+// as one compressed stream (see ble_lz.h).
+// On a framed connection {"cmd":"file_open","name","size","crc"} starts a
+// resumable file transfer into /spiffs (see ble_file.h);
+// {"cmd":"file_abort"} drops it.
+// Incoming notifications are deduplicated and shown in batches (see
+// ble_notif.h); {"cmd":"notif_prio","app","prio":"high"|"normal"|"low"}
+// sets an app's priority until reboot.
+// Reply to {"cmd":"radio"} with the radio duty cycle counters: time spent
+// advertising and connected, estimated radio on time and duty (per mille),
+// traffic and the current advertising or connection parameters
+esp_err_t ble_sync_send_radio_stats(void);
 esp_err_t ble_sync_set_enabled(bool enabled);
 bool ble_sync_is_enabled(void);
 
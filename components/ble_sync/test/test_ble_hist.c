@@ -0,0 +1,68 @@
+#include "unity.h"
+
+#include "ble_hist.h"
+
+static ble_hist_rec_t rec(uint32_t minute) {
+  return (ble_hist_rec_t){.minute = minute, .steps = (uint16_t)(minute * 3), .activity = 1, .battery = 90};
+}
+
+TEST_CASE("read from a cursor", "[ble_hist]") {
+  static ble_hist_rec_t ring[4];
+  ble_hist_rec_t out[4];
+  uint32_t first;
+
+  ble_hist_init(ring, 4, 100);
+  TEST_ASSERT_EQUAL_UINT32(100, ble_hist_next());
+  TEST_ASSERT_EQUAL_UINT32(0, ble_hist_read(100, out, 4, &first));
+  for (uint32_t i = 0; i < 3; ++i) {
+    ble_hist_rec_t r = rec(1000 + i);
+    TEST_ASSERT_EQUAL_UINT32(100 + i, ble_hist_append(&r));
+  }
+  TEST_ASSERT_EQUAL_UINT32(103, ble_hist_next());
+
+  TEST_ASSERT_EQUAL_UINT32(2, ble_hist_read(101, out, 4, &first));
+  TEST_ASSERT_EQUAL_UINT32(101, first);
+  TEST_ASSERT_EQUAL_UINT32(1001, out[0].minute);
+  TEST_ASSERT_EQUAL_UINT16(3006, out[1].steps);
+  // Up to date
+  TEST_ASSERT_EQUAL_UINT32(0, ble_hist_read(103, out, 4, &first));
+  TEST_ASSERT_EQUAL_UINT32(103, first);
+  // A cursor from a history since lost starts over at the oldest
+  TEST_ASSERT_EQUAL_UINT32(3, ble_hist_read(500, out, 4, &first));
+  TEST_ASSERT_EQUAL_UINT32(100, first);
+  // Batches
+  TEST_ASSERT_EQUAL_UINT32(1, ble_hist_read(100, out, 1, &first));
+  TEST_ASSERT_EQUAL_UINT32(1000, out[0].minute);
+}
+
+TEST_CASE("the ring drops the oldest records", "[ble_hist]") {
+  static ble_hist_rec_t ring[4];
+  ble_hist_rec_t out[8];
+  uint32_t first;
+
+  ble_hist_init(ring, 4, 0);
+  for (uint32_t i = 0; i < 10; ++i) {
+    ble_hist_rec_t r = rec(i);
+    ble_hist_append(&r);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, ble_hist_read(0, out, 8, &first));
+  TEST_ASSERT_EQUAL_UINT32(6, first);
+  for (uint32_t i = 0; i < 4; ++i)
+    TEST_ASSERT_EQUAL_UINT32(6 + i, out[i].minute);
+  TEST_ASSERT_EQUAL_UINT32(2, ble_hist_read(8, out, 8, &first));
+  TEST_ASSERT_EQUAL_UINT32(8, first);
+
+  // Without a buffer the cursors still count
+  ble_hist_init(NULL, 0, 7);
+  ble_hist_rec_t r = rec(1);
+  TEST_ASSERT_EQUAL_UINT32(7, ble_hist_append(&r));
+  TEST_ASSERT_EQUAL_UINT32(8, ble_hist_next());
+  TEST_ASSERT_EQUAL_UINT32(0, ble_hist_read(0, out, 8, &first));
+}
+
+TEST_CASE("calendar minutes", "[ble_hist]") {
+  TEST_ASSERT_EQUAL_UINT32(0, ble_hist_minutes(1970, 1, 1, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(15865230, ble_hist_minutes(2000, 3, 1, 12, 30));
+  TEST_ASSERT_EQUAL_UINT32(28487519, ble_hist_minutes(2024, 2, 29, 23, 59));
+  TEST_ASSERT_EQUAL_UINT32(0, ble_hist_minutes(1969, 12, 31, 23, 59));
+}
@@ -0,0 +1,116 @@
+#include "unity.h"
+
+#include "ble_notif.h"
+
+#include <stdio.h>
+#include <string.h>
+
+TEST_CASE("duplicates within the dedup time are dropped", "[ble_notif]") {
+  ble_notif_batch_t b;
+
+  ble_notif_init(1000, 5000);
+  TEST_ASSERT_TRUE(ble_notif_push("Mail", "Bob", "Lunch?", "t1", 10));
+  TEST_ASSERT_FALSE(ble_notif_push("Mail", "Bob", "Lunch?", "t2", 20));
+  TEST_ASSERT_TRUE(ble_notif_push("Mail", "Bob", "Lunch at 1?", "t3", 30));
+  // The split between the strings counts
+  TEST_ASSERT_TRUE(ble_notif_push("ab", "c", "", NULL, 40));
+  TEST_ASSERT_TRUE(ble_notif_push("a", "bc", "", NULL, 50));
+  TEST_ASSERT_FALSE(ble_notif_push("a", "bc", NULL, NULL, 60));
+  // Reposted once the dedup time is over
+  TEST_ASSERT_TRUE(ble_notif_push("Mail", "Bob", "Lunch?", "t4", 6000));
+
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_EQUAL_UINT32(5, b.count);
+  TEST_ASSERT_EQUAL_STRING("t1", b.item[0].ts);
+  TEST_ASSERT_EQUAL_STRING("", b.item[2].ts);
+  TEST_ASSERT_EQUAL_STRING("t4", b.item[4].ts);
+}
+
+TEST_CASE("a batch is due when its window closes", "[ble_notif]") {
+  ble_notif_batch_t b;
+
+  ble_notif_init(1000, 5000);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, ble_notif_due_in(0));
+  TEST_ASSERT_FALSE(ble_notif_take(&b));
+
+  // The clock may wrap while the window is open
+  uint32_t t0 = UINT32_MAX - 100;
+  ble_notif_push("Chat", "Ann", "hi", "1", t0);
+  ble_notif_push("Chat", "Ann", "there", "2", t0 + 400);
+  TEST_ASSERT_EQUAL_UINT32(1000, ble_notif_due_in(t0));
+  TEST_ASSERT_EQUAL_UINT32(500, ble_notif_due_in(t0 + 500));
+  TEST_ASSERT_EQUAL_UINT32(0, ble_notif_due_in(t0 + 1000));
+
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_EQUAL_UINT32(2, b.count);
+  TEST_ASSERT_EQUAL_UINT32(0, b.dropped);
+  TEST_ASSERT_TRUE(b.alert);
+  TEST_ASSERT_EQUAL_STRING("hi", b.item[0].message);
+  TEST_ASSERT_EQUAL_STRING("there", b.item[1].message);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, ble_notif_due_in(t0 + 1000));
+
+  // A long burst keeps the newest
+  for (int i = 0; i < BLE_NOTIF_BATCH_MAX + 2; ++i) {
+    char msg[8] = {'m', (char)('0' + i), 0};
+    TEST_ASSERT_TRUE(ble_notif_push("Chat", "Ann", msg, NULL, 2000 + i));
+  }
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_EQUAL_UINT32(BLE_NOTIF_BATCH_MAX, b.count);
+  TEST_ASSERT_EQUAL_UINT32(2, b.dropped);
+  TEST_ASSERT_EQUAL_STRING("m2", b.item[0].message);
+}
+
+TEST_CASE("app priorities", "[ble_notif]") {
+  ble_notif_batch_t b;
+  char name[BLE_NOTIF_APP_MAX + 1];
+
+  ble_notif_init(1000, 5000);
+  TEST_ASSERT_TRUE(ble_notif_set_prio("News", BLE_NOTIF_LOW));
+  TEST_ASSERT_TRUE(ble_notif_set_prio("Phone", BLE_NOTIF_HIGH));
+  TEST_ASSERT_EQUAL_INT(BLE_NOTIF_LOW, ble_notif_get_prio("News"));
+  TEST_ASSERT_EQUAL_INT(BLE_NOTIF_NORMAL, ble_notif_get_prio("Mail"));
+  TEST_ASSERT_EQUAL_INT(BLE_NOTIF_NORMAL, ble_notif_get_prio(NULL));
+
+  // Low: no wake, no sound, and it waits for the window
+  ble_notif_push("News", "Headline", "", NULL, 100);
+  TEST_ASSERT_EQUAL_UINT32(1000, ble_notif_due_in(100));
+  // High: the batch goes now and alerts
+  ble_notif_push("Phone", "Call", "Ann", NULL, 200);
+  TEST_ASSERT_EQUAL_UINT32(0, ble_notif_due_in(200));
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_TRUE(b.alert);
+  ble_notif_push("News", "Other", "", NULL, 300);
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_FALSE(b.alert);
+
+  // Normal takes an app out of the table
+  TEST_ASSERT_TRUE(ble_notif_set_prio("News", BLE_NOTIF_NORMAL));
+  TEST_ASSERT_EQUAL_INT(BLE_NOTIF_NORMAL, ble_notif_get_prio("News"));
+  TEST_ASSERT_TRUE(ble_notif_set_prio("Never set", BLE_NOTIF_NORMAL));
+
+  memset(name, 'x', BLE_NOTIF_APP_MAX);
+  name[BLE_NOTIF_APP_MAX] = '\0';
+  TEST_ASSERT_FALSE(ble_notif_set_prio(name, BLE_NOTIF_LOW));
+  for (int i = 1; i < BLE_NOTIF_APPS_MAX; ++i) {
+    snprintf(name, sizeof(name), "app%d", i);
+    TEST_ASSERT_TRUE(ble_notif_set_prio(name, BLE_NOTIF_LOW));
+  }
+  TEST_ASSERT_FALSE(ble_notif_set_prio("one more", BLE_NOTIF_LOW));
+  TEST_ASSERT_TRUE(ble_notif_set_prio("app3", BLE_NOTIF_HIGH)); // already in
+}
+
+TEST_CASE("long strings are cut to the item size", "[ble_notif]") {
+  static char msg[BLE_NOTIF_MESSAGE_MAX * 2];
+  ble_notif_batch_t b;
+
+  ble_notif_init(0, 0);
+  memset(msg, 'm', sizeof(msg) - 1);
+  msg[sizeof(msg) - 1] = '\0';
+  TEST_ASSERT_TRUE(ble_notif_push("App", NULL, msg, NULL, 1));
+  // No dedup time: the same one again is new
+  TEST_ASSERT_TRUE(ble_notif_push("App", NULL, msg, NULL, 1));
+  TEST_ASSERT_EQUAL_UINT32(0, ble_notif_due_in(1));
+  TEST_ASSERT_TRUE(ble_notif_take(&b));
+  TEST_ASSERT_EQUAL_UINT32(BLE_NOTIF_MESSAGE_MAX - 1, strlen(b.item[0].message));
+  TEST_ASSERT_EQUAL_STRING("", b.item[0].title);
+}
@@ -0,0 +1,270 @@
+#include "unity.h"
+
+#include "ble_proto.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Decode a copy: the decoder writes into the line
+static int decode(const char *json, char *buf, size_t cap, ble_msg_t *msg) {
+  size_t len = strlen(json);
+  TEST_ASSERT_LESS_THAN(cap, len);
+  memcpy(buf, json, len + 1);
+  return ble_proto_decode(buf, len, msg);
+}
+
+TEST_CASE("decode string escapes", "[ble_proto]") {
+  char buf[256];
+  ble_msg_t m;
+
+  TEST_ASSERT_EQUAL_INT(0, decode("{\"notification\":\"20240101\",\"app\":\"A\\\"B\\\\C\\/D\","
+                                  "\"title\":\"\\u00e9\\ud83d\\ude00\",\"message\":\"x\\ny\\tz\\b\\f\\r\"}",
+                                  buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_UINT32(BLE_MSG_NOTIFICATION, m.fields);
+  TEST_ASSERT_EQUAL_STRING("20240101", m.notification);
+  TEST_ASSERT_EQUAL_STRING("A\"B\\C/D", m.app);
+  TEST_ASSERT_EQUAL_STRING("\xc3\xa9\xf0\x9f\x98\x80", m.title); // U+00E9, U+1F600
+  TEST_ASSERT_EQUAL_STRING("x\ny\tz\b\f\r", m.message);
+
+  // Unpaired surrogates become U+FFFD; the character after one stays
+  TEST_ASSERT_EQUAL_INT(0, decode("{\"app\":\"\\ud83dx\",\"title\":\"\\ude00\",\"message\":\"\\ud83d\\u0041\"}",
+                                  buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_STRING("\xef\xbf\xbdx", m.app);
+  TEST_ASSERT_EQUAL_STRING("\xef\xbf\xbd", m.title);
+  TEST_ASSERT_EQUAL_STRING("\xef\xbf\xbd"
+                           "A",
+                           m.message);
+}
+
+TEST_CASE("decode fields, numbers and skipped values", "[ble_proto]") {
+  char buf[256];
+  ble_msg_t m;
+
+  TEST_ASSERT_EQUAL_INT(0, decode(" { \"cmd\" : \"framing\", \"mode\":\"cbor\", \"extra\":{\"a\":[1,2,{\"b\":null}],\"c\":true},"
+                                  "\"seq\":-12.5e3, \"size\":\"big\", \"since\":4294967296, \"comp\":false }",
+                                  buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_UINT32(BLE_MSG_CMD | BLE_MSG_MODE | BLE_MSG_SEQ | BLE_MSG_SINCE, m.fields);
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_FRAMING, m.cmd);
+  TEST_ASSERT_EQUAL_STRING("cbor", m.mode);
+  TEST_ASSERT_TRUE(m.seq == -12); // fraction and exponent dropped
+  TEST_ASSERT_TRUE(m.since == 4294967296LL);
+  TEST_ASSERT_EQUAL_STRING("", m.comp);
+  TEST_ASSERT_EQUAL_STRING("", m.name);
+
+  TEST_ASSERT_EQUAL_INT(0, decode("{\"datetime\":\"2024-2-29T23:05:09Z\",\"cmd\":\"reboot\"}", buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_UINT32(BLE_MSG_DATETIME | BLE_MSG_CMD, m.fields);
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_UNKNOWN, m.cmd);
+  TEST_ASSERT_EQUAL_INT(2024, m.datetime.year);
+  TEST_ASSERT_EQUAL_INT(2, m.datetime.month);
+  TEST_ASSERT_EQUAL_INT(29, m.datetime.day);
+  TEST_ASSERT_EQUAL_INT(23, m.datetime.hour);
+  TEST_ASSERT_EQUAL_INT(5, m.datetime.minute);
+  TEST_ASSERT_EQUAL_INT(9, m.datetime.second);
+
+  // Out of range numbers saturate
+  TEST_ASSERT_EQUAL_INT(0, decode("{\"since\":99999999999999999999,\"seq\":-99999999999999999999,\"size\":-0}",
+                                  buf, sizeof(buf), &m));
+  TEST_ASSERT_TRUE(m.since == INT64_MAX);
+  TEST_ASSERT_TRUE(m.seq == INT64_MIN);
+  TEST_ASSERT_TRUE(m.size == 0);
+
+  TEST_ASSERT_EQUAL_INT(0, decode("{\"datetime\":\"yesterday\"}", buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_UINT32(0, m.fields);
+  TEST_ASSERT_EQUAL_INT(0, decode("{}", buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_NONE, m.cmd);
+}
+
+TEST_CASE("decode rejects malformed lines", "[ble_proto]") {
+  static const char *bad[] = {
+      "",
+      "   ",
+      "[]",
+      "\"cmd\"",
+      "{",
+      "{\"cmd\"}",
+      "{\"cmd\":}",
+      "{\"cmd\":\"heap\",}",
+      "{\"cmd\":\"heap\" \"to\":\"x\"}",
+      "{\"cmd\":\"heap",
+      "{\"cmd\":\"\\q\"}",
+      "{\"cmd\":\"\\u12\"}",
+      "{\"cmd\":\"\\u12zz\"}",
+      "{\"cmd\":\"a\\",
+      "{\"cmd\":tru}",
+      "{\"cmd\":nul}",
+      "{\"seq\":-}",
+      "{\"seq\":[1,2",
+      "{cmd:\"heap\"}",
+      "{\"cmd\":\"a\tb\"}", // raw control character
+  };
+  char buf[64];
+  ble_msg_t m;
+
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    char what[80];
+    snprintf(what, sizeof(what), "accepted: %s", bad[i]);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, decode(bad[i], buf, sizeof(buf), &m), what);
+  }
+
+  // The length bounds the parse, not the NUL
+  strcpy(buf, "{\"cmd\":\"heap\"}");
+  TEST_ASSERT_EQUAL_INT(-1, ble_proto_decode(buf, strlen(buf) - 1, &m));
+}
+
+TEST_CASE("JSON writer escapes and round trips", "[ble_proto]") {
+  char out[256];
+  char buf[256];
+  ble_jw_t w;
+  ble_msg_t m;
+
+  ble_jw_init(&w, out, sizeof(out));
+  ble_jw_begin_object(&w, NULL);
+  ble_jw_str(&w, "cmd", "file_open");
+  ble_jw_str(&w, "name", "a\"b\\c\n\x01\xc3\xa9");
+  ble_jw_int(&w, "size", -9223372036854775807LL - 1);
+  ble_jw_int(&w, "crc", 0);
+  ble_jw_begin_array(&w, "list");
+  ble_jw_bool(&w, NULL, true);
+  ble_jw_int(&w, NULL, 7);
+  ble_jw_end_array(&w);
+  ble_jw_end_object(&w);
+  size_t n = ble_jw_finish(&w);
+  TEST_ASSERT_EQUAL_STRING("{\"cmd\":\"file_open\",\"name\":\"a\\\"b\\\\c\\n\\u0001\xc3\xa9\","
+                           "\"size\":-9223372036854775808,\"crc\":0,\"list\":[true,7]}",
+                           out);
+  TEST_ASSERT_EQUAL_UINT32(strlen(out), n);
+
+  TEST_ASSERT_EQUAL_INT(0, decode(out, buf, sizeof(buf), &m));
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_FILE_OPEN, m.cmd);
+  TEST_ASSERT_EQUAL_STRING("a\"b\\c\n\x01\xc3\xa9", m.name);
+  TEST_ASSERT_TRUE(m.size == INT64_MIN);
+  TEST_ASSERT_EQUAL_UINT32(BLE_MSG_CMD | BLE_MSG_NAME | BLE_MSG_SIZE | BLE_MSG_CRC, m.fields);
+
+  // Too small, or left open: nothing
+  ble_jw_init(&w, out, 8);
+  ble_jw_begin_object(&w, NULL);
+  ble_jw_str(&w, "cmd", "heap");
+  ble_jw_end_object(&w);
+  TEST_ASSERT_EQUAL_UINT32(0, ble_jw_finish(&w));
+  TEST_ASSERT_EQUAL_STRING("", out);
+  ble_jw_init(&w, out, sizeof(out));
+  ble_jw_begin_object(&w, NULL);
+  TEST_ASSERT_EQUAL_UINT32(0, ble_jw_finish(&w));
+}
+
+TEST_CASE("CBOR writer and decoder round trip", "[ble_proto]") {
+  uint8_t out[256];
+  ble_jw_t w;
+  ble_msg_t m;
+
+  ble_jw_init_cbor(&w, out, sizeof(out));
+  ble_jw_begin_object(&w, NULL);
+  ble_jw_str(&w, "cmd", "sync");
+  ble_jw_int(&w, "since", 4294967296LL);
+  ble_jw_int(&w, "seq", -300);
+  ble_jw_int(&w, "size", 23);
+  ble_jw_int(&w, "bytes", 24);
+  ble_jw_str(&w, "name", "\xc3\xa9t\xc3\xa9");
+  ble_jw_str(&w, "to", "");
+  ble_jw_begin_object(&w, "skip");
+  ble_jw_begin_array(&w, "a");
+  ble_jw_bool(&w, NULL, false);
+  ble_jw_str(&w, NULL, "x");
+  ble_jw_end_array(&w);
+  ble_jw_end_object(&w);
+  ble_jw_str(&w, "datetime", "2025-01-02T03:04:05");
+  ble_jw_end_object(&w);
+  size_t n = ble_jw_finish(&w);
+  TEST_ASSERT_GREATER_THAN(0, n);
+  TEST_ASSERT_EQUAL_HEX8(0xBF, out[0]); // indefinite-length map
+  TEST_ASSERT_EQUAL_HEX8(0xFF, out[n - 1]);
+
+  TEST_ASSERT_EQUAL_INT(0, ble_proto_decode_cbor(out, n, &m));
+  TEST_ASSERT_EQUAL_UINT32(BLE_MSG_CMD | BLE_MSG_SINCE | BLE_MSG_SEQ | BLE_MSG_SIZE | BLE_MSG_BYTES | BLE_MSG_NAME | BLE_MSG_TO |
+                               BLE_MSG_DATETIME,
+                           m.fields);
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_SYNC, m.cmd);
+  TEST_ASSERT_TRUE(m.since == 4294967296LL);
+  TEST_ASSERT_TRUE(m.seq == -300);
+  TEST_ASSERT_TRUE(m.size == 23);
+  TEST_ASSERT_TRUE(m.bytes == 24);
+  TEST_ASSERT_EQUAL_STRING("\xc3\xa9t\xc3\xa9", m.name);
+  TEST_ASSERT_EQUAL_STRING("", m.to);
+  TEST_ASSERT_EQUAL_INT(5, m.datetime.second);
+
+  // A definite-length map written by hand: {"cmd":"heap","sample":-1}
+  uint8_t def[] = {0xA2, 0x63, 'c', 'm', 'd', 0x64, 'h', 'e', 'a', 'p', 0x66, 's', 'a', 'm', 'p', 'l', 'e', 0x20};
+  TEST_ASSERT_EQUAL_INT(0, ble_proto_decode_cbor(def, sizeof(def), &m));
+  TEST_ASSERT_EQUAL_INT(BLE_CMD_HEAP, m.cmd);
+  TEST_ASSERT_TRUE(m.sample == -1);
+
+  // Truncated anywhere, or not a map
+  ble_jw_init_cbor(&w, out, sizeof(out));
+  ble_jw_begin_object(&w, NULL);
+  ble_jw_str(&w, "cmd", "heap");
+  ble_jw_begin_array(&w, "a");
+  ble_jw_int(&w, NULL, 1000);
+  ble_jw_end_array(&w);
+  ble_jw_end_object(&w);
+  n = ble_jw_finish(&w);
+  uint8_t copy[64];
+  for (size_t cut = 0; cut < n; ++cut) {
+    memcpy(copy, out, n);
+    TEST_ASSERT_EQUAL_INT(-1, ble_proto_decode_cbor(copy, cut, &m));
+  }
+  uint8_t arr[] = {0x81, 0x01};
+  TEST_ASSERT_EQUAL_INT(-1, ble_proto_decode_cbor(arr, sizeof(arr), &m));
+  uint8_t int_key[] = {0xA1, 0x01, 0x02};
+  TEST_ASSERT_EQUAL_INT(-1, ble_proto_decode_cbor(int_key, sizeof(int_key), &m));
+  uint8_t bad_info[] = {0xA1, 0x63, 'c', 'm', 'd', 0x1C};
+  TEST_ASSERT_EQUAL_INT(-1, ble_proto_decode_cbor(bad_info, sizeof(bad_info), &m));
+}
+
+TEST_CASE("frames are sealed and checked", "[ble_proto]") {
+  static const char payload[] = "{\"cmd\":\"heap\"}";
+  uint8_t frame[64];
+  ble_frame_t f;
+
+  size_t plen = strlen(payload);
+  memcpy(frame + BLE_FRAME_HDR, payload, plen);
+  size_t n = ble_frame_seal(frame, BLE_FRAME_JSON | BLE_FRAME_F_LZ, 200, plen);
+  TEST_ASSERT_EQUAL_UINT32(plen + BLE_FRAME_OVERHEAD, n);
+  TEST_ASSERT_EQUAL_HEX8(BLE_FRAME_SYNC, frame[0]);
+
+  TEST_ASSERT_EQUAL_INT(0, ble_frame_open(frame, n, &f));
+  TEST_ASSERT_EQUAL_HEX8(BLE_FRAME_JSON | BLE_FRAME_F_LZ, f.type);
+  TEST_ASSERT_EQUAL_UINT8(200, f.seq);
+  TEST_ASSERT_EQUAL_UINT32(plen, f.len);
+  TEST_ASSERT_EQUAL_PTR(frame + BLE_FRAME_HDR, f.payload);
+  TEST_ASSERT_EQUAL_MEMORY(payload, f.payload, plen);
+
+  // Length: shorter or longer than the header says, or below the overhead
+  TEST_ASSERT_EQUAL_INT(-1, ble_frame_open(frame, n - 1, &f));
+  TEST_ASSERT_EQUAL_INT(-1, ble_frame_open(frame, n + 1, &f));
+  TEST_ASSERT_EQUAL_INT(-1, ble_frame_open(frame, BLE_FRAME_OVERHEAD - 1, &f));
+
+  // Any single flipped bit after the sync byte fails the CRC
+  for (size_t i = 1; i < n; ++i) {
+    for (int bit = 0; bit < 8; ++bit) {
+      frame[i] ^= 1u << bit;
+      if (ble_frame_open(frame, n, &f) == 0)
+        TEST_FAIL_MESSAGE("corrupt frame accepted");
+      frame[i] ^= 1u << bit;
+    }
+  }
+  frame[0] = 0x5A;
+  TEST_ASSERT_EQUAL_INT(-1, ble_frame_open(frame, n, &f));
+  frame[0] = BLE_FRAME_SYNC;
+
+  // An empty payload is a valid frame
+  n = ble_frame_seal(frame, BLE_FRAME_RAW, 0, 0);
+  TEST_ASSERT_EQUAL_UINT32(BLE_FRAME_OVERHEAD, n);
+  TEST_ASSERT_EQUAL_INT(0, ble_frame_open(frame, n, &f));
+  TEST_ASSERT_EQUAL_UINT32(0, f.len);
+}
+
+TEST_CASE("CRC-32 matches zlib", "[ble_proto]") {
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, ble_crc32(0, "123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, ble_crc32(ble_crc32(0, "1234", 4), "56789", 5));
+  TEST_ASSERT_EQUAL_HEX32(0, ble_crc32(0, "", 0));
+}
@@ -0,0 +1,119 @@
+#include "unity.h"
+
+#include "ble_status.h"
+
+static unsigned next(ble_status_model_t *m, const ble_status_t *cur, bool key, uint16_t *seq, uint16_t *base) {
+  *seq = *base = 0xFFFF;
+  return ble_status_next(m, cur, key, seq, base);
+}
+
+TEST_CASE("keyframes until the phone acknowledges", "[ble_status]") {
+  ble_status_model_t m;
+  ble_status_t cur = {.battery = 80, .charging = false, .vbus = false, .steps = 1000};
+  uint16_t seq, base;
+
+  ble_status_reset(&m);
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(1, seq);
+  TEST_ASSERT_EQUAL_UINT16(0, base);
+  // Nothing new
+  TEST_ASSERT_EQUAL_UINT32(0, next(&m, &cur, false, &seq, &base));
+  // Asked for
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, true, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(2, seq);
+  // No ack yet: a change is still a keyframe
+  cur.steps++;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(3, seq);
+}
+
+TEST_CASE("deltas against the acknowledged state", "[ble_status]") {
+  ble_status_model_t m;
+  ble_status_t cur = {.battery = 80, .charging = false, .vbus = false, .steps = 1000};
+  uint16_t seq, base;
+
+  ble_status_reset(&m);
+  next(&m, &cur, false, &seq, &base);
+  TEST_ASSERT_TRUE(ble_status_ack(&m, 1));
+
+  cur.battery = 79;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_BATTERY, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(2, seq);
+  TEST_ASSERT_EQUAL_UINT16(1, base);
+
+  // Seq 2 not acknowledged (lost): the next delta carries its field too
+  cur.steps = 1010;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_BATTERY | BLE_STATUS_STEPS, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(3, seq);
+  TEST_ASSERT_EQUAL_UINT16(1, base);
+
+  TEST_ASSERT_TRUE(ble_status_ack(&m, 3));
+  cur.charging = cur.vbus = true;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_CHARGING | BLE_STATUS_VBUS, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(4, seq);
+  TEST_ASSERT_EQUAL_UINT16(3, base);
+
+  // Back to the acknowledged state: an empty delta would say nothing
+  cur.charging = cur.vbus = false;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(0, base);
+
+  // A keyframe on request even with an acknowledged state
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, true, &seq, &base));
+}
+
+TEST_CASE("acks out of order, unknown or evicted", "[ble_status]") {
+  ble_status_model_t m;
+  ble_status_t cur = {.battery = 50};
+  uint16_t seq, base;
+
+  ble_status_reset(&m);
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 0));
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 1)); // never sent
+  for (int i = 0; i < 6; ++i) {
+    cur.steps = i;
+    next(&m, &cur, false, &seq, &base);
+  }
+  TEST_ASSERT_EQUAL_UINT16(6, seq);
+  // Only the last BLE_STATUS_INFLIGHT are remembered
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 2));
+  TEST_ASSERT_TRUE(ble_status_ack(&m, 5));
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 4)); // older than the state acknowledged
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 5));
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 99));
+
+  cur.steps = 4; // seq 5 had steps 4
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, false, &seq, &base));
+  cur.battery = 49;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_BATTERY, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(5, base);
+}
+
+TEST_CASE("unsent updates and seq wrap", "[ble_status]") {
+  ble_status_model_t m;
+  ble_status_t cur = {.battery = 50};
+  uint16_t seq, base;
+
+  ble_status_reset(&m);
+  next(&m, &cur, false, &seq, &base);
+  ble_status_unsent(&m);
+  // Unchanged, but the last one never went out
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_ALL, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(2, seq);
+
+  // As if 65532 updates had gone before
+  ble_status_reset(&m);
+  m.seq = 0xFFFC;
+  for (int i = 0; i < 3; ++i) {
+    cur.steps = i;
+    next(&m, &cur, false, &seq, &base);
+  }
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, seq);
+  TEST_ASSERT_TRUE(ble_status_ack(&m, 0xFFFF));
+  cur.battery = 49;
+  TEST_ASSERT_EQUAL_UINT32(BLE_STATUS_BATTERY, next(&m, &cur, false, &seq, &base));
+  TEST_ASSERT_EQUAL_UINT16(0, seq);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, base);
+  TEST_ASSERT_TRUE(ble_status_ack(&m, 0)); // newer across the wrap
+  TEST_ASSERT_FALSE(ble_status_ack(&m, 0xFFFF));
+}
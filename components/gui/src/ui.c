@@ -21,6 +21,7 @@
 #include "batt_screen.h"
 #include "driver/gpio.h"
 #include "lvgl_spiffs_fs.h"
+#include "lwmalloc.h"
 
 static const char* TAG = "UI";
 
@@ -36,6 +37,12 @@ static lv_obj_t* dynamic_tile = NULL; // temporary tile right of controls
 static lv_obj_t* dynamic_subtile = NULL; // second-level tile to the right of dynamic tile
 static lv_obj_t* dynamic_subtile_source = NULL; // track where dynamic_subtile was opened from
 
+// Objects built into a dynamic tile are bump-allocated from a per-tile arena
+// between acquire and show; closing the tile hands the whole arena back.
+#define DYNAMIC_TILE_ARENA_CHUNK (8 * 1024)
+static lw_arena_t* dynamic_tile_arena = NULL;
+static lw_arena_t* dynamic_subtile_arena = NULL;
+
 
 lv_obj_t* get_main_screen(void) { return main_screen; }
 
@@ -53,6 +60,21 @@ lv_obj_t* get_main_screen(void) { return main_screen; }
 static lv_style_t main_style;
 static void tileview_change_cb(lv_event_t* e);
 
+// Start routing this task's allocations into a fresh arena for a tile
+static void dynamic_arena_begin(lw_arena_t** arena) {
+  lw_arena_release(*arena);
+  *arena = lw_arena_create(DYNAMIC_TILE_ARENA_CHUNK);
+  if (*arena) {
+    lw_arena_set_current(*arena);
+  }
+}
+
+// Tile content is gone: stop routing and free the arena once it drains
+static void dynamic_arena_end(lw_arena_t** arena) {
+  lw_arena_release(*arena);
+  *arena = NULL;
+}
+
 void init_theme(void) {
 
   lv_style_init(&main_style);
@@ -130,6 +152,7 @@ static void tileview_change_cb(lv_event_t* e)
     lv_tileview_set_tile(main_screen, dynamic_subtile_source, LV_ANIM_ON);
     lv_obj_del(dynamic_subtile);
     dynamic_subtile = NULL;
+    dynamic_arena_end(&dynamic_subtile_arena);
     dynamic_subtile_source = NULL;
     return;
   }
@@ -139,6 +162,7 @@ static void tileview_change_cb(lv_event_t* e)
     ESP_LOGI(TAG, "Auto-clean: deleting dynamic subtile (3,1)");
     lv_obj_del(dynamic_subtile);
     dynamic_subtile = NULL;
+    dynamic_arena_end(&dynamic_subtile_arena);
     dynamic_subtile_source = NULL; // Clear source tracking
   }
   // Delete level-1 if neither level-1 nor level-2 are active
@@ -146,6 +170,7 @@ static void tileview_change_cb(lv_event_t* e)
     ESP_LOGI(TAG, "Auto-clean: deleting dynamic tile (2,1)");
     lv_obj_del(dynamic_tile);
     dynamic_tile = NULL;
+    dynamic_arena_end(&dynamic_tile_arena);
   }
 }
 
@@ -155,6 +180,7 @@ lv_obj_t* ui_dynamic_tile_acquire(void) {
   if (dynamic_tile) {
     // Clean existing content for reuse
     lv_obj_clean(dynamic_tile);
+    dynamic_arena_begin(&dynamic_tile_arena);
     ESP_LOGI(TAG, "Reusing dynamic tile (2,1)");    
     return dynamic_tile;
   }
@@ -164,6 +190,7 @@ lv_obj_t* ui_dynamic_tile_acquire(void) {
     //lv_obj_add_style(dynamic_tile, &main_style, 0);
     //lv_obj_set_size(dynamic_tile, LV_PCT(100), LV_PCT(100));
     lv_obj_update_layout(main_screen);
+    dynamic_arena_begin(&dynamic_tile_arena);
     ESP_LOGI(TAG, "Created dynamic tile (2,1)");
   }
   return dynamic_tile;
@@ -174,6 +201,7 @@ lv_obj_t* ui_dynamic_tile_acquire(void) {
 void ui_dynamic_tile_show(void) {  
   if (!dynamic_tile || !main_screen) return;
   ESP_LOGI(TAG, "Showing dynamic tile (2,1)");
+  lw_arena_set_current(NULL); // content is built
   
   if (active_screen_get() != get_main_screen()) {
     load_screen(NULL, get_main_screen(), LV_SCR_LOAD_ANIM_NONE);
@@ -189,6 +217,7 @@ lv_obj_t* ui_dynamic_subtile_acquire(void) {
   if (!main_screen) return NULL;
   if (dynamic_subtile) {
     lv_obj_clean(dynamic_subtile);
+    dynamic_arena_begin(&dynamic_subtile_arena);
     return dynamic_subtile;
   }
   // Only allow LEFT direction to force proper back navigation
@@ -200,6 +229,7 @@ lv_obj_t* ui_dynamic_subtile_acquire(void) {
     if (dynamic_tile) {
       lv_obj_update_layout(dynamic_tile);
     }
+    dynamic_arena_begin(&dynamic_subtile_arena);
     ESP_LOGI(TAG, "Created dynamic subtile (3,1)");
   }
   return dynamic_subtile;
@@ -209,6 +239,7 @@ lv_obj_t* ui_dynamic_subtile_acquire(void) {
 void ui_dynamic_subtile_show(void) {
   if (!dynamic_subtile || !main_screen) return;
   ESP_LOGI(TAG, "Showing dynamic tile (3,1)");
+  lw_arena_set_current(NULL); // content is built
   if (active_screen_get() != get_main_screen()) {
     load_screen(NULL, get_main_screen(), LV_SCR_LOAD_ANIM_NONE);
   }
@@ -240,6 +271,7 @@ void ui_dynamic_subtile_close(void) {
     ESP_LOGI(TAG, "Deleting dynamic subtile (3,1)");
     lv_obj_del(dynamic_subtile);
     dynamic_subtile = NULL;
+    dynamic_arena_end(&dynamic_subtile_arena);
   }
 }
 
@@ -254,6 +286,7 @@ void ui_dynamic_tile_close(void) {
     ESP_LOGI(TAG, "Deleting dynamic tile (2,1)");
     lv_obj_del(dynamic_tile);
     dynamic_tile = NULL;
+    dynamic_arena_end(&dynamic_tile_arena);
   }
 }
 
@@ -0,0 +1,187 @@
+/*
+ * Size-class generator for lwmalloc's slab bins.
+ *
+ * Reads allocation traces recorded on the watch (CONFIG_LWMALLOC_TRACE, see
+ * lw_trace_bench.c for the formats) and picks dedicated slab classes for the
+ * dominant request sizes above the 8-byte bins (> 120 bytes). The result is
+ * the header lwmalloc.c is built with:
+ *
+ *   gcc -O2 -Icomponents/lwmalloc/include components/lwmalloc/host/lw_size_classes.c \
+ *       -o lw_size_classes
+ *   ./lw_size_classes lwtrace.bin [more traces...] > components/lwmalloc/lw_size_classes.h
+ *
+ * Options:
+ *   -n <count>     classes to pick at most (default 8, the most lwmalloc takes)
+ *   -w <percent>   largest waste a class may impose on a request (default 12)
+ *   -m <permille>  share of all allocations a class must serve (default 10)
+ *   -M <bytes>     largest slab block, header included (default 1024)
+ *
+ * Classes are picked greedily: each round takes the block size that serves
+ * the most not yet covered allocations within the waste limit. Request sizes
+ * are counted from malloc and realloc records.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lwmalloc.h"
+
+#define BIN_MAX 128    // largest 8-byte bin block; slabs start above it
+#define MAX_CLASSES 8  // fits lw_heap_stats_t.classes
+#define MAX_BLOCK 4096 // one bin chunk
+
+static uint64_t hist[MAX_BLOCK / 8 + 1]; // allocations per block size / 8
+static uint64_t total;
+
+static void count(uint32_t size)
+{
+    size_t asize = ((size_t)size + 8 + 7) & ~(size_t)7;
+    total++;
+    if (asize > BIN_MAX && asize <= MAX_BLOCK)
+        hist[asize / 8]++;
+}
+
+static int load(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    lw_trace_file_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, "LWTR", 4) == 0) {
+        lw_trace_rec_t rec;
+        if (hdr.rec_size != sizeof(rec)) {
+            fclose(f);
+            return -1;
+        }
+        while (fread(&rec, sizeof(rec), 1, f) == 1) {
+            uint32_t op = rec.size_op >> LW_TRACE_OP_SHIFT;
+            if (op == LW_TRACE_MALLOC || op == LW_TRACE_REALLOC_TO)
+                count(rec.size_op & LW_TRACE_SIZE_MASK);
+        }
+        fclose(f);
+        return 0;
+    }
+
+    rewind(f);
+    char line[128], op;
+    unsigned id, size;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, " %c %u %u", &op, &id, &size) == 3 && (op == 'a' || op == 'r'))
+            count(size);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Smallest request block a class of block size c may serve.
+static size_t window_low(size_t c, int waste_pct)
+{
+    size_t low = c - (c * waste_pct / 100 / 8) * 8;
+    return low > BIN_MAX ? low : BIN_MAX + 8;
+}
+
+int main(int argc, char** argv)
+{
+    int max_classes = MAX_CLASSES, waste_pct = 12, min_permille = 10;
+    size_t max_block = 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:m:M:")) != -1) {
+        switch (opt) {
+        case 'n': max_classes = atoi(optarg); break;
+        case 'w': waste_pct = atoi(optarg); break;
+        case 'm': min_permille = atoi(optarg); break;
+        case 'M': max_block = (size_t)atol(optarg) & ~(size_t)7; break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] [-w percent] [-m permille] [-M bytes] trace...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (max_classes > MAX_CLASSES)
+        max_classes = MAX_CLASSES;
+    if (max_block > MAX_BLOCK)
+        max_block = MAX_BLOCK;
+    for (int i = optind; i < argc; i++) {
+        if (load(argv[i]) != 0) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    static uint8_t covered[MAX_BLOCK / 8 + 1];
+    size_t classes[MAX_CLASSES];
+    uint64_t served[MAX_CLASSES];
+    int n = 0;
+
+    while (n < max_classes && total != 0) {
+        size_t best = 0;
+        uint64_t best_gain = 0;
+        // Only sizes that were actually requested are candidates.
+        for (size_t c = BIN_MAX + 8; c <= max_block; c += 8) {
+            if (hist[c / 8] == 0 || covered[c / 8])
+                continue;
+            uint64_t gain = 0;
+            for (size_t s = window_low(c, waste_pct); s <= c; s += 8)
+                gain += covered[s / 8] ? 0 : hist[s / 8];
+            if (gain > best_gain) {
+                best_gain = gain;
+                best = c;
+            }
+        }
+        if (best == 0 || best_gain * 1000 < (uint64_t)min_permille * total)
+            break;
+        for (size_t s = window_low(best, waste_pct); s <= best; s += 8)
+            covered[s / 8] = 1;
+        classes[n] = best;
+        served[n++] = best_gain;
+    }
+
+    // Ascending, so a request maps to the smallest class that fits.
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && classes[j - 1] > classes[j]; j--) {
+            size_t c = classes[j];
+            classes[j] = classes[j - 1];
+            classes[j - 1] = c;
+            uint64_t s = served[j];
+            served[j] = served[j - 1];
+            served[j - 1] = s;
+        }
+    }
+
+    printf("/*\n * lwmalloc slab classes above the 8-byte bins. Generated by\n");
+    printf(" * host/lw_size_classes.c from %llu recorded allocations; do not edit.\n",
+           (unsigned long long)total);
+    printf(" * Options: -n %d -w %d -m %d -M %zu\n", max_classes, waste_pct, min_permille, max_block);
+    for (int i = 0; i < n; i++)
+        printf(" *   %4zu B block: %5.1f%% of allocations\n", classes[i], 100.0 * served[i] / total);
+    printf(" */\n#pragma once\n\n");
+    printf("#define LW_SLAB_COUNT %d\n", n);
+    if (n == 0) {
+        printf("#define LW_SLAB_MAX %d\n", BIN_MAX);
+        return 0;
+    }
+    printf("#define LW_SLAB_MAX %zu\n\n", classes[n - 1]);
+
+    printf("/* Block sizes, header included. */\n#define LW_SLAB_SIZES {");
+    for (int i = 0; i < n; i++)
+        printf("%s %zu", i ? "," : "", classes[i]);
+    printf(" }\n\n");
+
+    // Entry k is for block size BIN_MAX + 8 * (k + 1): slab index + 1, or 0.
+    printf("/* Slab index + 1 per block size (%d + 8 * (i + 1)); 0 goes to the large heap. */\n",
+           BIN_MAX);
+    printf("#define LW_SLAB_LOOKUP {");
+    for (size_t s = BIN_MAX + 8, k = 0; s <= classes[n - 1]; s += 8, k++) {
+        int idx = 0;
+        for (int i = 0; i < n && !idx; i++) {
+            if (s <= classes[i] && s >= window_low(classes[i], waste_pct))
+                idx = i + 1;
+        }
+        printf("%s%s%d", k ? "," : "", k % 16 ? " " : "\\\n\t", idx);
+    }
+    printf(" }\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Host stress benchmark for lwmalloc's locking and per-thread magazines.
+ *
+ * Build and run on Linux (lwmalloc replaces the process malloc):
+ *   gcc -O2 -pthread -Icomponents/lwmalloc/include \
+ *       components/lwmalloc/lwmalloc.c components/lwmalloc/host/lw_stress_bench.c \
+ *       -o lw_stress_bench
+ *   ./lw_stress_bench [ops_per_thread]
+ *
+ * Each thread keeps a window of live blocks and randomly replaces them with a
+ * size mix close to the watch workload (mostly <= 120 B LVGL objects, some
+ * strings and JSON buffers). Blocks are occasionally handed to the next
+ * thread so cross-thread frees are exercised too.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwmalloc.h"
+
+#define WINDOW 256
+#define HANDOFF_SLOTS 64
+#define MAX_THREADS 8
+
+typedef struct {
+    int id;
+    long ops;
+    uint32_t seed;
+} worker_t;
+
+static void* handoff[MAX_THREADS][HANDOFF_SLOTS];
+static pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nthreads_running;
+
+static uint32_t xorshift(uint32_t* s)
+{
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static size_t pick_size(uint32_t* seed)
+{
+    uint32_t r = xorshift(seed) % 100;
+    if (r < 70)
+        return 8 + xorshift(seed) % 113;      // small objects
+    if (r < 95)
+        return 121 + xorshift(seed) % 900;    // labels, strings
+    return 1024 + xorshift(seed) % 7168;      // JSON documents, buffers
+}
+
+static void* worker(void* arg)
+{
+    worker_t* w = (worker_t*)arg;
+    void* live[WINDOW] = { 0 };
+
+    for (long i = 0; i < w->ops; i++) {
+        int slot = xorshift(&w->seed) % WINDOW;
+        if (live[slot]) {
+            if ((xorshift(&w->seed) & 31) == 0) {
+                // Pass the block to the neighbour; free whatever was parked there.
+                int peer = (w->id + 1) % nthreads_running;
+                int hs = xorshift(&w->seed) % HANDOFF_SLOTS;
+                pthread_mutex_lock(&handoff_lock);
+                void* old = handoff[peer][hs];
+                handoff[peer][hs] = live[slot];
+                pthread_mutex_unlock(&handoff_lock);
+                free(old);
+            } else {
+                free(live[slot]);
+            }
+            live[slot] = NULL;
+        } else {
+            size_t sz = pick_size(&w->seed);
+            live[slot] = malloc(sz);
+            if (!live[slot]) {
+                fprintf(stderr, "thread %d: malloc(%zu) failed\n", w->id, sz);
+                exit(1);
+            }
+            memset(live[slot], w->id, sz < 64 ? sz : 64);
+        }
+    }
+    for (int i = 0; i < WINDOW; i++)
+        free(live[i]);
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int threads, long ops)
+{
+    pthread_t tid[MAX_THREADS];
+    worker_t w[MAX_THREADS];
+    lw_lock_stats_t st;
+
+    nthreads_running = threads;
+    lw_reset_lock_stats();
+    double t0 = now_s();
+    for (int i = 0; i < threads; i++) {
+        w[i].id = i;
+        w[i].ops = ops;
+        w[i].seed = 0x9E3779B9u * (i + 1);
+        pthread_create(&tid[i], NULL, worker, &w[i]);
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_join(tid[i], NULL);
+    double dt = now_s() - t0;
+
+    for (int t = 0; t < MAX_THREADS; t++) {
+        for (int i = 0; i < HANDOFF_SLOTS; i++) {
+            free(handoff[t][i]);
+            handoff[t][i] = NULL;
+        }
+    }
+
+    lw_get_lock_stats(&st);
+    printf("threads=%d ops=%ld time=%.3fs ops/s=%.0f lock=%u contended=%u (%.2f%%) refills=%u flushes=%u\n",
+           threads, ops * threads, dt, (ops * threads) / dt,
+           st.lock_acquires, st.lock_contended,
+           st.lock_acquires ? 100.0 * st.lock_contended / st.lock_acquires : 0.0,
+           st.mag_refills, st.mag_flushes);
+}
+
+int main(int argc, char** argv)
+{
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    const int counts[] = { 1, 2, 8 };
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+        run(counts[i], ops);
+    return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ * Host replay benchmark: replays an allocation trace through whatever
+ * malloc the binary is linked with and reports per-operation latency
+ * percentiles, peak RSS and fragmentation (RSS growth during the replay over
+ * peak live bytes).
+ *
+ * Build against the current allocator:
+ *   gcc -O2 -pthread -Icomponents/lwmalloc/include \
+ *       components/lwmalloc/lwmalloc.c components/lwmalloc/host/lw_trace_bench.c \
+ *       -o lw_trace_bench
+ * Build against glibc:
+ *   gcc -O2 -Icomponents/lwmalloc/include components/lwmalloc/host/lw_trace_bench.c \
+ *       -o lw_trace_bench_glibc
+ * Build against TLSF (the allocator behind ESP-IDF's heap_caps), using
+ * tlsf.c/tlsf.h from https://github.com/mattconte/tlsf:
+ *   gcc -O2 -DLW_BENCH_TLSF -I<tlsf> -Icomponents/lwmalloc/include \
+ *       <tlsf>/tlsf.c components/lwmalloc/host/lw_trace_bench.c -o lw_trace_bench_tlsf
+ * Build against an older revision for comparison:
+ *   git show <rev>:main/lwmalloc.c > /tmp/lwmalloc_old.c
+ *   gcc -O2 -pthread -Icomponents/lwmalloc/include /tmp/lwmalloc_old.c \
+ *       components/lwmalloc/host/lw_trace_bench.c -o lw_trace_bench_old
+ *
+ * Usage: lw_trace_bench [--no-idle] [trace.txt | lwtrace.bin]
+ *
+ * Binary traces are the files written by the watch with
+ * CONFIG_LWMALLOC_TRACE: lw_trace_dump() on SPIFFS, or the base64 chunks of
+ * {"cmd":"trace"} decoded and concatenated. Pointers are mapped to dense ids
+ * on load; the recorded timestamps are not replayed. RSS growth is measured
+ * against the RSS right before the replay, so pages the allocator already
+ * touched while the trace was loaded are not counted again.
+ *
+ * Trace lines: "a <id> <size>" (malloc), "r <id> <size>" (realloc),
+ * "f <id>" (free), "i" (idle: the UI task waits for the next frame). Without a
+ * file a synthetic LVGL trace is generated: tile screens built from a few
+ * hundred objects and label texts, clock and step label churn, notification
+ * bursts and screen teardown.
+ *
+ * When linked with lwmalloc, idle points run lw_coalesce_idle() like the
+ * FreeRTOS idle hook does, and the coalescing pause statistics are printed.
+ * Pass --no-idle to see the pauses without the idle hook.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwmalloc.h"
+
+#define MAX_IDS 65536
+
+// Weak so the bench still links against allocators without these hooks.
+extern bool lw_coalesce_idle(void) __attribute__((weak));
+extern void lw_get_coalesce_stats(lw_coalesce_stats_t* out) __attribute__((weak));
+extern void lw_heap_stats(lw_heap_stats_t* out) __attribute__((weak));
+
+enum { OP_ALLOC, OP_REALLOC, OP_FREE, OP_IDLE };
+
+typedef struct {
+    uint8_t op;
+    uint32_t id;
+    uint32_t size;
+} trace_op_t;
+
+typedef struct {
+    trace_op_t* ops;
+    size_t count;
+    size_t cap;
+} trace_t;
+
+static void trace_push(trace_t* t, int op, uint32_t id, uint32_t size)
+{
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        t->ops = realloc(t->ops, t->cap * sizeof(trace_op_t));
+    }
+    t->ops[t->count++] = (trace_op_t){ (uint8_t)op, id, size };
+}
+
+#ifdef LW_BENCH_TLSF
+#include "tlsf.h"
+
+#define TLSF_POOL_BYTES (64u << 20)
+static tlsf_t tlsf;
+
+static void* bench_malloc(size_t size)
+{
+    if (!tlsf) {
+        void* pool = NULL;
+        if (posix_memalign(&pool, 64, TLSF_POOL_BYTES) != 0)
+            return NULL;
+        tlsf = tlsf_create_with_pool(pool, TLSF_POOL_BYTES);
+    }
+    return tlsf_malloc(tlsf, size);
+}
+#define bench_realloc(p, size) tlsf_realloc(tlsf, p, size)
+#define bench_free(p) tlsf_free(tlsf, p)
+#else
+#define bench_malloc malloc
+#define bench_realloc realloc
+#define bench_free free
+#endif
+
+// Open-addressing map from recorded pointer id to dense trace id.
+#define ID_MAP_SIZE (MAX_IDS * 2)
+static uint32_t map_key[ID_MAP_SIZE];
+static uint32_t map_val[ID_MAP_SIZE];
+static uint32_t dense_free[MAX_IDS];
+static uint32_t dense_nfree;
+
+static uint32_t* map_slot(uint32_t key)
+{
+    uint32_t h = (key * 2654435761u) % ID_MAP_SIZE;
+    while (map_key[h] != 0 && map_key[h] != key)
+        h = (h + 1) % ID_MAP_SIZE;
+    return &map_key[h];
+}
+
+static void map_del(uint32_t key)
+{
+    uint32_t h = map_slot(key) - map_key;
+    if (map_key[h] == 0)
+        return;
+    map_key[h] = 0;
+    // Re-insert the rest of the cluster so lookups still find it.
+    for (uint32_t i = (h + 1) % ID_MAP_SIZE; map_key[i] != 0; i = (i + 1) % ID_MAP_SIZE) {
+        uint32_t k = map_key[i], v = map_val[i];
+        map_key[i] = 0;
+        uint32_t* s = map_slot(k);
+        *s = k;
+        map_val[s - map_key] = v;
+    }
+}
+
+// Returns the dense id for key, or 0 if it is not live.
+static uint32_t map_get(uint32_t key)
+{
+    uint32_t* s = map_slot(key);
+    return *s ? map_val[s - map_key] : 0;
+}
+
+static void map_put(uint32_t key, uint32_t val)
+{
+    uint32_t* s = map_slot(key);
+    *s = key;
+    map_val[s - map_key] = val;
+}
+
+static int trace_load_bin(trace_t* t, FILE* f)
+{
+    lw_trace_file_hdr_t hdr;
+    lw_trace_rec_t rec;
+    uint32_t pending = 0; // dense id of a realloc waiting for its _TO record
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "LWTR", 4) != 0 ||
+        hdr.rec_size != sizeof(rec))
+        return -1;
+    for (uint32_t i = 1; i < MAX_IDS; i++)
+        dense_free[dense_nfree++] = MAX_IDS - i;
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        uint32_t op = rec.size_op >> LW_TRACE_OP_SHIFT;
+        uint32_t size = rec.size_op & LW_TRACE_SIZE_MASK;
+        uint32_t id = map_get(rec.id);
+        switch (op) {
+        case LW_TRACE_MALLOC:
+            // The ring starts mid-run, and a racing free can be recorded late:
+            // a still-mapped pointer is released first.
+            if (id) {
+                trace_push(t, OP_FREE, id, 0);
+                map_del(rec.id);
+                dense_free[dense_nfree++] = id;
+            }
+            if (dense_nfree == 0)
+                break;
+            id = dense_free[--dense_nfree];
+            map_put(rec.id, id);
+            trace_push(t, OP_ALLOC, id, size);
+            break;
+        case LW_TRACE_FREE:
+            // Frees of blocks allocated before the ring window are skipped.
+            if (id) {
+                trace_push(t, OP_FREE, id, 0);
+                map_del(rec.id);
+                dense_free[dense_nfree++] = id;
+            }
+            break;
+        case LW_TRACE_REALLOC:
+            pending = id;
+            if (id)
+                map_del(rec.id);
+            break;
+        case LW_TRACE_REALLOC_TO:
+            if (!pending) {
+                if (dense_nfree == 0)
+                    break;
+                // Unknown source block: replay as a fresh allocation.
+                pending = dense_free[--dense_nfree];
+                trace_push(t, OP_ALLOC, pending, size);
+            } else {
+                trace_push(t, OP_REALLOC, pending, size);
+            }
+            if ((id = map_get(rec.id)) != 0 && id != pending) {
+                trace_push(t, OP_FREE, id, 0);
+                map_del(rec.id);
+                dense_free[dense_nfree++] = id;
+            }
+            map_put(rec.id, pending);
+            pending = 0;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int trace_load(trace_t* t, const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char magic[4];
+    if (fread(magic, 1, 4, f) == 4 && memcmp(magic, "LWTR", 4) == 0) {
+        rewind(f);
+        int r = trace_load_bin(t, f);
+        fclose(f);
+        return r;
+    }
+    rewind(f);
+    char op;
+    unsigned id, size;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        id = size = 0;
+        int n = sscanf(line, " %c %u %u", &op, &id, &size);
+        if (n == 1 && op == 'i') {
+            trace_push(t, OP_IDLE, 0, 0);
+            continue;
+        }
+        if (n < 2 || id >= MAX_IDS)
+            continue;
+        trace_push(t, op == 'a' ? OP_ALLOC : op == 'r' ? OP_REALLOC : OP_FREE, id, size);
+    }
+    fclose(f);
+    return 0;
+}
+
+static uint32_t rng = 0x12345678u;
+static uint32_t rnd(uint32_t n)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+}
+
+static uint8_t id_live[MAX_IDS];
+static uint32_t next_id = 1;
+
+static uint32_t gen_alloc(trace_t* t, uint32_t size)
+{
+    uint32_t id = next_id;
+    while (id_live[id])
+        id = (id + 1) % MAX_IDS ? (id + 1) % MAX_IDS : 1;
+    next_id = (id + 1) % MAX_IDS ? (id + 1) % MAX_IDS : 1;
+    id_live[id] = 1;
+    trace_push(t, OP_ALLOC, id, size);
+    return id;
+}
+
+static void gen_free(trace_t* t, uint32_t id)
+{
+    id_live[id] = 0;
+    trace_push(t, OP_FREE, id, 0);
+}
+
+static void trace_synth_lvgl(trace_t* t)
+{
+    static uint32_t screen[1024];
+    static uint32_t notif[64];
+    uint32_t clock_label = gen_alloc(t, 24);
+    uint32_t steps_label = gen_alloc(t, 140);
+    int nnotif = 0;
+
+    for (int round = 0; round < 400; round++) {
+        /* Open a settings screen or app: objects, styles and label texts. */
+        int n = 150 + rnd(350);
+        for (int i = 0; i < n; i++) {
+            uint32_t r = rnd(100);
+            uint32_t sz = r < 55 ? 40 + rnd(81) : r < 90 ? 121 + rnd(400) : 600 + rnd(3000);
+            screen[i] = gen_alloc(t, sz);
+        }
+        /* Live label updates while the screen is shown. */
+        for (int tick = 0; tick < 60; tick++) {
+            trace_push(t, OP_REALLOC, clock_label, 16 + rnd(24));
+            trace_push(t, OP_REALLOC, steps_label, 121 + rnd(200));
+            int i = rnd(n);
+            gen_free(t, screen[i]);
+            screen[i] = gen_alloc(t, 121 + rnd(500));
+            trace_push(t, OP_IDLE, 0, 0);
+        }
+        /* Notification burst: JSON line, parsed strings, kept texts. */
+        if (rnd(4) == 0) {
+            int burst = 1 + rnd(10);
+            for (int b = 0; b < burst; b++) {
+                uint32_t line = gen_alloc(t, 200 + rnd(400));
+                uint32_t dom = gen_alloc(t, 300 + rnd(1200));
+                if (nnotif == 64) {
+                    gen_free(t, notif[0]);
+                    memmove(notif, notif + 1, sizeof(notif[0]) * 63);
+                    nnotif--;
+                }
+                notif[nnotif++] = gen_alloc(t, 121 + rnd(900));
+                gen_free(t, dom);
+                gen_free(t, line);
+            }
+        }
+        /* Close the screen in creation order, like lv_obj_del does. */
+        for (int i = 0; i < n; i++)
+            gen_free(t, screen[i]);
+        trace_push(t, OP_IDLE, 0, 0);
+    }
+    for (int i = 0; i < nnotif; i++)
+        gen_free(t, notif[i]);
+    gen_free(t, clock_label);
+    gen_free(t, steps_label);
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Resident set in KB, sampled from /proc so the bench's own tables can be
+// subtracted as a baseline.
+static long rss_now_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char* name, uint32_t* lat, size_t n)
+{
+    if (n == 0)
+        return;
+    qsort(lat, n, sizeof(uint32_t), cmp_u32);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += lat[i];
+    printf("%-8s n=%-8zu avg=%6.0fns p50=%6uns p99=%6uns p99.9=%7uns max=%8uns\n", name, n,
+           (double)sum / n, lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1]);
+}
+
+int main(int argc, char** argv)
+{
+    trace_t t = { 0 };
+    int idle = 1;
+    if (argc > 1 && strcmp(argv[1], "--no-idle") == 0) {
+        idle = 0;
+        argc--;
+        argv++;
+    }
+    if (argc > 1) {
+        if (trace_load(&t, argv[1]) != 0) {
+            fprintf(stderr, "cannot read %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        trace_synth_lvgl(&t);
+    }
+
+    void** ptrs = calloc(MAX_IDS, sizeof(void*));
+    uint32_t* sizes = calloc(MAX_IDS, sizeof(uint32_t));
+    uint32_t* lat_alloc = malloc(t.count * sizeof(uint32_t));
+    uint32_t* lat_free = malloc(t.count * sizeof(uint32_t));
+    uint32_t* lat_realloc = malloc(t.count * sizeof(uint32_t));
+    size_t na = 0, nf = 0, nr = 0;
+    size_t live = 0, peak_live = 0;
+
+    // Touch the bench's own tables so only allocator growth shows up as RSS.
+    memset(ptrs, 0, MAX_IDS * sizeof(void*));
+    memset(sizes, 0, MAX_IDS * sizeof(uint32_t));
+    memset(lat_alloc, 0, t.count * sizeof(uint32_t));
+    memset(lat_free, 0, t.count * sizeof(uint32_t));
+    memset(lat_realloc, 0, t.count * sizeof(uint32_t));
+    long rss_base = rss_now_kb(), rss_peak = rss_base;
+
+    for (size_t i = 0; i < t.count; i++) {
+        trace_op_t* op = &t.ops[i];
+        uint64_t t0 = now_ns();
+        switch (op->op) {
+        case OP_ALLOC:
+            ptrs[op->id] = bench_malloc(op->size);
+            lat_alloc[na++] = (uint32_t)(now_ns() - t0);
+            live = live - sizes[op->id] + op->size;
+            sizes[op->id] = op->size;
+            break;
+        case OP_REALLOC:
+            ptrs[op->id] = bench_realloc(ptrs[op->id], op->size);
+            lat_realloc[nr++] = (uint32_t)(now_ns() - t0);
+            live = live - sizes[op->id] + op->size;
+            sizes[op->id] = op->size;
+            break;
+        case OP_FREE:
+            bench_free(ptrs[op->id]);
+            lat_free[nf++] = (uint32_t)(now_ns() - t0);
+            ptrs[op->id] = NULL;
+            live -= sizes[op->id];
+            sizes[op->id] = 0;
+            break;
+        case OP_IDLE:
+            // Idle time is not part of any operation's latency.
+            while (idle && lw_coalesce_idle && lw_coalesce_idle()) {
+            }
+            break;
+        }
+        if (live > peak_live)
+            peak_live = live;
+        if ((i & 1023) == 0) {
+            long rss = rss_now_kb();
+            if (rss > rss_peak)
+                rss_peak = rss;
+        }
+    }
+
+    printf("ops=%zu\n", t.count);
+    report("malloc", lat_alloc, na);
+    report("realloc", lat_realloc, nr);
+    report("free", lat_free, nf);
+    printf("peak_live=%zuKB peak_rss=+%ldKB rss/live=%.2f\n", peak_live / 1024, rss_peak - rss_base,
+           peak_live ? (rss_peak - rss_base) * 1024.0 / peak_live : 0.0);
+
+    if (lw_get_coalesce_stats) {
+        lw_coalesce_stats_t cs;
+        lw_get_coalesce_stats(&cs);
+        printf("coalesce passes=%u idle=%u merged=%u avg=%.0fns max=%uns\n", cs.calls, cs.idle_calls,
+               cs.blocks_merged, cs.calls ? (double)cs.total_pause_ns / cs.calls : 0.0, cs.max_pause_ns);
+    }
+    if (lw_heap_stats) {
+        lw_heap_stats_t hs;
+        lw_heap_stats(&hs);
+        printf("lwmalloc heap=%zuKB peak_used=%zuKB free=%zuKB largest=%zuKB frag=%u/1000\n", hs.heap_bytes / 1024,
+               hs.peak_used_bytes / 1024, hs.free_bytes / 1024, hs.largest_free / 1024, hs.frag_permille);
+    }
+    return 0;
+}
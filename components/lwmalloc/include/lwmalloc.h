@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// lwmalloc backs the global malloc/free/realloc/calloc for every task.
+// Small requests (<= 120 bytes) are served from per-core magazines without
+// taking the heap lock; refills, flushes and large blocks go through a short
+// critical section. Reserving and releasing system memory and moving a
+// reallocated block happen with the lock dropped.
+void* lw_malloc(size_t size);
+void lw_free(void* ptr);
+void* lw_realloc(void* ptr, size_t size);
+void* lw_calloc(size_t nmemb, size_t size);
+
+// Counters for the shared heap lock. Updated while the lock is held.
+typedef struct {
+    uint32_t lock_acquires;  // times the heap lock was taken
+    uint32_t lock_contended; // times the lock was already held by someone else
+    uint32_t mag_refills;    // magazine refills from the shared bins
+    uint32_t mag_flushes;    // magazine overflows returned to the shared bins
+} lw_lock_stats_t;
+
+void lw_get_lock_stats(lw_lock_stats_t* out);
+void lw_reset_lock_stats(void);
+
+// Placement hints for the memory tiers. With CONFIG_LWMALLOC_TIERED, large
+// blocks go to a PSRAM heap when tagged cold or when they reach the PSRAM
+// threshold; hot, DMA and ISR data always stays in internal SRAM, DMA data
+// in a heap of its own that alone takes DMA-capable SRAM. Other small
+// requests (<= 120 bytes) are always internal. PSRAM allocations fall back
+// to internal SRAM once the PSRAM limit is reached.
+typedef enum {
+    LW_TAG_DEFAULT = 0, // size-based: internal below the threshold, PSRAM above
+    LW_TAG_HOT,         // latency sensitive, keep internal
+    LW_TAG_DMA,         // touched by DMA, keep internal
+    LW_TAG_ISR,         // touched from interrupts or with the cache disabled
+    LW_TAG_COLD,        // bulk data that tolerates PSRAM latency
+} lw_tag_t;
+
+void* lw_malloc_tagged(size_t size, lw_tag_t tag);
+
+// Tag applied to plain malloc() calls from the current task. Returns the
+// previous tag so callers can restore it around a scope.
+lw_tag_t lw_set_task_tag(lw_tag_t tag);
+
+// Default-tagged blocks of at least this many bytes go to PSRAM.
+void lw_set_psram_threshold(size_t bytes);
+
+// Aligned allocation; align must be a power of two. Alignments of 8 or less
+// are a plain malloc. Larger ones over-allocate by align plus a minimum block
+// and return the slack in front and behind to the heap, so the waste is at
+// most the 128-byte split threshold. memalign, aligned_alloc and
+// posix_memalign are routed here. Aligned blocks are freed with free().
+void* lw_memalign(size_t align, size_t size);
+
+// lw_memalign with a placement tag and LW_ALLOC_* flags. With LW_ALLOC_DMA
+// the block is reachable by GDMA: internal SRAM for every tag except
+// LW_TAG_COLD, which may land in PSRAM aligned and padded to whole data cache
+// lines so cache write-back/invalidate never touches a neighbour.
+#define LW_ALLOC_DMA (1u << 0)
+
+void* lw_memalign_tagged(size_t align, size_t size, lw_tag_t tag, uint32_t flags);
+
+// Heap telemetry. Sizes are block sizes, headers included. Blocks parked in
+// the per-core magazines count as free (on the host, where magazines are per
+// thread, they count as used).
+#define LW_HEAP_STATS_CLASSES 23 // 16..128-byte bins, then up to 8 generated slab classes
+#define LW_HEAP_HIST_BUCKETS 16  // bucket 0: < 16 B, bucket i: [2^(i+3), 2^(i+4)), last: >= 256 KB
+
+typedef struct {
+    uint16_t block_size;
+    uint16_t chunks; // 4 KB chunks carved for this class
+    uint32_t used;   // blocks handed out to callers
+    uint32_t cached; // free blocks sitting in magazines
+} lw_class_stats_t;
+
+typedef struct {
+    size_t heap_bytes;   // bytes reserved from the system
+    size_t used_bytes;   // large blocks in use
+    size_t free_bytes;   // free large blocks
+    size_t largest_free; // largest block a large malloc can get without growing
+    uint32_t regions;    // separate regions the heap is made of
+} lw_tier_stats_t;
+
+typedef struct {
+    size_t heap_bytes;
+    size_t used_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t peak_used_bytes; // high-water mark of used_bytes
+    // External fragmentation of large free space: 1000 * (1 - largest / free).
+    // Merges still pending in the buffered list raise it until they finish.
+    uint16_t frag_permille;
+    uint32_t sample_rate;
+    uint32_t arenas;     // arenas not yet returned to the heap
+    size_t arena_bytes;  // chunks held by them (part of used_bytes)
+    size_t trimmed_bytes; // total handed back to the system heap
+    lw_tier_stats_t tiers[2]; // internal SRAM, PSRAM
+    lw_class_stats_t classes[LW_HEAP_STATS_CLASSES];
+    uint32_t size_hist[LW_HEAP_HIST_BUCKETS];
+} lw_heap_stats_t;
+
+// Snapshot of the allocator state. Takes the heap lock for a short walk of
+// the counters; it does not traverse the heap.
+void lw_heap_stats(lw_heap_stats_t* out);
+
+// Record every Nth allocation size in lw_heap_stats_t.size_hist (0 = off,
+// the default). Changing the rate clears the histogram.
+void lw_set_sample_rate(uint32_t every_n);
+
+// Scoped bump arenas for short-lived object trees such as a UI screen. While
+// an arena is current for a task, that task's malloc calls (up to a quarter
+// of the chunk size) are bump-allocated from it and free only counts blocks
+// down. After lw_arena_release() the chunks go back to the heap in one step
+// as soon as the last block is freed, so blocks that outlive the screen stay
+// valid. Arena chunks always come from internal SRAM.
+typedef struct lw_arena lw_arena_t;
+
+lw_arena_t* lw_arena_create(size_t chunk_size);
+// Route the calling task's allocations into arena (NULL stops). Returns the
+// previous one.
+lw_arena_t* lw_arena_set_current(lw_arena_t* arena);
+// The owner is done: stop routing into it and free it once it is empty.
+void lw_arena_release(lw_arena_t* arena);
+
+// The heap grows in regions reserved from the system heap (internal
+// DMA-capable SRAM or PSRAM), which need not be contiguous. Regions that
+// become empty are handed back from the idle hook once they add up to more
+// than CONFIG_LWMALLOC_TRIM_THRESHOLD, keeping one region's worth as a spare.
+// Small blocks are carved from 4 KB chunks kept in regions of their own;
+// a chunk with no block handed out goes back to the heap before a trim.
+// lw_trim() returns the calling core's cached small blocks, finishes pending
+// merges and releases empty regions until at most keep bytes of them remain
+// per heap; it returns the bytes released.
+size_t lw_trim(size_t keep);
+
+// Freed large blocks are merged with their neighbours lazily. Each large
+// malloc/realloc merges at most a budget's worth of blocks (counted in blocks
+// visited), so its pause is bounded; the remainder is finished by the idle
+// hook. When the budgeted pass finds no fit the heap grows a region rather
+// than draining the rest, and the idle hook trims it once merges free it up.
+// The idle hook's scan for bin chunks to give back visits at most a budget's
+// worth of free small blocks per pass and resumes on the next one.
+typedef struct {
+    uint32_t calls;          // coalescing passes that found pending work
+    uint32_t idle_calls;     // passes run from the idle hook
+    uint32_t drained;        // passes that emptied the pending list
+    uint32_t blocks_merged;  // neighbours absorbed
+    uint32_t max_pause_ns;   // longest single pass (1 us resolution on target)
+    uint64_t total_pause_ns; // sum over all passes; avg = total_pause_ns / calls
+} lw_coalesce_stats_t;
+
+void lw_set_coalesce_budget(size_t blocks);
+void lw_get_coalesce_stats(lw_coalesce_stats_t* out);
+void lw_reset_coalesce_stats(void);
+
+// One bounded coalescing pass over every heap, skipped if the heap lock is
+// busy. Returns true while merges are still pending.
+bool lw_coalesce_idle(void);
+
+#ifdef ESP_PLATFORM
+// Run lw_coalesce_idle() from the FreeRTOS idle task on every core.
+void lw_coalesce_idle_enable(void);
+#endif
+
+// Allocation trace (CONFIG_LWMALLOC_TRACE). Calls through malloc, free,
+// realloc, calloc, lw_malloc_tagged and the aligned entry points are appended to a ring of
+// CONFIG_LWMALLOC_TRACE_ENTRIES records. A realloc that returns a pointer is
+// two records: LW_TRACE_REALLOC with the old pointer and LW_TRACE_REALLOC_TO
+// with the new one. The exported stream is a trace file: a header followed by
+// count records, oldest first. Without the option the calls are no-ops.
+enum {
+    LW_TRACE_MALLOC = 0,
+    LW_TRACE_FREE = 1,
+    LW_TRACE_REALLOC = 2,
+    LW_TRACE_REALLOC_TO = 3,
+};
+#define LW_TRACE_OP_SHIFT 30
+#define LW_TRACE_SIZE_MASK ((1u << LW_TRACE_OP_SHIFT) - 1)
+
+typedef struct {
+    uint32_t ts_us;   // microseconds since the first record
+    uint32_t size_op; // op in the top two bits, requested size below
+    uint32_t id;      // pointer >> 3
+} lw_trace_rec_t;
+
+typedef struct {
+    char magic[4];     // "LWTR"
+    uint16_t version;  // 1
+    uint16_t rec_size; // sizeof(lw_trace_rec_t)
+    uint32_t count;    // records that follow
+    uint32_t dropped;  // older records overwritten by the ring
+} lw_trace_file_hdr_t;
+
+void lw_trace_enable(bool on);
+void lw_trace_clear(void);
+// Copy up to len bytes of the trace file starting at offset; returns the
+// number copied, 0 at the end. Disable recording while exporting in pieces.
+size_t lw_trace_export(size_t offset, void* buf, size_t len);
+// Write the trace file to path (e.g. on SPIFFS). Returns records written or -1.
+int lw_trace_dump(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+/*
+ * lwmalloc slab classes above the 8-byte bins. Generated by
+ * host/lw_size_classes.c from 204174 recorded allocations; do not edit.
+ * Options: -n 8 -w 12 -m 10 -M 1024
+ *    168 B block:   3.3% of allocations
+ *    200 B block:   4.5% of allocations
+ *    232 B block:   4.4% of allocations
+ *    272 B block:   5.6% of allocations
+ *    336 B block:   6.2% of allocations
+ *    400 B block:   4.5% of allocations
+ *    464 B block:   4.5% of allocations
+ *    536 B block:   5.5% of allocations
+ */
+#pragma once
+
+#define LW_SLAB_COUNT 8
+#define LW_SLAB_MAX 536
+
+/* Block sizes, header included. */
+#define LW_SLAB_SIZES { 168, 200, 232, 272, 336, 400, 464, 536 }
+
+/* Slab index + 1 per block size (128 + 8 * (i + 1)); 0 goes to the large heap. */
+#define LW_SLAB_LOOKUP {\
+	0, 0, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,\
+	4, 4, 0, 0, 5, 5, 5, 5, 5, 5, 0, 6, 6, 6, 6, 6,\
+	6, 6, 0, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8,\
+	8, 8, 8 }
@@ -0,0 +1,2157 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include "lwmalloc.h"
+#include "lw_size_classes.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "esp_timer.h"
+#include "esp_freertos_hooks.h"
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+#ifndef CONFIG_LWMALLOC_TIERED
+#define CONFIG_LWMALLOC_TIERED 0
+#endif
+#ifndef CONFIG_LWMALLOC_PSRAM_ARENA_SIZE
+#define CONFIG_LWMALLOC_PSRAM_ARENA_SIZE (2 * 1024 * 1024)
+#endif
+#ifndef CONFIG_LWMALLOC_PSRAM_THRESHOLD
+#define CONFIG_LWMALLOC_PSRAM_THRESHOLD 4096
+#endif
+#ifndef CONFIG_LWMALLOC_REGION_SIZE
+#define CONFIG_LWMALLOC_REGION_SIZE (32 * 1024)
+#endif
+#ifndef CONFIG_LWMALLOC_TRIM_THRESHOLD
+#define CONFIG_LWMALLOC_TRIM_THRESHOLD (64 * 1024)
+#endif
+#ifndef CONFIG_LWMALLOC_COALESCE_BUDGET
+#define CONFIG_LWMALLOC_COALESCE_BUDGET 32
+#endif
+#ifndef CONFIG_LWMALLOC_TRACE
+#define CONFIG_LWMALLOC_TRACE 0
+#endif
+#ifndef CONFIG_LWMALLOC_TRACE_ENTRIES
+#define CONFIG_LWMALLOC_TRACE_ENTRIES 8192
+#endif
+#ifndef CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+#define CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE 64
+#endif
+
+#if CONFIG_LWMALLOC_TRACE
+static void lw_trace_record(uint32_t op, size_t size, void* ptr);
+#define LW_TRACE(op, size, ptr) lw_trace_record(op, size, ptr)
+#else
+#define LW_TRACE(op, size, ptr) do { } while (0)
+#endif
+
+static void* lw_malloc_tier(size_t size, lw_tag_t tag);
+
+void* malloc(size_t size)
+{
+	void* p = lw_malloc(size);
+	LW_TRACE(LW_TRACE_MALLOC, size, p);
+	return p;
+}
+
+void free(void* ptr)
+{
+	if (ptr != NULL)
+		LW_TRACE(LW_TRACE_FREE, 0, ptr);
+	lw_free(ptr);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	void* p = lw_realloc(ptr, size);
+	if (ptr == NULL)
+	{
+		LW_TRACE(LW_TRACE_MALLOC, size, p);
+	}
+	else if (size == 0)
+	{
+		LW_TRACE(LW_TRACE_FREE, 0, ptr);
+	}
+	else if (p != NULL)
+	{
+		LW_TRACE(LW_TRACE_REALLOC, size, ptr);
+		LW_TRACE(LW_TRACE_REALLOC_TO, size, p);
+	}
+	return p;
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	void* p = lw_calloc(nmemb, size);
+	LW_TRACE(LW_TRACE_MALLOC, nmemb * size, p);
+	return p;
+}
+
+void* memalign(size_t align, size_t size)
+{
+	return lw_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+	return lw_memalign(align, size);
+}
+
+int posix_memalign(void** memptr, size_t align, size_t size)
+{
+	if (align < sizeof(void*) || (align & (align - 1)) != 0)
+		return EINVAL;
+
+	void* p = lw_memalign(align, size);
+	if (p == NULL)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+
+#define WSIZE 8
+#define DSIZE 16
+#define CHUNKSIZE (1 << 12)
+#define MAX(x, y) (x > y ? x : y)
+#define MIN(x, y) (x < y ? x : y)
+#define PACK(size, alloc) (size | alloc)
+#define GET(p) (*(size_t *)(p))
+#define PUT(p, val) (*(size_t *)(p) = (size_t)(val))
+#define GET_SIZE(p) (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+#define HDRP(bp) ((char *)(bp) - WSIZE)
+#define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+#define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+#define GET_NEXT(bp) (*(void **)((char *)(bp) + WSIZE))
+#define GET_PREV(bp) (*(void **)(bp))
+#define SEGSIZE 17
+#define GET_ROOT(h, class) ((h)->roots[class])
+#define IS_BUFFER(p) ((GET(HDRP(p)) >> 1) & 0x1)
+#define IS_BIN(p) ((GET(HDRP(p)) >> 2) & 0x1)
+#define IS_BIN_N_BUF(p) (GET(HDRP(p)) & 0x6)
+#define IS_BUF_N_ALOC(p) (GET(HDRP(p)) & 0x3)
+#define GET_NEXT_S(bp) (*(void **)(bp))
+#define IS_INDEXED_FREE(p) ((GET(p) & 0x7) == 0)
+/* alloc + buffered is never a heap block state; it marks arena blocks. */
+#define LW_ARENA_FLAG 3
+#define IS_ARENA(p) ((GET(HDRP(p)) & 0x7) == LW_ARENA_FLAG)
+
+#define LW_SMALL_MAX 120
+/* Smallest block that can stand alone in front of an aligned payload. */
+#define LW_MIN_BLOCK (2 * DSIZE)
+#define LW_SPLIT_MIN 128
+/* PSRAM is reached by DMA through the data cache; sync works on whole lines. */
+#define LW_DMA_PSRAM_ALIGN CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+/*
+ * Bin classes: 8-byte steps up to LW_SMALL_BLOCK (class = block size / 8),
+ * then the generated slab classes for the dominant larger sizes.
+ */
+#define LW_SMALL_BLOCK 128
+#define LW_BIN_MAX MAX(LW_SMALL_MAX, LW_SLAB_MAX - WSIZE)
+#define LW_MAG_CLASSES (SEGSIZE + LW_SLAB_COUNT)
+#if LW_MAG_CLASSES - 2 > LW_HEAP_STATS_CLASSES
+#error "lw_size_classes.h has more slab classes than lw_heap_stats_t reports"
+#endif
+#define LW_MAG_SIZE 16
+#define LW_MAG_BATCH 8
+#define LW_COALESCE_MIN 4
+#define LW_COALESCE_ALL ((size_t)-1)
+
+/*
+ * Large free blocks live in a TLSF-style two-level index: the first level is
+ * the power of two of the block size, the second splits it into
+ * LW_SL_COUNT linear ranges. Two bitmaps tell which lists are non-empty, so
+ * insert, remove and find-fit are all constant time.
+ */
+#define LW_FL_SHIFT 7
+#define LW_FL_COUNT 25
+#define LW_SL_LOG2 3
+#define LW_SL_COUNT (1 << LW_SL_LOG2)
+
+typedef struct {
+	uint32_t fl_bitmap;
+	uint32_t sl_bitmap[LW_FL_COUNT];
+	void* blocks[LW_FL_COUNT][LW_SL_COUNT];
+} lw_index_t;
+
+#define LW_TIER_INTERNAL 0
+#define LW_TIER_PSRAM 1
+#define LW_TIER_COUNT 2
+/* Bin chunks and DMA blocks come from heaps of their own, in internal SRAM too. */
+#define LW_HEAP_BINS LW_TIER_COUNT
+#define LW_HEAP_DMA (LW_TIER_COUNT + 1)
+#define LW_HEAP_COUNT (LW_TIER_COUNT + 2)
+#define LW_PSRAM_LIMIT ((size_t)CONFIG_LWMALLOC_PSRAM_ARENA_SIZE)
+#define LW_REGION_SIZE ((size_t)CONFIG_LWMALLOC_REGION_SIZE)
+#define LW_TRIM_THRESHOLD ((size_t)CONFIG_LWMALLOC_TRIM_THRESHOLD)
+
+/* Tasks that set a non-default tag; looked up only while one is active. */
+#define LW_TASK_SLOTS 8
+
+/*
+ * Heap memory is reserved from the system in regions of at least
+ * LW_REGION_SIZE bytes. A region starts with this header and an allocated
+ * prologue block and ends with an epilogue header, so merges never cross
+ * region boundaries. A region whose first free block spans all of it is
+ * empty and can be handed back.
+ */
+typedef struct lw_region {
+	struct lw_region* next;
+	size_t size;
+} lw_region_t;
+
+#define LW_REGION_HDR ALIGN(sizeof(lw_region_t))
+#define LW_REGION_OVERHEAD (LW_REGION_HDR + DSIZE + WSIZE)
+#define LW_REGION_FIRST(r) ((char*)(r) + LW_REGION_OVERHEAD)
+
+/*
+ * One heap per memory tier, each a list of regions. The PSRAM heap is
+ * capped at LW_PSRAM_LIMIT and falls back to internal RAM once full.
+ * Small bins only exist internally, carved from chunks of the bin heap: its
+ * regions hold nothing else, so a long-lived small block never keeps a
+ * large-block region from being trimmed. DMA blocks get the only regions
+ * reserved from DMA-capable SRAM, so other internal data leaves it alone.
+ */
+typedef struct {
+	lw_region_t* regions;
+	void* roots[LW_MAG_CLASSES];	/* bin lists; class 1 is the buffered list */
+	lw_index_t index;
+	size_t heap_bytes;	/* reserved from the system */
+	size_t used_bytes;	/* large blocks handed out, headers included */
+	size_t bin_bytes;	/* chunks carved for the small bins */
+	uint32_t nregions;
+	uint8_t tier;
+	uint8_t dma;	/* regions are DMA-capable */
+	uint8_t trim_pending;	/* freed since the last trim check */
+} lw_heap_t;
+
+static void* lw_find_fit(lw_heap_t* h, size_t size);
+static void* lw_malloc_large(lw_heap_t* h, size_t size);
+static void* lw_place(lw_heap_t* h, void* bp, size_t size);
+static void lw_remove_free_block(lw_heap_t* h, void* bp);
+static void lw_add_free_block(lw_heap_t* h, void* bp);
+static void lw_deferred_coalescing(lw_heap_t* h, size_t budget);
+static void* lw_arena_malloc(size_t size);
+inline void set_block(void* ptr, size_t size, int alloc);
+
+static lw_heap_t lw_heaps[LW_HEAP_COUNT] = {
+	[LW_TIER_INTERNAL] = { .tier = LW_TIER_INTERNAL },
+	[LW_TIER_PSRAM] = { .tier = LW_TIER_PSRAM },
+	[LW_HEAP_BINS] = { .tier = LW_TIER_INTERNAL },
+	[LW_HEAP_DMA] = { .tier = LW_TIER_INTERNAL, .dma = 1 },
+};
+#define LW_INTERNAL (&lw_heaps[LW_TIER_INTERNAL])
+#define LW_BINS (&lw_heaps[LW_HEAP_BINS])
+#define LW_DMA (&lw_heaps[LW_HEAP_DMA])
+
+/*
+ * Arena blocks are bump-allocated inside chunks taken from the large heap.
+ * Their header word holds the block size with LW_ARENA_FLAG and the offset
+ * back to the chunk, whose header points at the owning arena. The arena
+ * itself lives at the start of its first chunk.
+ */
+typedef struct lw_arena_chunk {
+	struct lw_arena_chunk* next;
+	lw_arena_t* arena;
+} lw_arena_chunk_t;
+
+typedef struct {
+	uint32_t size_flags;
+	uint32_t chunk_off;
+} lw_arena_hdr_t;
+
+#define ARENA_HDR(bp) ((lw_arena_hdr_t*)HDRP(bp))
+
+struct lw_arena {
+	lw_arena_chunk_t* chunks;
+	char* cur;
+	char* end;
+	char* last;	/* newest block, can still grow in place */
+	size_t chunk_size;
+	uint32_t live;
+	uint8_t released;
+};
+
+/* Per-task allocation policy: placement tag and current arena. */
+typedef struct {
+	void* owner;
+	uint8_t tag;
+	lw_arena_t* arena;
+} lw_task_scope_t;
+
+static lw_task_scope_t lw_scopes[LW_TASK_SLOTS];
+static int lw_scopes_active;
+static volatile int lw_arena_scopes;
+static uint32_t lw_arenas;
+static size_t lw_arena_bytes;
+static size_t lw_psram_threshold = CONFIG_LWMALLOC_PSRAM_THRESHOLD;
+static size_t lw_coalesce_budget = MAX(CONFIG_LWMALLOC_COALESCE_BUDGET, LW_COALESCE_MIN);
+static lw_coalesce_stats_t lw_cstats;
+
+/*
+ * Small bins are carved from chunks, large blocks that start with this
+ * header. A bin block's header has the arena block layout: its size and
+ * flags, then the offset back to the chunk. Chunks count their blocks out
+ * so one with none out can go back to the large heap instead of pinning
+ * its region.
+ */
+typedef struct lw_bin_chunk {
+	struct lw_bin_chunk* next;	/* reclaim list */
+	uint16_t live;	/* blocks off the shared list, magazines included */
+	uint8_t queued;
+} lw_bin_chunk_t;
+
+#define LW_BIN_CHUNK_HDR ALIGN(sizeof(lw_bin_chunk_t))
+#define BIN_SIZE(bp) (ARENA_HDR(bp)->size_flags & ~0x7)
+
+/* Small-bin accounting, updated with the lock held. */
+static uint32_t lw_bin_out[LW_MAG_CLASSES];	/* blocks taken off the shared lists */
+static uint16_t lw_bin_chunks[LW_MAG_CLASSES];
+static uint16_t lw_bin_idle[LW_MAG_CLASSES];	/* chunks with no block out */
+static uint32_t lw_bin_gen;	/* bumped by every change to a bin list */
+
+#if LW_SLAB_COUNT > 0
+static const uint16_t lw_slab_size[LW_SLAB_COUNT] = LW_SLAB_SIZES;
+static const uint8_t lw_slab_lookup[(LW_SLAB_MAX - LW_SMALL_BLOCK) / 8] = LW_SLAB_LOOKUP;
+#endif
+
+/* Bin class serving blocks of asize bytes, or 0 for the large heap. */
+static inline int lw_bin_class(size_t asize)
+{
+	if (asize <= LW_SMALL_BLOCK)
+		return asize >> 3;
+#if LW_SLAB_COUNT > 0
+	if (asize <= LW_SLAB_MAX)
+	{
+		int slab = lw_slab_lookup[(asize - LW_SMALL_BLOCK) / 8 - 1];
+		return slab ? SEGSIZE + slab - 1 : 0;
+	}
+#endif
+	return 0;
+}
+
+static inline size_t lw_bin_size(int class)
+{
+#if LW_SLAB_COUNT > 0
+	if (class >= SEGSIZE)
+		return lw_slab_size[class - SEGSIZE];
+#endif
+	return (size_t)class << 3;
+}
+static size_t lw_bin_bytes_out;
+static size_t lw_peak_used;
+static size_t lw_trimmed_bytes;
+
+/* Allocation-size sampling: every lw_sample_rate-th malloc lands in a log2 bucket. */
+static uint32_t lw_sample_rate;
+static uint32_t lw_sample_tick;
+static uint32_t lw_hist[LW_HEAP_HIST_BUCKETS];
+
+/*
+ * One lock protects the shared heap (brk, segregated roots, buffered list).
+ * Small blocks are handed out from magazines that only their owner touches:
+ * one per core on the target, where masking local interrupts pins the task
+ * to the core for the few instructions needed, and one per thread on the host.
+ */
+typedef struct {
+	uint8_t count[LW_MAG_CLASSES];
+	uint8_t dead;
+	void* slots[LW_MAG_CLASSES][LW_MAG_SIZE];
+} lw_magazine_t;
+
+static lw_lock_stats_t lw_stats;
+
+#ifdef ESP_PLATFORM
+static portMUX_TYPE lw_lock = portMUX_INITIALIZER_UNLOCKED;
+#define LW_TRYLOCK() (portTRY_ENTER_CRITICAL(&lw_lock, portMUX_TRY_LOCK) == pdPASS)
+#define LW_LOCK() portENTER_CRITICAL(&lw_lock)
+#define LW_UNLOCK() portEXIT_CRITICAL(&lw_lock)
+
+static lw_magazine_t lw_mags[portNUM_PROCESSORS];
+#define LW_MAG_ENTER() UBaseType_t lw_irq_state = portSET_INTERRUPT_MASK_FROM_ISR()
+#define LW_MAG_EXIT() portCLEAR_INTERRUPT_MASK_FROM_ISR(lw_irq_state)
+#define LW_MAG_SELF() (&lw_mags[xPortGetCoreID()])
+#define LW_TASK_SELF() ((void*)xTaskGetCurrentTaskHandle())
+/* esp_timer resolution is 1 us; CPU cycles are not usable under DFS. */
+#define LW_NOW_NS() ((uint64_t)esp_timer_get_time() * 1000)
+#else
+static pthread_mutex_t lw_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LW_TRYLOCK() (pthread_mutex_trylock(&lw_lock) == 0)
+#define LW_LOCK() pthread_mutex_lock(&lw_lock)
+#define LW_UNLOCK() pthread_mutex_unlock(&lw_lock)
+
+static __thread lw_magazine_t lw_mag;
+static __thread int lw_mag_registered;
+static pthread_key_t lw_mag_key;
+static pthread_once_t lw_mag_once = PTHREAD_ONCE_INIT;
+static lw_magazine_t* lw_mag_self(void);
+#define LW_MAG_ENTER() do { } while (0)
+#define LW_MAG_EXIT() do { } while (0)
+#define LW_MAG_SELF() lw_mag_self()
+#define LW_TASK_SELF() ((void*)pthread_self())
+static inline uint64_t lw_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#define LW_NOW_NS() lw_now_ns()
+#endif
+
+static inline void lw_lock_acquire(void)
+{
+	if (!LW_TRYLOCK())
+	{
+		LW_LOCK();
+		lw_stats.lock_contended++;
+	}
+	lw_stats.lock_acquires++;
+}
+
+static inline void lw_lock_release(void)
+{
+	LW_UNLOCK();
+}
+
+inline void set_block(void* ptr, size_t size, int alloc) {
+	*(size_t*)((char*)(ptr)-WSIZE) = (size | alloc);
+	*(size_t*)((char*)(ptr)+size - DSIZE) = (size | alloc);
+}
+
+static void* lw_sys_reserve(const lw_heap_t* h, size_t size)
+{
+#ifdef ESP_PLATFORM
+	uint32_t caps = h->tier == LW_TIER_PSRAM ? MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT
+		: h->dma ? MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT
+		: MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+	return heap_caps_aligned_alloc(DSIZE, size, caps);
+#else
+	(void)h;
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static void lw_sys_release(void* p, size_t size)
+{
+#ifdef ESP_PLATFORM
+	(void)size;
+	heap_caps_free(p);
+#else
+	munmap(p, size);
+#endif
+}
+
+static inline int lw_fls(size_t size)
+{
+	return (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long)size);
+}
+
+static inline void lw_mapping_insert(size_t size, int* fl, int* sl)
+{
+	int f = lw_fls(size);
+
+	if (f < LW_FL_SHIFT)
+	{
+		*fl = 0;
+		*sl = 0;
+		return;
+	}
+	if (f - LW_FL_SHIFT >= LW_FL_COUNT)
+	{
+		*fl = LW_FL_COUNT - 1;
+		*sl = LW_SL_COUNT - 1;
+		return;
+	}
+	*fl = f - LW_FL_SHIFT;
+	*sl = (int)((size >> (f - LW_SL_LOG2)) & (LW_SL_COUNT - 1));
+}
+
+/* Round up to the next second-level range so any block in the list fits. */
+static inline size_t lw_search_size(size_t size)
+{
+	if (lw_fls(size) >= LW_FL_SHIFT)
+		size += ((size_t)1 << (lw_fls(size) - LW_SL_LOG2)) - 1;
+	return size;
+}
+
+static inline void lw_mapping_search(size_t size, int* fl, int* sl)
+{
+	lw_mapping_insert(lw_search_size(size), fl, sl);
+}
+
+static void lw_remove_free_block(lw_heap_t* h, void* bp)
+{
+	int fl, sl;
+	lw_mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+	if (bp == h->index.blocks[fl][sl])
+	{
+		h->index.blocks[fl][sl] = GET_NEXT(bp);
+		if (h->index.blocks[fl][sl] == NULL)
+		{
+			h->index.sl_bitmap[fl] &= ~(1u << sl);
+			if (h->index.sl_bitmap[fl] == 0)
+				h->index.fl_bitmap &= ~(1u << fl);
+		}
+		return;
+	}
+	GET_NEXT(GET_PREV(bp)) = GET_NEXT(bp);
+
+	if (GET_NEXT(bp) != NULL)
+		GET_PREV(GET_NEXT(bp)) = GET_PREV(bp);
+}
+
+static void lw_add_free_block(lw_heap_t* h, void* bp)
+{
+	int fl, sl;
+	lw_mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+	GET_NEXT(bp) = h->index.blocks[fl][sl];
+	if (h->index.blocks[fl][sl] != NULL)
+		GET_PREV(h->index.blocks[fl][sl]) = bp;
+
+	h->index.blocks[fl][sl] = bp;
+	h->index.fl_bitmap |= 1u << fl;
+	h->index.sl_bitmap[fl] |= 1u << sl;
+}
+
+static inline size_t lw_asize(size_t size)
+{
+	return size <= DSIZE ? 2 * DSIZE : ALIGN(2 * WSIZE + size);
+}
+
+/* Region that fits a block of asize. Sizes are whole chunks so regions are easy to reuse. */
+static inline size_t lw_region_bytes(size_t asize)
+{
+	size_t size = MAX(LW_REGION_SIZE, asize + LW_REGION_OVERHEAD);
+	return (size + CHUNKSIZE - 1) & ~(size_t)(CHUNKSIZE - 1);
+}
+
+static inline int lw_psram_room(lw_heap_t* h, size_t size)
+{
+	return h->tier != LW_TIER_PSRAM || h->heap_bytes + size <= LW_PSRAM_LIMIT;
+}
+
+/* Link a reserved region into h and index its one free block. Lock held. */
+static void lw_region_link(lw_heap_t* h, lw_region_t* r, size_t size)
+{
+	r->size = size;
+	r->next = h->regions;
+	h->regions = r;
+	h->heap_bytes += size;
+	h->nregions++;
+
+	char* bp = LW_REGION_FIRST(r);
+	PUT(HDRP(bp) - DSIZE, PACK(DSIZE, 1));
+	PUT(HDRP(bp) - WSIZE, PACK(DSIZE, 1));
+	set_block(bp, size - LW_REGION_OVERHEAD, 0);
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+	lw_add_free_block(h, bp);
+}
+
+/*
+ * Reserve a region that fits a size-byte request and link it into h. The
+ * heap functions never grow under the lock: entry points that find no room
+ * drop it, call this and try again, so the system heap is only called with
+ * the lock free. The region's block must be found by lw_find_fit(), which
+ * rounds the request up. Returns 0 if the system or the PSRAM limit has no
+ * room.
+ */
+static int lw_heap_grow(lw_heap_t* h, size_t size)
+{
+	size_t bytes = lw_region_bytes(lw_search_size(lw_asize(size)));
+	if (!lw_psram_room(h, bytes))
+		return 0;
+
+	lw_region_t* r = lw_sys_reserve(h, bytes);
+	if (r == NULL)
+		return 0;
+
+	lw_lock_acquire();
+	/* Another task may have grown PSRAM to the limit meanwhile. */
+	int ok = lw_psram_room(h, bytes);
+	if (ok)
+		lw_region_link(h, r, bytes);
+	lw_lock_release();
+
+	if (!ok)
+		lw_sys_release(r, bytes);
+	return ok;
+}
+
+/* Hand a list of trimmed regions back to the system. Lock not held. */
+static void lw_region_release(lw_region_t* r)
+{
+	while (r != NULL)
+	{
+		lw_region_t* next = r->next;
+		lw_sys_release(r, r->size);
+		r = next;
+	}
+}
+
+static inline int lw_region_empty(lw_region_t* r)
+{
+	return GET(HDRP(LW_REGION_FIRST(r))) == PACK((r->size - LW_REGION_OVERHEAD), 0);
+}
+
+/*
+ * Once empty regions hold more than high bytes, unlink them until at most
+ * keep bytes remain and add them to *out, for the caller to release with
+ * the lock dropped. Merges must be finished so empty regions are
+ * recognised. Lock held. Returns the bytes unlinked.
+ */
+static size_t lw_trim_heap(lw_heap_t* h, size_t high, size_t keep, lw_region_t** out)
+{
+	size_t empty = 0;
+	size_t released = 0;
+
+	h->trim_pending = 0;
+	for (lw_region_t* r = h->regions; r != NULL; r = r->next)
+	{
+		if (lw_region_empty(r))
+			empty += r->size;
+	}
+	if (empty <= high)
+		return 0;
+
+	lw_region_t** link = &h->regions;
+	while (*link != NULL && empty > keep)
+	{
+		lw_region_t* r = *link;
+		if (!lw_region_empty(r))
+		{
+			link = &r->next;
+			continue;
+		}
+		lw_remove_free_block(h, LW_REGION_FIRST(r));
+		*link = r->next;
+		empty -= r->size;
+		released += r->size;
+		h->heap_bytes -= r->size;
+		h->nregions--;
+		r->next = *out;
+		*out = r;
+	}
+	lw_trimmed_bytes += released;
+	return released;
+}
+
+static inline int lw_heap_owns(lw_heap_t* h, void* bp)
+{
+	for (lw_region_t* r = h->regions; r != NULL; r = r->next)
+	{
+		if ((char*)bp > (char*)r && (char*)bp < (char*)r + r->size)
+			return 1;
+	}
+	return 0;
+}
+
+/* Heap that owns bp. PSRAM and DMA blocks need a lookup. Lock held. */
+static inline lw_heap_t* lw_heap_of(void* bp)
+{
+#ifdef ESP_PLATFORM
+	if (esp_ptr_external_ram(bp))
+		return &lw_heaps[LW_TIER_PSRAM];
+#else
+	if (lw_heap_owns(&lw_heaps[LW_TIER_PSRAM], bp))
+		return &lw_heaps[LW_TIER_PSRAM];
+#endif
+	/* A few regions at most: DMA-capable SRAM is scarce. */
+	if (lw_heap_owns(LW_DMA, bp))
+		return LW_DMA;
+	return LW_INTERNAL;
+}
+
+static inline lw_bin_chunk_t* lw_bin_chunk_of(void* bp)
+{
+	return (lw_bin_chunk_t*)((char*)HDRP(bp) - ARENA_HDR(bp)->chunk_off);
+}
+
+static inline void lw_bin_hdr(void* bp, size_t size, int flags, lw_bin_chunk_t* c)
+{
+	ARENA_HDR(bp)->size_flags = (uint32_t)size | flags;
+	ARENA_HDR(bp)->chunk_off = (uint32_t)((char*)HDRP(bp) - (char*)c);
+}
+
+/* Large block for a new bin chunk. Lock held. */
+static lw_bin_chunk_t* lw_bin_chunk_new(lw_heap_t* h)
+{
+	/* lw_place may leave the chunk slightly bigger. */
+	lw_bin_chunk_t* c = lw_malloc_large(h, CHUNKSIZE - DSIZE);
+	if (c == NULL)
+		return NULL;
+
+	size_t csize = GET_SIZE(HDRP(c));
+	h->used_bytes -= csize;
+	h->bin_bytes += csize;
+	c->live = 0;
+	c->queued = 0;
+	return c;
+}
+
+static void* lw_bin_alloc(int class, size_t asize)
+{
+	lw_heap_t* h = LW_BINS;
+	char* bp = GET_ROOT(h, class);
+
+	if (bp == NULL)
+	{
+		lw_bin_chunk_t* c = lw_bin_chunk_new(h);
+		if (c == NULL)
+			return NULL;
+		lw_bin_chunks[class]++;
+		lw_bin_idle[class]++;
+
+		/* The chunk starts out as one free remainder behind its header. */
+		bp = (char*)c + LW_BIN_CHUNK_HDR + WSIZE;
+		lw_bin_hdr(bp, GET_SIZE(HDRP(c)) - DSIZE - LW_BIN_CHUNK_HDR, 4, c);
+	}
+
+	lw_bin_chunk_t* c = lw_bin_chunk_of(bp);
+	if (!GET_ALLOC(HDRP(bp)))
+	{
+		/* The remainder ends the list; a last piece too small to split goes whole. */
+		size_t csize = BIN_SIZE(bp);
+		if (csize < (asize << 1))
+		{
+			GET_ROOT(h, class) = NULL;
+		}
+		else
+		{
+			lw_bin_hdr(bp + asize, csize - asize, 4, c);
+			GET_ROOT(h, class) = bp + asize;
+		}
+		lw_bin_hdr(bp, asize, 5, c);
+	}
+	else
+	{
+		GET_ROOT(h, class) = GET_NEXT_S(bp);
+	}
+
+	if (c->live++ == 0)
+		lw_bin_idle[class]--;
+	lw_bin_out[class]++;
+	lw_bin_gen++;
+	return bp;
+}
+
+static void lw_bin_free(int class, void* bp)
+{
+	lw_heap_t* h = LW_BINS;
+	lw_bin_chunk_t* c = lw_bin_chunk_of(bp);
+
+	GET_NEXT_S(bp) = GET_ROOT(h, class);
+	GET_ROOT(h, class) = bp;
+	lw_bin_out[class]--;
+	lw_bin_gen++;
+	if (--c->live == 0)
+	{
+		lw_bin_idle[class]++;
+		h->trim_pending = 1;
+	}
+}
+
+/* Bytes handed out across tiers; magazine-cached blocks count as used. Lock held. */
+static inline void lw_note_peak(void)
+{
+	size_t used = lw_bin_bytes_out + LW_DMA->used_bytes;
+	for (int i = 0; i < LW_TIER_COUNT; i++)
+		used += lw_heaps[i].used_bytes;
+	if (used > lw_peak_used)
+		lw_peak_used = used;
+}
+
+#ifndef ESP_PLATFORM
+static void lw_mag_flush(lw_magazine_t* mag, int class, int n);
+
+/* Thread exit: hand the cached blocks back and stop caching for this thread. */
+static void lw_mag_release(void* arg)
+{
+	lw_magazine_t* mag = (lw_magazine_t*)arg;
+	for (int class = 0; class < LW_MAG_CLASSES; class++)
+		lw_mag_flush(mag, class, mag->count[class]);
+	mag->dead = 1;
+}
+
+static void lw_mag_key_init(void)
+{
+	pthread_key_create(&lw_mag_key, lw_mag_release);
+}
+
+static lw_magazine_t* lw_mag_self(void)
+{
+	if (!lw_mag_registered)
+	{
+		lw_mag_registered = 1;
+		pthread_once(&lw_mag_once, lw_mag_key_init);
+		pthread_setspecific(lw_mag_key, &lw_mag);
+	}
+	return &lw_mag;
+}
+#endif
+
+static void lw_mag_refill(lw_magazine_t* mag, int class, size_t asize)
+{
+	int want = mag->dead ? 1 : LW_MAG_BATCH;
+
+	lw_lock_acquire();
+	lw_stats.mag_refills++;
+	while (mag->count[class] < want)
+	{
+		void* bp = lw_bin_alloc(class, asize);
+		if (bp == NULL)
+			break;
+		mag->slots[class][mag->count[class]++] = bp;
+		lw_bin_bytes_out += asize;
+	}
+	lw_note_peak();
+	lw_lock_release();
+}
+
+static void lw_mag_flush(lw_magazine_t* mag, int class, int n)
+{
+	if (n <= 0)
+		return;
+
+	lw_lock_acquire();
+	lw_stats.mag_flushes++;
+	lw_bin_bytes_out -= (size_t)n * lw_bin_size(class);
+	while (n-- > 0)
+		lw_bin_free(class, mag->slots[class][--mag->count[class]]);
+	lw_lock_release();
+}
+
+static void* lw_malloc_large(lw_heap_t* h, size_t size)
+{
+	size_t asize = lw_asize(size);
+
+	lw_deferred_coalescing(h, lw_coalesce_budget);
+
+	/*
+	 * No fit: the caller grows the heap with lw_heap_grow(). Merges still
+	 * pending are left to the idle hook, which trims what they free up;
+	 * draining them here would be an unbounded pause under the lock.
+	 */
+	char* bp = lw_find_fit(h, asize);
+	if (bp == NULL)
+		return NULL;
+	return lw_place(h, bp, asize);
+}
+
+static void lw_free_large(lw_heap_t* h, void* bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	h->used_bytes -= size;
+	h->trim_pending = 1;
+
+	int prev_buf_n_alloc = IS_BUF_N_ALOC(PREV_BLKP(bp));
+	int next_buf_n_alloc = IS_BUF_N_ALOC(NEXT_BLKP(bp));
+
+	if ((prev_buf_n_alloc == 2) || (next_buf_n_alloc == 2))
+	{
+		set_block(bp, size, 6);
+		return;
+	}
+	else if ((prev_buf_n_alloc == 0) || (next_buf_n_alloc == 0))
+	{
+		set_block(bp, size, 2);
+		GET_NEXT(bp) = GET_ROOT(h, 1);
+		if (GET_ROOT(h, 1) != NULL)
+			GET_PREV(GET_ROOT(h, 1)) = bp;
+		GET_ROOT(h, 1) = bp;
+	}
+	else if ((prev_buf_n_alloc == 1) && (next_buf_n_alloc == 1))
+	{
+		set_block(bp, size, 0);
+		lw_add_free_block(h, bp);
+	}
+}
+
+/* Give the tail of an allocated block beyond asize back to the heap. Lock held. */
+static void lw_split_tail(lw_heap_t* h, char* bp, size_t asize)
+{
+	size_t total = GET_SIZE(HDRP(bp));
+	if (total - asize > LW_SPLIT_MIN)
+	{
+		set_block(bp, asize, 1);
+		set_block(NEXT_BLKP(bp), total - asize, 1);
+		lw_free_large(h, NEXT_BLKP(bp));
+	}
+}
+
+/*
+ * Reclaim scan, carried over from one idle pass to the next. Entries of
+ * queued chunks are held off their list until the class is done, when the
+ * chunks go back whole. Any bin list change in between voids the position,
+ * and the held entries go back to the list. Lock held.
+ */
+static int lw_scan_class = 2;
+static void** lw_scan_link;	/* where the class scan stopped, NULL at its root */
+static uint32_t lw_scan_gen;
+static void* lw_scan_held;
+static lw_bin_chunk_t* lw_scan_idle;
+
+static void lw_bin_scan_abort(void)
+{
+	lw_heap_t* h = LW_BINS;
+
+	while (lw_scan_held != NULL)
+	{
+		void* bp = lw_scan_held;
+		lw_scan_held = GET_NEXT_S(bp);
+		GET_NEXT_S(bp) = GET_ROOT(h, lw_scan_class);
+		GET_ROOT(h, lw_scan_class) = bp;
+	}
+	for (lw_bin_chunk_t* c = lw_scan_idle; c != NULL; c = c->next)
+		c->queued = 0;
+	lw_scan_idle = NULL;
+	lw_scan_link = NULL;
+}
+
+/*
+ * Hand bin chunks with no block out back to the large heap, so parked bins
+ * do not pin their region. Walks only the lists of classes that have such
+ * chunks, visiting at most budget entries; the next call continues where
+ * this one stopped. Lock held. Returns whether the scan is unfinished.
+ */
+static bool lw_bin_reclaim(size_t budget)
+{
+	lw_heap_t* h = LW_BINS;
+
+	if (lw_scan_gen != lw_bin_gen)
+		lw_bin_scan_abort();
+	if (budget == LW_COALESCE_ALL)
+	{
+		lw_bin_scan_abort();
+		lw_scan_class = 2;
+	}
+
+	for (; lw_scan_class < LW_MAG_CLASSES; lw_scan_class++)
+	{
+		int class = lw_scan_class;
+		if (lw_scan_link == NULL)
+		{
+			if (lw_bin_idle[class] == 0)
+				continue;
+			lw_scan_link = &GET_ROOT(h, class);
+		}
+
+		void** link = lw_scan_link;
+		while (*link != NULL)
+		{
+			if (budget == 0)
+			{
+				lw_scan_link = link;
+				lw_scan_gen = lw_bin_gen;
+				return true;
+			}
+			budget--;
+
+			char* bp = *link;
+			lw_bin_chunk_t* c = lw_bin_chunk_of(bp);
+			int remainder = !GET_ALLOC(HDRP(bp));
+
+			if (c->live != 0)
+			{
+				if (remainder)
+					break;
+				link = &GET_NEXT_S(bp);
+				continue;
+			}
+			if (remainder)
+			{
+				*link = NULL;
+			}
+			else
+			{
+				*link = GET_NEXT_S(bp);
+				GET_NEXT_S(bp) = lw_scan_held;
+				lw_scan_held = bp;
+			}
+			if (!c->queued)
+			{
+				c->queued = 1;
+				c->next = lw_scan_idle;
+				lw_scan_idle = c;
+			}
+		}
+
+		while (lw_scan_idle != NULL)
+		{
+			lw_bin_chunk_t* idle = lw_scan_idle;
+			size_t csize = GET_SIZE(HDRP(idle));
+			lw_scan_idle = idle->next;
+			h->bin_bytes -= csize;
+			h->used_bytes += csize;
+			lw_bin_chunks[class]--;
+			lw_bin_idle[class]--;
+			lw_free_large(h, idle);
+		}
+		lw_scan_held = NULL;
+		lw_scan_link = NULL;
+	}
+	lw_scan_class = 2;
+	lw_scan_gen = lw_bin_gen;
+	return false;
+}
+
+/* Scope slot of the calling task; with create, claims a free one. Lock held. */
+static lw_task_scope_t* lw_scope_slot(int create)
+{
+	void* self = LW_TASK_SELF();
+	lw_task_scope_t* free_slot = NULL;
+
+	for (int i = 0; i < LW_TASK_SLOTS; i++)
+	{
+		if (lw_scopes[i].owner == self)
+			return &lw_scopes[i];
+		if (lw_scopes[i].owner == NULL && free_slot == NULL)
+			free_slot = &lw_scopes[i];
+	}
+	if (!create || free_slot == NULL)
+		return NULL;
+
+	free_slot->owner = self;
+	free_slot->tag = LW_TAG_DEFAULT;
+	free_slot->arena = NULL;
+	lw_scopes_active++;
+	return free_slot;
+}
+
+/*
+ * Whether the calling task has an arena, read without the lock. Only a task
+ * sets its own arena, so a miss is always right; a hit is looked up again
+ * under the lock.
+ */
+static inline int lw_task_has_arena(void)
+{
+	void* self = LW_TASK_SELF();
+	for (int i = 0; i < LW_TASK_SLOTS; i++)
+	{
+		if (lw_scopes[i].owner == self && lw_scopes[i].arena != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+/* Give the slot back once it no longer changes anything. Lock held. */
+static void lw_scope_trim(lw_task_scope_t* s)
+{
+	if (s->tag == LW_TAG_DEFAULT && s->arena == NULL)
+	{
+		s->owner = NULL;
+		lw_scopes_active--;
+	}
+}
+
+/* Tag set by the calling task, or LW_TAG_DEFAULT. Lock held. */
+static lw_tag_t lw_task_tag(void)
+{
+	if (lw_scopes_active == 0)
+		return LW_TAG_DEFAULT;
+
+	lw_task_scope_t* s = lw_scope_slot(0);
+	return s != NULL ? (lw_tag_t)s->tag : LW_TAG_DEFAULT;
+}
+
+/*
+ * Pick the tier for a large request and fall back to internal SRAM once
+ * PSRAM is full. Without a fit, *grow is the heap to grow. Lock held.
+ */
+static void* lw_malloc_routed(size_t size, lw_tag_t tag, lw_heap_t** grow)
+{
+	void* bp;
+
+	if (tag == LW_TAG_DEFAULT)
+		tag = lw_task_tag();
+
+	if (tag == LW_TAG_DMA)
+	{
+		*grow = LW_DMA;
+		return lw_malloc_large(LW_DMA, size);
+	}
+
+	if (CONFIG_LWMALLOC_TIERED &&
+		(tag == LW_TAG_COLD || (tag == LW_TAG_DEFAULT && size >= lw_psram_threshold)))
+	{
+		lw_heap_t* psram = &lw_heaps[LW_TIER_PSRAM];
+		if ((bp = lw_malloc_large(psram, size)) != NULL)
+			return bp;
+		if (lw_psram_room(psram, lw_region_bytes(lw_search_size(lw_asize(size)))))
+		{
+			*grow = psram;
+			return NULL;
+		}
+	}
+
+	*grow = LW_INTERNAL;
+	return lw_malloc_large(LW_INTERNAL, size);
+}
+
+static void* lw_memalign_large(size_t align, size_t size, lw_tag_t tag, lw_heap_t** grow);
+
+/*
+ * Large allocation. The lock is held only to place the block; when no heap
+ * has a fit, one grows with the lock dropped and the request is tried
+ * again. align above ALIGNMENT asks for an aligned block.
+ */
+static void* lw_malloc_slow(size_t align, size_t size, lw_tag_t tag)
+{
+	/* Sizes this big would wrap in the block arithmetic. */
+	if (size > (size_t)-1 / 2)
+		return NULL;
+
+	for (;;)
+	{
+		lw_heap_t* grow = LW_INTERNAL;
+		void* bp;
+
+		lw_lock_acquire();
+		if (align > ALIGNMENT)
+			bp = lw_memalign_large(align, size, tag, &grow);
+		else
+			bp = lw_malloc_routed(size, tag, &grow);
+		lw_note_peak();
+		lw_lock_release();
+		if (bp != NULL)
+			return bp;
+
+		if (lw_heap_grow(grow, align > ALIGNMENT ? size + align + LW_MIN_BLOCK : size))
+			continue;
+		if (grow != &lw_heaps[LW_TIER_PSRAM])
+			return NULL;
+		/* The system has no PSRAM left: internal SRAM it is. */
+		tag = LW_TAG_HOT;
+	}
+}
+
+static void lw_sample(size_t size)
+{
+	if (__atomic_add_fetch(&lw_sample_tick, 1, __ATOMIC_RELAXED) % lw_sample_rate != 0)
+		return;
+	int bucket = size < 16 ? 0 : MIN(lw_fls(size) - 3, LW_HEAP_HIST_BUCKETS - 1);
+	__atomic_add_fetch(&lw_hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void* lw_malloc(size_t size)
+{
+	void* bp = NULL;
+
+	if (lw_sample_rate != 0)
+		lw_sample(size);
+
+	/* Tasks without an arena skip the lookup and the lock. */
+	if (lw_arena_scopes != 0 && lw_task_has_arena() && (bp = lw_arena_malloc(size)) != NULL)
+		return bp;
+
+	int class;
+	if (size <= LW_BIN_MAX && (class = lw_bin_class(MAX(ALIGN(size + WSIZE), (size_t)16))) != 0)
+	{
+		/* An empty bin heap grows outside the magazine and the lock. */
+		do
+		{
+			LW_MAG_ENTER();
+			lw_magazine_t* mag = LW_MAG_SELF();
+			if (mag->count[class] == 0)
+				lw_mag_refill(mag, class, lw_bin_size(class));
+			if (mag->count[class] != 0)
+				bp = mag->slots[class][--mag->count[class]];
+			LW_MAG_EXIT();
+		} while (bp == NULL && lw_heap_grow(LW_BINS, CHUNKSIZE - DSIZE));
+		return bp;
+	}
+
+	return lw_malloc_slow(0, size, LW_TAG_DEFAULT);
+}
+
+void* lw_malloc_tagged(size_t size, lw_tag_t tag)
+{
+	void* bp = lw_malloc_tier(size, tag);
+	LW_TRACE(LW_TRACE_MALLOC, size, bp);
+	return bp;
+}
+
+static void* lw_malloc_tier(size_t size, lw_tag_t tag)
+{
+	/* Bin chunks are not DMA-capable: small DMA blocks are large blocks. */
+	if (size <= LW_SMALL_MAX && tag != LW_TAG_DMA)
+		return lw_malloc(size);
+
+	if (lw_sample_rate != 0)
+		lw_sample(size);
+
+	return lw_malloc_slow(0, size, tag);
+}
+
+/*
+ * Over-allocate by align plus a minimum block, then hand the slack in front
+ * of the aligned payload and any large tail back to the heap. Lock held.
+ */
+static void* lw_memalign_large(size_t align, size_t size, lw_tag_t tag, lw_heap_t** grow)
+{
+	size_t pad = align + LW_MIN_BLOCK;
+	if (size > (size_t)-1 - pad - DSIZE)
+		return NULL;
+
+	size_t asize = lw_asize(size);
+	char* bp = lw_malloc_routed(asize - DSIZE + pad, tag, grow);
+	if (bp == NULL)
+		return NULL;
+
+	lw_heap_t* h = lw_heap_of(bp);
+	size_t total = GET_SIZE(HDRP(bp));
+	if (((uintptr_t)bp & (align - 1)) != 0)
+	{
+		char* abp = (char*)(((uintptr_t)bp + LW_MIN_BLOCK + align - 1) & ~(uintptr_t)(align - 1));
+		size_t lead = abp - bp;
+
+		set_block(bp, lead, 1);
+		set_block(abp, total - lead, 1);
+		lw_free_large(h, bp);
+		bp = abp;
+	}
+	lw_split_tail(h, bp, asize);
+	return bp;
+}
+
+static void* lw_memalign_tier(size_t align, size_t size, lw_tag_t tag, uint32_t flags)
+{
+	if (align == 0 || (align & (align - 1)) != 0)
+		return NULL;
+
+	if (flags & LW_ALLOC_DMA)
+	{
+		/* Only cold blocks may use PSRAM; there they must own whole cache lines. */
+		if (tag == LW_TAG_COLD)
+		{
+			align = MAX(align, (size_t)LW_DMA_PSRAM_ALIGN);
+			size = (size + LW_DMA_PSRAM_ALIGN - 1) & ~(size_t)(LW_DMA_PSRAM_ALIGN - 1);
+		}
+		else
+		{
+			tag = LW_TAG_DMA;
+		}
+	}
+
+	if (align <= ALIGNMENT)
+		return tag == LW_TAG_DEFAULT ? lw_malloc(size) : lw_malloc_tier(size, tag);
+
+	if (lw_sample_rate != 0)
+		lw_sample(size);
+
+	return lw_malloc_slow(align, size, tag);
+}
+
+void* lw_memalign_tagged(size_t align, size_t size, lw_tag_t tag, uint32_t flags)
+{
+	void* bp = lw_memalign_tier(align, size, tag, flags);
+	LW_TRACE(LW_TRACE_MALLOC, size, bp);
+	return bp;
+}
+
+void* lw_memalign(size_t align, size_t size)
+{
+	return lw_memalign_tagged(align, size, LW_TAG_DEFAULT, 0);
+}
+
+lw_tag_t lw_set_task_tag(lw_tag_t tag)
+{
+	lw_tag_t prev = LW_TAG_DEFAULT;
+
+	lw_lock_acquire();
+	/* A full table leaves the task on the default policy. */
+	lw_task_scope_t* s = lw_scope_slot(tag != LW_TAG_DEFAULT);
+	if (s != NULL)
+	{
+		prev = (lw_tag_t)s->tag;
+		s->tag = (uint8_t)tag;
+		lw_scope_trim(s);
+	}
+	lw_lock_release();
+	return prev;
+}
+
+/* Take a chunk for arena a from the internal heap. Lock held. */
+static lw_arena_chunk_t* lw_arena_chunk(lw_arena_t* a, size_t size)
+{
+	lw_arena_chunk_t* c = lw_malloc_large(LW_INTERNAL, size);
+	if (c == NULL)
+		return NULL;
+
+	c->next = a->chunks;
+	c->arena = a;
+	a->chunks = c;
+	a->end = (char*)c + size;
+	a->last = NULL;
+	lw_arena_bytes += GET_SIZE(HDRP(c));
+	return c;
+}
+
+lw_arena_t* lw_arena_create(size_t chunk_size)
+{
+	lw_arena_t tmp = { 0 };
+	lw_arena_t* a = NULL;
+
+	chunk_size = ALIGN(MAX(chunk_size, (size_t)1024));
+
+	lw_arena_chunk_t* c;
+	do
+	{
+		lw_lock_acquire();
+		c = lw_arena_chunk(&tmp, chunk_size);
+		if (c != NULL)
+		{
+			a = (lw_arena_t*)((char*)c + ALIGN(sizeof(lw_arena_chunk_t)));
+			*a = tmp;
+			a->chunk_size = chunk_size;
+			a->cur = (char*)a + ALIGN(sizeof(lw_arena_t));
+			c->arena = a;
+			lw_arenas++;
+			lw_note_peak();
+		}
+		lw_lock_release();
+	} while (c == NULL && lw_heap_grow(LW_INTERNAL, chunk_size));
+	return a;
+}
+
+/*
+ * Return every chunk of a dead arena to the heap, one short lock hold each.
+ * Nothing else can reach it any more. The arena lives in the last chunk.
+ */
+static void lw_arena_destroy(lw_arena_t* a)
+{
+	lw_arena_chunk_t* c = a->chunks;
+	while (c != NULL)
+	{
+		lw_arena_chunk_t* next = c->next;
+		lw_lock_acquire();
+		lw_arena_bytes -= GET_SIZE(HDRP(c));
+		lw_free_large(lw_heap_of(c), c);
+		lw_lock_release();
+		c = next;
+	}
+}
+
+/* Bump-allocate from the calling task's arena, if it has one. */
+static void* lw_arena_malloc(size_t size)
+{
+	void* bp = NULL;
+	size_t grow;
+
+	/* The arena is looked up again after growing: it may be released meanwhile. */
+	do
+	{
+		grow = 0;
+		lw_lock_acquire();
+		lw_task_scope_t* s = lw_scope_slot(0);
+		lw_arena_t* a = s != NULL ? s->arena : NULL;
+
+		/* Big blocks would waste most of a chunk; they go to the heap. */
+		if (a != NULL && size <= a->chunk_size / 4)
+		{
+			size_t asize = ALIGN(size) + WSIZE;
+			if (a->cur + asize > a->end)
+			{
+				lw_arena_chunk_t* c = lw_arena_chunk(a, a->chunk_size);
+				a->cur = c != NULL ? (char*)c + ALIGN(sizeof(lw_arena_chunk_t)) : a->end;
+				grow = c != NULL ? 0 : a->chunk_size;
+				lw_note_peak();
+			}
+			if (a->cur + asize <= a->end)
+			{
+				bp = a->cur + WSIZE;
+				ARENA_HDR(bp)->size_flags = (uint32_t)asize | LW_ARENA_FLAG;
+				ARENA_HDR(bp)->chunk_off = (uint32_t)((char*)HDRP(bp) - (char*)a->chunks);
+				a->cur += asize;
+				a->last = bp;
+				a->live++;
+			}
+		}
+		lw_lock_release();
+	} while (grow != 0 && lw_heap_grow(LW_INTERNAL, grow));
+	return bp;
+}
+
+static inline lw_arena_t* lw_arena_of(void* bp)
+{
+	lw_arena_chunk_t* c = (lw_arena_chunk_t*)((char*)HDRP(bp) - ARENA_HDR(bp)->chunk_off);
+	return c->arena;
+}
+
+static void lw_arena_free(void* bp)
+{
+	lw_lock_acquire();
+	lw_arena_t* a = lw_arena_of(bp);
+	if (bp == a->last)
+	{
+		a->cur = HDRP(bp);
+		a->last = NULL;
+	}
+	int dead = --a->live == 0 && a->released;
+	if (dead)
+		lw_arenas--;
+	lw_lock_release();
+
+	if (dead)
+		lw_arena_destroy(a);
+}
+
+lw_arena_t* lw_arena_set_current(lw_arena_t* arena)
+{
+	lw_arena_t* prev = NULL;
+
+	lw_lock_acquire();
+	lw_task_scope_t* s = lw_scope_slot(arena != NULL);
+	if (s != NULL)
+	{
+		prev = s->arena;
+		lw_arena_scopes += (arena != NULL) - (prev != NULL);
+		s->arena = arena;
+		lw_scope_trim(s);
+	}
+	lw_lock_release();
+	return prev;
+}
+
+void lw_arena_release(lw_arena_t* arena)
+{
+	if (arena == NULL)
+		return;
+
+	lw_lock_acquire();
+	for (int i = 0; i < LW_TASK_SLOTS; i++)
+	{
+		if (lw_scopes[i].owner != NULL && lw_scopes[i].arena == arena)
+		{
+			lw_scopes[i].arena = NULL;
+			lw_arena_scopes--;
+			lw_scope_trim(&lw_scopes[i]);
+		}
+	}
+	arena->released = 1;
+	int dead = arena->live == 0;
+	if (dead)
+		lw_arenas--;
+	lw_lock_release();
+
+	if (dead)
+		lw_arena_destroy(arena);
+}
+
+void lw_set_psram_threshold(size_t bytes)
+{
+	lw_lock_acquire();
+	lw_psram_threshold = MAX(bytes, (size_t)LW_SMALL_MAX + 1);
+	lw_lock_release();
+}
+
+void lw_free(void* bp)
+{
+	if (bp == NULL)
+		return;
+
+	if (IS_ARENA(bp))
+	{
+		lw_arena_free(bp);
+		return;
+	}
+
+	if (IS_BIN(bp))
+	{
+		int class = lw_bin_class(BIN_SIZE(bp));
+
+		LW_MAG_ENTER();
+		lw_magazine_t* mag = LW_MAG_SELF();
+		if (mag->count[class] == LW_MAG_SIZE)
+			lw_mag_flush(mag, class, LW_MAG_BATCH);
+		mag->slots[class][mag->count[class]++] = bp;
+		if (mag->dead)
+			lw_mag_flush(mag, class, mag->count[class]);
+		LW_MAG_EXIT();
+		return;
+	}
+
+	lw_lock_acquire();
+	lw_free_large(lw_heap_of(bp), bp);
+	lw_lock_release();
+}
+
+void* lw_calloc(size_t nmemb, size_t size)
+{
+	size_t bytes = nmemb * size;
+	if (size != 0 && bytes / size != nmemb)
+		return NULL;
+
+	void* new_ptr = lw_malloc(bytes);
+	if (new_ptr == NULL)
+		return NULL;
+	/* Arena blocks carry no heap size word; clear just the request. */
+	if (IS_ARENA(new_ptr))
+		memset(new_ptr, 0, bytes);
+	else if (IS_BIN(new_ptr))
+		memset(new_ptr, 0, BIN_SIZE(new_ptr) - WSIZE);
+	else
+		memset(new_ptr, 0, GET_SIZE(HDRP(new_ptr)) - DSIZE);
+	return new_ptr;
+}
+
+void lw_get_lock_stats(lw_lock_stats_t* out)
+{
+	lw_lock_acquire();
+	*out = lw_stats;
+	lw_lock_release();
+}
+
+void lw_reset_lock_stats(void)
+{
+	lw_lock_acquire();
+	memset(&lw_stats, 0, sizeof(lw_stats));
+	lw_lock_release();
+}
+
+/* Largest indexed free block: the highest non-empty list holds it. */
+static size_t lw_largest_free(lw_heap_t* h)
+{
+	if (h->index.fl_bitmap == 0)
+		return 0;
+
+	int fl = 31 - __builtin_clz(h->index.fl_bitmap);
+	int sl = 31 - __builtin_clz(h->index.sl_bitmap[fl]);
+	size_t best = 0;
+	for (void* bp = h->index.blocks[fl][sl]; bp != NULL; bp = GET_NEXT(bp))
+		best = MAX(best, GET_SIZE(HDRP(bp)));
+	return best;
+}
+
+void lw_heap_stats(lw_heap_stats_t* out)
+{
+	size_t large_free = 0;
+	size_t largest = 0;
+
+	memset(out, 0, sizeof(*out));
+
+	lw_lock_acquire();
+	/* The DMA heap counts for the internal tier. */
+	static const int large_heaps[] = { LW_TIER_INTERNAL, LW_TIER_PSRAM, LW_HEAP_DMA };
+	for (size_t i = 0; i < sizeof(large_heaps) / sizeof(large_heaps[0]); i++)
+	{
+		lw_heap_t* h = &lw_heaps[large_heaps[i]];
+		lw_tier_stats_t* t = &out->tiers[h->tier];
+		if (h->regions == NULL)
+			continue;
+
+		size_t free_bytes = h->heap_bytes - h->nregions * LW_REGION_OVERHEAD - h->bin_bytes - h->used_bytes;
+		t->heap_bytes += h->heap_bytes;
+		t->regions += h->nregions;
+		t->used_bytes += h->used_bytes;
+		t->free_bytes += free_bytes;
+		t->largest_free = MAX(t->largest_free, lw_largest_free(h));
+		large_free += free_bytes;
+		largest = MAX(largest, t->largest_free);
+		out->heap_bytes += h->heap_bytes;
+	}
+
+	/* Bin regions count for the internal tier; their spare room is not for large blocks. */
+	lw_heap_t* b = LW_BINS;
+	size_t bin_spare = b->heap_bytes - b->nregions * LW_REGION_OVERHEAD - b->bin_bytes - b->used_bytes;
+	out->tiers[LW_TIER_INTERNAL].heap_bytes += b->heap_bytes;
+	out->tiers[LW_TIER_INTERNAL].regions += b->nregions;
+	out->heap_bytes += b->heap_bytes;
+
+	size_t small_used = 0;
+	for (int class = 2; class < LW_MAG_CLASSES; class++)
+	{
+		lw_class_stats_t* c = &out->classes[class - 2];
+		c->block_size = lw_bin_size(class);
+		c->chunks = lw_bin_chunks[class];
+		c->used = lw_bin_out[class];
+#ifdef ESP_PLATFORM
+		/* Other cores' magazines are read racily; good enough for telemetry. */
+		for (int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+			c->cached += lw_mags[cpu].count[class];
+		c->used -= c->cached;
+#endif
+		small_used += (size_t)c->used * c->block_size;
+	}
+	out->used_bytes = small_used;
+	for (int i = 0; i < LW_TIER_COUNT; i++)
+		out->used_bytes += out->tiers[i].used_bytes;
+	out->free_bytes = large_free + bin_spare + b->bin_bytes - small_used;
+	out->largest_free = largest;
+	out->frag_permille = large_free ? (uint16_t)(1000 - (uint64_t)largest * 1000 / large_free) : 0;
+	out->peak_used_bytes = MAX(lw_peak_used, out->used_bytes);
+	out->sample_rate = lw_sample_rate;
+	out->arenas = lw_arenas;
+	out->arena_bytes = lw_arena_bytes;
+	out->trimmed_bytes = lw_trimmed_bytes;
+	memcpy(out->size_hist, lw_hist, sizeof(out->size_hist));
+	lw_lock_release();
+}
+
+void lw_set_sample_rate(uint32_t every_n)
+{
+	lw_lock_acquire();
+	lw_sample_rate = every_n;
+	memset(lw_hist, 0, sizeof(lw_hist));
+	lw_lock_release();
+}
+
+/*
+ * Grow a large block in place by absorbing free neighbours. The whole run
+ * is marked allocated; only the old header and footer inside it change, so
+ * the payload is untouched. When the block in front is absorbed, *move is
+ * set and the caller moves the payload down with the lock dropped. Lock held.
+ */
+static void* lw_realloc_merge(lw_heap_t* h, char* ptr, size_t oldsize, size_t asize, int* move)
+{
+	/* Buffered neighbours are still waiting to be coalesced: treat them as in use. */
+	int prev_alloc = !IS_INDEXED_FREE(FTRP(PREV_BLKP(ptr)));
+	size_t prev_size = GET_SIZE(FTRP(PREV_BLKP(ptr)));
+	int next_alloc = !IS_INDEXED_FREE(HDRP(NEXT_BLKP(ptr)));
+	size_t next_size = next_alloc ? 0 : GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+	char* bp = ptr;
+	size_t total = oldsize + next_size;
+
+	*move = 0;
+	if (total < asize)
+	{
+		if (prev_alloc || total + prev_size < asize)
+			return NULL;
+		bp = PREV_BLKP(ptr);
+		lw_remove_free_block(h, bp);
+		total += prev_size;
+		*move = 1;
+	}
+	if (!next_alloc)
+		lw_remove_free_block(h, NEXT_BLKP(ptr));
+
+	set_block(bp, total, 1);
+	return bp;
+}
+
+static void* lw_arena_realloc(void* ptr, size_t size)
+{
+	lw_lock_acquire();
+	lw_arena_t* a = lw_arena_of(ptr);
+	size_t old = (ARENA_HDR(ptr)->size_flags & ~0x7) - WSIZE;
+	if (size <= old)
+	{
+		lw_lock_release();
+		return ptr;
+	}
+	/* The newest block grows in place while its chunk has room. */
+	if (ptr == a->last && (char*)ptr + ALIGN(size) <= a->end)
+	{
+		ARENA_HDR(ptr)->size_flags = (uint32_t)(ALIGN(size) + WSIZE) | LW_ARENA_FLAG;
+		a->cur = (char*)ptr + ALIGN(size);
+		lw_lock_release();
+		return ptr;
+	}
+	lw_lock_release();
+
+	void* newptr = lw_malloc(size);
+	if (newptr == NULL)
+		return NULL;
+	memcpy(newptr, ptr, old);
+	lw_free(ptr);
+	return newptr;
+}
+
+void* lw_realloc(void* ptr, size_t size)
+{
+	size_t asize;
+	void* newptr;
+
+	if (size <= DSIZE)
+		asize = 2 * DSIZE;
+	else
+		asize = ALIGN(2 * WSIZE + size);
+
+	if (ptr == NULL)
+		return lw_malloc(size);
+
+	if (IS_ARENA(ptr) && size != 0)
+		return lw_arena_realloc(ptr, size);
+
+	if (size <= 0)
+	{
+		lw_free(ptr);
+		return 0;
+	}
+
+	if (IS_BIN(ptr))
+	{
+		size_t binsize = BIN_SIZE(ptr);
+		if (size + WSIZE <= binsize)
+			return ptr;
+
+		newptr = lw_malloc(size);
+		if (newptr == NULL)
+			return NULL;
+
+		memcpy(newptr, ptr, MIN(binsize - WSIZE, size));
+		lw_free(ptr);
+		return newptr;
+	}
+
+	size_t oldsize = GET_SIZE(HDRP(ptr));
+	if (asize <= oldsize)
+		return ptr;
+
+	lw_heap_t* h;
+	int move;
+	/* lw_heap_of() walks the region lists, which trimming edits under the lock. */
+	lw_lock_acquire();
+	h = lw_heap_of(ptr);
+	lw_deferred_coalescing(h, lw_coalesce_budget);
+	newptr = lw_realloc_merge(h, ptr, oldsize, asize, &move);
+	if (newptr != NULL)
+	{
+		h->used_bytes += GET_SIZE(HDRP(newptr)) - oldsize;
+		lw_note_peak();
+		if (!move)
+			lw_split_tail(h, newptr, asize);
+	}
+	lw_lock_release();
+	if (newptr != NULL)
+	{
+		if (!move)
+			return newptr;
+		/* The run is ours: move the payload without the lock, then trim it. */
+		memmove(newptr, ptr, oldsize - DSIZE);
+		lw_lock_acquire();
+		lw_split_tail(h, newptr, asize);
+		lw_lock_release();
+		return newptr;
+	}
+
+	/* A block that already lives in PSRAM or DMA-capable SRAM stays there when it moves. */
+	newptr = lw_malloc_tier(size, h->tier == LW_TIER_PSRAM ? LW_TAG_COLD : h == LW_DMA ? LW_TAG_DMA : LW_TAG_DEFAULT);
+	if (newptr == NULL)
+		return NULL;
+
+	memcpy(newptr, ptr, (GET_SIZE(HDRP(ptr)) - DSIZE));
+	lw_free(ptr);
+
+	return newptr;
+}
+
+static inline void lw_unlink_buffered(lw_heap_t* h, void* bp)
+{
+	if (bp == GET_ROOT(h, 1))
+	{
+		GET_ROOT(h, 1) = GET_NEXT(bp);
+	}
+	else
+	{
+		GET_NEXT(GET_PREV(bp)) = GET_NEXT(bp);
+		if (GET_NEXT(bp) != NULL)
+			GET_PREV(GET_NEXT(bp)) = GET_PREV(bp);
+	}
+}
+
+/* Take a free neighbour out of whichever list it is on before merging it. */
+static inline void lw_absorb(lw_heap_t* h, void* bp)
+{
+	if (IS_BUFFER(bp) && !IS_BIN(bp))
+		lw_unlink_buffered(h, bp);
+	else if (!IS_BUFFER(bp) && !IS_BIN(bp))
+		lw_remove_free_block(h, bp);
+}
+
+/*
+ * Merge the free run around the head of the buffered list, visiting at most
+ * *budget blocks. If the budget runs out while free neighbours remain, the
+ * merged block goes back to the head of the buffered list and the next call
+ * continues from it. Returns the number of blocks merged.
+ */
+static size_t lw_coalesce_one(lw_heap_t* h, size_t* budget)
+{
+	char* ptr = GET_ROOT(h, 1);
+	char* start_ptr = ptr;
+	char* next_ptr = NEXT_BLKP(ptr);
+	size_t totalsize = GET_SIZE(HDRP(ptr));
+	size_t merged = 0;
+
+	lw_unlink_buffered(h, ptr);
+	(*budget)--;
+
+	while (*budget > 0 && !GET_ALLOC(HDRP(PREV_BLKP(start_ptr))))
+	{
+		start_ptr = PREV_BLKP(start_ptr);
+		lw_absorb(h, start_ptr);
+		totalsize += GET_SIZE(HDRP(start_ptr));
+		merged++;
+		(*budget)--;
+	}
+
+	while (*budget > 0 && !GET_ALLOC(HDRP(next_ptr)))
+	{
+		lw_absorb(h, next_ptr);
+		totalsize += GET_SIZE(HDRP(next_ptr));
+		next_ptr = NEXT_BLKP(next_ptr);
+		merged++;
+		(*budget)--;
+	}
+
+	if (!GET_ALLOC(HDRP(PREV_BLKP(start_ptr))) || !GET_ALLOC(HDRP(next_ptr)))
+	{
+		set_block(start_ptr, totalsize, 2);
+		GET_NEXT(start_ptr) = GET_ROOT(h, 1);
+		if (GET_ROOT(h, 1) != NULL)
+			GET_PREV(GET_ROOT(h, 1)) = start_ptr;
+		GET_ROOT(h, 1) = start_ptr;
+	}
+	else
+	{
+		set_block(start_ptr, totalsize, 0);
+		lw_add_free_block(h, start_ptr);
+	}
+	return merged;
+}
+
+/*
+ * Drain the buffered list (class 1) within a work budget counted in visited
+ * blocks, so a single call has a bounded pause. LW_COALESCE_ALL drains it
+ * completely. Lock held.
+ */
+static void lw_deferred_coalescing(lw_heap_t* h, size_t budget)
+{
+	if (GET_ROOT(h, 1) == NULL)
+		return;
+
+	uint64_t t0 = LW_NOW_NS();
+	size_t merged = 0;
+
+	while (budget > 0 && GET_ROOT(h, 1) != NULL)
+		merged += lw_coalesce_one(h, &budget);
+
+	uint32_t pause = (uint32_t)MIN(LW_NOW_NS() - t0, (uint64_t)UINT32_MAX);
+	lw_cstats.calls++;
+	lw_cstats.blocks_merged += merged;
+	lw_cstats.total_pause_ns += pause;
+	if (pause > lw_cstats.max_pause_ns)
+		lw_cstats.max_pause_ns = pause;
+	if (GET_ROOT(h, 1) == NULL)
+		lw_cstats.drained++;
+}
+
+bool lw_coalesce_idle(void)
+{
+	bool more = false;
+	lw_region_t* trimmed = NULL;
+
+	/* Never make the idle task wait for the heap. */
+	if (!LW_TRYLOCK())
+		return true;
+
+	lw_stats.lock_acquires++;
+	lw_cstats.idle_calls++;
+	for (int i = 0; i < LW_HEAP_COUNT; i++)
+	{
+		lw_heap_t* h = &lw_heaps[i];
+		if (h->regions == NULL)
+			continue;
+		lw_deferred_coalescing(h, lw_coalesce_budget);
+		/* Chunks the bins give back are merged on the next pass, then trimmed. */
+		if (h == LW_BINS && GET_ROOT(h, 1) == NULL && (h->trim_pending || lw_scan_link != NULL || lw_scan_class != 2))
+			more |= lw_bin_reclaim(lw_coalesce_budget);
+		if (GET_ROOT(h, 1) != NULL)
+			more = true;
+		else if (h->trim_pending)
+			lw_trim_heap(h, LW_TRIM_THRESHOLD, LW_REGION_SIZE, &trimmed);
+	}
+	lw_lock_release();
+	lw_region_release(trimmed);
+	return more;
+}
+
+size_t lw_trim(size_t keep)
+{
+	size_t released = 0;
+	lw_region_t* trimmed = NULL;
+
+	/* Blocks cached for the caller would keep their chunks from going back. */
+	LW_MAG_ENTER();
+	lw_magazine_t* mag = LW_MAG_SELF();
+	for (int class = 2; class < LW_MAG_CLASSES; class++)
+		lw_mag_flush(mag, class, mag->count[class]);
+	LW_MAG_EXIT();
+
+	lw_lock_acquire();
+	for (int i = 0; i < LW_HEAP_COUNT; i++)
+	{
+		lw_heap_t* h = &lw_heaps[i];
+		if (h == LW_BINS)
+			lw_bin_reclaim(LW_COALESCE_ALL);
+		lw_deferred_coalescing(h, LW_COALESCE_ALL);
+		released += lw_trim_heap(h, keep, keep, &trimmed);
+	}
+	lw_lock_release();
+	lw_region_release(trimmed);
+	return released;
+}
+
+#ifdef ESP_PLATFORM
+static bool lw_idle_hook(void)
+{
+	/* true lets the idle task sleep until the next tick. */
+	return !lw_coalesce_idle();
+}
+
+void lw_coalesce_idle_enable(void)
+{
+	for (int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+		esp_register_freertos_idle_hook_for_cpu(lw_idle_hook, cpu);
+}
+#endif
+
+void lw_set_coalesce_budget(size_t blocks)
+{
+	lw_lock_acquire();
+	lw_coalesce_budget = MAX(blocks, LW_COALESCE_MIN);
+	lw_lock_release();
+}
+
+void lw_get_coalesce_stats(lw_coalesce_stats_t* out)
+{
+	lw_lock_acquire();
+	*out = lw_cstats;
+	lw_lock_release();
+}
+
+void lw_reset_coalesce_stats(void)
+{
+	lw_lock_acquire();
+	memset(&lw_cstats, 0, sizeof(lw_cstats));
+	lw_lock_release();
+}
+
+static void* lw_find_fit(lw_heap_t* h, size_t asize)
+{
+	int fl, sl;
+	lw_mapping_search(asize, &fl, &sl);
+
+	for (;;)
+	{
+		uint32_t sl_map = h->index.sl_bitmap[fl] & (~0u << sl);
+		if (sl_map == 0)
+		{
+			uint32_t fl_map = (fl + 1 < LW_FL_COUNT) ? (h->index.fl_bitmap & (~0u << (fl + 1))) : 0;
+			if (fl_map == 0)
+				return NULL;
+			fl = __builtin_ctz(fl_map);
+			sl_map = h->index.sl_bitmap[fl];
+		}
+		sl = __builtin_ctz(sl_map);
+
+		/*
+		 * Only the first and the last, clamped list can hold blocks smaller
+		 * than the request; if none of them fits, go on to the next list.
+		 */
+		void* bp = h->index.blocks[fl][sl];
+		while (bp != NULL && GET_SIZE(HDRP(bp)) < asize)
+			bp = GET_NEXT(bp);
+		if (bp != NULL)
+			return bp;
+
+		if (++sl == LW_SL_COUNT)
+		{
+			if (++fl == LW_FL_COUNT)
+				return NULL;
+			sl = 0;
+		}
+	}
+}
+
+static void* lw_place(lw_heap_t* h, void* bp, size_t asize)
+{
+	lw_remove_free_block(h, bp);
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if ((csize - asize) <= LW_SPLIT_MIN)
+	{
+		set_block(bp, csize, 1);
+		h->used_bytes += csize;
+		return bp;
+	}
+	else
+	{
+		set_block(bp, asize, 1);
+		h->used_bytes += asize;
+		set_block(NEXT_BLKP(bp), csize - asize, 0);
+		lw_add_free_block(h, NEXT_BLKP(bp));
+		return bp;
+	}
+}
+
+#if CONFIG_LWMALLOC_TRACE
+/*
+ * Allocation trace recorder. Every call through malloc/free/realloc/calloc
+ * and lw_malloc_tagged appends a 12-byte record to a ring; once full, the
+ * oldest records are overwritten. The ring has its own lock so the
+ * magazine fast path stays lock-free when tracing is compiled out.
+ */
+#ifdef ESP_PLATFORM
+static portMUX_TYPE lw_trace_lock = portMUX_INITIALIZER_UNLOCKED;
+#define LW_TRACE_LOCK() portENTER_CRITICAL(&lw_trace_lock)
+#define LW_TRACE_UNLOCK() portEXIT_CRITICAL(&lw_trace_lock)
+static lw_trace_rec_t* lw_trace_ring;
+#else
+static pthread_mutex_t lw_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LW_TRACE_LOCK() pthread_mutex_lock(&lw_trace_lock)
+#define LW_TRACE_UNLOCK() pthread_mutex_unlock(&lw_trace_lock)
+static lw_trace_rec_t lw_trace_buf[CONFIG_LWMALLOC_TRACE_ENTRIES];
+static lw_trace_rec_t* lw_trace_ring = lw_trace_buf;
+#endif
+
+static uint32_t lw_trace_written;
+static uint8_t lw_trace_on = 1;
+static uint64_t lw_trace_t0;
+
+static void lw_trace_record(uint32_t op, size_t size, void* ptr)
+{
+	if (!lw_trace_on || ptr == NULL)
+		return;
+
+#ifdef ESP_PLATFORM
+	/* The ring comes from the system heap, preferably PSRAM, on first use. */
+	if (lw_trace_ring == NULL)
+	{
+		size_t bytes = CONFIG_LWMALLOC_TRACE_ENTRIES * sizeof(lw_trace_rec_t);
+		lw_trace_rec_t* ring = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (ring == NULL)
+			ring = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+		if (ring == NULL)
+			return;
+		LW_TRACE_LOCK();
+		if (lw_trace_ring == NULL)
+		{
+			lw_trace_ring = ring;
+			ring = NULL;
+		}
+		LW_TRACE_UNLOCK();
+		if (ring != NULL)
+			heap_caps_free(ring);
+	}
+#endif
+
+	uint64_t now = LW_NOW_NS() / 1000;
+	lw_trace_rec_t rec = {
+		.size_op = (op << LW_TRACE_OP_SHIFT) | (uint32_t)MIN(size, (size_t)LW_TRACE_SIZE_MASK),
+		.id = (uint32_t)((uintptr_t)ptr >> 3),
+	};
+
+	LW_TRACE_LOCK();
+	if (lw_trace_written == 0)
+		lw_trace_t0 = now;
+	rec.ts_us = (uint32_t)(now - lw_trace_t0);
+	lw_trace_ring[lw_trace_written % CONFIG_LWMALLOC_TRACE_ENTRIES] = rec;
+	lw_trace_written++;
+	LW_TRACE_UNLOCK();
+}
+
+void lw_trace_enable(bool on)
+{
+	LW_TRACE_LOCK();
+	lw_trace_on = on;
+	LW_TRACE_UNLOCK();
+}
+
+void lw_trace_clear(void)
+{
+	LW_TRACE_LOCK();
+	lw_trace_written = 0;
+	LW_TRACE_UNLOCK();
+}
+
+size_t lw_trace_export(size_t offset, void* buf, size_t len)
+{
+	lw_trace_file_hdr_t hdr = { .magic = { 'L', 'W', 'T', 'R' }, .version = 1, .rec_size = sizeof(lw_trace_rec_t) };
+	size_t copied = 0;
+
+	LW_TRACE_LOCK();
+	uint32_t count = MIN(lw_trace_written, (uint32_t)CONFIG_LWMALLOC_TRACE_ENTRIES);
+	uint32_t first = lw_trace_written - count;
+	hdr.count = count;
+	hdr.dropped = first;
+
+	if (offset < sizeof(hdr))
+	{
+		copied = MIN(len, sizeof(hdr) - offset);
+		memcpy(buf, (char*)&hdr + offset, copied);
+	}
+	size_t total = sizeof(hdr) + (size_t)count * sizeof(lw_trace_rec_t);
+	while (copied < len && offset + copied < total)
+	{
+		size_t pos = offset + copied - sizeof(hdr);
+		size_t idx = pos / sizeof(lw_trace_rec_t);
+		size_t skip = pos % sizeof(lw_trace_rec_t);
+		size_t n = MIN(sizeof(lw_trace_rec_t) - skip, len - copied);
+		const char* rec = (const char*)&lw_trace_ring[(first + idx) % CONFIG_LWMALLOC_TRACE_ENTRIES];
+		memcpy((char*)buf + copied, rec + skip, n);
+		copied += n;
+	}
+	LW_TRACE_UNLOCK();
+	return copied;
+}
+
+int lw_trace_dump(const char* path)
+{
+	char chunk[512];
+	size_t offset = 0;
+	size_t n;
+
+	/* Recording stops so the file is one consistent snapshot. */
+	lw_trace_enable(false);
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+	{
+		lw_trace_enable(true);
+		return -1;
+	}
+	while ((n = lw_trace_export(offset, chunk, sizeof(chunk))) > 0)
+	{
+		if (fwrite(chunk, 1, n, f) != n)
+			break;
+		offset += n;
+	}
+	int ok = (fclose(f) == 0 && n == 0);
+	lw_trace_enable(true);
+	return ok ? (int)((offset - sizeof(lw_trace_file_hdr_t)) / sizeof(lw_trace_rec_t)) : -1;
+}
+#else
+void lw_trace_enable(bool on) { (void)on; }
+
+void lw_trace_clear(void) { }
+
+size_t lw_trace_export(size_t offset, void* buf, size_t len)
+{
+	(void)offset;
+	(void)buf;
+	(void)len;
+	return 0;
+}
+
+int lw_trace_dump(const char* path)
+{
+	(void)path;
+	return -1;
+}
+#endif
@@ -0,0 +1,291 @@
+#include "unity.h"
+
+#include "lwmalloc.h"
+
+#include "esp_memory_utils.h"
+#include "sdkconfig.h"
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void fill(void *p, size_t len, uint8_t seed) {
+  uint8_t *b = p;
+  for (size_t i = 0; i < len; ++i)
+    b[i] = (uint8_t)(seed + i * 7);
+}
+
+static void check(const void *p, size_t len, uint8_t seed) {
+  const uint8_t *b = p;
+  for (size_t i = 0; i < len; ++i) {
+    if (b[i] != (uint8_t)(seed + i * 7))
+      TEST_FAIL_MESSAGE("content changed");
+  }
+}
+
+// Run the idle pass until nothing is pending
+static void coalesce_all(void) {
+  for (int i = 0; i < 10000 && lw_coalesce_idle(); ++i) {
+  }
+}
+
+TEST_CASE("malloc / calloc keep their contents", "[lwmalloc]") {
+  static const size_t sizes[] = {1, 8, 24, 120, 121, 500, 4096, 20000};
+  void *p[sizeof(sizes) / sizeof(sizes[0])];
+
+  for (int i = 0; i < 8; ++i) {
+    p[i] = malloc(sizes[i]);
+    TEST_ASSERT_NOT_NULL(p[i]);
+    TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)p[i] & 7);
+    fill(p[i], sizes[i], i);
+  }
+  for (int i = 0; i < 8; ++i)
+    check(p[i], sizes[i], i);
+  for (int i = 0; i < 8; ++i)
+    free(p[i]);
+
+  // Reused blocks come back cleared
+  for (int i = 0; i < 8; ++i) {
+    uint8_t *z = calloc(sizes[i], 3);
+    TEST_ASSERT_NOT_NULL(z);
+    for (size_t j = 0; j < sizes[i] * 3; ++j)
+      TEST_ASSERT_EQUAL_UINT8(0, z[j]);
+    free(z);
+  }
+  // Volatile keeps the compiler from flagging the overflow it is testing
+  volatile size_t huge = SIZE_MAX / 2;
+  TEST_ASSERT_NULL(calloc(huge, 3));
+  free(NULL);
+}
+
+TEST_CASE("blocks land on their tier", "[lwmalloc]") {
+  void *hot = lw_malloc_tagged(8192, LW_TAG_HOT);
+  void *dma = lw_malloc_tagged(2048, LW_TAG_DMA);
+  // Bin chunks are not DMA-capable, so small DMA blocks skip the bins
+  void *dma_small = lw_malloc_tagged(64, LW_TAG_DMA);
+  void *cold = lw_malloc_tagged(8192, LW_TAG_COLD);
+  TEST_ASSERT_NOT_NULL(hot);
+  TEST_ASSERT_NOT_NULL(dma);
+  TEST_ASSERT_NOT_NULL(dma_small);
+  TEST_ASSERT_NOT_NULL(cold);
+  TEST_ASSERT_TRUE(esp_ptr_internal(hot));
+  TEST_ASSERT_TRUE(esp_ptr_dma_capable(dma));
+  TEST_ASSERT_TRUE(esp_ptr_dma_capable(dma_small));
+#if CONFIG_LWMALLOC_TIERED
+  TEST_ASSERT_TRUE(esp_ptr_external_ram(cold));
+#endif
+  fill(hot, 8192, 1);
+  fill(dma, 2048, 2);
+  fill(cold, 8192, 3);
+  check(hot, 8192, 1);
+  check(dma, 2048, 2);
+  check(cold, 8192, 3);
+  // A DMA block that moves stays DMA-capable
+  dma = realloc(dma, 16384);
+  TEST_ASSERT_NOT_NULL(dma);
+  TEST_ASSERT_TRUE(esp_ptr_dma_capable(dma));
+  check(dma, 2048, 2);
+  free(hot);
+  free(dma);
+  free(dma_small);
+  free(cold);
+}
+
+TEST_CASE("realloc moves contents across bins, heaps and tiers", "[lwmalloc]") {
+  // Small bin -> large heap -> larger -> small bin again
+  uint8_t *p = malloc(40);
+  TEST_ASSERT_NOT_NULL(p);
+  fill(p, 40, 9);
+  p = realloc(p, 100);
+  TEST_ASSERT_NOT_NULL(p);
+  check(p, 40, 9);
+  fill(p, 100, 10);
+  p = realloc(p, 3000);
+  TEST_ASSERT_NOT_NULL(p);
+  check(p, 100, 10);
+  fill(p, 3000, 11);
+  p = realloc(p, 9000);
+  TEST_ASSERT_NOT_NULL(p);
+  check(p, 3000, 11);
+  p = realloc(p, 64);
+  TEST_ASSERT_NOT_NULL(p);
+  check(p, 64, 11);
+  free(p);
+
+  // A PSRAM block stays there when it moves
+  p = lw_malloc_tagged(5000, LW_TAG_COLD);
+  TEST_ASSERT_NOT_NULL(p);
+  fill(p, 5000, 12);
+  void *blocker = lw_malloc_tagged(5000, LW_TAG_COLD);
+  p = realloc(p, 40000);
+  TEST_ASSERT_NOT_NULL(p);
+  check(p, 5000, 12);
+#if CONFIG_LWMALLOC_TIERED
+  TEST_ASSERT_TRUE(esp_ptr_external_ram(p));
+#endif
+  free(blocker);
+  free(p);
+
+  p = realloc(NULL, 32);
+  TEST_ASSERT_NOT_NULL(p);
+  TEST_ASSERT_NULL(realloc(p, 0));
+}
+
+TEST_CASE("memalign / posix_memalign alignment", "[lwmalloc]") {
+  for (size_t align = 8; align <= 4096; align <<= 1) {
+    void *a = memalign(align, 100);
+    void *b = NULL;
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)a & (align - 1));
+    TEST_ASSERT_EQUAL_INT(0, posix_memalign(&b, align, 3000));
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)b & (align - 1));
+    fill(a, 100, align);
+    fill(b, 3000, align + 1);
+    check(a, 100, align);
+    check(b, 3000, align + 1);
+    free(a);
+    free(b);
+  }
+
+  void *p = NULL;
+  TEST_ASSERT_EQUAL_INT(EINVAL, posix_memalign(&p, 24, 64));
+  TEST_ASSERT_EQUAL_INT(EINVAL, posix_memalign(&p, 2, 64));
+  TEST_ASSERT_NULL(memalign(48, 64));
+
+  void *dma = lw_memalign_tagged(64, 1000, LW_TAG_DEFAULT, LW_ALLOC_DMA);
+  TEST_ASSERT_NOT_NULL(dma);
+  TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)dma & 63);
+  TEST_ASSERT_TRUE(esp_ptr_dma_capable(dma));
+  free(dma);
+}
+
+TEST_CASE("arena goes back once its last block is freed", "[lwmalloc]") {
+  lw_heap_stats_t st;
+  void *blocks[64];
+
+  lw_heap_stats(&st);
+  uint32_t arenas = st.arenas;
+  size_t arena_bytes = st.arena_bytes;
+
+  lw_arena_t *a = lw_arena_create(2048);
+  TEST_ASSERT_NOT_NULL(a);
+  lw_arena_t *prev = lw_arena_set_current(a);
+  // Enough to span several chunks
+  for (int i = 0; i < 64; ++i) {
+    blocks[i] = malloc(48);
+    TEST_ASSERT_NOT_NULL(blocks[i]);
+    fill(blocks[i], 48, i);
+  }
+  TEST_ASSERT_EQUAL_PTR(a, lw_arena_set_current(prev));
+  lw_heap_stats(&st);
+  TEST_ASSERT_EQUAL_UINT32(arenas + 1, st.arenas);
+  TEST_ASSERT_GREATER_THAN(arena_bytes + 2048, st.arena_bytes);
+
+  lw_arena_release(a);
+  for (int i = 0; i < 63; ++i)
+    free(blocks[i]);
+  // The last block outlives the owner
+  lw_heap_stats(&st);
+  TEST_ASSERT_EQUAL_UINT32(arenas + 1, st.arenas);
+  check(blocks[63], 48, 63);
+  free(blocks[63]);
+
+  lw_heap_stats(&st);
+  TEST_ASSERT_EQUAL_UINT32(arenas, st.arenas);
+  TEST_ASSERT_EQUAL_UINT32(arena_bytes, st.arena_bytes);
+}
+
+TEST_CASE("freed neighbours merge and empty regions are trimmed", "[lwmalloc]") {
+  lw_coalesce_stats_t cs;
+  lw_heap_stats_t st;
+  void *p[64];
+
+  // Larger than the spare region kept, so a trim has something to return
+  for (int i = 0; i < 64; ++i) {
+    p[i] = lw_malloc_tagged(2000, LW_TAG_HOT);
+    TEST_ASSERT_NOT_NULL(p[i]);
+    fill(p[i], 2000, i);
+  }
+  lw_heap_stats(&st);
+  size_t heap_bytes = st.tiers[0].heap_bytes;
+
+  lw_reset_coalesce_stats();
+  for (int i = 0; i < 64; i += 2)
+    free(p[i]);
+  for (int i = 1; i < 64; i += 2)
+    check(p[i], 2000, i);
+  for (int i = 1; i < 64; i += 2)
+    free(p[i]);
+  coalesce_all();
+  lw_get_coalesce_stats(&cs);
+  TEST_ASSERT_GREATER_THAN(0, cs.blocks_merged);
+  TEST_ASSERT_GREATER_THAN(0, cs.drained);
+
+  // Each region's run is one block again
+  lw_heap_stats(&st);
+  TEST_ASSERT_GREATER_OR_EQUAL(8 * 2000, st.tiers[0].largest_free);
+
+  lw_trim(0);
+  lw_heap_stats(&st);
+  TEST_ASSERT_LESS_THAN(heap_bytes, st.tiers[0].heap_bytes);
+}
+
+static uint32_t bin_chunks(void) {
+  lw_heap_stats_t st;
+  uint32_t n = 0;
+  lw_heap_stats(&st);
+  for (int i = 0; i < LW_HEAP_STATS_CLASSES; ++i)
+    n += st.classes[i].chunks;
+  return n;
+}
+
+TEST_CASE("idle small-block chunks go back to the heap", "[lwmalloc]") {
+  static void *p[512];
+
+  for (int i = 0; i < 512; ++i) {
+    p[i] = malloc(64);
+    TEST_ASSERT_NOT_NULL(p[i]);
+  }
+  uint32_t chunks = bin_chunks();
+  for (int i = 0; i < 512; ++i)
+    free(p[i]);
+
+  // A small budget spreads the reclaim scan over many idle passes; blocks
+  // left in a magazine may keep a chunk or two
+  lw_set_coalesce_budget(4);
+  coalesce_all();
+  lw_set_coalesce_budget(CONFIG_LWMALLOC_COALESCE_BUDGET);
+  TEST_ASSERT_LESS_THAN(chunks - 4, bin_chunks());
+}
+
+TEST_CASE("slab-sized requests come from their slab class", "[lwmalloc]") {
+  static void *p[32];
+  lw_heap_stats_t st;
+
+  // The generated classes follow the 16..128-byte bins
+  lw_heap_stats(&st);
+  int slab = -1;
+  for (int i = 0; i < LW_HEAP_STATS_CLASSES && slab < 0; ++i) {
+    if (st.classes[i].block_size > 128)
+      slab = i;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(0, slab);
+
+  // Room for the block header on either word size
+  size_t size = st.classes[slab].block_size - 16;
+  for (int i = 0; i < 32; ++i) {
+    p[i] = malloc(size);
+    TEST_ASSERT_NOT_NULL(p[i]);
+    TEST_ASSERT_TRUE(esp_ptr_internal(p[i]));
+    fill(p[i], size, (uint8_t)i);
+  }
+  lw_heap_stats(&st);
+  TEST_ASSERT_GREATER_OR_EQUAL(32, st.classes[slab].used);
+  TEST_ASSERT_GREATER_THAN(0, st.classes[slab].chunks);
+  for (int i = 0; i < 32; ++i) {
+    check(p[i], size, (uint8_t)i);
+    free(p[i]);
+  }
+}
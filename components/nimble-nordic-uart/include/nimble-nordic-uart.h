@@ -5,7 +5,6 @@
 #include <esp_err.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/ringbuf.h>
 #include <host/ble_hs.h>
 
 
@@ -13,8 +12,15 @@
 extern "C" {
 #endif
 
-// Handle for the Nordic UART RX ring buffer
-extern RingbufHandle_t nordic_uart_rx_buf_handle;
+// Receive the next item: a line without its "\r\n", NUL terminated (size
+// includes the NUL), a frame, or a "\003" break sent on disconnect. Lines
+// longer than CONFIG_NORDIC_UART_MAX_LINE_LENGTH arrive whole, up to
+// CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH, in a separate heap buffer. The item
+// can be parsed in place; give it back with nordic_uart_rx_return() before
+// receiving the next. Items come from a lock-free single-consumer ring: call
+// these from one task only, which waits on its task notification.
+uint8_t *nordic_uart_rx_receive(size_t *size, TickType_t wait);
+void nordic_uart_rx_return(uint8_t *item);
 
 // Enum for Nordic UART callback types
 enum nordic_uart_callback_type {
@@ -32,17 +38,100 @@ esp_err_t nordic_uart_start(const char *device_name, void (*callback)(enum nordi
 
 // Function to stop the Nordic UART service
 esp_err_t nordic_uart_stop(void);
+
+// Extra GATT services served next to the Nordic UART service, such as the
+// standard Battery or Current Time services. Call before nordic_uart_start();
+// the table must stay valid while the service runs. gap_cb, if not NULL, sees
+// every GAP event of the connection first, so the services can track their
+// own subscriptions and indications.
+esp_err_t nordic_uart_add_services(const struct ble_gatt_svc_def *svcs, ble_gap_event_fn *gap_cb);
 esp_err_t nordic_uart_disconnect(void);
 esp_err_t nordic_uart_set_advertising_enabled(bool enable);
 
-// Function to send a message over Nordic UART
+// Outgoing data goes through a TX queue drained by the NimBLE host task as
+// notifications complete, so sending never sleeps in the caller. Entries are
+// sent whole, highest priority first: acks and command replies, then status
+// updates, then bulk data. The queue holds CONFIG_NORDIC_UART_TX_QUEUE_SIZE
+// bytes and is dropped on disconnect.
+typedef enum {
+  NORDIC_UART_PRIO_BULK,   // file and trace streams, benchmarks
+  NORDIC_UART_PRIO_STATUS, // periodic status
+  NORDIC_UART_PRIO_ACK,    // acks and replies the phone is waiting for
+  NORDIC_UART_PRIO_COUNT,
+} nordic_uart_prio_t;
+
+// Queue len bytes. wait is how long to wait for queue space (0 = fail at
+// once with ESP_ERR_NO_MEM); never wait from the NimBLE host task.
+// Returns ESP_FAIL when not connected.
+esp_err_t nordic_uart_enqueue(const void *data, size_t len, nordic_uart_prio_t prio, TickType_t wait);
+
+// Transports. Bulk data goes over an L2CAP connection-oriented channel
+// when the phone has opened one on CONFIG_NORDIC_UART_COC_PSM: SDUs of up to
+// the peer's MTU with credit-based flow control, instead of one notification
+// per ATT MTU. Everything else, and bulk without a channel, uses GATT
+// notifications. Data the phone sends on the channel is received like
+// writes to the RX characteristic.
+typedef enum {
+  NORDIC_UART_TRANSPORT_AUTO, // L2CAP channel for bulk priority when open, else GATT
+  NORDIC_UART_TRANSPORT_GATT,
+  NORDIC_UART_TRANSPORT_COC,  // ESP_ERR_INVALID_STATE without a channel
+} nordic_uart_transport_t;
+
+// nordic_uart_enqueue() over a given transport.
+esp_err_t nordic_uart_enqueue_via(const void *data, size_t len, nordic_uart_prio_t prio, nordic_uart_transport_t via,
+                                  TickType_t wait);
+// An L2CAP channel is open and usable for bulk.
+bool nordic_uart_coc_connected(void);
+
+// Queue message plus "\r\n" as one entry.
+esp_err_t nordic_uart_enqueueln(const char *message, nordic_uart_prio_t prio, TickType_t wait);
+
+// Wait until everything queued has been handed to the controller.
+esp_err_t nordic_uart_tx_wait_idle(TickType_t wait);
+
+// Function to send a message over Nordic UART (status priority, no wait)
 // - message: String message to be sent
 esp_err_t nordic_uart_send(const char *message);
 
-// Function to send a message with a newline over Nordic UART
+// Function to send raw bytes over Nordic UART (bulk priority, waits for space)
+// - data: Bytes to be sent, split into notifications of nordic_uart_link_t.chunk
+// - len: Number of bytes
+esp_err_t nordic_uart_send_bytes(const void *data, size_t len);
+
+// Function to send a message with a newline over Nordic UART (status priority, no wait)
 // - message: String message to be sent
 esp_err_t nordic_uart_sendln(const char *message);
 
+// RX framing. By default writes are split into lines. In frame mode they are
+// reassembled by length prefix instead: each record
+//   sync 0xA5 | 2 bytes | payload length (LE16) | payload | 2-byte trailer
+// becomes one received item, as received and without a NUL, so payloads
+// may contain any byte. Whole frames are limited to
+// CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH. The mode falls back to lines on
+// disconnect.
+// nordic_uart_set_rx_frames() may be called from any task: the host task
+// switches before the next write it handles, dropping a partial message.
+#define NORDIC_UART_FRAME_SYNC 0xA5
+#define NORDIC_UART_FRAME_HDR 5
+#define NORDIC_UART_FRAME_TRAILER 2
+
+void nordic_uart_set_rx_frames(bool frames);
+bool nordic_uart_rx_frames(void);
+
+// Negotiated link parameters of the current connection. On connect the
+// service asks for the preferred ATT MTU, 251-byte LL PDUs (DLE) and the LE
+// 2M PHY; the fields follow whatever the peer accepts and fall back to the
+// defaults (23, 27, 1M) on disconnect.
+typedef struct {
+  uint16_t mtu;       // ATT MTU
+  uint16_t tx_octets; // max LL payload we may send per PDU
+  uint8_t phy;        // BLE_GAP_LE_PHY_1M / _2M / _CODED
+  uint16_t chunk;     // payload bytes per notification
+  uint16_t coc_mtu;   // peer SDU size on the L2CAP channel, 0 when none is open
+} nordic_uart_link_t;
+
+void nordic_uart_get_link(nordic_uart_link_t *out);
+
 // Function to yield for UART receive callback
 // - uart_receive_callback: Callback function for UART receive
 esp_err_t nordic_uart_yield(uart_receive_callback_t uart_receive_callback);
@@ -52,18 +141,86 @@ esp_err_t _nordic_uart_buf_deinit();
 esp_err_t _nordic_uart_buf_init();
 esp_err_t _nordic_uart_send_line_buf_to_ring_buf();
 esp_err_t _nordic_uart_linebuf_append(char c);
+esp_err_t _nordic_uart_linebuf_append_bytes(const uint8_t *data, size_t len);
+esp_err_t _nordic_uart_frame_append(const uint8_t *data, size_t len);
+bool _nordic_uart_rx_mode_sync(void);
+void _nordic_uart_rx_mode_init(void);
+void _nordic_uart_rx_mode_deinit(void);
 bool _nordic_uart_linebuf_initialized();
 char* _nordic_uart_get_linebuf(void);
 
 esp_err_t _nordic_uart_start(const char *device_name, void (*callback)(enum nordic_uart_callback_type callback_type));
 esp_err_t _nordic_uart_stop(void);
 esp_err_t _nordic_uart_send(const char *message);
+int _nordic_uart_notify(const uint8_t *data, size_t len);
+size_t _nordic_uart_tx_chunk(void);
+bool _nordic_uart_connected(void);
+esp_err_t _nordic_uart_txq_init(void);
+void _nordic_uart_txq_deinit(void);
+void _nordic_uart_txq_flush(void);
+void _nordic_uart_txq_connected(void);
+void _nordic_uart_txq_resume(void);
+esp_err_t _nordic_uart_txq_push(const void *a, size_t alen, const void *b, size_t blen,
+                                nordic_uart_prio_t prio, nordic_uart_transport_t via, TickType_t wait);
+esp_err_t _nordic_uart_coc_init(void);
+void _nordic_uart_coc_deinit(void);
+void _nordic_uart_coc_reset(void);
+size_t _nordic_uart_coc_sdu_max(void);
+int _nordic_uart_coc_send(const uint8_t *data, size_t len);
+esp_err_t _nordic_uart_txq_wait_idle(TickType_t wait);
+
+// Radio duty cycle. Advertising runs fast (20-30 ms) for
+// CONFIG_NORDIC_UART_ADV_FAST_MS after start or disconnect, then backs off
+// minute by minute up to CONFIG_NORDIC_UART_ADV_MAX_INTERVAL_MS. While
+// connected the service picks the connection interval and slave latency
+// from the traffic it sees: short for bursts and a backed-up TX queue,
+// longer after CONFIG_NORDIC_UART_CONN_IDLE_MS without traffic.
+typedef enum {
+  NORDIC_UART_RADIO_BURST,   // 15-30 ms, no latency
+  NORDIC_UART_RADIO_ACTIVE,  // 30-50 ms, no latency
+  NORDIC_UART_RADIO_IDLE,    // 100-150 ms, latency 4
+  NORDIC_UART_RADIO_DORMANT, // 400-500 ms, latency 2; low power mode only
+  NORDIC_UART_RADIO_LEVEL_COUNT, // not connected, or the central's own parameters
+} nordic_uart_radio_level_t;
+
+// Counters since nordic_uart_start(). radio_on_us is an estimate from the
+// advertising and connection events the parameters imply and the traffic
+// counted, not a measurement.
+typedef struct {
+  uint32_t uptime_ms;
+  uint32_t adv_ms;      // advertising
+  uint32_t conn_ms;     // connected
+  uint64_t radio_on_us; // estimated
+  uint32_t adv_events;
+  uint32_t conn_events;
+  uint32_t tx_pkts, rx_pkts;   // notifications and writes
+  uint32_t tx_bytes, rx_bytes;
+  uint16_t adv_itvl_ms;        // current advertising interval, 0 if not advertising
+  uint32_t conn_itvl_us;       // current connection interval
+  uint16_t conn_latency;
+  nordic_uart_radio_level_t level;
+} nordic_uart_radio_stats_t;
+
+void nordic_uart_get_radio_stats(nordic_uart_radio_stats_t *out);
 
 // Hint to adjust connection parameters for power saving while keeping link alive.
-// When enabled, prefers longer intervals and higher slave latency.
+// When enabled (screen off), an idle link may drop to NORDIC_UART_RADIO_DORMANT;
+// when disabled it goes no slower than NORDIC_UART_RADIO_IDLE.
 // Safe to call anytime; takes effect on the next connection or immediately if connected.
 void nordic_uart_set_low_power_mode(bool enable);
 
+// private funcs for the radio duty cycle, called on the host task.
+esp_err_t _nordic_uart_radio_init(void);
+void _nordic_uart_radio_deinit(void);
+void _nordic_uart_radio_adv_params(struct ble_gap_adv_params *params, int32_t *duration_ms);
+void _nordic_uart_radio_adv_reset(void);
+void _nordic_uart_radio_adv_timeout(void);
+void _nordic_uart_radio_connected(uint16_t conn_handle);
+void _nordic_uart_radio_disconnected(void);
+void _nordic_uart_radio_conn_updated(uint16_t conn_handle, int status);
+void _nordic_uart_radio_count(bool tx, size_t bytes);
+size_t _nordic_uart_txq_pending(void);
+
 #ifdef __cplusplus
 }
 #endif
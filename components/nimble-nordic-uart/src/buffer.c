@@ -1,33 +1,142 @@
 #include "nimble-nordic-uart.h"
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "nimble/nimble_port.h"
+#include "spsc_ring.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/ringbuf.h>
+#include <string.h>
 
 static const char *_TAG = "NORDIC UART";
 
-// the ringbuffer is an interface with external
-RingbufHandle_t nordic_uart_rx_buf_handle;
+// Received lines and frames for the consumer. The NimBLE host task is the
+// only producer and one task consumes, so a lock-free ring carries them as
+// in-place messages.
+static spsc_ring_t _nordic_uart_rx_ring;
+static uint8_t *_nordic_uart_rx_ring_buf = NULL;
 
+// The fixed line buffer holds a line of CONFIG_NORDIC_UART_MAX_LINE_LENGTH
+// or a frame of that payload. A longer message moves to a heap buffer
+// (PSRAM when there is some) that grows up to
+// CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH and is handed to the consumer by
+// reference instead of being copied into the ring buffer.
 static char *_nordic_uart_rx_line_buf = NULL;
+static char *_nordic_uart_rx_buf = NULL; // the line buffer or a grown one
+static size_t _nordic_uart_rx_buf_cap = 0;
 static size_t _nordic_uart_rx_line_buf_pos = 0;
+static bool _nordic_uart_rx_dropping = false; // skipping the rest of an oversized line
+static volatile bool _nordic_uart_rx_frames = false;
+// The mode another task asked for. Only the host task touches the producer
+// state, so it switches when it sees the request (see
+// _nordic_uart_rx_mode_sync).
+static volatile bool _nordic_uart_rx_frames_req = false;
+static struct ble_npl_event _nordic_uart_rx_mode_ev;
+static bool _nordic_uart_rx_mode_ev_ready = false;
+static uint8_t *_nordic_uart_rx_ref_out = NULL; // grown buffer held by the consumer
 
-esp_err_t _nordic_uart_send_line_buf_to_ring_buf() {
-  _nordic_uart_rx_line_buf[_nordic_uart_rx_line_buf_pos] = '\0';
-  // Non-blocking (or near non-blocking) enqueue to avoid stalling BLE/other tasks
-  UBaseType_t res = xRingbufferSend(nordic_uart_rx_buf_handle,
-                                    _nordic_uart_rx_line_buf,
-                                    _nordic_uart_rx_line_buf_pos + 1,
-                                    0);
+#define _FRAME_MAX (NORDIC_UART_FRAME_HDR + CONFIG_NORDIC_UART_MAX_LINE_LENGTH + NORDIC_UART_FRAME_TRAILER)
+#define _MESSAGE_MAX CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH
+
+// Message tags: the item itself, or a reference to a grown buffer
+#define _RX_ITEM 0
+#define _RX_REF 1
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+} _nordic_uart_rx_ref_t;
+
+// Back to the fixed line buffer, freeing a grown one.
+static void _nordic_uart_rx_reset(void) {
+  if (_nordic_uart_rx_buf != _nordic_uart_rx_line_buf)
+    heap_caps_free(_nordic_uart_rx_buf);
+  _nordic_uart_rx_buf = _nordic_uart_rx_line_buf;
+  _nordic_uart_rx_buf_cap = _FRAME_MAX;
   _nordic_uart_rx_line_buf_pos = 0;
+}
+
+// Make room for size bytes. Fails past the message limit or out of memory.
+static bool _nordic_uart_rx_grow(size_t size) {
+  if (size <= _nordic_uart_rx_buf_cap)
+    return true;
+  if (size > _MESSAGE_MAX + 1)
+    return false;
+
+  size_t cap = _nordic_uart_rx_buf_cap * 2;
+  if (cap < size)
+    cap = size;
+  if (cap > _MESSAGE_MAX + 1)
+    cap = _MESSAGE_MAX + 1;
+
+  char *buf;
+  if (_nordic_uart_rx_buf == _nordic_uart_rx_line_buf) {
+    buf = heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buf == NULL)
+      buf = heap_caps_malloc(cap, MALLOC_CAP_8BIT);
+    if (buf != NULL)
+      memcpy(buf, _nordic_uart_rx_line_buf, _nordic_uart_rx_line_buf_pos);
+  } else {
+    buf = heap_caps_realloc(_nordic_uart_rx_buf, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buf == NULL)
+      buf = heap_caps_realloc(_nordic_uart_rx_buf, cap, MALLOC_CAP_8BIT);
+  }
+  if (buf == NULL) {
+    ESP_LOGW(_TAG, "No memory for a %u byte message", (unsigned)cap);
+    return false;
+  }
+  _nordic_uart_rx_buf = buf;
+  _nordic_uart_rx_buf_cap = cap;
+  return true;
+}
+
+// Deliver the assembled size bytes: copied from the line buffer, or the grown
+// buffer itself by reference.
+static esp_err_t _nordic_uart_rx_deliver(size_t size) {
+  bool ok;
+
+  // Non-blocking enqueue to avoid stalling BLE/other tasks
+  if (_nordic_uart_rx_buf == _nordic_uart_rx_line_buf) {
+    ok = spsc_msg_push(&_nordic_uart_rx_ring, _nordic_uart_rx_line_buf, size, _RX_ITEM);
+  } else {
+    _nordic_uart_rx_ref_t ref = {.buf = (uint8_t *)_nordic_uart_rx_buf, .size = size};
+    ok = spsc_msg_push(&_nordic_uart_rx_ring, &ref, sizeof(ref), _RX_REF);
+    if (ok)
+      _nordic_uart_rx_buf = _nordic_uart_rx_line_buf; // now the consumer's
+  }
+  _nordic_uart_rx_reset();
+
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t _nordic_uart_send_line_buf_to_ring_buf() {
+  _nordic_uart_rx_buf[_nordic_uart_rx_line_buf_pos] = '\0';
+  return _nordic_uart_rx_deliver(_nordic_uart_rx_line_buf_pos + 1);
+}
+
+// Past the limit (or out of memory) a line is dropped up to its end.
+static esp_err_t _nordic_uart_linebuf_drop(void) {
+  ESP_LOGW(_TAG, "Line over %u bytes dropped", (unsigned)_MESSAGE_MAX);
+  _nordic_uart_rx_reset();
+  _nordic_uart_rx_dropping = true;
+  return ESP_FAIL;
+}
 
-  return res == pdTRUE ? ESP_OK : ESP_FAIL;
+// Append one byte of a line, growing the buffer.
+static esp_err_t _nordic_uart_linebuf_push(char c) {
+  if (_nordic_uart_rx_dropping)
+    return ESP_OK;
+  if (!_nordic_uart_rx_grow(_nordic_uart_rx_line_buf_pos + 2))
+    return _nordic_uart_linebuf_drop();
+  _nordic_uart_rx_buf[_nordic_uart_rx_line_buf_pos++] = c;
+  return ESP_OK;
 }
 
 esp_err_t _nordic_uart_linebuf_append(char c) {
   switch (c) {
   // break \003 == Ctrl-c
   case '\003':
+    _nordic_uart_rx_reset();
+    _nordic_uart_rx_dropping = false;
     _nordic_uart_rx_line_buf[0] = '\003';
     _nordic_uart_rx_line_buf_pos = 1;
     if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
@@ -43,39 +152,250 @@ esp_err_t _nordic_uart_linebuf_append(char c) {
   // send a line buffer to ring buffer
   case '\n':
   case '\0':
+    if (_nordic_uart_rx_dropping) {
+      _nordic_uart_rx_dropping = false;
+      break;
+    }
     if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
       ESP_LOGE(_TAG, "Failed to send item");
       return ESP_FAIL;
     }
     break;
 
-  // push char to local line buffer (segment if exceeds max line length)
+  // push char to the line buffer (grown past the max line length)
   default:
-    if (_nordic_uart_rx_line_buf_pos < CONFIG_NORDIC_UART_MAX_LINE_LENGTH) {
-      _nordic_uart_rx_line_buf[_nordic_uart_rx_line_buf_pos++] = c;
-    } else {
-      // Reached configured max; try to flush current chunk quickly.
-      // If ring buffer is full, drop the current chunk silently to avoid blocking.
-      if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
-        _nordic_uart_rx_line_buf_pos = 0; // drop
-      }
-      _nordic_uart_rx_line_buf[_nordic_uart_rx_line_buf_pos++] = c;
+    return _nordic_uart_linebuf_push(c);
+  }
+  return ESP_OK;
+}
+
+// Word-at-a-time scan for the first frame delimiter ('\n', '\0' or the
+// '\003' break). A byte b of x is zero iff the high bit of
+// (x - 0x01..01) & ~x & 0x80..80 is set for it, so each delimiter costs one
+// xor and three ops per four bytes instead of a compare per byte.
+#define _ONES 0x01010101u
+#define _HIGHS 0x80808080u
+#define _HASZERO(x) (((x) - _ONES) & ~(x) & _HIGHS)
+
+static size_t _nordic_uart_find_delim(const uint8_t *p, size_t n) {
+  size_t i = 0;
+
+  for (; i < n && ((uintptr_t)(p + i) & 3); ++i) {
+    if (p[i] == '\n' || p[i] == '\0' || p[i] == '\003')
+      return i;
+  }
+  for (; i + 4 <= n; i += 4) {
+    uint32_t w;
+    memcpy(&w, p + i, 4);
+    if (_HASZERO(w) | _HASZERO(w ^ (_ONES * '\n')) | _HASZERO(w ^ (_ONES * '\003')))
+      break;
+  }
+  for (; i < n; ++i) {
+    if (p[i] == '\n' || p[i] == '\0' || p[i] == '\003')
+      return i;
+  }
+  return n;
+}
+
+// Copy a delimiter-free run into the line buffer, dropping '\r' and growing
+// the buffer like the per-char append does.
+static esp_err_t _nordic_uart_linebuf_put(const uint8_t *p, size_t n) {
+  while (n > 0 && !_nordic_uart_rx_dropping) {
+    if (*p == '\r') {
+      ++p;
+      --n;
+      continue;
     }
-    break;
+    const uint8_t *cr = memchr(p, '\r', n);
+    size_t run = cr ? (size_t)(cr - p) : n;
+    if (!_nordic_uart_rx_grow(_nordic_uart_rx_line_buf_pos + run + 1))
+      return _nordic_uart_linebuf_drop();
+    memcpy(_nordic_uart_rx_buf + _nordic_uart_rx_line_buf_pos, p, run);
+    _nordic_uart_rx_line_buf_pos += run;
+    p += run;
+    n -= run;
   }
   return ESP_OK;
 }
 
+// Enqueue a complete line straight from the received data: the ring
+// message is reserved first and filled with a single copy. Returns ESP_ERR_INVALID_SIZE
+// when the line needs the line buffer instead (embedded '\r' or too long).
+static esp_err_t _nordic_uart_send_direct(const uint8_t *p, size_t n) {
+  while (n > 0 && p[n - 1] == '\r')
+    --n;
+  if (n > CONFIG_NORDIC_UART_MAX_LINE_LENGTH || memchr(p, '\r', n) != NULL)
+    return ESP_ERR_INVALID_SIZE;
+
+  char *slot = spsc_msg_reserve(&_nordic_uart_rx_ring, n + 1);
+  if (slot == NULL)
+    return ESP_FAIL;
+  memcpy(slot, p, n);
+  slot[n] = '\0';
+  spsc_msg_commit(&_nordic_uart_rx_ring, n + 1, _RX_ITEM);
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_linebuf_append_bytes(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+
+  while (len > 0) {
+    size_t d = _nordic_uart_find_delim(data, len);
+    if (d == len) {
+      // no delimiter: the line continues in the next write
+      if (_nordic_uart_linebuf_put(data, len) != ESP_OK)
+        ret = ESP_FAIL;
+      break;
+    }
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    if (data[d] != '\003' && _nordic_uart_rx_line_buf_pos == 0 && !_nordic_uart_rx_dropping)
+      err = _nordic_uart_send_direct(data, d);
+    if (err == ESP_ERR_INVALID_SIZE) {
+      if (_nordic_uart_linebuf_put(data, d) != ESP_OK)
+        ret = ESP_FAIL;
+      err = _nordic_uart_linebuf_append((char)data[d]);
+    } else if (err != ESP_OK) {
+      ESP_LOGE(_TAG, "Failed to send item");
+    }
+    if (err != ESP_OK)
+      ret = ESP_FAIL;
+    data += d + 1;
+    len -= d + 1;
+  }
+  return ret;
+}
+
+void nordic_uart_set_rx_frames(bool frames) {
+  _nordic_uart_rx_frames_req = frames;
+  if (_nordic_uart_rx_mode_ev_ready)
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &_nordic_uart_rx_mode_ev);
+}
+
+bool nordic_uart_rx_frames(void) { //
+  return _nordic_uart_rx_frames;
+}
+
+bool _nordic_uart_rx_mode_sync(void) {
+  if (_nordic_uart_rx_frames_req != _nordic_uart_rx_frames) {
+    // The switch comes after it was acked, or on disconnect, so a partial
+    // line or frame is stale either way.
+    _nordic_uart_rx_reset();
+    _nordic_uart_rx_dropping = false;
+    _nordic_uart_rx_frames = _nordic_uart_rx_frames_req;
+  }
+  return _nordic_uart_rx_frames;
+}
+
+static void _nordic_uart_rx_mode_cb(struct ble_npl_event *ev) { //
+  _nordic_uart_rx_mode_sync();
+}
+
+void _nordic_uart_rx_mode_init(void) {
+  ble_npl_event_init(&_nordic_uart_rx_mode_ev, _nordic_uart_rx_mode_cb, NULL);
+  _nordic_uart_rx_mode_ev_ready = true;
+}
+
+// Call once the host task has stopped.
+void _nordic_uart_rx_mode_deinit(void) {
+  if (!_nordic_uart_rx_mode_ev_ready)
+    return;
+  _nordic_uart_rx_mode_ev_ready = false;
+  ble_npl_event_deinit(&_nordic_uart_rx_mode_ev);
+}
+
+// Reassemble length-prefixed frames. Bytes outside a frame are dropped up to
+// the next sync byte; a header announcing more than the message limit is
+// dropped the same way.
+esp_err_t _nordic_uart_frame_append(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+
+  while (len > 0) {
+    if (_nordic_uart_rx_line_buf_pos == 0) {
+      const uint8_t *sync = memchr(data, NORDIC_UART_FRAME_SYNC, len);
+      if (sync == NULL)
+        break;
+      len -= sync - data;
+      data = sync;
+    }
+
+    uint8_t *buf = (uint8_t *)_nordic_uart_rx_buf;
+    size_t want = NORDIC_UART_FRAME_HDR;
+    if (_nordic_uart_rx_line_buf_pos >= NORDIC_UART_FRAME_HDR)
+      want += (buf[3] | (buf[4] << 8)) + NORDIC_UART_FRAME_TRAILER;
+    size_t n = want - _nordic_uart_rx_line_buf_pos;
+    if (n > len)
+      n = len;
+    memcpy(buf + _nordic_uart_rx_line_buf_pos, data, n);
+    _nordic_uart_rx_line_buf_pos += n;
+    data += n;
+    len -= n;
+
+    if (_nordic_uart_rx_line_buf_pos == NORDIC_UART_FRAME_HDR) {
+      size_t plen = buf[3] | (buf[4] << 8);
+      if (NORDIC_UART_FRAME_HDR + plen + NORDIC_UART_FRAME_TRAILER > _MESSAGE_MAX ||
+          !_nordic_uart_rx_grow(NORDIC_UART_FRAME_HDR + plen + NORDIC_UART_FRAME_TRAILER)) {
+        ESP_LOGW(_TAG, "Frame of %u bytes dropped", (unsigned)plen);
+        _nordic_uart_rx_reset();
+        ret = ESP_FAIL;
+      }
+    } else if (_nordic_uart_rx_line_buf_pos == want) {
+      if (_nordic_uart_rx_deliver(want) != ESP_OK) {
+        ESP_LOGE(_TAG, "Failed to send item");
+        ret = ESP_FAIL;
+      }
+    }
+  }
+  return ret;
+}
+
+uint8_t *nordic_uart_rx_receive(size_t *size, TickType_t wait) {
+  uint32_t len, tag;
+
+  if (!_nordic_uart_linebuf_initialized() || !spsc_ring_wait(&_nordic_uart_rx_ring, 1, wait))
+    return NULL;
+  uint8_t *item = spsc_msg_peek(&_nordic_uart_rx_ring, &len, &tag);
+  if (tag != _RX_REF) {
+    *size = len;
+    return item;
+  }
+
+  _nordic_uart_rx_ref_t ref;
+  memcpy(&ref, item, sizeof(ref));
+  spsc_msg_release(&_nordic_uart_rx_ring);
+  _nordic_uart_rx_ref_out = ref.buf;
+  *size = ref.size;
+  return ref.buf;
+}
+
+void nordic_uart_rx_return(uint8_t *item) {
+  if (item != NULL && item == _nordic_uart_rx_ref_out) {
+    _nordic_uart_rx_ref_out = NULL;
+    heap_caps_free(item);
+  } else if (item != NULL) {
+    spsc_msg_release(&_nordic_uart_rx_ring);
+  }
+}
+
 esp_err_t _nordic_uart_buf_deinit() {
   if (!_nordic_uart_linebuf_initialized())
     return ESP_FAIL;
 
+  _nordic_uart_rx_reset();
+  _nordic_uart_rx_dropping = false;
   free(_nordic_uart_rx_line_buf);
   _nordic_uart_rx_line_buf = NULL;
-  _nordic_uart_rx_line_buf_pos = 0;
+  _nordic_uart_rx_buf = NULL;
 
-  vRingbufferDelete(nordic_uart_rx_buf_handle);
-  nordic_uart_rx_buf_handle = NULL;
+  // free grown buffers still queued
+  uint32_t len, tag;
+  void *item;
+  while ((item = spsc_msg_peek(&_nordic_uart_rx_ring, &len, &tag)) != NULL) {
+    if (tag == _RX_REF)
+      heap_caps_free(((_nordic_uart_rx_ref_t *)item)->buf);
+    spsc_msg_release(&_nordic_uart_rx_ring);
+  }
+  free(_nordic_uart_rx_ring_buf);
+  _nordic_uart_rx_ring_buf = NULL;
 
   return ESP_OK;
 }
@@ -83,14 +403,25 @@ esp_err_t _nordic_uart_buf_deinit() {
 esp_err_t _nordic_uart_buf_init() {
   _nordic_uart_buf_deinit();
 
-  // Buffer for receive BLE and split it with /\r*\n/
-  _nordic_uart_rx_line_buf = malloc(CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1);
-  _nordic_uart_rx_line_buf_pos = 0;
-  nordic_uart_rx_buf_handle = xRingbufferCreate(CONFIG_NORDIC_UART_RX_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
-  if (nordic_uart_rx_buf_handle == NULL) {
+  // The ring needs a power-of-two size
+  uint32_t ring_size = 64;
+  while (ring_size < CONFIG_NORDIC_UART_RX_BUFFER_SIZE)
+    ring_size <<= 1;
+  _nordic_uart_rx_ring_buf = malloc(ring_size);
+  if (_nordic_uart_rx_ring_buf == NULL) {
     ESP_LOGE(_TAG, "Failed to create ring buffer");
     return ESP_FAIL;
   }
+  spsc_ring_init(&_nordic_uart_rx_ring, _nordic_uart_rx_ring_buf, ring_size, 1);
+
+  // Buffer for receive BLE and split it with /\r*\n/, or for one frame
+  _nordic_uart_rx_line_buf = malloc(_FRAME_MAX);
+  _nordic_uart_rx_buf = _nordic_uart_rx_line_buf;
+  _nordic_uart_rx_buf_cap = _FRAME_MAX;
+  _nordic_uart_rx_line_buf_pos = 0;
+  _nordic_uart_rx_dropping = false;
+  _nordic_uart_rx_frames = false;
+  _nordic_uart_rx_frames_req = false;
   return ESP_OK;
 }
 
@@ -0,0 +1,201 @@
+#include "nimble-nordic-uart.h"
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+
+static const char *_TAG = "NORDIC UART";
+
+// L2CAP connection-oriented channel next to the Nordic UART service. The
+// phone opens it on CONFIG_NORDIC_UART_COC_PSM; from then on it is a second
+// pipe into the same RX reassembly, and the TX queue sends bulk messages
+// over it as SDUs of up to the peer's MTU. The channel's credits are its
+// flow control: a send that runs out of them stalls until the peer grants
+// more (BLE_L2CAP_EVENT_COC_TX_UNSTALLED).
+
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM > 0
+
+// Retry delay when there is no mbuf for the next receive SDU
+#define COC_RX_RETRY_MS 10
+
+static struct ble_l2cap_chan *_coc_chan = NULL;
+static uint16_t _coc_peer_mtu = 0;
+static bool _coc_stalled = false;
+// NimBLE took an SDU but failed it: the channel's stream is broken, so
+// nothing more goes on it and bulk falls back to GATT
+static bool _coc_failed = false;
+static struct ble_npl_callout _coc_rx_retry;
+
+static int _coc_recv_ready(struct ble_l2cap_chan *chan) {
+  struct os_mbuf *sdu_rx = os_msys_get_pkthdr(CONFIG_NORDIC_UART_COC_MTU, 0);
+  if (sdu_rx == NULL)
+    return BLE_HS_ENOMEM;
+  int rc = ble_l2cap_recv_ready(chan, sdu_rx);
+  if (rc != 0)
+    os_mbuf_free_chain(sdu_rx);
+  return rc;
+}
+
+// The peer gets no credits until the next SDU buffer is posted, so keep
+// trying while the channel is open.
+static void _coc_rx_retry_cb(struct ble_npl_event *ev) {
+  if (_coc_chan != NULL && _coc_recv_ready(_coc_chan) != 0)
+    ble_npl_callout_reset(&_coc_rx_retry, ble_npl_time_ms_to_ticks32(COC_RX_RETRY_MS));
+}
+
+static void _coc_receive(struct os_mbuf *sdu_rx) {
+  _nordic_uart_radio_count(false, OS_MBUF_PKTLEN(sdu_rx));
+  const bool frames = _nordic_uart_rx_mode_sync();
+  for (const struct os_mbuf *om = sdu_rx; om != NULL; om = SLIST_NEXT(om, om_next)) {
+    if (frames)
+      _nordic_uart_frame_append(om->om_data, om->om_len);
+    else
+      _nordic_uart_linebuf_append_bytes(om->om_data, om->om_len);
+  }
+  os_mbuf_free_chain(sdu_rx);
+}
+
+static int _coc_event(struct ble_l2cap_event *event, void *arg) {
+  struct ble_l2cap_chan_info info;
+
+  switch (event->type) {
+  case BLE_L2CAP_EVENT_COC_CONNECTED:
+    if (event->connect.status != 0) {
+      ESP_LOGW(_TAG, "L2CAP CoC connect failed: %d", event->connect.status);
+      break;
+    }
+    _coc_chan = event->connect.chan;
+    _coc_stalled = false;
+    _coc_failed = false;
+    // 23 is the smallest MTU an LE channel may have
+    _coc_peer_mtu = 23;
+    if (ble_l2cap_get_chan_info(_coc_chan, &info) == 0 && info.peer_coc_mtu > _coc_peer_mtu)
+      _coc_peer_mtu = info.peer_coc_mtu;
+    ESP_LOGI(_TAG, "L2CAP CoC connected, peer MTU %u", _coc_peer_mtu);
+    break;
+
+  case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+    if (event->disconnect.chan == _coc_chan) {
+      ESP_LOGI(_TAG, "L2CAP CoC disconnected");
+      _nordic_uart_coc_reset();
+      _nordic_uart_txq_resume(); // a stalled message is dropped on the next try
+    }
+    break;
+
+  case BLE_L2CAP_EVENT_COC_ACCEPT:
+    // One channel at a time, on the connection the Nordic UART service serves
+    if (_coc_chan != NULL || !_nordic_uart_connected())
+      return BLE_HS_ENOMEM;
+    return _coc_recv_ready(event->accept.chan);
+
+  case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+    if (event->receive.sdu_rx != NULL)
+      _coc_receive(event->receive.sdu_rx);
+    if (_coc_recv_ready(event->receive.chan) != 0) {
+      ESP_LOGW(_TAG, "No buffer for the next L2CAP SDU, retrying");
+      ble_npl_callout_reset(&_coc_rx_retry, ble_npl_time_ms_to_ticks32(COC_RX_RETRY_MS));
+    }
+    break;
+
+  case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+    if (event->tx_unstalled.chan == _coc_chan) {
+      _coc_stalled = false;
+      _nordic_uart_txq_resume();
+    }
+    break;
+
+  default:
+    break;
+  }
+  return 0;
+}
+
+esp_err_t _nordic_uart_coc_init(void) {
+  ble_npl_callout_init(&_coc_rx_retry, nimble_port_get_dflt_eventq(), _coc_rx_retry_cb, NULL);
+  int rc = ble_l2cap_create_server(CONFIG_NORDIC_UART_COC_PSM, CONFIG_NORDIC_UART_COC_MTU, _coc_event, NULL);
+  if (rc != 0) {
+    ESP_LOGE(_TAG, "ble_l2cap_create_server failed: %d", rc);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// Call once the host task has stopped.
+void _nordic_uart_coc_deinit(void) {
+  _nordic_uart_coc_reset();
+  ble_npl_callout_deinit(&_coc_rx_retry);
+}
+
+void _nordic_uart_coc_reset(void) {
+  ble_npl_callout_stop(&_coc_rx_retry);
+  _coc_chan = NULL;
+  _coc_peer_mtu = 0;
+  _coc_stalled = false;
+  _coc_failed = false;
+}
+
+bool nordic_uart_coc_connected(void) { //
+  return _coc_chan != NULL && !_coc_failed;
+}
+
+size_t _nordic_uart_coc_sdu_max(void) { //
+  return _coc_peer_mtu;
+}
+
+int _nordic_uart_coc_send(const uint8_t *data, size_t len) {
+  if (_coc_chan == NULL || _coc_failed)
+    return BLE_HS_ENOTCONN;
+  if (_coc_stalled)
+    return BLE_HS_EAGAIN;
+
+  struct os_mbuf *sdu = ble_hs_mbuf_from_flat(data, len);
+  if (sdu == NULL)
+    return BLE_HS_ENOMEM;
+  int rc = ble_l2cap_send(_coc_chan, sdu);
+  if (rc == BLE_HS_ESTALLED) {
+    // Taken; the rest of it goes out as the peer returns credits
+    _coc_stalled = true;
+    rc = 0;
+  } else if (rc == BLE_HS_EBUSY) {
+    // The previous SDU is still being sent: retry like an mbuf shortage
+    os_mbuf_free_chain(sdu);
+    rc = BLE_HS_ENOMEM;
+  } else if (rc == BLE_HS_EBADDATA) {
+    // Rejected before it was queued
+    os_mbuf_free_chain(sdu);
+  } else if (rc != 0) {
+    // Queued, then failed: NimBLE frees the SDU or still holds it, so it
+    // is not ours to free. Count it as sent; the rest of the message is
+    // dropped and the next ones go over GATT.
+    ESP_LOGW(_TAG, "L2CAP send failed after queueing: %d", rc);
+    _coc_failed = true;
+    rc = 0;
+  }
+  if (rc == 0)
+    _nordic_uart_radio_count(true, len);
+  return rc;
+}
+
+#else
+
+esp_err_t _nordic_uart_coc_init(void) { //
+  return ESP_OK;
+}
+
+void _nordic_uart_coc_deinit(void) {}
+
+void _nordic_uart_coc_reset(void) {}
+
+bool nordic_uart_coc_connected(void) { //
+  return false;
+}
+
+size_t _nordic_uart_coc_sdu_max(void) { //
+  return 0;
+}
+
+int _nordic_uart_coc_send(const uint8_t *data, size_t len) { //
+  return BLE_HS_ENOTSUP;
+}
+
+#endif
@@ -13,17 +13,35 @@ static const char *_TAG = "NORDIC UART";
 // #define CONFIG_NORDIC_UART_MAX_LINE_LENGTH 256
 // #define CONFIG_NORDIC_UART_RX_BUFFER_SIZE 4096
 
-// Split the message in BLE_SEND_MTU and send it.
+// Queue the message; the host task splits it in link-sized notifications.
 esp_err_t nordic_uart_send(const char *message) { //
   return _nordic_uart_send(message);
 }
 
-esp_err_t nordic_uart_sendln(const char *message) {
-  if (nordic_uart_send(message) != ESP_OK)
-    return ESP_FAIL;
-  if (nordic_uart_send("\r\n") != ESP_OK)
-    return ESP_FAIL;
-  return ESP_OK;
+esp_err_t nordic_uart_send_bytes(const void *data, size_t len) {
+  return _nordic_uart_txq_push(data, len, NULL, 0, NORDIC_UART_PRIO_BULK, NORDIC_UART_TRANSPORT_AUTO, portMAX_DELAY);
+}
+
+esp_err_t nordic_uart_sendln(const char *message) { //
+  return nordic_uart_enqueueln(message, NORDIC_UART_PRIO_STATUS, 0);
+}
+
+esp_err_t nordic_uart_enqueue(const void *data, size_t len, nordic_uart_prio_t prio, TickType_t wait) {
+  return _nordic_uart_txq_push(data, len, NULL, 0, prio, NORDIC_UART_TRANSPORT_AUTO, wait);
+}
+
+esp_err_t nordic_uart_enqueue_via(const void *data, size_t len, nordic_uart_prio_t prio, nordic_uart_transport_t via,
+                                  TickType_t wait) {
+  return _nordic_uart_txq_push(data, len, NULL, 0, prio, via, wait);
+}
+
+esp_err_t nordic_uart_enqueueln(const char *message, nordic_uart_prio_t prio, TickType_t wait) {
+  // One queue entry, so the line is never split by another message
+  return _nordic_uart_txq_push(message, strlen(message), "\r\n", 2, prio, NORDIC_UART_TRANSPORT_AUTO, wait);
+}
+
+esp_err_t nordic_uart_tx_wait_idle(TickType_t wait) { //
+  return _nordic_uart_txq_wait_idle(wait);
 }
 
 esp_err_t nordic_uart_start(const char *device_name, void (*callback)(enum nordic_uart_callback_type callback_type)) {
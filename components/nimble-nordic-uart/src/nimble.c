@@ -14,7 +14,16 @@ static const char* _TAG = "NORDIC UART";
 
 // #define CONFIG_NORDIC_UART_MAX_LINE_LENGTH 256
 // #define CONFIG_NORDIC_UART_RX_BUFFER_SIZE 4096
-#define BLE_SEND_MTU 203
+
+// Link defaults until the peer negotiates something better
+#define BLE_DEFAULT_MTU 23
+#define BLE_DEFAULT_TX_OCTETS 27
+// Data Length Extension request: 251-byte LL payloads, 2120 us on the 1M PHY
+#define BLE_DLE_TX_OCTETS 251
+#define BLE_DLE_TX_TIME 2120
+// Per notification: 3 bytes ATT header, and 4 bytes L2CAP header on the SDU
+#define ATT_NOTIFY_HDR 3
+#define L2CAP_HDR 4
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define B0(x) ((x) & 0xFF)
@@ -44,33 +53,86 @@ static uint16_t notify_char_attr_hdl;
 
 static void (*_nordic_uart_callback)(enum nordic_uart_callback_type callback_type) = NULL;
 static uart_receive_callback_t _uart_receive_callback = NULL;
-static bool s_low_power_pref = false;
+static const struct ble_gatt_svc_def* s_extra_svcs = NULL;
+static ble_gap_event_fn* s_extra_gap_cb = NULL;
 static bool s_adv_enabled = true;
 static bool s_ble_synced = false;
+static nordic_uart_link_t s_link = {
+    .mtu = BLE_DEFAULT_MTU,
+    .tx_octets = BLE_DEFAULT_TX_OCTETS,
+    .phy = BLE_GAP_LE_PHY_1M,
+    .chunk = BLE_DEFAULT_MTU - ATT_NOTIFY_HDR,
+};
+
+
+/// @brief Notification payload for the current link
+/// The ATT limit is MTU - 3. When that spans several LL PDUs, trim it so the
+/// L2CAP SDU fills whole PDUs and no near-empty PDU trails each notification.
+static uint16_t _tx_chunk(void)
+{
+    uint16_t chunk = s_link.mtu - ATT_NOTIFY_HDR;
+    uint16_t sdu = chunk + ATT_NOTIFY_HDR + L2CAP_HDR;
+    if (sdu > s_link.tx_octets) {
+        uint16_t whole = (sdu / s_link.tx_octets) * s_link.tx_octets;
+        if (whole < sdu) {
+            chunk = whole - ATT_NOTIFY_HDR - L2CAP_HDR;
+        }
+    }
+    return chunk;
+}
+
+static void _link_reset(void)
+{
+    s_link.mtu = BLE_DEFAULT_MTU;
+    s_link.tx_octets = BLE_DEFAULT_TX_OCTETS;
+    s_link.phy = BLE_GAP_LE_PHY_1M;
+    s_link.chunk = _tx_chunk();
+}
+
+static int _mtu_exchange_cb(uint16_t conn_handle, const struct ble_gatt_error* error, uint16_t mtu, void* arg)
+{
+    // The new value also arrives as BLE_GAP_EVENT_MTU; only report failures here
+    if (error->status != 0) {
+        ESP_LOGW(_TAG, "MTU exchange failed: %d", error->status);
+    }
+    return 0;
+}
 
+/// @brief Ask for the larger MTU, DLE and the 2M PHY on a new connection
+/// The results are tracked from the GAP events; a peer that refuses any of
+/// them just leaves the defaults in place.
+static void _request_fast_link(uint16_t conn_handle)
+{
+    int rc = ble_gattc_exchange_mtu(conn_handle, _mtu_exchange_cb, NULL);
+    if (rc != 0) {
+        ESP_LOGW(_TAG, "ble_gattc_exchange_mtu failed: %d", rc);
+    }
+    rc = ble_gap_set_data_len(conn_handle, BLE_DLE_TX_OCTETS, BLE_DLE_TX_TIME);
+    if (rc != 0) {
+        ESP_LOGW(_TAG, "ble_gap_set_data_len failed: %d", rc);
+    }
+#if CONFIG_BT_NIMBLE_LL_CFG_FEAT_LE_2M_PHY
+    rc = ble_gap_set_prefered_le_phy(conn_handle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        ESP_LOGW(_TAG, "ble_gap_set_prefered_le_phy failed: %d", rc);
+    }
+#endif
+}
 
-/// @brief Apply connection parameters based on power preference
-/// @param  
-static void _apply_conn_params(void)
+void nordic_uart_get_link(nordic_uart_link_t* out)
 {
-    if (ble_conn_hdl == 0) return;
-    struct ble_gap_conn_desc desc;
-    int rc = ble_gap_conn_find(ble_conn_hdl, &desc);
-    if (rc != 0) return;
-    struct ble_gap_upd_params params;
-    if (s_low_power_pref) {
-        params.itvl_min = 400;
-        params.itvl_max = 800;
-        params.latency  = 8;
-        params.supervision_timeout = 800; // 6.0 s
-    } else {
-        // More responsive when active
-        params.itvl_min = 24;   // 30 ms
-        params.itvl_max = 40;   // 50 ms
-        params.latency  = 0;
-        params.supervision_timeout = desc.supervision_timeout;
-    }
-    (void)ble_gap_update_params(ble_conn_hdl, &params);
+    *out = s_link;
+    out->coc_mtu = _nordic_uart_coc_sdu_max();
+}
+
+esp_err_t nordic_uart_add_services(const struct ble_gatt_svc_def* svcs, ble_gap_event_fn* gap_cb) {
+    if (_nordic_uart_linebuf_initialized()) {
+        ESP_LOGE(_TAG, "Services must be added before start");
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_extra_svcs = svcs;
+    s_extra_gap_cb = gap_cb;
+    return ESP_OK;
 }
 
 esp_err_t nordic_uart_yield(uart_receive_callback_t uart_receive_callback) {
@@ -80,13 +142,18 @@ esp_err_t nordic_uart_yield(uart_receive_callback_t uart_receive_callback) {
 
 
 static int _uart_receive(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt* ctxt, void* arg) {
+    _nordic_uart_radio_count(false, OS_MBUF_PKTLEN(ctxt->om));
     if (_uart_receive_callback) {
         _uart_receive_callback(ctxt);
     }
     else {
-        for (int i = 0; i < ctxt->om->om_len; ++i) {
-            const char c = ctxt->om->om_data[i];
-            _nordic_uart_linebuf_append(c);
+        // Long writes arrive as a chain of mbufs; scan each segment in place.
+        const bool frames = _nordic_uart_rx_mode_sync();
+        for (const struct os_mbuf* om = ctxt->om; om != NULL; om = SLIST_NEXT(om, om_next)) {
+            if (frames)
+                _nordic_uart_frame_append(om->om_data, om->om_len);
+            else
+                _nordic_uart_linebuf_append_bytes(om->om_data, om->om_len);
         }
     }
     return 0;
@@ -169,12 +236,11 @@ static int ble_app_advertise(void) {
     memset(&adv_params, 0, sizeof(adv_params));
     adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    // Slow down advertising interval to reduce idle power when not connected
-    // Units are 0.625 ms; 800 => 500 ms, 1000 => 625 ms
-    adv_params.itvl_min = 800;
-    adv_params.itvl_max = 1000;
+    // Fast right after a disconnect, then slower at each timeout
+    int32_t duration_ms;
+    _nordic_uart_radio_adv_params(&adv_params, &duration_ms);
 
-    err = ble_gap_adv_start(ble_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event_cb, NULL);
+    err = ble_gap_adv_start(ble_addr_type, NULL, duration_ms, &adv_params, ble_gap_event_cb, NULL);
     if (err) {
         if (err == BLE_HS_EALREADY) {
             ESP_LOGD(_TAG, "Advertising already running");
@@ -187,6 +253,8 @@ static int ble_app_advertise(void) {
 }
 
 static int ble_gap_event_cb(struct ble_gap_event* event, void* arg) {
+    if (s_extra_gap_cb)
+        (void)s_extra_gap_cb(event, NULL);
     switch (event->type) {
     case BLE_GAP_EVENT_CONNECT:
         ESP_LOGI(_TAG, "BLE_GAP_EVENT_CONNECT %s", event->connect.status == 0 ? "OK" : "Failed");
@@ -202,8 +270,10 @@ static int ble_gap_event_cb(struct ble_gap_event* event, void* arg) {
                 return rc;
             }
 
-            // Apply preferred params based on current power preference
-            _apply_conn_params();
+            _link_reset();
+            _nordic_uart_txq_connected();
+            _nordic_uart_radio_connected(ble_conn_hdl);
+            _request_fast_link(ble_conn_hdl);
             if (_nordic_uart_callback)
                 _nordic_uart_callback(NORDIC_UART_CONNECTED);
         }
@@ -212,16 +282,52 @@ static int ble_gap_event_cb(struct ble_gap_event* event, void* arg) {
         }
         break;
     case BLE_GAP_EVENT_DISCONNECT:
+        nordic_uart_set_rx_frames(false);
+        _nordic_uart_rx_mode_sync(); // already on the host task
         _nordic_uart_linebuf_append('\003'); // send Ctrl-C
         ESP_LOGI(_TAG, "BLE_GAP_EVENT_DISCONNECT");
         ble_conn_hdl = 0;
+        _link_reset();
+        _nordic_uart_coc_reset();
+        _nordic_uart_radio_disconnected();
+        _nordic_uart_txq_flush();
         if (_nordic_uart_callback)
             _nordic_uart_callback(NORDIC_UART_DISCONNECTED);
         (void)ble_app_advertise();
         break;
     case BLE_GAP_EVENT_ADV_COMPLETE:
         ESP_LOGI(_TAG, "BLE_GAP_EVENT_ADV_COMPLETE");
-        (void)ble_app_advertise();
+        if (event->adv_complete.reason == BLE_HS_ETIMEOUT) {
+            _nordic_uart_radio_adv_timeout();
+        }
+        if (ble_conn_hdl == 0) {
+            (void)ble_app_advertise();
+        }
+        break;
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        _nordic_uart_radio_conn_updated(event->conn_update.conn_handle, event->conn_update.status);
+        break;
+    case BLE_GAP_EVENT_MTU:
+        if (event->mtu.conn_handle == ble_conn_hdl) {
+            s_link.mtu = event->mtu.value;
+            s_link.chunk = _tx_chunk();
+            ESP_LOGI(_TAG, "MTU %u, chunk %u", s_link.mtu, s_link.chunk);
+        }
+        break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        if (event->data_len_chg.conn_handle == ble_conn_hdl) {
+            s_link.tx_octets = event->data_len_chg.max_tx_octets;
+            s_link.chunk = _tx_chunk();
+            ESP_LOGI(_TAG, "LL tx octets %u, chunk %u", s_link.tx_octets, s_link.chunk);
+        }
+        break;
+#endif
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        if (event->phy_updated.conn_handle == ble_conn_hdl && event->phy_updated.status == 0) {
+            s_link.phy = event->phy_updated.tx_phy;
+            ESP_LOGI(_TAG, "PHY tx %u rx %u", event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        }
         break;
     case BLE_GAP_EVENT_SUBSCRIBE:
         if (event->subscribe.attr_handle == notify_char_attr_hdl) {
@@ -233,7 +339,8 @@ static int ble_gap_event_cb(struct ble_gap_event* event, void* arg) {
             }
         }
         else {
-            ESP_LOGW(_TAG, "Unknown subscribe event for attr_handle %d", event->subscribe.attr_handle);
+            // One of the extra services; s_extra_gap_cb has it
+            ESP_LOGD(_TAG, "Subscribe event for attr_handle %d", event->subscribe.attr_handle);
         }
         ESP_LOGI(_TAG, "BLE_GAP_EVENT_SUBSCRIBE");
         break;
@@ -249,6 +356,7 @@ static void ble_app_on_sync_cb(void) {
         ESP_LOGE(_TAG, "Error ble_hs_id_infer_auto: %d", ret);
     }
     s_ble_synced = true;
+    _nordic_uart_radio_adv_reset();
     (void)ble_app_advertise();
 }
 
@@ -263,35 +371,29 @@ static void ble_host_task(void* param) {
     }
 }
 
-// Split the message in BLE_SEND_MTU and send it.
-esp_err_t _nordic_uart_send(const char* message) {
-    const int len = strlen(message);
-    if (len == 0)
-        return ESP_OK;
-    // Split the message in BLE_SEND_MTU and send it.
-    for (int i = 0; i < len; i += BLE_SEND_MTU) {
-        int err;
-        struct os_mbuf* om;
-        int err_count = 0;
-    do_notify:
-        om = ble_hs_mbuf_from_flat(&message[i], MIN(BLE_SEND_MTU, len - i));
-        //err = ble_gattc_notify_custom(ble_conn_hdl, notify_char_attr_hdl, om);
-        err = ble_gatts_notify_custom(ble_conn_hdl, notify_char_attr_hdl, om);
-        if (err == BLE_HS_ENOMEM && err_count++ < 10) {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            goto do_notify;
-        }
-        if (err)
-            return ESP_FAIL;
-    }
-    return ESP_OK;
+// One notification with the given payload; BLE_HS_ENOMEM when the host is
+// out of mbufs. Called from the TX queue on the host task.
+int _nordic_uart_notify(const uint8_t* data, size_t len) {
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL)
+        return BLE_HS_ENOMEM;
+    //return ble_gattc_notify_custom(ble_conn_hdl, notify_char_attr_hdl, om);
+    int rc = ble_gatts_notify_custom(ble_conn_hdl, notify_char_attr_hdl, om);
+    if (rc == 0)
+        _nordic_uart_radio_count(true, len);
+    return rc;
 }
 
+size_t _nordic_uart_tx_chunk(void) {
+    return s_link.chunk;
+}
 
-void nordic_uart_set_low_power_mode(bool enable)
-{
-    s_low_power_pref = enable;
-    _apply_conn_params();
+bool _nordic_uart_connected(void) {
+    return ble_conn_hdl != 0;
+}
+
+esp_err_t _nordic_uart_send(const char* message) {
+    return _nordic_uart_txq_push(message, strlen(message), NULL, 0, NORDIC_UART_PRIO_STATUS, NORDIC_UART_TRANSPORT_AUTO, 0);
 }
 
 /***
@@ -329,6 +431,22 @@ esp_err_t _nordic_uart_start(const char* device_name, void (*callback)(enum nord
         return ESP_FAIL;
     }
 
+    if (_nordic_uart_txq_init() != ESP_OK) {
+        ESP_LOGE(_TAG, "Failed to init Nordic UART TX queue");
+        return ESP_FAIL;
+    }
+
+    if (_nordic_uart_coc_init() != ESP_OK) {
+        ESP_LOGW(_TAG, "L2CAP channel unavailable; bulk data stays on GATT");
+    }
+
+    if (_nordic_uart_radio_init() != ESP_OK) {
+        ESP_LOGE(_TAG, "Failed to init Nordic UART radio duty cycle");
+        return ESP_FAIL;
+    }
+
+    _nordic_uart_rx_mode_init();
+
     // Initialize the NimBLE Host configuration
     // Bluetooth device name for advertisement
 
@@ -343,6 +461,14 @@ esp_err_t _nordic_uart_start(const char* device_name, void (*callback)(enum nord
     rc = ble_gatts_add_svcs(gat_svcs);
     assert(rc == 0);
 
+    if (s_extra_svcs) {
+        rc = ble_gatts_count_cfg(s_extra_svcs);
+        assert(rc == 0);
+
+        rc = ble_gatts_add_svcs(s_extra_svcs);
+        assert(rc == 0);
+    }
+
     /* Set the default device name */
     rc = ble_svc_gap_device_name_set(device_name);
     assert(rc == 0);
@@ -377,6 +503,10 @@ esp_err_t _nordic_uart_stop(void) {
     }
 
     int ret = nimble_port_stop();
+    _nordic_uart_txq_deinit();
+    _nordic_uart_radio_deinit();
+    _nordic_uart_rx_mode_deinit();
+    _nordic_uart_coc_deinit();
     if (ret == ESP_OK) {
         ret = nimble_port_deinit();
         if (ret != ESP_OK) {
@@ -413,6 +543,7 @@ esp_err_t nordic_uart_set_advertising_enabled(bool enable)
 {
     s_adv_enabled = enable;
     if (enable) {
+        _nordic_uart_radio_adv_reset();
         int rc = ble_app_advertise();
         return (rc == 0) ? ESP_OK : ESP_FAIL;
     }
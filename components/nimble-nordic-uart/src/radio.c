@@ -0,0 +1,340 @@
+#include "nimble-nordic-uart.h"
+
+#include "esp_log.h"
+#include "nimble/nimble_port.h"
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+static const char *_TAG = "NORDIC UART";
+
+// Radio duty cycle. Advertising starts fast after a disconnect and backs off
+// step by step; while connected, a 1 s tick on the host task picks the
+// connection interval and slave latency from the traffic it saw, and adds
+// the estimated radio on time to the stats. The tick only runs while
+// connected or advertising.
+
+#define RADIO_TICK_MS 1000
+
+// Advertising: units of 0.625 ms. The fast window runs at 20-30 ms, then
+// each stage lasts ADV_STAGE_MS at twice the interval of the one before
+// until CONFIG_NORDIC_UART_ADV_MAX_INTERVAL_MS, which runs until connected.
+#define ADV_FAST_ITVL_MIN 32
+#define ADV_FAST_ITVL_MAX 48
+#define ADV_SLOW_ITVL_FIRST 244 // 152.5 ms
+#define ADV_STAGE_MS 60000
+#define ADV_ITVL_MAX (CONFIG_NORDIC_UART_ADV_MAX_INTERVAL_MS * 8 / 5)
+// Legacy advertising accepts no interval above 10.24 s
+#define ADV_ITVL_LIMIT 0x4000
+
+// A burst: this many notifications and writes in one tick, or a TX backlog
+#define BURST_PKTS 8
+// Ticks without a burst before leaving NORDIC_UART_RADIO_BURST
+#define BURST_HOLD_TICKS 3
+// Ticks before asking again after the central refused the fastest preset
+#define REFUSED_HOLD_TICKS 30
+
+// Connection presets, interval in 1.25 ms units and timeout in 10 ms. Each
+// keeps itvl_max * (latency + 1) <= 2 s and the supervision timeout above
+// three times that and at most 6 s, as iOS requires.
+static const struct {
+  uint16_t itvl_min, itvl_max, latency, timeout;
+} _levels[NORDIC_UART_RADIO_LEVEL_COUNT] = {
+    [NORDIC_UART_RADIO_BURST] = {12, 24, 0, 400},   // 15-30 ms
+    [NORDIC_UART_RADIO_ACTIVE] = {24, 40, 0, 400},  // 30-50 ms
+    [NORDIC_UART_RADIO_IDLE] = {80, 120, 4, 600},   // 100-150 ms, answers within 750 ms
+    [NORDIC_UART_RADIO_DORMANT] = {320, 400, 2, 550}, // 400-500 ms, answers within 1.5 s
+};
+
+// Radio on time model. The controller does not report it, so it is
+// estimated from the events the link parameters imply: an advertising event
+// sends on three channels and listens after each; a connection event is at
+// least one empty packet each way with ramp-up and IFS; data adds its air
+// time per byte plus the LL header, MIC-less CRC and the ack per PDU.
+#define ADV_EVENT_US 1500
+#define CONN_EVENT_US 500
+#define PDU_OVERHEAD_BYTES 10
+#define PDU_OVERHEAD_US 300
+
+static portMUX_TYPE _radio_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct ble_npl_callout _radio_tick;
+static struct ble_npl_event _radio_pref_ev;
+static bool _radio_initialized = false;
+
+static nordic_uart_radio_stats_t _stats;
+static ble_npl_time_t _last_tick;
+
+static uint16_t _conn_hdl; // 0 when not connected
+static nordic_uart_radio_level_t _level;     // requested
+static bool _update_pending;
+static uint32_t _tick_pkts, _tick_bytes;     // traffic since the last tick
+static uint32_t _idle_ms;                    // since the last traffic
+static uint8_t _calm_ticks;                  // since the last burst
+static uint8_t _hold_ticks;                  // no requests until 0
+static nordic_uart_radio_level_t _ceiling;   // slowest the central accepted
+static volatile bool _low_power_pref = false;
+
+static uint8_t _adv_stage; // 0: fast window
+static uint16_t _adv_itvl; // interval of the current stage
+
+static void _radio_tick_start(void);
+
+static uint32_t _adv_stage_itvl(uint8_t stage) {
+  if (stage == 0)
+    return (ADV_FAST_ITVL_MIN + ADV_FAST_ITVL_MAX) / 2;
+  uint32_t itvl = ADV_SLOW_ITVL_FIRST << (stage - 1);
+  return itvl < ADV_ITVL_MAX ? itvl : ADV_ITVL_MAX;
+}
+
+void _nordic_uart_radio_adv_params(struct ble_gap_adv_params *params, int32_t *duration_ms) {
+  if (_adv_stage == 0) {
+    params->itvl_min = ADV_FAST_ITVL_MIN;
+    params->itvl_max = ADV_FAST_ITVL_MAX;
+    *duration_ms = CONFIG_NORDIC_UART_ADV_FAST_MS;
+  } else {
+    uint32_t itvl = _adv_stage_itvl(_adv_stage);
+    params->itvl_min = itvl;
+    params->itvl_max = itvl + itvl / 4 < ADV_ITVL_LIMIT ? itvl + itvl / 4 : ADV_ITVL_LIMIT;
+    *duration_ms = itvl < ADV_ITVL_MAX ? ADV_STAGE_MS : BLE_HS_FOREVER;
+  }
+  _adv_itvl = (params->itvl_min + params->itvl_max) / 2;
+  _radio_tick_start();
+}
+
+void _nordic_uart_radio_adv_reset(void) { //
+  _adv_stage = 0;
+}
+
+void _nordic_uart_radio_adv_timeout(void) {
+  if (_adv_stage_itvl(_adv_stage) >= ADV_ITVL_MAX)
+    return;
+  _adv_stage++;
+  ESP_LOGI(_TAG, "Advertising backs off to %u ms", (unsigned)(_adv_stage_itvl(_adv_stage) * 5 / 8));
+}
+
+static void _radio_request(nordic_uart_radio_level_t level) {
+  if (_conn_hdl == 0 || level == _level || _update_pending || _hold_ticks > 0)
+    return;
+  struct ble_gap_upd_params params = {
+      .itvl_min = _levels[level].itvl_min,
+      .itvl_max = _levels[level].itvl_max,
+      .latency = _levels[level].latency,
+      .supervision_timeout = _levels[level].timeout,
+  };
+  int rc = ble_gap_update_params(_conn_hdl, &params);
+  if (rc != 0) {
+    ESP_LOGD(_TAG, "ble_gap_update_params failed: %d", rc);
+    return;
+  }
+  ESP_LOGD(_TAG, "Radio level %d -> %d", _level, level);
+  _level = level;
+  _update_pending = true;
+}
+
+// Slowest level allowed while idle: dormant only when the user is not
+// looking at the watch, and never one the central refused
+static nordic_uart_radio_level_t _radio_slowest(void) {
+  nordic_uart_radio_level_t level = _low_power_pref ? NORDIC_UART_RADIO_DORMANT : NORDIC_UART_RADIO_IDLE;
+  return level < _ceiling ? level : _ceiling;
+}
+
+static void _radio_pick_level(uint32_t pkts, bool backlog) {
+  nordic_uart_radio_level_t level = _level;
+
+  if (pkts >= BURST_PKTS || backlog) {
+    level = NORDIC_UART_RADIO_BURST;
+    _calm_ticks = 0;
+  } else if (pkts > 0) {
+    if (level == NORDIC_UART_RADIO_BURST && ++_calm_ticks < BURST_HOLD_TICKS)
+      return;
+    level = NORDIC_UART_RADIO_ACTIVE;
+  } else if (_idle_ms >= CONFIG_NORDIC_UART_CONN_IDLE_MS) {
+    // one level slower per idle period
+    _idle_ms = 0;
+    if (level < _radio_slowest())
+      level++;
+  }
+  if (level > _radio_slowest())
+    level = _radio_slowest();
+  _radio_request(level);
+}
+
+static void _radio_account(uint32_t ms, uint32_t pkts, uint32_t bytes) {
+  uint64_t on_us = 0;
+  uint32_t events = 0;
+  nordic_uart_link_t l;
+  const nordic_uart_link_t *link = &l;
+  nordic_uart_get_link(&l);
+
+  portENTER_CRITICAL(&_radio_lock);
+  _stats.uptime_ms += ms;
+  if (_conn_hdl != 0) {
+    uint32_t itvl_us = _stats.conn_itvl_us ? _stats.conn_itvl_us : 30000;
+    // With traffic the peripheral listens at every event, else it may skip
+    // latency events
+    uint32_t period_us = pkts ? itvl_us : itvl_us * (_stats.conn_latency + 1);
+    events = (uint32_t)((uint64_t)ms * 1000 / period_us);
+    uint32_t pdus = pkts + bytes / link->tx_octets;
+    uint32_t ns_per_byte = link->phy == BLE_GAP_LE_PHY_2M ? 4000 : link->phy == BLE_GAP_LE_PHY_CODED ? 64000 : 8000;
+    on_us = (uint64_t)events * CONN_EVENT_US + pdus * PDU_OVERHEAD_US +
+            ((uint64_t)bytes + pdus * PDU_OVERHEAD_BYTES) * ns_per_byte / 1000;
+    _stats.conn_ms += ms;
+    _stats.conn_events += events;
+    _stats.adv_itvl_ms = 0;
+  } else if (ble_gap_adv_active()) {
+    // advDelay adds 0-10 ms to every interval
+    uint32_t period_us = _adv_itvl * 625 + 5000;
+    events = (uint32_t)((uint64_t)ms * 1000 / period_us);
+    on_us = (uint64_t)events * ADV_EVENT_US;
+    _stats.adv_ms += ms;
+    _stats.adv_events += events;
+    _stats.adv_itvl_ms = _adv_itvl * 5 / 8;
+  } else {
+    _stats.adv_itvl_ms = 0;
+  }
+  _stats.radio_on_us += on_us;
+  _stats.level = _conn_hdl != 0 ? _level : NORDIC_UART_RADIO_LEVEL_COUNT;
+  portEXIT_CRITICAL(&_radio_lock);
+}
+
+// Called before connecting or advertising. The time since the tick stopped
+// had neither, so it only adds to the uptime.
+static void _radio_tick_start(void) {
+  if (!_radio_initialized || ble_npl_callout_is_active(&_radio_tick))
+    return;
+  ble_npl_time_t now = ble_npl_time_get();
+  uint32_t ms = ble_npl_time_ticks_to_ms32(now - _last_tick);
+  _last_tick = now;
+  portENTER_CRITICAL(&_radio_lock);
+  _stats.uptime_ms += ms;
+  _stats.adv_itvl_ms = 0;
+  portEXIT_CRITICAL(&_radio_lock);
+  ble_npl_callout_reset(&_radio_tick, ble_npl_time_ms_to_ticks32(RADIO_TICK_MS));
+}
+
+static void _radio_tick_cb(struct ble_npl_event *ev) {
+  ble_npl_time_t now = ble_npl_time_get();
+  uint32_t ms = ble_npl_time_ticks_to_ms32(now - _last_tick);
+  _last_tick = now;
+
+  portENTER_CRITICAL(&_radio_lock);
+  uint32_t pkts = _tick_pkts, bytes = _tick_bytes;
+  _tick_pkts = _tick_bytes = 0;
+  portEXIT_CRITICAL(&_radio_lock);
+  _idle_ms = pkts ? 0 : _idle_ms + ms;
+
+  _radio_account(ms, pkts, bytes);
+  if (_hold_ticks > 0)
+    _hold_ticks--;
+  // More queued than a burst of notifications carries: the link is the bottleneck
+  if (_conn_hdl != 0)
+    _radio_pick_level(pkts, _nordic_uart_txq_pending() > _nordic_uart_tx_chunk() * BURST_PKTS);
+
+  // Nothing to pace or count: sleep until _radio_tick_start()
+  if (_conn_hdl != 0 || ble_gap_adv_active())
+    ble_npl_callout_reset(&_radio_tick, ble_npl_time_ms_to_ticks32(RADIO_TICK_MS));
+}
+
+// The screen turned on: leave dormant at once. Turning it off only lets the
+// idle steps go one level further.
+static void _radio_pref_cb(struct ble_npl_event *ev) {
+  if (_conn_hdl != 0 && _level == NORDIC_UART_RADIO_DORMANT && !_low_power_pref)
+    _radio_request(NORDIC_UART_RADIO_IDLE);
+}
+
+void _nordic_uart_radio_connected(uint16_t conn_handle) {
+  _conn_hdl = conn_handle;
+  // The connect parameters are the central's; start from them
+  _level = NORDIC_UART_RADIO_LEVEL_COUNT;
+  _update_pending = false;
+  _idle_ms = 0;
+  _calm_ticks = 0;
+  _hold_ticks = 0;
+  _ceiling = NORDIC_UART_RADIO_DORMANT;
+  _radio_tick_start();
+  _nordic_uart_radio_conn_updated(conn_handle, 0);
+  // Link setup, time sync and the first status follow right away
+  _radio_request(NORDIC_UART_RADIO_ACTIVE);
+}
+
+void _nordic_uart_radio_disconnected(void) {
+  _conn_hdl = 0;
+  _update_pending = false;
+  _adv_stage = 0;
+}
+
+// Also called when the central changes the parameters on its own.
+void _nordic_uart_radio_conn_updated(uint16_t conn_handle, int status) {
+  struct ble_gap_conn_desc desc;
+  if (conn_handle != _conn_hdl)
+    return;
+  _update_pending = false;
+  if (status != 0) {
+    ESP_LOGD(_TAG, "Connection update to level %d refused: %d", _level, status);
+    // Settle one level faster instead of asking for the same one again;
+    // only the fastest preset is retried, after a pause
+    if (_level != NORDIC_UART_RADIO_LEVEL_COUNT && _level > NORDIC_UART_RADIO_BURST)
+      _ceiling = _level - 1;
+    else
+      _hold_ticks = REFUSED_HOLD_TICKS;
+    _level = NORDIC_UART_RADIO_LEVEL_COUNT;
+  }
+  if (ble_gap_conn_find(conn_handle, &desc) != 0)
+    return;
+  portENTER_CRITICAL(&_radio_lock);
+  _stats.conn_itvl_us = desc.conn_itvl * 1250;
+  _stats.conn_latency = desc.conn_latency;
+  portEXIT_CRITICAL(&_radio_lock);
+  ESP_LOGI(_TAG, "Connection interval %u us, latency %u", (unsigned)desc.conn_itvl * 1250, desc.conn_latency);
+}
+
+void _nordic_uart_radio_count(bool tx, size_t bytes) {
+  portENTER_CRITICAL(&_radio_lock);
+  if (tx) {
+    _stats.tx_pkts++;
+    _stats.tx_bytes += bytes;
+  } else {
+    _stats.rx_pkts++;
+    _stats.rx_bytes += bytes;
+  }
+  _tick_pkts++;
+  _tick_bytes += bytes;
+  portEXIT_CRITICAL(&_radio_lock);
+}
+
+void nordic_uart_set_low_power_mode(bool enable) {
+  _low_power_pref = enable;
+  if (_radio_initialized)
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &_radio_pref_ev);
+}
+
+void nordic_uart_get_radio_stats(nordic_uart_radio_stats_t *out) {
+  portENTER_CRITICAL(&_radio_lock);
+  *out = _stats;
+  portEXIT_CRITICAL(&_radio_lock);
+}
+
+esp_err_t _nordic_uart_radio_init(void) {
+  if (_radio_initialized)
+    return ESP_OK;
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.level = NORDIC_UART_RADIO_LEVEL_COUNT;
+  _conn_hdl = 0;
+  _adv_stage = 0;
+  _tick_pkts = _tick_bytes = 0;
+  _ceiling = NORDIC_UART_RADIO_DORMANT;
+  ble_npl_callout_init(&_radio_tick, nimble_port_get_dflt_eventq(), _radio_tick_cb, NULL);
+  ble_npl_event_init(&_radio_pref_ev, _radio_pref_cb, NULL);
+  _last_tick = ble_npl_time_get();
+  _radio_initialized = true;
+  return ESP_OK;
+}
+
+// Call once the host task has stopped.
+void _nordic_uart_radio_deinit(void) {
+  if (!_radio_initialized)
+    return;
+  _radio_initialized = false;
+  ble_npl_callout_stop(&_radio_tick);
+  ble_npl_callout_deinit(&_radio_tick);
+  ble_npl_event_deinit(&_radio_pref_ev);
+}
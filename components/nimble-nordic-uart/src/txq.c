@@ -0,0 +1,295 @@
+#include "nimble-nordic-uart.h"
+
+#include "esp_log.h"
+#include "nimble/nimble_port.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+static const char *_TAG = "NORDIC UART";
+
+// Producers only copy the message into the queue and wake the NimBLE host
+// task; the host task sends it notification by notification. A message is
+// never interleaved with another one, so priorities apply at message
+// (line) boundaries.
+//
+// Notifications complete synchronously (BLE_GAP_EVENT_NOTIFY_TX fires inside
+// the notify call), so they cannot pace the queue. The msys pool can: the
+// host keeps a notification's mbufs until the controller has taken its
+// packets, so the drain stops while no more than
+// CONFIG_NORDIC_UART_TX_MSYS_RESERVE blocks are free and retries from a
+// callout. That also leaves mbufs for incoming writes and L2CAP SDUs.
+
+// Retry delay when the host is out of mbufs
+#define TXQ_RETRY_MS 5
+// Several tasks may wait on the one space semaphore; re-check at least this often
+#define TXQ_POLL_TICKS pdMS_TO_TICKS(50)
+
+typedef struct _txq_msg {
+  struct _txq_msg *next;
+  size_t len;
+  size_t off;
+  nordic_uart_transport_t via; // resolved when the message starts sending
+  uint8_t data[];
+} _txq_msg_t;
+
+static _txq_msg_t *_txq_head[NORDIC_UART_PRIO_COUNT];
+static _txq_msg_t *_txq_tail[NORDIC_UART_PRIO_COUNT];
+static _txq_msg_t *_txq_cur; // being sent; owned by the host task
+static size_t _txq_bytes;    // queued plus _txq_cur
+static portMUX_TYPE _txq_lock = portMUX_INITIALIZER_UNLOCKED;
+// Bumped on connect and by every flush; a message is queued only if the
+// epoch it was pushed in is still current, so one that races a disconnect
+// never goes out on the next connection.
+static uint32_t _txq_epoch;
+static bool _txq_open;
+static SemaphoreHandle_t _txq_space; // given whenever bytes leave the queue
+static struct ble_npl_event _txq_drain_ev;
+static struct ble_npl_callout _txq_retry;
+static bool _txq_initialized = false;
+
+static void _txq_kick(void) {
+  ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &_txq_drain_ev);
+}
+
+static void _txq_release(_txq_msg_t *m) {
+  portENTER_CRITICAL(&_txq_lock);
+  _txq_bytes -= m->len;
+  portEXIT_CRITICAL(&_txq_lock);
+  free(m);
+  xSemaphoreGive(_txq_space);
+}
+
+// Send the next notification of _txq_cur. Returns false when the drain has
+// to wait for mbufs.
+static bool _txq_send_gatt(void) {
+  if (os_msys_num_free() <= CONFIG_NORDIC_UART_TX_MSYS_RESERVE) {
+    ble_npl_callout_reset(&_txq_retry, ble_npl_time_ms_to_ticks32(TXQ_RETRY_MS));
+    return false;
+  }
+
+  size_t n = _txq_cur->len - _txq_cur->off;
+  if (n > _nordic_uart_tx_chunk())
+    n = _nordic_uart_tx_chunk();
+  int rc = _nordic_uart_notify(_txq_cur->data + _txq_cur->off, n);
+  if (rc == BLE_HS_ENOMEM) {
+    ble_npl_callout_reset(&_txq_retry, ble_npl_time_ms_to_ticks32(TXQ_RETRY_MS));
+    return false;
+  }
+  if (rc != 0) {
+    // Not connected or not subscribed: drop the whole message
+    ESP_LOGD(_TAG, "notify failed: %d, dropping %u bytes", rc, (unsigned)_txq_cur->len);
+    _txq_cur->off = _txq_cur->len;
+  } else {
+    _txq_cur->off += n;
+  }
+  return true;
+}
+
+// Send the next SDU of _txq_cur over the L2CAP channel, like
+// _txq_send_gatt().
+static bool _txq_send_coc(void) {
+  size_t n = _txq_cur->len - _txq_cur->off;
+  if (n > _nordic_uart_coc_sdu_max())
+    n = _nordic_uart_coc_sdu_max();
+  int rc = _nordic_uart_coc_send(_txq_cur->data + _txq_cur->off, n);
+  if (rc == BLE_HS_EAGAIN)
+    return false; // resumed by BLE_L2CAP_EVENT_COC_TX_UNSTALLED
+  if (rc == BLE_HS_ENOMEM) {
+    ble_npl_callout_reset(&_txq_retry, ble_npl_time_ms_to_ticks32(TXQ_RETRY_MS));
+    return false;
+  }
+  if (rc != 0) {
+    // Channel closed: drop the whole message
+    ESP_LOGD(_TAG, "L2CAP send failed: %d, dropping %u bytes", rc, (unsigned)_txq_cur->len);
+    _txq_cur->off = _txq_cur->len;
+  } else {
+    _txq_cur->off += n;
+  }
+  return true;
+}
+
+// Runs on the NimBLE host task, from the event queue or the retry callout.
+static void _txq_drain(struct ble_npl_event *ev) {
+  for (;;) {
+    if (_txq_cur == NULL) {
+      portENTER_CRITICAL(&_txq_lock);
+      for (int p = NORDIC_UART_PRIO_COUNT - 1; p >= 0; --p) {
+        if (_txq_head[p]) {
+          _txq_cur = _txq_head[p];
+          _txq_head[p] = _txq_cur->next;
+          if (_txq_head[p] == NULL)
+            _txq_tail[p] = NULL;
+          // Bulk goes over the L2CAP channel while the phone has one open
+          if (_txq_cur->via == NORDIC_UART_TRANSPORT_AUTO)
+            _txq_cur->via = p == NORDIC_UART_PRIO_BULK && nordic_uart_coc_connected() ? NORDIC_UART_TRANSPORT_COC
+                                                                                      : NORDIC_UART_TRANSPORT_GATT;
+          break;
+        }
+      }
+      portEXIT_CRITICAL(&_txq_lock);
+      if (_txq_cur == NULL)
+        return;
+    }
+    bool sent = _txq_cur->via == NORDIC_UART_TRANSPORT_COC ? _txq_send_coc() : _txq_send_gatt();
+    if (!sent)
+      return;
+    if (_txq_cur->off == _txq_cur->len) {
+      _txq_msg_t *done = _txq_cur;
+      _txq_cur = NULL;
+      _txq_release(done);
+    }
+  }
+}
+
+// Kick the drain after the L2CAP channel unstalled or closed
+void _nordic_uart_txq_resume(void) {
+  if (_txq_initialized)
+    _txq_kick();
+}
+
+// A connection is up: pushes are accepted until the next flush
+void _nordic_uart_txq_connected(void) {
+  portENTER_CRITICAL(&_txq_lock);
+  _txq_epoch++;
+  _txq_open = true;
+  portEXIT_CRITICAL(&_txq_lock);
+}
+
+void _nordic_uart_txq_flush(void) {
+  _txq_msg_t *heads[NORDIC_UART_PRIO_COUNT];
+
+  if (!_txq_initialized)
+    return;
+  portENTER_CRITICAL(&_txq_lock);
+  _txq_epoch++;
+  _txq_open = false;
+  for (int p = 0; p < NORDIC_UART_PRIO_COUNT; ++p) {
+    heads[p] = _txq_head[p];
+    _txq_head[p] = _txq_tail[p] = NULL;
+  }
+  portEXIT_CRITICAL(&_txq_lock);
+
+  ble_npl_callout_stop(&_txq_retry);
+  if (_txq_cur) {
+    _txq_release(_txq_cur);
+    _txq_cur = NULL;
+  }
+  for (int p = 0; p < NORDIC_UART_PRIO_COUNT; ++p) {
+    _txq_msg_t *m = heads[p];
+    while (m) {
+      _txq_msg_t *next = m->next;
+      _txq_release(m);
+      m = next;
+    }
+  }
+}
+
+esp_err_t _nordic_uart_txq_init(void) {
+  if (_txq_initialized)
+    return ESP_OK;
+  _txq_space = xSemaphoreCreateBinary();
+  if (_txq_space == NULL)
+    return ESP_FAIL;
+  ble_npl_event_init(&_txq_drain_ev, _txq_drain, NULL);
+  ble_npl_callout_init(&_txq_retry, nimble_port_get_dflt_eventq(), _txq_drain, NULL);
+  _txq_initialized = true;
+  return ESP_OK;
+}
+
+// Bytes queued or being sent
+size_t _nordic_uart_txq_pending(void) {
+  portENTER_CRITICAL(&_txq_lock);
+  size_t n = _txq_bytes;
+  portEXIT_CRITICAL(&_txq_lock);
+  return n;
+}
+
+// Call once the host task has stopped.
+void _nordic_uart_txq_deinit(void) {
+  if (!_txq_initialized)
+    return;
+  _nordic_uart_txq_flush();
+  _txq_initialized = false;
+  ble_npl_callout_deinit(&_txq_retry);
+  ble_npl_event_deinit(&_txq_drain_ev);
+  vSemaphoreDelete(_txq_space);
+  _txq_space = NULL;
+}
+
+esp_err_t _nordic_uart_txq_push(const void *a, size_t alen, const void *b, size_t blen,
+                                nordic_uart_prio_t prio, nordic_uart_transport_t via, TickType_t wait) {
+  const size_t len = alen + blen;
+  if (len == 0)
+    return ESP_OK;
+  if (!_txq_initialized)
+    return ESP_FAIL;
+  portENTER_CRITICAL(&_txq_lock);
+  const uint32_t epoch = _txq_epoch;
+  const bool open = _txq_open;
+  portEXIT_CRITICAL(&_txq_lock);
+  if (!open)
+    return ESP_FAIL;
+  if (len > CONFIG_NORDIC_UART_TX_QUEUE_SIZE || prio >= NORDIC_UART_PRIO_COUNT)
+    return ESP_ERR_INVALID_SIZE;
+  if (via == NORDIC_UART_TRANSPORT_COC && !nordic_uart_coc_connected())
+    return ESP_ERR_INVALID_STATE;
+
+  _txq_msg_t *m = malloc(sizeof(_txq_msg_t) + len);
+  if (m == NULL)
+    return ESP_ERR_NO_MEM;
+  m->next = NULL;
+  m->len = len;
+  m->off = 0;
+  m->via = via;
+  memcpy(m->data, a, alen);
+  if (blen)
+    memcpy(m->data + alen, b, blen);
+
+  TickType_t start = xTaskGetTickCount();
+  for (;;) {
+    bool queued = false;
+    portENTER_CRITICAL(&_txq_lock);
+    const bool current = _txq_epoch == epoch;
+    if (current && _txq_bytes + len <= CONFIG_NORDIC_UART_TX_QUEUE_SIZE) {
+      _txq_bytes += len;
+      if (_txq_tail[prio])
+        _txq_tail[prio]->next = m;
+      else
+        _txq_head[prio] = m;
+      _txq_tail[prio] = m;
+      queued = true;
+    }
+    portEXIT_CRITICAL(&_txq_lock);
+    if (queued) {
+      _txq_kick();
+      return ESP_OK;
+    }
+    if (!current) {
+      free(m);
+      return ESP_FAIL;
+    }
+
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= wait) {
+      free(m);
+      return wait ? ESP_ERR_TIMEOUT : ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(_txq_space, wait - waited < TXQ_POLL_TICKS ? wait - waited : TXQ_POLL_TICKS);
+  }
+}
+
+esp_err_t _nordic_uart_txq_wait_idle(TickType_t wait) {
+  TickType_t start = xTaskGetTickCount();
+  for (;;) {
+    portENTER_CRITICAL(&_txq_lock);
+    size_t bytes = _txq_bytes;
+    portEXIT_CRITICAL(&_txq_lock);
+    if (bytes == 0)
+      return ESP_OK;
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= wait || !_txq_initialized)
+      return ESP_ERR_TIMEOUT;
+    xSemaphoreTake(_txq_space, wait - waited < TXQ_POLL_TICKS ? wait - waited : TXQ_POLL_TICKS);
+  }
+}
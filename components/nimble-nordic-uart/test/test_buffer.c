@@ -4,7 +4,6 @@
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/ringbuf.h"
 #include <string.h>
 
 TEST_CASE("buffer init / deinit", "[buffer]") {
@@ -21,45 +20,53 @@ TEST_CASE("buffer append", "[buffer]") {
   TEST_ESP_OK(_nordic_uart_linebuf_append('a'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('b'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('c'));
-  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
   TEST_ASSERT(str == NULL);
 
   TEST_ESP_OK(_nordic_uart_linebuf_append('d'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('\r'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
-  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
   TEST_ASSERT_EQUAL_STRING("abcd", str);
 
-  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  nordic_uart_rx_return((uint8_t *)str);
 
   TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
-  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
   TEST_ASSERT_EQUAL_STRING("", str);
-  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  nordic_uart_rx_return((uint8_t *)str);
 
   TEST_ESP_OK(_nordic_uart_buf_deinit());
 }
 
-TEST_CASE("line buffer overflow", "[buffer]") {
+TEST_CASE("long line reassembly", "[buffer]") {
   size_t item_size;
   char *str;
 
   TEST_ESP_OK(_nordic_uart_buf_init());
-  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_LINE_LENGTH; ++i) {
+  for (int i = 0; i < 2 * CONFIG_NORDIC_UART_MAX_LINE_LENGTH; ++i) {
     TEST_ESP_OK(_nordic_uart_linebuf_append('0' + i % 10));
   }
-  TEST_ESP_ERR(ESP_FAIL, _nordic_uart_linebuf_append('d'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('\r'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
-  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
-  TEST_ASSERT_EQUAL_INT(CONFIG_NORDIC_UART_MAX_LINE_LENGTH, strlen(str));
-  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
-
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
+  TEST_ASSERT_NOT_NULL(str);
+  TEST_ASSERT_EQUAL_INT(2 * CONFIG_NORDIC_UART_MAX_LINE_LENGTH, strlen(str));
+  TEST_ASSERT_EQUAL_INT(2 * CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1, item_size);
+  nordic_uart_rx_return((uint8_t *)str);
+
+  // over the hard limit: dropped whole, the next line is intact
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_MESSAGE_LENGTH; ++i) {
+    TEST_ESP_OK(_nordic_uart_linebuf_append('0' + i % 10));
+  }
+  TEST_ESP_ERR(ESP_FAIL, _nordic_uart_linebuf_append('d'));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('a'));
   TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
-  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
   TEST_ASSERT_EQUAL_STRING("a", str);
-  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  nordic_uart_rx_return((uint8_t *)str);
+  TEST_ASSERT_NULL(nordic_uart_rx_receive(&item_size, 1));
 
   TEST_ESP_OK(_nordic_uart_buf_deinit());
 }
@@ -84,11 +91,57 @@ TEST_CASE("ring buffer overflow", "[buffer]") {
   TEST_ESP_ERR(ESP_FAIL, _nordic_uart_linebuf_append('\n'));
 
   for (int j = 0; j < CONFIG_NORDIC_UART_RX_BUFFER_SIZE / (CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1); ++j) {
-    str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+    str = (char *)nordic_uart_rx_receive(&item_size, 1);
     TEST_ASSERT_NOT_NULL(str);
-    vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+    nordic_uart_rx_return((uint8_t *)str);
   }
-  TEST_ASSERT_NULL(xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1));
+  TEST_ASSERT_NULL(nordic_uart_rx_receive(&item_size, 1));
 
   TEST_ESP_OK(_nordic_uart_buf_deinit());
 }
+
+TEST_CASE("bulk append", "[buffer]") {
+  size_t item_size;
+  char *str;
+  const char *data = "{\"a\":1}\r\n{\"b\"";
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  TEST_ESP_OK(_nordic_uart_linebuf_append_bytes((const uint8_t *)data, strlen(data)));
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("{\"a\":1}", str);
+  TEST_ASSERT_EQUAL_INT(strlen("{\"a\":1}") + 1, item_size);
+  nordic_uart_rx_return((uint8_t *)str);
+  TEST_ASSERT_NULL(nordic_uart_rx_receive(&item_size, 1));
+
+  // the partial line continues in the next write
+  data = ":2}\n";
+  TEST_ESP_OK(_nordic_uart_linebuf_append_bytes((const uint8_t *)data, strlen(data)));
+  str = (char *)nordic_uart_rx_receive(&item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("{\"b\":2}", str);
+  nordic_uart_rx_return((uint8_t *)str);
+
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
+
+TEST_CASE("frame reassembly", "[buffer]") {
+  size_t item_size;
+  uint8_t *item;
+  // garbage, then a frame with a newline in its payload split across writes
+  const uint8_t frame[] = {'x', NORDIC_UART_FRAME_SYNC, 1, 0, 3, 0, 'a', '\n', 'b', 0x12, 0x34};
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  nordic_uart_set_rx_frames(true);
+  TEST_ASSERT_TRUE(_nordic_uart_rx_mode_sync());
+  TEST_ESP_OK(_nordic_uart_frame_append(frame, 4));
+  TEST_ASSERT_NULL(nordic_uart_rx_receive(&item_size, 1));
+  TEST_ESP_OK(_nordic_uart_frame_append(frame + 4, sizeof(frame) - 4));
+  item = (uint8_t *)nordic_uart_rx_receive(&item_size, 1);
+  TEST_ASSERT_NOT_NULL(item);
+  TEST_ASSERT_EQUAL_INT(sizeof(frame) - 1, item_size);
+  TEST_ASSERT_EQUAL_MEMORY(frame + 1, item, item_size);
+  nordic_uart_rx_return(item);
+
+  nordic_uart_set_rx_frames(false);
+  TEST_ASSERT_FALSE(_nordic_uart_rx_mode_sync());
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
@@ -14,6 +14,8 @@ typedef enum {
 void sensors_init(void);
 void sensors_task(void *pvParameters);
 uint32_t sensors_get_step_count(void);
+// Steps per minute over the last few steps, 0 when no step in the last 2 s
+uint16_t sensors_get_cadence(void);
 // Returns current activity classification
 sensors_activity_t sensors_get_activity(void);
 
@@ -28,6 +28,7 @@ static const char *TAG = "SENSORS";
 static qmi8658_dev_t s_imu;
 static bool s_imu_ready = false;
 static volatile uint32_t s_step_count = 0; // daily steps
+static volatile uint16_t s_cadence_spm = 0;
 static sensors_activity_t s_activity = SENSORS_ACTIVITY_IDLE;
 static SemaphoreHandle_t s_wom_sem = NULL; // wake-on-motion semaphore
 static time_t s_last_midnight = 0;
@@ -126,6 +127,8 @@ void sensors_init(void) {
 
 uint32_t sensors_get_step_count(void) { return s_step_count; }
 
+uint16_t sensors_get_cadence(void) { return s_cadence_spm; }
+
 sensors_activity_t sensors_get_activity(void) { return s_activity; }
 
 void sensors_task(void *pvParameters) {
@@ -214,6 +217,7 @@ void sensors_task(void *pvParameters) {
         if (span_ms > 0) {
           spm = 60000.0f * (float)(step_ts_num - 1) / (float)span_ms;
         }
+        s_cadence_spm = (now_ms - newest < 2000) ? (uint16_t)(spm + 0.5f) : 0;
         if (spm > 130.0f)
           s_activity = SENSORS_ACTIVITY_RUN;
         else if (spm > 60.0f)
@@ -223,6 +227,7 @@ void sensors_task(void *pvParameters) {
         else
           s_activity = SENSORS_ACTIVITY_IDLE;
       } else {
+        s_cadence_spm = 0;
         s_activity = SENSORS_ACTIVITY_IDLE;
       }
 
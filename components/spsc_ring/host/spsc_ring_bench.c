@@ -0,0 +1,319 @@
+/*
+ * Host benchmark: spsc_ring against a FreeRTOS ringbuffer stand-in.
+ *
+ * Build and run on Linux:
+ *   gcc -O2 -pthread -Icomponents/spsc_ring/include \
+ *       components/spsc_ring/host/spsc_ring_bench.c -o spsc_ring_bench
+ *   ./spsc_ring_bench [messages]
+ *
+ * Two workloads, each run single-threaded (push a batch, pop it: the cost
+ * per operation) and, with two or more CPUs, with a producer and a consumer
+ * thread (throughput across cores):
+ *   - lines: variable-length messages of 16..512 bytes as the Nordic UART RX
+ *     path queues them, through spsc_msg_* in place against
+ *     xRingbufferSend / xRingbufferReceive / vRingbufferReturnItem;
+ *   - samples: batches of 64 int16 samples, as an audio feed would move
+ *     them, through spsc_ring_push / spsc_ring_pop against a byte buffer.
+ *
+ * The stand-in reproduces what esp_ringbuf does per call on the data path:
+ * a spinlock around every send, receive and return (portENTER_CRITICAL), an
+ * 8-byte item header with 4-byte alignment, a copy in on send and an item
+ * returned in place on receive. It has no blocking and no semaphores, so it
+ * flatters the real ringbuffer.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+#define RING_BYTES 4096
+#define BATCH 4
+#define SAMPLES 64
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t msg_len(uint32_t i)
+{
+    return 16 + (i * 2654435761u >> 7) % 497;
+}
+
+/* ---- FreeRTOS ringbuffer stand-in (NOSPLIT and byte buffer) ---- */
+
+typedef struct {
+    pthread_spinlock_t lock;
+    uint8_t buf[RING_BYTES];
+    size_t head, tail, used;
+} rb_t;
+
+typedef struct {
+    uint32_t len;
+    uint32_t flags;
+} rb_hdr_t;
+
+static void rb_init(rb_t* rb)
+{
+    memset(rb, 0, sizeof(*rb));
+    pthread_spin_init(&rb->lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+static int rb_send(rb_t* rb, const void* data, size_t len)
+{
+    size_t need = sizeof(rb_hdr_t) + ((len + 3) & ~(size_t)3);
+    int ok = 0;
+    pthread_spin_lock(&rb->lock);
+    size_t to_end = RING_BYTES - rb->head;
+    size_t skip = to_end < need ? to_end : 0;
+    if (rb->used + skip + need <= RING_BYTES) {
+        if (skip) {
+            rb_hdr_t mark = { UINT32_MAX, 0 };
+            memcpy(rb->buf + rb->head, &mark, sizeof(mark));
+            rb->head = 0;
+        }
+        rb_hdr_t hdr = { (uint32_t)len, 0 };
+        memcpy(rb->buf + rb->head, &hdr, sizeof(hdr));
+        memcpy(rb->buf + rb->head + sizeof(hdr), data, len);
+        rb->head = (rb->head + need) % RING_BYTES;
+        rb->used += skip + need;
+        ok = 1;
+    }
+    pthread_spin_unlock(&rb->lock);
+    return ok;
+}
+
+static void* rb_receive(rb_t* rb, size_t* len)
+{
+    void* item = NULL;
+    pthread_spin_lock(&rb->lock);
+    if (rb->used) {
+        rb_hdr_t hdr;
+        memcpy(&hdr, rb->buf + rb->tail, sizeof(hdr));
+        if (hdr.len == UINT32_MAX) {
+            rb->used -= RING_BYTES - rb->tail;
+            rb->tail = 0;
+            memcpy(&hdr, rb->buf, sizeof(hdr));
+        }
+        *len = hdr.len;
+        item = rb->buf + rb->tail + sizeof(hdr);
+    }
+    pthread_spin_unlock(&rb->lock);
+    return item;
+}
+
+static void rb_return(rb_t* rb, void* item)
+{
+    (void)item;
+    pthread_spin_lock(&rb->lock);
+    rb_hdr_t hdr;
+    memcpy(&hdr, rb->buf + rb->tail, sizeof(hdr));
+    size_t n = sizeof(hdr) + ((hdr.len + 3) & ~(size_t)3);
+    rb->tail = (rb->tail + n) % RING_BYTES;
+    rb->used -= n;
+    pthread_spin_unlock(&rb->lock);
+}
+
+// Byte buffer mode: copy in, copy out, one lock per call
+static size_t rb_bytes_send(rb_t* rb, const void* data, size_t len)
+{
+    pthread_spin_lock(&rb->lock);
+    if (len > RING_BYTES - rb->used) {
+        len = RING_BYTES - rb->used;
+    }
+    size_t first = RING_BYTES - rb->head < len ? RING_BYTES - rb->head : len;
+    memcpy(rb->buf + rb->head, data, first);
+    memcpy(rb->buf, (const uint8_t*)data + first, len - first);
+    rb->head = (rb->head + len) % RING_BYTES;
+    rb->used += len;
+    pthread_spin_unlock(&rb->lock);
+    return len;
+}
+
+static size_t rb_bytes_receive(rb_t* rb, void* out, size_t len)
+{
+    pthread_spin_lock(&rb->lock);
+    if (len > rb->used) {
+        len = rb->used;
+    }
+    size_t first = RING_BYTES - rb->tail < len ? RING_BYTES - rb->tail : len;
+    memcpy(out, rb->buf + rb->tail, first);
+    memcpy((uint8_t*)out + first, rb->buf, len - first);
+    rb->tail = (rb->tail + len) % RING_BYTES;
+    rb->used -= len;
+    pthread_spin_unlock(&rb->lock);
+    return len;
+}
+
+/* ---- workloads ---- */
+
+typedef struct {
+    int spsc;       // 1: spsc_ring, 0: stand-in
+    int samples;    // 1: sample batches, 0: lines
+    uint32_t count; // messages or batches
+    spsc_ring_t ring;
+    rb_t rb;
+    uint8_t src[512];
+    uint64_t check;
+} bench_t;
+
+static SPSC_ALIGNED uint8_t s_ring_buf[RING_BYTES];
+
+static int produce_one(bench_t* b, uint32_t i)
+{
+    if (b->samples) {
+        int16_t* s = (int16_t*)b->src;
+        s[0] = (int16_t)i;
+        if (b->spsc) {
+            // a batch is pushed whole or not at all, so it stays in step with pop
+            if (spsc_ring_space(&b->ring) < SAMPLES) {
+                return 0;
+            }
+            return spsc_ring_push(&b->ring, s, SAMPLES) == SAMPLES;
+        }
+        if (RING_BYTES - __atomic_load_n(&b->rb.used, __ATOMIC_ACQUIRE) < SAMPLES * 2) {
+            return 0;
+        }
+        return rb_bytes_send(&b->rb, s, SAMPLES * 2) == SAMPLES * 2;
+    }
+    uint32_t len = msg_len(i);
+    b->src[0] = (uint8_t)i;
+    if (b->spsc) {
+        void* p = spsc_msg_reserve(&b->ring, len);
+        if (!p) {
+            return 0;
+        }
+        memcpy(p, b->src, len);
+        spsc_msg_commit(&b->ring, len, 0);
+        return 1;
+    }
+    return rb_send(&b->rb, b->src, len);
+}
+
+static int consume_one(bench_t* b)
+{
+    if (b->samples) {
+        int16_t out[SAMPLES];
+        size_t n = b->spsc ? spsc_ring_pop(&b->ring, out, SAMPLES) * 2 : rb_bytes_receive(&b->rb, out, SAMPLES * 2);
+        if (n == 0) {
+            return 0;
+        }
+        b->check += (uint16_t)out[0];
+        return 1;
+    }
+    if (b->spsc) {
+        uint32_t len;
+        uint8_t* p = (uint8_t*)spsc_msg_peek(&b->ring, &len, NULL);
+        if (!p) {
+            return 0;
+        }
+        b->check += p[0] + len;
+        spsc_msg_release(&b->ring);
+        return 1;
+    }
+    size_t len;
+    uint8_t* p = (uint8_t*)rb_receive(&b->rb, &len);
+    if (!p) {
+        return 0;
+    }
+    b->check += p[0] + len;
+    rb_return(&b->rb, p);
+    return 1;
+}
+
+static void reset(bench_t* b)
+{
+    spsc_ring_init(&b->ring, s_ring_buf, b->samples ? RING_BYTES / 2 : RING_BYTES, b->samples ? 2 : 1);
+    rb_init(&b->rb);
+    b->check = 0;
+}
+
+static double run_single(bench_t* b)
+{
+    reset(b);
+    double t0 = now_s();
+    for (uint32_t i = 0; i < b->count; i += BATCH) {
+        for (uint32_t j = 0; j < BATCH; j++) {
+            produce_one(b, i + j);
+        }
+        for (uint32_t j = 0; j < BATCH; j++) {
+            consume_one(b);
+        }
+    }
+    return now_s() - t0;
+}
+
+static void* producer(void* arg)
+{
+    bench_t* b = (bench_t*)arg;
+    for (uint32_t i = 0; i < b->count;) {
+        if (produce_one(b, i)) {
+            i++;
+        }
+    }
+    return NULL;
+}
+
+static double run_threads(bench_t* b)
+{
+    pthread_t t;
+    cpu_set_t set;
+
+    reset(b);
+    double t0 = now_s();
+    pthread_create(&t, NULL, producer, b);
+    CPU_ZERO(&set);
+    CPU_SET(1, &set);
+    pthread_setaffinity_np(t, sizeof(set), &set);
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    for (uint32_t i = 0; i < b->count;) {
+        if (consume_one(b)) {
+            i++;
+        }
+    }
+    pthread_join(t, NULL);
+    return now_s() - t0;
+}
+
+static void report(const char* name, bench_t* b, int threaded)
+{
+    b->spsc = 0;
+    double rb = threaded ? run_threads(b) : run_single(b);
+    uint64_t rb_check = b->check;
+    b->spsc = 1;
+    double sp = threaded ? run_threads(b) : run_single(b);
+    printf("%-8s %-8s ringbuf %7.1f ns/op  spsc %7.1f ns/op  x%.2f%s\n", name, threaded ? "2 cores" : "1 core",
+           rb * 1e9 / b->count, sp * 1e9 / b->count, rb / sp, rb_check == b->check ? "" : "  (MISMATCH)");
+}
+
+int main(int argc, char** argv)
+{
+    bench_t b;
+    memset(&b, 0, sizeof(b));
+    b.count = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000000;
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int samples = 0; samples <= 1; samples++) {
+        b.samples = samples;
+        const char* name = samples ? "samples" : "lines";
+        report(name, &b, 0);
+        if (cpus >= 2) {
+            report(name, &b, 1);
+        }
+    }
+    if (cpus < 2) {
+        printf("(one CPU: threaded runs skipped)\n");
+    }
+    return 0;
+}
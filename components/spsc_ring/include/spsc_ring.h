@@ -0,0 +1,378 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lock-free single-producer/single-consumer ring of fixed-size elements.
+// Exactly one task (or ISR) pushes and one task pops; neither side takes a
+// lock or enters a critical section. Indices run freely and are masked, so
+// the capacity must be a power of two and a full ring holds capacity
+// elements.
+//
+// Producer and consumer indices live on separate cache lines, and each side
+// keeps a cached copy of the other's index so the shared line is only read
+// when the cached view runs out. Place rings in internal RAM or align them to
+// SPSC_CACHE_LINE when they are allocated from PSRAM.
+//
+// On ESP-IDF the consumer can block until a watermark is reached; it sleeps
+// on its task notification (index 0), so the consumer task must not use that
+// notification for anything else.
+//
+// On top of a byte ring (elem_size 1), the spsc_msg_* calls carry
+// variable-length messages. Each message is contiguous in the ring and can
+// be written and read in place.
+
+#ifndef SPSC_CACHE_LINE
+#ifdef CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+#define SPSC_CACHE_LINE CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+#else
+#define SPSC_CACHE_LINE 64
+#endif
+#endif
+
+#define SPSC_ALIGNED __attribute__((aligned(SPSC_CACHE_LINE)))
+
+typedef struct {
+    // written by the consumer
+    SPSC_ALIGNED uint32_t tail;
+    uint32_t head_cache;
+#ifdef ESP_PLATFORM
+    TaskHandle_t waiter; // consumer sleeping until count >= watermark
+    uint32_t watermark;
+#endif
+    // written by the producer
+    SPSC_ALIGNED uint32_t head;
+    uint32_t tail_cache;
+    uint32_t skip; // bytes to the end of the ring before a reserved message
+    // read-only after init
+    SPSC_ALIGNED uint8_t* buf;
+    uint32_t mask;
+    uint32_t esize;
+} spsc_ring_t;
+
+#define SPSC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SPSC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// buf holds capacity * elem_size bytes. Returns false if capacity is not a
+// power of two.
+static inline bool spsc_ring_init(spsc_ring_t* r, void* buf, uint32_t capacity, uint32_t elem_size)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || elem_size == 0) {
+        return false;
+    }
+    memset(r, 0, sizeof(*r));
+    r->buf = (uint8_t*)buf;
+    r->mask = capacity - 1;
+    r->esize = elem_size;
+    return true;
+}
+
+static inline uint32_t spsc_ring_capacity(const spsc_ring_t* r)
+{
+    return r->mask + 1;
+}
+
+// Elements ready to pop (consumer side)
+static inline uint32_t spsc_ring_count(spsc_ring_t* r)
+{
+    r->head_cache = SPSC_LOAD(&r->head);
+    return r->head_cache - r->tail;
+}
+
+// Elements that can be pushed (producer side)
+static inline uint32_t spsc_ring_space(spsc_ring_t* r)
+{
+    r->tail_cache = SPSC_LOAD(&r->tail);
+    return spsc_ring_capacity(r) - (r->head - r->tail_cache);
+}
+
+// --- producer ---
+
+// Contiguous free run at the write position, for filling in place before
+// spsc_ring_commit(). *n is set to its length in elements (0 when full).
+static inline void* spsc_ring_write_span(spsc_ring_t* r, uint32_t* n)
+{
+    uint32_t h = r->head & r->mask;
+    uint32_t space = spsc_ring_capacity(r) - (r->head - r->tail_cache);
+    if (space < spsc_ring_capacity(r) - h) {
+        space = spsc_ring_space(r);
+    }
+    *n = space < spsc_ring_capacity(r) - h ? space : spsc_ring_capacity(r) - h;
+    return r->buf + (size_t)h * r->esize;
+}
+
+#ifdef ESP_PLATFORM
+static inline TaskHandle_t spsc_ring_waiter_(spsc_ring_t* r)
+{
+    // Pairs with the fence in spsc_ring_wait(): either the consumer sees the
+    // new head, or we see it waiting.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    TaskHandle_t w = __atomic_load_n(&r->waiter, __ATOMIC_RELAXED);
+    if (w && r->head - SPSC_LOAD(&r->tail) >= __atomic_load_n(&r->watermark, __ATOMIC_RELAXED)) {
+        return w;
+    }
+    return NULL;
+}
+#endif
+
+// Publish n elements written through spsc_ring_write_span() or spsc_msg_reserve()
+static inline void spsc_ring_commit(spsc_ring_t* r, uint32_t n)
+{
+    SPSC_STORE(&r->head, r->head + n);
+#ifdef ESP_PLATFORM
+    TaskHandle_t w = spsc_ring_waiter_(r);
+    if (w) {
+        xTaskNotifyGive(w);
+    }
+#endif
+}
+
+#ifdef ESP_PLATFORM
+static inline void spsc_ring_commit_from_isr(spsc_ring_t* r, uint32_t n, BaseType_t* woken)
+{
+    SPSC_STORE(&r->head, r->head + n);
+    TaskHandle_t w = spsc_ring_waiter_(r);
+    if (w) {
+        vTaskNotifyGiveFromISR(w, woken);
+    }
+}
+#endif
+
+// Copy up to n elements in; returns how many fit. Two memcpy at most.
+static inline uint32_t spsc_ring_push_nocommit_(spsc_ring_t* r, const void* src, uint32_t n)
+{
+    uint32_t space = spsc_ring_capacity(r) - (r->head - r->tail_cache);
+    if (space < n) {
+        space = spsc_ring_space(r);
+    }
+    if (n > space) {
+        n = space;
+    }
+    uint32_t h = r->head & r->mask;
+    uint32_t first = spsc_ring_capacity(r) - h < n ? spsc_ring_capacity(r) - h : n;
+    memcpy(r->buf + (size_t)h * r->esize, src, (size_t)first * r->esize);
+    memcpy(r->buf, (const uint8_t*)src + (size_t)first * r->esize, (size_t)(n - first) * r->esize);
+    return n;
+}
+
+static inline uint32_t spsc_ring_push(spsc_ring_t* r, const void* src, uint32_t n)
+{
+    n = spsc_ring_push_nocommit_(r, src, n);
+    if (n) {
+        spsc_ring_commit(r, n);
+    }
+    return n;
+}
+
+// --- consumer ---
+
+// Contiguous filled run at the read position, to be consumed in place before
+// spsc_ring_release(). *n is set to its length in elements (0 when empty).
+static inline void* spsc_ring_read_span(spsc_ring_t* r, uint32_t* n)
+{
+    uint32_t t = r->tail & r->mask;
+    uint32_t count = r->head_cache - r->tail;
+    if (count < spsc_ring_capacity(r) - t) {
+        count = spsc_ring_count(r);
+    }
+    *n = count < spsc_ring_capacity(r) - t ? count : spsc_ring_capacity(r) - t;
+    return r->buf + (size_t)t * r->esize;
+}
+
+static inline void spsc_ring_release(spsc_ring_t* r, uint32_t n)
+{
+    SPSC_STORE(&r->tail, r->tail + n);
+}
+
+// Copy up to n elements out; returns how many there were.
+static inline uint32_t spsc_ring_pop(spsc_ring_t* r, void* dst, uint32_t n)
+{
+    uint32_t count = r->head_cache - r->tail;
+    if (count < n) {
+        count = spsc_ring_count(r);
+    }
+    if (n > count) {
+        n = count;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    uint32_t t = r->tail & r->mask;
+    uint32_t first = spsc_ring_capacity(r) - t < n ? spsc_ring_capacity(r) - t : n;
+    memcpy(dst, r->buf + (size_t)t * r->esize, (size_t)first * r->esize);
+    memcpy((uint8_t*)dst + (size_t)first * r->esize, r->buf, (size_t)(n - first) * r->esize);
+    spsc_ring_release(r, n);
+    return n;
+}
+
+#ifdef ESP_PLATFORM
+// Block until at least count elements are ready. Returns false on timeout.
+static inline bool spsc_ring_wait(spsc_ring_t* r, uint32_t count, TickType_t wait)
+{
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    for (;;) {
+        if (spsc_ring_count(r) >= count) {
+            return true;
+        }
+        __atomic_store_n(&r->watermark, count, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        bool ready = spsc_ring_count(r) >= count;
+        if (!ready && xTaskCheckForTimeOut(&timeout, &wait) == pdFALSE) {
+            ulTaskNotifyTake(pdTRUE, wait);
+            ready = spsc_ring_count(r) >= count;
+        }
+        __atomic_store_n(&r->waiter, NULL, __ATOMIC_RELAXED);
+        if (ready) {
+            return true;
+        }
+        if (xTaskCheckForTimeOut(&timeout, &wait) != pdFALSE) {
+            return false;
+        }
+    }
+}
+#endif
+
+// --- messages on a byte ring ---
+//
+// A message is an 8-byte header and its payload, padded to 8 bytes, never
+// wrapped: when one does not fit before the end of the ring, the producer
+// skips to the start. A message of up to capacity / 2 - 8 bytes always fits
+// once the consumer catches up. tag is free for the caller.
+
+typedef struct {
+    uint32_t len;
+    uint32_t tag;
+} spsc_msg_hdr_t;
+
+#define SPSC_MSG_SKIP 0xFFFFFFFFu // header len: rest of the ring is unused
+#define SPSC_MSG_SIZE(len) ((uint32_t)sizeof(spsc_msg_hdr_t) + (((len) + 7u) & ~7u))
+
+// Room for a len-byte payload, or NULL if the ring is too full. Fill it and
+// call spsc_msg_commit() with the final length (at most len).
+static inline void* spsc_msg_reserve(spsc_ring_t* r, uint32_t len)
+{
+    uint32_t need = SPSC_MSG_SIZE(len);
+    uint32_t h = r->head & r->mask;
+    uint32_t to_end = spsc_ring_capacity(r) - h;
+    uint32_t skip = to_end < need ? to_end : 0;
+
+    if (len > spsc_ring_capacity(r) - sizeof(spsc_msg_hdr_t)) {
+        return NULL;
+    }
+    if (spsc_ring_capacity(r) - (r->head - r->tail_cache) < skip + need && spsc_ring_space(r) < skip + need) {
+        return NULL;
+    }
+    r->skip = skip;
+    return r->buf + (skip ? 0 : h) + sizeof(spsc_msg_hdr_t);
+}
+
+static inline void spsc_msg_commit(spsc_ring_t* r, uint32_t len, uint32_t tag)
+{
+    uint32_t h = r->head & r->mask;
+    spsc_msg_hdr_t hdr = { len, tag };
+    if (r->skip) {
+        // to_end is a multiple of 8, so the marker fits
+        spsc_msg_hdr_t mark = { SPSC_MSG_SKIP, 0 };
+        memcpy(r->buf + h, &mark, sizeof(mark));
+        h = 0;
+    }
+    memcpy(r->buf + h, &hdr, sizeof(hdr));
+    spsc_ring_commit(r, r->skip + SPSC_MSG_SIZE(len));
+    r->skip = 0;
+}
+
+// Copy a message in; false if there is no room.
+static inline bool spsc_msg_push(spsc_ring_t* r, const void* data, uint32_t len, uint32_t tag)
+{
+    void* p = spsc_msg_reserve(r, len);
+    if (!p) {
+        return false;
+    }
+    memcpy(p, data, len);
+    spsc_msg_commit(r, len, tag);
+    return true;
+}
+
+// The oldest message, in place, or NULL if there is none. It stays valid
+// until spsc_msg_release().
+static inline void* spsc_msg_peek(spsc_ring_t* r, uint32_t* len, uint32_t* tag)
+{
+    if (r->head_cache == r->tail && spsc_ring_count(r) == 0) {
+        return NULL;
+    }
+    spsc_msg_hdr_t hdr;
+    uint32_t t = r->tail & r->mask;
+    memcpy(&hdr, r->buf + t, sizeof(hdr));
+    if (hdr.len == SPSC_MSG_SKIP) {
+        // published together with the message after it
+        spsc_ring_release(r, spsc_ring_capacity(r) - t);
+        t = 0;
+        memcpy(&hdr, r->buf, sizeof(hdr));
+    }
+    *len = hdr.len;
+    if (tag) {
+        *tag = hdr.tag;
+    }
+    return r->buf + t + sizeof(spsc_msg_hdr_t);
+}
+
+static inline void spsc_msg_release(spsc_ring_t* r)
+{
+    spsc_msg_hdr_t hdr;
+    memcpy(&hdr, r->buf + (r->tail & r->mask), sizeof(hdr));
+    spsc_ring_release(r, SPSC_MSG_SIZE(hdr.len));
+}
+
+#ifdef __cplusplus
+}
+
+#include <type_traits>
+
+// Typed ring with inline storage for C++ callers, e.g.
+//   static SpscRing<imu_sample_t, 256> s_samples;
+template <typename T, uint32_t N>
+class SpscRing {
+    static_assert(N != 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "elements are moved with memcpy");
+
+public:
+    SpscRing() { spsc_ring_init(&ring_, buf_, N, sizeof(T)); }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    bool push(const T& v) { return spsc_ring_push(&ring_, &v, 1) == 1; }
+    uint32_t push(const T* src, uint32_t n) { return spsc_ring_push(&ring_, src, n); }
+    bool pop(T& v) { return spsc_ring_pop(&ring_, &v, 1) == 1; }
+    uint32_t pop(T* dst, uint32_t n) { return spsc_ring_pop(&ring_, dst, n); }
+
+    T* write_span(uint32_t* n) { return static_cast<T*>(spsc_ring_write_span(&ring_, n)); }
+    void commit(uint32_t n) { spsc_ring_commit(&ring_, n); }
+    T* read_span(uint32_t* n) { return static_cast<T*>(spsc_ring_read_span(&ring_, n)); }
+    void release(uint32_t n) { spsc_ring_release(&ring_, n); }
+
+    uint32_t count() { return spsc_ring_count(&ring_); }
+    uint32_t space() { return spsc_ring_space(&ring_); }
+#ifdef ESP_PLATFORM
+    bool wait(uint32_t n, TickType_t ticks) { return spsc_ring_wait(&ring_, n, ticks); }
+#endif
+    spsc_ring_t* c_ring() { return &ring_; }
+
+private:
+    spsc_ring_t ring_;
+    T buf_[N];
+};
+#endif
@@ -10,6 +10,7 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "lvgl.h"
+#include "lwmalloc.h"
 #include "sensors.h"
 #include "settings.h"
 #include "ui.h"
@@ -56,6 +57,9 @@ extern "C" void app_main(void) {
   //lv_log_register_print_cb(lvgl_log_cb);
   power_init();
 
+  // Finish deferred heap merges while the CPUs are idle, not inside LVGL frames
+  lw_coalesce_idle_enable();
+
   // Create default event loop for component event handlers
   esp_event_loop_create_default();
 